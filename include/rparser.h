@@ -2,4 +2,5 @@
 #include "../src/Song.h"
 #include "../src/rutil.h"
 #include "../src/ChartUtil.h"
+#include "../src/Diagnostics.h"
 #endif
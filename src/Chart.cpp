@@ -159,6 +159,12 @@ void Chart::UpdateNotePos(NoteElement &nobj)
 
 void Chart::UpdateTempoData()
 {
+  // shared tempo data is updated once per song.
+  if (shared_data_.timingsegmentdata && parent_song_)
+  {
+    parent_song_->UpdateSharedTempoData();
+    return;
+  }
   GetTimingSegmentData().Update(&GetMetaData(), GetTimingData());
 }
 
@@ -216,8 +222,9 @@ bool Chart::IsEmpty() const
 const std::string &Chart::GetHash() const
 {
   if (hash_.empty() && !IsEmpty()) {
-    std::string nd_serialized = GetNoteData().Serialize();
-    hash_ = md5_str(nd_serialized.c_str(), nd_serialized.size());
+    ChartHasher hasher(ChartHashTypes::kMD5);
+    hasher.Update(*this);
+    hash_ = hasher.GetDigest();
   }
   return hash_;
 }
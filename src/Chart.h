@@ -102,8 +102,9 @@ public:
   /**
    * @detail
    * This hash is generated for identity key of the chart.
-   * OpenSSL MD5 hash is used to generate this key
-   * (otherwise dummy key will created, which is useless for identity code)
+   * MD5 hash of chart file is used for this key when it is loaded,
+   * otherwise canonical hash of chart objects is generated
+   * by ChartHasher in md5 mode.
    * The key will be updated when chart is load or saved
    * by ChartReader / ChartWriter.
    */
@@ -18,6 +18,16 @@ ChartLoader* ChartLoader::Create(Song *song)
     cl->ProcessConditionalStatement(!bOpenBmsFileWithoutProcessing);
     return cl;
   }
+  case SONGTYPE::BMSON:
+    return new ChartLoaderBMSON(song);
+  case SONGTYPE::DTX:
+    return new ChartLoaderDTX(song);
+  case SONGTYPE::OJM:
+    return new ChartLoaderOJN(song);
+  case SONGTYPE::OSU:
+    return new ChartLoaderOSU(song);
+  case SONGTYPE::SM:
+    return new ChartLoaderSM(song);
   case SONGTYPE::VOS:
     return new ChartLoaderVOS(song);
   default:
@@ -34,9 +44,14 @@ void ChartLoader::SetSeed(int seed)
 }
 
 void ChartLoader::Preload(Chart &c, const void* p, int iLen)
+{
+  Preload(c, rutil::md5_str(p, iLen));
+}
+
+void ChartLoader::Preload(Chart &c, const std::string& hash)
 {
   c.Clear();
-  c.hash_ = rutil::md5_str(p, iLen);
+  c.hash_ = hash;
   c.seed_ = seed_;
 }
 
@@ -8,6 +8,7 @@
 #include "Song.h"
 #include "Chart.h"
 #include "Directory.h"
+#include "Diagnostics.h"
 #include "rutil.h"
 
 namespace rparser {
@@ -25,10 +26,16 @@ class Song;
  */
 class ChartLoader {
 public:
-  ChartLoader(Song* song) : song_(song), error_(0), seed_(0) {};
+  ChartLoader(Song* song)
+    : song_(song), error_(0), seed_(0),
+      diag_(song ? song->GetDiagnostics() : nullptr) {};
+  virtual ~ChartLoader() {}
   virtual bool Test(const void* p, unsigned iLen);
   virtual void SetSeed(int seed = -1);
 
+  /* @brief attach diagnostics sink. (nullptr to disable) */
+  void SetDiagnostics(Diagnostics *diag) { diag_ = diag; }
+
   /* @brief used for chart which song exists in a single binary
    * (e.g. VOS) */
   virtual bool Load(Chart &c, const void* p, unsigned iLen) = 0;
@@ -49,12 +56,77 @@ protected:
   Song *song_;
   int error_;
   int seed_;
+  Diagnostics *diag_;
+
+  /* @brief report to diagnostics sink, if attached. */
+  void Report(DiagnosticCodes code, unsigned line = 0)
+  {
+    if (diag_) diag_->Report(code, line);
+  }
 
   /* @brief preprocess when loading chart. */
   void Preload(Chart &c, const void* p, int iLen);
+  /* @brief preprocess with hash already calculated. */
+  void Preload(Chart &c, const std::string& hash);
+};
+
+
+/* @brief dispatch type of BMS-like (BMS / DTX) note channel. */
+enum class BmsChannelTypes
+{
+  kNone,
+  kBgm,
+  kBga,
+  kNote,
+  kTiming,
+  kEffect,
+  kMeasureLength
+};
+
+/**
+ * @brief descriptor of BMS-like note channel.
+ * @detail
+ * Channels are indexed by two-digit base-36 number (0 ~ 1295),
+ * and each format provides its own constexpr generated table.
+ * Descriptor is resolved once per line, so no channel comparison
+ * is done for each object.
+ */
+struct BmsChannelInfo
+{
+  BmsChannelTypes type;
+  uint8_t track;      // timing / command track index (kTiming, kBga, kEffect)
+  uint8_t subtype;    // NoteTypes (kNote) or ARGB layer index (kEffect)
+  uint8_t lane;       // note lane (kNote); 1P / 2P channels share lanes
+  uint8_t radix;      // radix of object value (16 or 36)
+  bool longnote;
 };
 
+constexpr BmsChannelInfo MakeBmsChannel(BmsChannelTypes type,
+  uint8_t track = 0, uint8_t subtype = 0, uint8_t radix = 36)
+{
+  return { type, track, subtype, 0, radix, false };
+}
+
+constexpr BmsChannelInfo MakeBmsNoteChannel(uint8_t subtype,
+  uint8_t lane, bool longnote = false)
+{
+  return { BmsChannelTypes::kNote, 0, subtype, lane, 36, longnote };
+}
+
+const unsigned kBmsChannelCount = 36 * 36;
 
+struct BmsChannelTable
+{
+  BmsChannelInfo ch[kBmsChannelCount];
+};
+
+/**
+ * @brief BMS (.bms / .bme / .bml / .pms) chart loader.
+ * @detail
+ * Lines in #mmmcc:objects form are object lines. Other lines are header
+ * (metadata) lines, and header value can be separated by colon as well as
+ * space (DTX style, e.g. "#WAV01: a.wav"); such lines were ignored before.
+ */
 class ChartLoaderBMS : public ChartLoader {
 public:
   ChartLoaderBMS(Song* song);
@@ -66,44 +138,132 @@ public:
   void ProcessCommand(Chart &c, const char* p, unsigned len);
 
   void ProcessConditionalStatement(bool do_process = true);
+
+  /**
+   * @brief All-branch expansion of #RANDOM charts.
+   * @detail
+   * PrepareVariants() tokenizes chart only once into tree of #RANDOM blocks,
+   * and LoadVariant() replays cached lines with given value
+   * for each #RANDOM (in order of appearance) instead of random draw.
+   * Lines out of #RANDOM are replayed only once into base chart,
+   * so tracks not written by #IF clauses are shared with it (copy-on-write).
+   * Chart built by LoadVariant() is the same as the chart loaded
+   * with the seed which draws the same values.
+   * @param
+   * GetRandomRanges range of each #RANDOM statement. (#SETRANDOM is constant)
+   * GetVariantCount count of distinct assignments, as value of #RANDOM
+   *                 in unreachable #IF clause is not counted.
+   *                 (saturated to UINT64_MAX)
+   * NextVariant     advance assignment to enumerate all of them.
+   *                 (values should start from all 1)
+   * SampleVariant   draw assignment using seed of loader.
+   * @warn source buffer must be kept until LoadVariant() is done.
+   */
+  bool PrepareVariants(const void* p, unsigned iLen);
+  const std::vector<unsigned>& GetRandomRanges() const;
+  uint64_t GetVariantCount() const;
+  bool LoadVariant(Chart &c, const std::vector<int>& values);
+  void SampleVariant(std::vector<int>& values);
+  bool NextVariant(std::vector<int>& values) const;
+
+protected:
+  /* @brief channel table used for dispatching notes. */
+  const BmsChannelInfo *channel_table_;
+
 private:
   Chart * chart_context_;
   uint32_t longnote_idx_per_lane[128];
   std::map<int, uint8_t> bgm_column_idx_per_measure_;
 
-  struct CondContext {
-    int condblock;
-    int condcur;
-    int condprocessed;
-    int condcheckedcount;
-    bool parseable;
-  };
-  std::vector<CondContext> cond_;
-
-  struct LineContext {
+  /**
+   * @brief Tokenized line.
+   * @detail Command is not copied, as it is at stmt + 1 of source buffer.
+   */
+  struct LineToken {
     const char* stmt;
-    unsigned stmt_len;
-    char command[256];
     const char* value;
-    unsigned int value_len;
-    unsigned int measure;
-    unsigned int bms_channel;
+    unsigned stmt_len;
+    unsigned value_len;
+    unsigned line;
+    unsigned clause;        // clause of #RANDOM block containing this line
+    uint16_t command_len;
+    uint16_t measure;       // measure / channel of object (#mmmcc) line
+    uint16_t bms_channel;
+    uint16_t target;        // track written by this line (LineTargets)
+    int8_t keyword;         // header / control flow keyword (BmsCommands), -1 if none
     char terminator_type;
-
-    void clear();
-    LineContext();
+    bool is_control_flow;
   };
-  std::vector<LineContext*> parsing_buffer_;
-  LineContext* current_line_;
+  std::vector<LineToken> lines_;
+  std::vector<LineToken*> parsing_buffer_;
+  LineToken line_;
+  LineToken* current_line_;
+  char command_[256];       // uppercased command of tokenizing line
   rutil::Random random_;
   bool process_conditional_statement_;
 
+  /**
+   * @brief Tree of #RANDOM blocks.
+   * @detail
+   * Block has clauses (common part, #IF, #ELSE and after #ENDIF)
+   * and nested blocks declared in its clauses. Top-level is block 0
+   * with constant value. Clause is active if its block is reached
+   * and condition matches with value of the block, and block is reached
+   * if the clause declaring the block is active.
+   */
+  struct RandomClause {
+    unsigned block;
+    int type;               // kBmsCmdRandom (common part), kBmsCmdIf, kBmsCmdElse, kBmsCmdEndIf
+    int cond;
+  };
+  struct RandomBlock {
+    unsigned parent;        // clause declaring this block, UINT32_MAX for top-level
+    unsigned range;         // 0 if value is constant (top-level, #SETRANDOM)
+    int value;              // constant value
+    unsigned dimension;     // index of assignment, valid if range > 0
+    std::vector<unsigned> clauses;
+    std::vector<unsigned> children;
+  };
+  /* @brief open block while tokenizing. */
+  struct CondContext {
+    unsigned block;
+    unsigned clause;
+    int condprocessed;
+  };
+  std::vector<RandomBlock> blocks_;
+  std::vector<RandomClause> clauses_;
+  std::vector<CondContext> cond_;
+  std::vector<uint8_t> clause_active_;
+
+  // #RANDOM ranges of tokenized lines, and assignment to replay.
+  std::vector<unsigned> random_ranges_;
+  std::vector<int> variant_values_;
+  std::string variant_hash_;
+  rutil::Random variant_random_;
+  // chart with lines of clauses not depending on assignment,
+  // and lines depending on assignment.
+  Chart variant_base_;
+  int variant_longnote_type_;
+  int variant_longnote_object_;
+  std::vector<unsigned> variant_lines_;
+  std::vector<uint8_t> dirty_targets_;
+
+  void TokenizeLines(const char* p, unsigned len);
+  void ReplayLines(Chart &c, const uint8_t* dirty_targets);
+  unsigned AddClause(unsigned block, int type, int cond);
+  void EvalBlock(const RandomBlock &b, int value, std::vector<uint8_t>& active) const;
+  void EvalClauses(std::vector<int>& values, rutil::Random* random,
+                   std::vector<uint8_t>& active) const;
+  uint64_t CountVariants(unsigned block, std::vector<uint8_t>& active) const;
+  uint16_t GetLineTarget() const;
+
   bool IsCurrentLineIsConditionalStatement();
   bool ParseCurrentLine();
   bool ParseControlFlow();
   bool ParseMetaData();
   bool ParseMeasureLength();
   bool ParseNote();
+  void ParseNoteToken(unsigned token_idx);
   bool ParseBgaNote();
   bool ParseBgmNote();
   bool ParseSoundNote();
@@ -120,7 +280,233 @@ private:
     unsigned int deno, num;
     unsigned int value_u;
     const char* value;
+    const BmsChannelInfo* desc;
+    int longnote_type;
+    unsigned longnote_object;
   } curr_note_syntax_;
+
+  // decoded object values of current line and its nonzero bitmask.
+  std::vector<uint16_t> token_values_;
+  std::vector<uint64_t> token_mask_;
+};
+
+/**
+ * @brief DTXMania (.dtx) chart loader.
+ * @detail
+ * DTX shares line syntax (#mmmcc:objects) and conditional statements
+ * with BMS, so it reuses BMS tokenizer with its own channel table.
+ * Only drum chips are loaded into note lanes. (12 lanes)
+ */
+class ChartLoaderDTX : public ChartLoaderBMS {
+public:
+  ChartLoaderDTX(Song* song);
+  virtual bool Test(const void* p, unsigned iLen);
+  virtual bool Load(Chart &c, const void* p, unsigned iLen);
+  virtual bool LoadFromDirectory();
+};
+
+/**
+ * @brief BMSON chart loader.
+ * @detail
+ * Parses JSON with pull-style tokenizer without building DOM tree,
+ * so notes are written into chart directly while reading.
+ * Notes are appended to tracks without sorting, and sorted once
+ * when loading is finished.
+ * As "info" (resolution) and "lines" may appear after notes,
+ * position of object is kept in raw pulse while reading,
+ * and converted into measure once in Finalize().
+ */
+class ChartLoaderBMSON : public ChartLoader {
+public:
+  ChartLoaderBMSON(Song* song);
+  virtual bool Test(const void* p, unsigned iLen);
+  virtual bool Load(Chart &c, const void* p, unsigned iLen);
+  virtual bool LoadFromDirectory();
+
+  /* @brief Streaming JSON tokenizer. */
+  class JsonReader {
+  public:
+    enum class Token {
+      kNone,
+      kObjectBegin,
+      kObjectEnd,
+      kArrayBegin,
+      kArrayEnd,
+      kKey,       // string followed by ':'
+      kString,
+      kNumber,
+      kTrue,
+      kFalse,
+      kNull,
+      kEnd,
+      kError
+    };
+
+    JsonReader();
+    void SetSource(const char* p, size_t len);
+    Token Next();
+    /* @brief skip value starting with given token (object / array). */
+    bool SkipValue(Token t);
+
+    /* @brief string of last kKey / kString token.
+     * @warn valid until next token is read. */
+    const char* str() const;
+    size_t str_len() const;
+    bool IsKey(const char* key) const;
+    double number() const;
+    size_t GetOffset() const;
+
+  private:
+    const char* p_;
+    const char* start_;
+    const char* end_;
+    const char* str_;
+    size_t str_len_;
+    std::string buf_;
+    double number_;
+
+    bool ReadString();
+    bool ReadNumber();
+    bool ReadLiteral(const char* lit, size_t len);
+  };
+
+private:
+  Chart *chart_;
+  JsonReader reader_;
+  unsigned resolution_;
+  double init_bpm_;
+  struct BmsonEvent {
+    uint32_t y;
+    double value;
+  };
+  std::vector<BmsonEvent> bpm_events_;
+  std::vector<BmsonEvent> stop_events_;
+  std::vector<uint32_t> lines_;
+
+  bool ParseInfo();
+  bool ParseLines();
+  bool ParseEvents(std::vector<BmsonEvent>& events, const char* value_key);
+  bool ParseSoundChannels();
+  bool ParseSoundNotes(unsigned channel);
+  bool ParseBga();
+  bool ParseBgaHeader();
+  bool ParseBgaEvents(size_t track_idx);
+  void Finalize();
+
+  bool ReadNumber(double& out);
+  bool ReadString(std::string& out);
+  void SetPulse(NoteElement& ne, uint32_t y) const;
+};
+
+/**
+ * @brief osu! beatmap (.osu) loader.
+ * @detail
+ * Section offsets are indexed first by scanning line heads only,
+ * then each section is parsed only when necessary.
+ * In header-only mode, [TimingPoints] and [HitObjects] are not parsed
+ * at all, which is useful for scanning large beatmap libraries.
+ *
+ * As osu! objects are placed in msec, object time is converted to
+ * beat using uninherited timing points. (4 beat per measure)
+ * Inherited timing points (slider velocity) are ignored.
+ */
+class ChartLoaderOSU : public ChartLoader {
+public:
+  ChartLoaderOSU(Song* song);
+  virtual bool Test(const void* p, unsigned iLen);
+  virtual bool Load(Chart &c, const void* p, unsigned iLen);
+  virtual bool LoadFromDirectory();
+
+  /* @brief load metadata sections only. */
+  void SetHeaderOnly(bool header_only = true);
+
+private:
+  Chart *chart_;
+  bool header_only_;
+
+  enum OsuSection {
+    kOsuGeneral,
+    kOsuMetadata,
+    kOsuDifficulty,
+    kOsuEvents,
+    kOsuTimingPoints,
+    kOsuHitObjects,
+    kOsuSectionMax
+  };
+  struct SectionRange {
+    const char* p;
+    size_t len;
+  } sections_[kOsuSectionMax];
+
+  struct TimingPoint {
+    double time;
+    double beat_length;
+    double beat;
+  };
+  std::vector<TimingPoint> timing_points_;
+
+  void IndexSections(const char* p, size_t len);
+  void ParseKeyValues(OsuSection section);
+  void ParseEvents();
+  void ParseTimingPoints();
+  void ParseHitObjects();
+  double GetMeasureFromTime(double time_msec, size_t &idx) const;
+};
+
+/**
+ * @brief StepMania (.sm) chart loader.
+ * @detail
+ * Single .sm file contains all difficulties with common timing,
+ * so #BPMS / #STOPS are parsed once into timing data shared by song
+ * (see Song::NewChart()), and only note data is parsed per chart.
+ * As #NOTES blocks are independent, they are parsed in parallel
+ * when thread count is bigger than 1.
+ *
+ * Load() fills given chart with first #NOTES block, and appends
+ * charts for the other blocks to the song.
+ */
+class ChartLoaderSM : public ChartLoader {
+public:
+  ChartLoaderSM(Song* song);
+  virtual bool Test(const void* p, unsigned iLen);
+  virtual bool Load(Chart &c, const void* p, unsigned iLen);
+  virtual bool LoadFromDirectory();
+  void SetThreadCount(unsigned thread_count);
+
+private:
+  unsigned thread_count_;
+
+  struct NotesBlock {
+    const char* p;
+    size_t len;
+  };
+
+  void ParseTiming(Chart &c, const char* bpms, size_t bpms_len,
+                   const char* stops, size_t stops_len);
+  /* @brief parse note data (thread-safe). returns count of ignored rows. */
+  static unsigned ParseNotes(Chart &c, const NotesBlock &block);
+};
+
+/**
+ * @brief O2Jam chart (.ojn) loader.
+ * @detail
+ * Single .ojn file contains three difficulties (EX / NX / HX),
+ * so Load() fills given chart with EX and appends charts for the others.
+ * Note packages are appended to tracks as read, and sorted once.
+ * Sounds refer to samples in .ojm container by its id,
+ * (e.g. o2ma100.ojm|1001.ogg) which is opened as DirectoryOJM
+ * and decoded only when it is accessed.
+ */
+class ChartLoaderOJN : public ChartLoader {
+public:
+  ChartLoaderOJN(Song* song);
+  virtual bool Test(const void* p, unsigned iLen);
+  virtual bool Load(Chart &c, const void* p, unsigned iLen);
+  virtual bool LoadFromDirectory();
+
+private:
+  static bool ParsePackages(Chart &c, const std::string& ojm_file,
+                            const uint8_t* p, size_t len);
 };
 
 enum VOS_VERSION {
@@ -129,8 +515,6 @@ enum VOS_VERSION {
   VOS_V3 = 3
 };
 
-enum class MIDISIG;
-struct MIDIProgramInfo;
 
 class ChartLoaderVOS : public ChartLoader {
 public:
@@ -163,10 +547,10 @@ private:
     uint8_t GetUInt8();
     void GetChar(char *out, size_t cnt);
     size_t GetOffset();
-    int GetMSInt();
-    int GetMSFixedInt(uint8_t bytesize=4);
+    size_t GetRemain() const;
+    bool HasRemain(size_t cnt) const;
+    const uint8_t* GetPtr() const;
     bool IsEnd();
-    MIDISIG GetMidiSignature(MIDIProgramInfo& mprog);
   private:
     const void* p_;
     unsigned len_;
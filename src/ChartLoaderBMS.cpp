@@ -9,36 +9,6 @@ using namespace rutil;
 
 namespace rparser {
 
-enum class BmsChannelTypes
-{
-  kNone,
-  kBgm,
-  kBga,
-  kNote,
-  kTiming,
-  kEffect
-};
-
-ChartLoaderBMS::LineContext::LineContext() { clear(); }
-
-void ChartLoaderBMS::LineContext::clear()
-{
-  stmt = 0;
-  stmt_len = 0;
-  *command = 0;
-  value = 0;
-  value_len = 0;
-  measure = 0;
-  bms_channel = 0;
-  terminator_type = 0;
-}
-
-ChartLoaderBMS::ChartLoaderBMS(Song *song)
-  : ChartLoader(song), chart_context_(0), process_conditional_statement_(true)
-{
-
-}
-
 bool TestName( const char *fn )
 {
   std::string fn_lower = fn;  lower(fn_lower);
@@ -68,12 +38,13 @@ bool ChartLoaderBMS::LoadFromDirectory()
     Chart *c = song_->NewChart();
     if (!c) return false;
 
+    if (diag_) diag_->SetFile(filename);
     bool r = Load(*c, f->p, f->len);
     c->SetFilename(filename);
 
     if (!r)
     {
-      std::cerr << "Failed to read chart file (may be invalid) : " << filename << std::endl;
+      Report(DiagnosticCodes::kChartLoadFailed);
       song_->DeleteChart(song_->GetChartCount() - 1);
     }
   }
@@ -108,73 +79,10 @@ bool ChartLoaderBMS::Test(const void* p, unsigned iLen)
 
 void ChartLoaderBMS::ProcessCommand(Chart &chart, const char* chr, unsigned len)
 {
-  /** Initialize global context */
-  memset(longnote_idx_per_lane, 0xffffffff, sizeof(longnote_idx_per_lane));
-  cond_.clear();
-  cond_.emplace_back(CondContext{ 0, -1, 0, 0, true });
+  TokenizeLines(chr, len);
   random_.SetSeed(seed_);
-  bgm_column_idx_per_measure_.clear();
-  // enable by default
-  chart.GetTimingSegmentData().SetMeasureLengthRecover(true);
-  chart_context_ = &chart;
-
-
-  unsigned pos = 0;
-  unsigned stmtlen = 0;
-  unsigned nextpos = 0;
-
-  while (pos < len)
-  {
-    if (!IsCharacterTrimmable(chr[pos]))
-    {
-      stmtlen = 0;
-      while (pos + stmtlen < len && chr[pos + stmtlen] != '\n')
-        stmtlen++;
-      nextpos = stmtlen + pos + 1;
-      while (stmtlen > 0 && IsCharacterTrimmable(chr[pos + stmtlen - 1]))
-        stmtlen--;
-
-      // prepare for line
-      current_line_ = new LineContext();
-      current_line_->stmt = chr + pos;
-      current_line_->stmt_len = stmtlen;
-      if (!ParseCurrentLine())
-      {
-        delete current_line_;
-        current_line_ = 0;
-        pos = nextpos;
-        continue;
-      }
-
-      // First check for conditional statement
-      // Conditional statement is processed first and stored in FlushParsingBuffer.
-      // If it's conditional statement and should not be processed,
-      // It'll be stored in metadata area.
-      if (IsCurrentLineIsConditionalStatement())
-      {
-        if (!process_conditional_statement_)
-        {
-          chart.GetMetaData().script +=
-            std::string(current_line_->stmt, current_line_->stmt_len) + "\n";
-        }
-        else ParseControlFlow();
-      }
-      else if (cond_.back().parseable) /* parsable condition */
-      {
-        parsing_buffer_.push_back(current_line_);
-      }
-
-      current_line_ = 0;
-      pos = nextpos;
-    }
-    else pos++;
-  }
-
-  /* Process parsed commands */
-  FlushParsingBuffer();
-
-  /* Sorting - TODO: not by row but measure */
-  //chart.GetNoteData().SortByBeat();
+  EvalClauses(variant_values_, &random_, clause_active_);
+  ReplayLines(chart, nullptr);
 }
 
 void ChartLoaderBMS::ProcessConditionalStatement(bool do_process)
@@ -201,24 +109,76 @@ unsigned int atoi_bms_measure(const char* p, unsigned int length = 3)
   return r;
 }
 
+/* @brief base-36 digit of character, 0xFF for invalid one. */
+struct Base36DigitTable
+{
+  uint8_t d[256];
+};
+
+constexpr Base36DigitTable MakeBase36DigitTable()
+{
+  Base36DigitTable t{};
+  for (unsigned i = 0; i < 256; ++i)
+  {
+    if (i >= 'a' && i <= 'z') t.d[i] = static_cast<uint8_t>(10 + i - 'a');
+    else if (i >= 'A' && i <= 'Z') t.d[i] = static_cast<uint8_t>(10 + i - 'A');
+    else if (i >= '0' && i <= '9') t.d[i] = static_cast<uint8_t>(i - '0');
+    else t.d[i] = 0xFF;
+  }
+  return t;
+}
+
+constexpr Base36DigitTable kBase36Digit = MakeBase36DigitTable();
+
 unsigned int atoi_bms_channel(const char* p, unsigned int length = 2)
 {
   unsigned int r = 0;
   while (*p && length)
   {
     r *= 26+10;
-    if (*p >= 'a' && *p <= 'z')
-      r += 10+(*p-'a');
-    else if (*p >= 'A' && *p <= 'Z')
-      r += 10+(*p-'A');
-    else if (*p >= '0' && *p <= '9')
-      r += (*p-'0');
-    else break;
+    const uint8_t d = kBase36Digit.d[static_cast<uint8_t>(*p)];
+    if (d == 0xFF) break;
+    r += d;
     ++p; --length;
   }
   return r;
 }
 
+/* @brief copy value span into C string buffer. (long value is truncated) */
+template <size_t N>
+inline const char* CopyValueSpan(char (&buf)[N], const char* p, unsigned int length)
+{
+  if (length >= N) length = N - 1;
+  memcpy(buf, p, length);
+  buf[length] = 0;
+  return buf;
+}
+
+/* @brief numeric value of span, parsed without heap allocation. */
+int atoi_span(const char* p, unsigned int length)
+{
+  char buf[32];
+  return atoi(CopyValueSpan(buf, p, length));
+}
+
+double atof_span(const char* p, unsigned int length)
+{
+  char buf[64];
+  return atof(CopyValueSpan(buf, p, length));
+}
+
+/* @brief index of lowest set bit. (m should not be 0) */
+inline unsigned CountTrailingZero(uint64_t m)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctzll(m);
+#else
+  unsigned r = 0;
+  while (!(m & 1)) { m >>= 1; ++r; }
+  return r;
+#endif
+}
+
 #if 0
 int atoi_bms16(const char* p, int length)
 {
@@ -244,7 +204,7 @@ bool ChartLoaderBMS::ParseCurrentLine()
 {
   const char *c, *p;
   unsigned len = current_line_->stmt_len;
-  char *cw = current_line_->command;
+  char *cw = command_;
   char terminator_type;
   c = p = current_line_->stmt;
 
@@ -264,8 +224,7 @@ bool ChartLoaderBMS::ParseCurrentLine()
   // '%' start is ignored
   if (current_line_->stmt[0] == '%')
   {
-    std::cerr << "percent starting line is ignored : "
-              << std::string(current_line_->stmt, current_line_->stmt_len) << std::endl;
+    Report(DiagnosticCodes::kBmsPercentLine, current_line_->line);
     return false;
   }
 
@@ -274,10 +233,13 @@ bool ChartLoaderBMS::ParseCurrentLine()
   c++;
   while (*c != ' ' && *c != ':' && c < p+len)
   {
-    *cw = upperchr(*c);
-    c++; cw++;
+    // too long command cannot be keyword, so don't need to be stored.
+    if (cw < command_ + sizeof(command_) - 1)
+      *cw++ = upperchr(*c);
+    c++;
   }
   *cw = 0;
+  current_line_->command_len = static_cast<uint16_t>(std::min<ptrdiff_t>(c - p - 1, 0xFFFF));
   // check an attribute has no value
   if (c - p == len)
   {
@@ -292,223 +254,686 @@ bool ChartLoaderBMS::ParseCurrentLine()
   current_line_->value = c + 1;
   current_line_->terminator_type = terminator_type;
 
+  // trim value after colon (e.g. DTX style "#WAV01: a.wav")
+  if (terminator_type == ':')
+  {
+    while (current_line_->value_len > 0 &&
+           IsCharacterTrimmable(*current_line_->value))
+    {
+      current_line_->value++;
+      current_line_->value_len--;
+    }
+  }
+
   return true;
 }
 
-#define CMDCMP(x) (strcmp(current_line_->command, (x)) == 0)
+/* @brief check command is in object form (#mmmcc) */
+inline bool IsObjectCommand(const char* cmd)
+{
+  for (unsigned i = 0; i < 3; ++i)
+    if (cmd[i] < '0' || cmd[i] > '9') return false;
+  return kBase36Digit.d[static_cast<uint8_t>(cmd[3])] != 0xFF &&
+         kBase36Digit.d[static_cast<uint8_t>(cmd[4])] != 0xFF &&
+         cmd[5] == 0;
+}
+
+/* @brief control flow / header keywords, in order of kBmsCommandNames. */
+enum BmsCommands
+{
+  kBmsCmdSwitch,
+  kBmsCmdRandom,
+  kBmsCmdRondom,
+  kBmsCmdSetRandom,
+  kBmsCmdEndRandom,
+  kBmsCmdEndRondom,
+  kBmsCmdIf,
+  kBmsCmdElse,
+  kBmsCmdElseIf,
+  kBmsCmdEndIf,
+  kBmsCmdEnd,
+  kBmsCmdLnType,
+  kBmsCmdLnObj,
+  kBmsCmdStp,
+  // keywords with channel (e.g. #WAV01)
+  kBmsCmdWav,
+  kBmsCmdBmp,
+  kBmsCmdBpm,
+  kBmsCmdExBpm,
+  kBmsCmdStop,
+};
+
+constexpr const char* kBmsCommandNames[] = {
+  "SWITCH", "RANDOM", "RONDOM", "SETRANDOM", "ENDRANDOM", "ENDRONDOM",
+  "IF", "ELSE", "ELSEIF", "ENDIF", "END",
+  "LNTYPE", "LNOBJ", "STP",
+  "WAV", "BMP", "BPM", "EXBPM", "STOP",
+};
+
+constexpr KeywordHash<sizeof(kBmsCommandNames) / sizeof(kBmsCommandNames[0])>
+  kBmsCommandHash(kBmsCommandNames);
+static_assert(kBmsCommandHash.valid(), "Failed to generate perfect hash of BMS keywords.");
+
+/**
+ * @brief Find keyword of command.
+ * @detail
+ * Keywords with channel are matched with last two characters removed,
+ * and command of object (#mmmcc) is not looked up.
+ */
+int GetBmsCommand(const char* cmd, unsigned len)
+{
+  int k = kBmsCommandHash.Find(cmd, len);
+  if (k >= 0 && k < kBmsCmdWav) return k;
+  if (len <= 2) return -1;
+  k = kBmsCommandHash.Find(cmd, len - 2);
+  return k >= kBmsCmdWav ? k : -1;
+}
 
 bool ChartLoaderBMS::IsCurrentLineIsConditionalStatement()
 {
-  return (CMDCMP("SWITCH") ||
-    CMDCMP("RANDOM") || CMDCMP("RONDOM") || CMDCMP("SETRANDOM") ||
-    CMDCMP("ENDRANDOM") || CMDCMP("ENDRONDOM") ||
-    CMDCMP("IF") || CMDCMP("ELSE") || CMDCMP("ELSEIF") ||
-    CMDCMP("ENDIF") || CMDCMP("END"));
+  return current_line_->keyword >= kBmsCmdSwitch && current_line_->keyword <= kBmsCmdEnd;
 }
 
-bool ChartLoaderBMS::ParseControlFlow()
+/* @brief track written by line: (TrackTypes << 8 | track index). */
+enum LineTargets
 {
-  unsigned int cond = atoi_bms_measure(current_line_->value, current_line_->value_len);
+  kLineTargetAllTracks = 0xFF,   // track index for all tracks (BGM columns)
+  kLineTargetCount = TrackTypes::kTrackMax << 8,
+  kLineTargetMeta = 0xFFFE,
+  kLineTargetNone = 0xFFFF,
+};
 
-  if (CMDCMP("SWITCH"))
+constexpr unsigned kNoClause = UINT32_MAX;
+
+uint16_t ChartLoaderBMS::GetLineTarget() const
+{
+  if (current_line_->is_control_flow) return kLineTargetNone;
+  if (current_line_->keyword >= 0 || current_line_->terminator_type != ':' ||
+      !IsObjectCommand(command_))
+    return kLineTargetMeta;
+
+  const BmsChannelInfo &desc = channel_table_[current_line_->bms_channel];
+  switch (desc.type)
   {
-    // check start of the stmt
-    cond_.emplace_back(
-      CondContext{ (int)cond, random_.Next(1, cond), 0, 0, true /* true for orphanized common part */ });
+  case BmsChannelTypes::kNote:
+    return TrackTypes::kTrackTap << 8 | desc.lane;
+  case BmsChannelTypes::kBgm:
+    // BGM column is allocated in order of lines, so all columns are written.
+    return TrackTypes::kTrackBGM << 8 | kLineTargetAllTracks;
+  case BmsChannelTypes::kMeasureLength:
+    return TrackTypes::kTrackTiming << 8 | TimingTrackTypes::kMeasure;
+  case BmsChannelTypes::kTiming:
+    return TrackTypes::kTrackTiming << 8 | desc.track;
+  case BmsChannelTypes::kBga:
+  case BmsChannelTypes::kEffect:
+    return TrackTypes::kTrackCommand << 8 | desc.track;
+  default:
+    return kLineTargetNone;
   }
-  else if (CMDCMP("RANDOM") || CMDCMP("RONDOM") || CMDCMP("SETRANDOM"))
+}
+
+unsigned ChartLoaderBMS::AddClause(unsigned block, int type, int cond)
+{
+  const unsigned clause = static_cast<unsigned>(clauses_.size());
+  clauses_.push_back(RandomClause{ block, type, cond });
+  blocks_[block].clauses.push_back(clause);
+  return clause;
+}
+
+bool ChartLoaderBMS::ParseControlFlow()
+{
+  unsigned int cond = atoi_bms_measure(current_line_->value, current_line_->value_len);
+  CondContext &ctx = cond_.back();
+
+  switch (current_line_->keyword)
   {
-    // check start of the stmt
-    cond_.emplace_back(
-      CondContext{ (int)cond, random_.Next(1, cond), 0, 0, true /* true for orphanized common part */ });
-  }
-  else if (CMDCMP("ENDRANDOM") || CMDCMP("ENDRONDOM"))
+  case kBmsCmdSwitch:
+  case kBmsCmdRandom:
+  case kBmsCmdRondom:
+  case kBmsCmdSetRandom:
   {
-    // restore chart context.
-    cond_.pop_back();
+    // check start of the stmt: #SETRANDOM has constant value.
+    RandomBlock b;
+    b.parent = ctx.clause;
+    b.range = 0;
+    b.value = (int)cond;
+    b.dimension = 0;
+    if (current_line_->keyword != kBmsCmdSetRandom)
+    {
+      b.range = cond > 0 ? cond : 1;
+      b.dimension = static_cast<unsigned>(random_ranges_.size());
+      random_ranges_.push_back(b.range);
+    }
+    const unsigned block = static_cast<unsigned>(blocks_.size());
+    blocks_[ctx.block].children.push_back(block);
+    blocks_.push_back(b);
+    // common part is parsed before any IF clause (orphanized common part).
+    cond_.emplace_back(CondContext{ block, AddClause(block, kBmsCmdRandom, 0), 0 });
+    break;
   }
-  else if (CMDCMP("IF"))
-  {
+  case kBmsCmdEndRandom:
+  case kBmsCmdEndRondom:
+    // top-level block cannot be closed.
+    if (cond_.size() > 1)
+      cond_.pop_back();
+    break;
+  case kBmsCmdIf:
+  case kBmsCmdElseIf:
     /**
      * COMMENT: IF statement can exist multiple times in same RANDOM block
      * So comment out assert below:
      * ASSERT(condstmt_->GetSentenceCount() == 0);
      */
-     // JUST warning: no statement after ELSE
-    if (cond_.back().condprocessed < 0)
-      std::cerr << "BMSParser : IF clause after ELSE statement." << std::endl;
-    cond_.back().parseable = cond_.back().condcur == (int)cond;
-    cond_.back().condprocessed++;
-    cond_.back().condcheckedcount += cond_.back().parseable;
+    // JUST warning: no statement after ELSE
+    if (ctx.condprocessed < 0)
+      Report(DiagnosticCodes::kBmsIfAfterElse, current_line_->line);
+    // JUST warning: IF statement must placed before ELSEIF
+    if (current_line_->keyword == kBmsCmdElseIf && ctx.condprocessed == 0)
+      Report(DiagnosticCodes::kBmsElseIfBeforeIf, current_line_->line);
+    ctx.condprocessed++;
+    ctx.clause = AddClause(ctx.block, kBmsCmdIf, (int)cond);
+    break;
+  case kBmsCmdElse:
+    ctx.condprocessed = -9999; /* else state */
+    ctx.clause = AddClause(ctx.block, kBmsCmdElse, 0);
+    break;
+  case kBmsCmdEndIf:
+  case kBmsCmdEnd:
+    // JUST warning: ENDIF without IF clause.
+    if (ctx.condprocessed == 0)
+      Report(DiagnosticCodes::kBmsEndIfWithoutIf, current_line_->line);
+    // lines until next IF clause are not parsed.
+    ctx.condprocessed = 0;
+    ctx.clause = AddClause(ctx.block, kBmsCmdEndIf, 0);
+    break;
+  default:
+    return false;
   }
-  else if (CMDCMP("ELSE"))
+  return true;
+}
+
+/**
+ * @brief Evaluate clauses of reached block with value.
+ * @detail ELSE is active if no IF clause after last ENDIF is matched.
+ */
+void ChartLoaderBMS::EvalBlock(const RandomBlock &b, int value,
+                               std::vector<uint8_t>& active) const
+{
+  int condprocessed = 0, condcheckedcount = 0;
+  for (unsigned c : b.clauses)
   {
-    cond_.back().parseable =
-      (cond_.back().condcheckedcount == 0 && cond_.back().condprocessed > 0);
-    cond_.back().condprocessed = -9999; /* else state */
+    const RandomClause &clause = clauses_[c];
+    switch (clause.type)
+    {
+    case kBmsCmdIf:
+      active[c] = clause.cond == value;
+      condprocessed++;
+      condcheckedcount += active[c];
+      break;
+    case kBmsCmdElse:
+      active[c] = condcheckedcount == 0 && condprocessed > 0;
+      condprocessed = -9999;
+      break;
+    case kBmsCmdEndIf:
+      active[c] = false;
+      condprocessed = 0;
+      condcheckedcount = 0;
+      break;
+    default:
+      active[c] = true;
+    }
   }
-  else if (CMDCMP("ELSEIF"))
+}
+
+/**
+ * @brief Evaluate all clauses with assignment.
+ * @detail
+ * Blocks are visited in order of appearance, so parent clause is evaluated
+ * before its nested block. If random is given, value of reached #RANDOM is
+ * drawn in that order (same as loading chart), and value of #RANDOM not
+ * reached is set to 1.
+ */
+void ChartLoaderBMS::EvalClauses(std::vector<int>& values, rutil::Random* random,
+                                 std::vector<uint8_t>& active) const
+{
+  values.resize(random_ranges_.size(), 1);
+  active.resize(clauses_.size());
+  for (const RandomBlock &b : blocks_)
   {
-    // JUST warning: no statement after ELSE
-    if (cond_.back().condprocessed < 0)
-      std::cerr << "BMSParser : IF clause after ELSE statement." << std::endl;
-    // JUST warning: IF statement must placed before ELSEIF
-    if (cond_.back().condprocessed == 0)
-      std::cerr << "BMSParser : ELSEIF clause before IF statement." << std::endl;
-    cond_.back().parseable = cond_.back().condcur == (int)cond;
-    cond_.back().condprocessed++;
-    cond_.back().condcheckedcount += cond_.back().parseable;
+    if (b.parent != kNoClause && !active[b.parent])
+    {
+      for (unsigned c : b.clauses) active[c] = false;
+      if (random && b.range > 0) values[b.dimension] = 1;
+      continue;
+    }
+    if (random && b.range > 0)
+      values[b.dimension] = random->Next(1, b.range);
+    EvalBlock(b, b.range > 0 ? values[b.dimension] : b.value, active);
   }
-  else if (CMDCMP("ENDIF") || CMDCMP("END"))
+}
+
+void ChartLoaderBMS::TokenizeLines(const char* chr, unsigned len)
+{
+  unsigned pos = 0;
+  unsigned stmtlen = 0;
+  unsigned nextpos = 0;
+  unsigned line = 1;
+
+  lines_.clear();
+  random_ranges_.clear();
+  blocks_.clear();
+  clauses_.clear();
+  cond_.clear();
+  // top-level block, which has constant value.
+  RandomBlock top;
+  top.parent = kNoClause;
+  top.range = 0;
+  top.value = -1;
+  top.dimension = 0;
+  blocks_.push_back(top);
+  cond_.emplace_back(CondContext{ 0, AddClause(0, kBmsCmdRandom, 0), 0 });
+
+  while (pos < len)
   {
-    // JUST warning: ENDIF without IF clause.
-    if (cond_.back().condprocessed == 0)
-      std::cerr << "BMSParser : ENDIF clause without IF statement." << std::endl;
-    // just clear(init) chart context (unparse-able state)
-    cond_.back().parseable = false;
-    cond_.back().condprocessed = 0;
-    cond_.back().condcheckedcount = 0;
-  }
-  else return false;
+    if (!IsCharacterTrimmable(chr[pos]))
+    {
+      stmtlen = 0;
+      while (pos + stmtlen < len && chr[pos + stmtlen] != '\n')
+        stmtlen++;
+      nextpos = stmtlen + pos + 1;
+      while (stmtlen > 0 && IsCharacterTrimmable(chr[pos + stmtlen - 1]))
+        stmtlen--;
+
+      // prepare for line
+      current_line_ = &line_;
+      line_ = LineToken();
+      line_.keyword = -1;
+      line_.stmt = chr + pos;
+      line_.stmt_len = stmtlen;
+      line_.line = line;
+      if (ParseCurrentLine())
+      {
+        if (line_.terminator_type != ':' || !IsObjectCommand(command_))
+        {
+          if (line_.command_len < sizeof(command_))
+            line_.keyword = static_cast<int8_t>(GetBmsCommand(command_, line_.command_len));
+        }
+        else
+        {
+          line_.measure = static_cast<uint16_t>(atoi_bms_measure(command_, 3));
+          line_.bms_channel = static_cast<uint16_t>(atoi_bms_channel(command_ + 3, 2));
+        }
+        line_.is_control_flow = IsCurrentLineIsConditionalStatement();
+        // block tree is not built if conditional statement is kept as script.
+        if (line_.is_control_flow && process_conditional_statement_)
+          ParseControlFlow();
+        line_.clause = cond_.back().clause;
+        line_.target = GetLineTarget();
+        lines_.push_back(line_);
+      }
+
+      current_line_ = 0;
+      pos = nextpos;
+      line++;
+    }
+    else if (chr[pos++] == '\n') line++;
+  }
+}
+
+/**
+ * @brief Parse lines of active clauses.
+ * @detail
+ * If dirty_targets is given, only lines writing to those tracks are parsed
+ * (with LNTYPE / LNOBJ which changes parsing of notes).
+ */
+void ChartLoaderBMS::ReplayLines(Chart &chart, const uint8_t* dirty_targets)
+{
+  /** Initialize global context */
+  memset(longnote_idx_per_lane, 0xffffffff, sizeof(longnote_idx_per_lane));
+  bgm_column_idx_per_measure_.clear();
+  // enable by default
+  chart.GetTimingSegmentData().SetMeasureLengthRecover(true);
+  chart_context_ = &chart;
+
+  for (auto &l : lines_)
+  {
+    current_line_ = &l;
+
+    // First check for conditional statement
+    // Conditional statement is already evaluated into active clauses.
+    // If it's conditional statement and should not be processed,
+    // It'll be stored in metadata area.
+    if (current_line_->is_control_flow)
+    {
+      if (!process_conditional_statement_)
+      {
+        chart.GetMetaData().script +=
+          std::string(current_line_->stmt, current_line_->stmt_len) + "\n";
+      }
+    }
+    else if (clause_active_[current_line_->clause]) /* parsable condition */
+    {
+      if (dirty_targets &&
+          !(l.target < kLineTargetCount && dirty_targets[l.target]) &&
+          l.keyword != kBmsCmdLnType && l.keyword != kBmsCmdLnObj)
+        continue;
+      parsing_buffer_.push_back(current_line_);
+    }
+  }
+  current_line_ = 0;
+
+  /* Process parsed commands */
+  FlushParsingBuffer();
+
+  /* Sorting - TODO: not by row but measure */
+  //chart.GetNoteData().SortByBeat();
+}
+
+bool ChartLoaderBMS::PrepareVariants(const void* p, unsigned iLen)
+{
+  variant_hash_ = rutil::md5_str(p, iLen);
+  variant_random_.SetSeed(seed_);
+  TokenizeLines(static_cast<const char*>(p), iLen);
+
+  // evaluate clauses not depending on assignment.
+  // (clause of #RANDOM and its nested block is variable)
+  std::vector<uint8_t> variable(clauses_.size(), 0);
+  clause_active_.assign(clauses_.size(), 0);
+  for (const RandomBlock &b : blocks_)
+  {
+    const bool parent_variable = b.parent != kNoClause && variable[b.parent];
+    const bool parent_active = b.parent == kNoClause || clause_active_[b.parent];
+    if (parent_variable || (parent_active && b.range > 0))
+    {
+      for (unsigned c : b.clauses) variable[c] = 1;
+    }
+    else if (parent_active)
+      EvalBlock(b, b.value, clause_active_);
+  }
+
+  // replay lines of constant clauses once into base chart.
+  Preload(variant_base_, variant_hash_);
+  variant_longnote_type_ = variant_base_.GetMetaData().bms_longnote_type;
+  variant_longnote_object_ = variant_base_.GetMetaData().bms_longnote_object;
+  ReplayLines(variant_base_, nullptr);
+
+  variant_lines_.clear();
+  for (unsigned i = 0; i < lines_.size(); ++i)
+  {
+    if (!lines_[i].is_control_flow && variable[lines_[i].clause])
+      variant_lines_.push_back(i);
+  }
+  dirty_targets_.assign(kLineTargetCount, 0);
+  return !lines_.empty();
+}
+
+const std::vector<unsigned>& ChartLoaderBMS::GetRandomRanges() const
+{
+  return random_ranges_;
+}
+
+/**
+ * @brief Count assignments of block and its nested blocks.
+ * @detail
+ * Nested block is counted only for the values reaching the block,
+ * and nested blocks in the different clauses are independent.
+ */
+uint64_t ChartLoaderBMS::CountVariants(unsigned block, std::vector<uint8_t>& active) const
+{
+  const RandomBlock &b = blocks_[block];
+  const int first = b.range > 0 ? 1 : b.value;
+  const int last = b.range > 0 ? (int)b.range : b.value;
+  uint64_t r = 0;
+  for (int v = first; v <= last; ++v)
+  {
+    uint64_t n = 1;
+    EvalBlock(b, v, active);
+    for (unsigned child : b.children)
+    {
+      if (!active[blocks_[child].parent]) continue;
+      const uint64_t cn = CountVariants(child, active);
+      n = (n > UINT64_MAX / cn) ? UINT64_MAX : n * cn;
+    }
+    r = (r > UINT64_MAX - n) ? UINT64_MAX : r + n;
+  }
+  return r;
+}
+
+uint64_t ChartLoaderBMS::GetVariantCount() const
+{
+  std::vector<uint8_t> active(clauses_.size());
+  return CountVariants(0, active);
+}
+
+bool ChartLoaderBMS::LoadVariant(Chart &c, const std::vector<int>& values)
+{
+  variant_values_ = values;
+  EvalClauses(variant_values_, nullptr, clause_active_);
+  Preload(c, variant_hash_);
+
+  // check tracks written by lines of this variant.
+  bool is_dirty = false;
+  std::fill(dirty_targets_.begin(), dirty_targets_.end(), 0);
+  for (unsigned i : variant_lines_)
+  {
+    const LineToken &l = lines_[i];
+    if (!clause_active_[l.clause] || l.target == kLineTargetNone) continue;
+    if (l.target == kLineTargetMeta)
+    {
+      // metadata affects parsing of following lines, so replay all lines.
+      ReplayLines(c, nullptr);
+      return true;
+    }
+    dirty_targets_[l.target] = 1;
+    is_dirty = true;
+  }
+
+  // share tracks of base chart, and rebuild tracks written by this variant.
+  Chart base(variant_base_);
+  TrackData* trackdata[TrackTypes::kTrackMax] = {
+    &c.GetTimingData(), &c.GetNoteData(), &c.GetCommandData(), &c.GetBgmData() };
+  TrackData* base_trackdata[TrackTypes::kTrackMax] = {
+    &base.GetTimingData(), &base.GetNoteData(), &base.GetCommandData(), &base.GetBgmData() };
+  for (size_t i = 0; i < TrackTypes::kTrackMax; ++i)
+    trackdata[i]->swap(*base_trackdata[i]);
+  c.GetMetaData().swap(base.GetMetaData());
+  c.GetTimingSegmentData().swap(base.GetTimingSegmentData());
+  if (!is_dirty) return true;
+
+  for (unsigned t = 0; t < kLineTargetCount; ++t)
+  {
+    if (!dirty_targets_[t]) continue;
+    TrackData &td = *trackdata[t >> 8];
+    if ((t & 0xFF) == kLineTargetAllTracks)
+      td.clear();
+    else if ((t & 0xFF) < td.get_track_count())
+      td[t & 0xFF].clear();
+  }
+  c.GetMetaData().bms_longnote_type = variant_longnote_type_;
+  c.GetMetaData().bms_longnote_object = variant_longnote_object_;
+  ReplayLines(c, dirty_targets_.data());
   return true;
 }
-#undef CMDCMP
+
+void ChartLoaderBMS::SampleVariant(std::vector<int>& values)
+{
+  EvalClauses(values, &variant_random_, clause_active_);
+}
+
+bool ChartLoaderBMS::NextVariant(std::vector<int>& values) const
+{
+  std::vector<uint8_t> active;
+  EvalClauses(values, nullptr, active);
+  for (size_t i = blocks_.size(); i > 0; --i)
+  {
+    const RandomBlock &b = blocks_[i - 1];
+    if (b.range == 0) continue;
+    // value of block not reached makes no difference, so keep it as 1.
+    int &v = values[b.dimension];
+    if (active[b.parent] && v < (int)b.range)
+    {
+      v++;
+      return true;
+    }
+    v = 1;
+  }
+  return false;
+}
 
 bool ChartLoaderBMS::ParseMetaData()
 {
   // check contains value
   if (current_line_->value_len == 0)
   {
-    std::cerr << "Warning: Command #" << current_line_->command << " has no value, ignored." << std::endl;
+    Report(DiagnosticCodes::kBmsNoValue, current_line_->line);
     return true;
   }
 
   // cannot parse between control flow stmt
   if (!chart_context_) return false;
   MetaData& md = chart_context_->GetMetaData();
-  std::string cmd(current_line_->command);
-  std::string value(current_line_->value, current_line_->value_len);
-
-  /**
-   * @warn
-   * LNTYPE metadata effects directly in syntax progress!
-   */
-  if (cmd == "LNTYPE")
-    md.bms_longnote_type = atoi(value.c_str());
-  else if (cmd == "LNOBJ")
-    md.bms_longnote_object = atoi(value.c_str());
-
-# define CHKCMD(cmd_const, len) (strncmp(current_line_->command, cmd_const, len) == 0)
-  if (CHKCMD("BMP",3)) {
-    unsigned int key = atoi_bms_channel(current_line_->command + 3);
-    md.GetBGAChannel()->bga[key] = { value, 0,0,0,0, 0,0,0,0 };
-  }
-  else if (CHKCMD("WAV",3)) {
-    unsigned int key = atoi_bms_channel(current_line_->command + 3);
-    md.GetSoundChannel()->fn[key] = value;
-  }
-  else if (cmd.size() > 3 && (CHKCMD("EXBPM",5) || CHKCMD("BPM",3))) {
-    unsigned int key;
-    if (cmd[0] == 'B')
-        key = atoi_bms_channel(cmd.c_str() + 3);
-    else
-        key = atoi_bms_channel(cmd.c_str() + 5);
-    md.GetBPMChannel()->bpm[key] = static_cast<float>(atof( value.c_str() ));
-  }
-  else if (CHKCMD("STOP",4)) {
-    unsigned int key = atoi_bms_channel(current_line_->command + 4);
-    md.GetSTOPChannel()->stop[key] = static_cast<float>(atoi(value.c_str()));  // 1/192nd
-  }
+  const int keyword = current_line_->keyword;
+  const char* value = current_line_->value;
+  const unsigned int value_len = current_line_->value_len;
+  // channel of keyword (e.g. #WAV01)
+  const unsigned int key = keyword >= kBmsCmdWav ?
+    atoi_bms_channel(current_line_->stmt + 1 + current_line_->command_len - 2) : 0;
+
+  switch (keyword)
+  {
+  case kBmsCmdLnType:
+    /**
+     * @warn
+     * LNTYPE metadata effects directly in syntax progress!
+     */
+    md.bms_longnote_type = atoi_span(value, value_len);
+    md.SetAttribute(upper(std::string(current_line_->stmt + 1, current_line_->command_len)),
+                    std::string(value, value_len));
+    break;
+  case kBmsCmdLnObj:
+    // LNOBJ is base-36 object value, so don't leave it as attribute
+    // (which is parsed as decimal by SetMetaFromAttribute).
+    md.bms_longnote_object = atoi_bms_channel(value, std::min(value_len, 2u));
+    break;
+  case kBmsCmdBmp:
+    md.GetBGAChannel()->Set(key, std::string(value, value_len));
+    break;
+  case kBmsCmdWav:
+    md.GetSoundChannel()->Set(key, std::string(value, value_len));
+    break;
+  case kBmsCmdBpm:
+  case kBmsCmdExBpm:
+    md.GetBPMChannel()->bpm[key] = static_cast<float>(atof_span(value, value_len));
+    break;
+  case kBmsCmdStop:
+    md.GetSTOPChannel()->stop[key] = static_cast<float>(atoi_span(value, value_len));  // 1/192nd
+    break;
   // TODO: WAVCMD, EXWAV
   // TODO: MIDIFILE
-# undef CHKCMD
-  else if (cmd == "STP") {
-    std::string sMeasure, sTime;
-    if (!split(value, ' ', sMeasure, sTime))
+  case kBmsCmdStp:
+  {
+    const char* sep = static_cast<const char*>(memchr(value, ' ', value_len));
+    if (!sep)
     {
-      printf("invalid #STP found, ignore. (%s)\n", value.c_str());
-      return false;
+      Report(DiagnosticCodes::kBmsInvalidStp, current_line_->line);
+      return true;
     }
-    float fMeasure = static_cast<float>(atof(sMeasure.c_str()));
-    md.GetSTOPChannel()->STP[fMeasure] = static_cast<float>(atoi(sTime.c_str()));
+    const unsigned int measure_len = static_cast<unsigned>(sep - value);
+    float fMeasure = static_cast<float>(atof_span(value, measure_len));
+    md.GetSTOPChannel()->STP[fMeasure] =
+      static_cast<float>(atoi_span(sep + 1, value_len - measure_len - 1));
+    break;
   }
-  else {
-    md.SetAttribute(cmd, value);
+  default:
+    // command is uppercased only when it's stored as attribute.
+    md.SetAttribute(upper(std::string(current_line_->stmt + 1, current_line_->command_len)),
+                    std::string(value, value_len));
   }
 
   return true;
 }
 
-constexpr unsigned int radix_16_2_36(unsigned int radix_16)
+/* SC is 8th ch */
+/* in DP: SC is 15, 16th ch */
+/* XXX: pedal is 9th ch, but when it would be in progress? */
+constexpr uint8_t GetBmsNoteLane(unsigned int channel_lo)
 {
-  return (radix_16 >> 4 /* / 16 */) * 36 + (radix_16 & 0b1111 /* % 16 */);
+  switch (channel_lo)
+  {
+  case 6: return 7;   // scratch
+  case 7: return 8;   // pedal
+  case 8: return 5;
+  case 9: return 6;
+  default: return static_cast<uint8_t>(channel_lo - 1);
+  }
 }
 
-BmsChannelTypes GetNoteTypeFromBmsChannel(unsigned int bms_channel)
+constexpr BmsChannelInfo GetBmsChannelInfo(unsigned int bms_channel)
 {
   switch (bms_channel)
   {
   case 1:   // BGM
-    return BmsChannelTypes::kBgm;
+    return MakeBmsChannel(BmsChannelTypes::kBgm);
+  case 2:   // measure length
+    return MakeBmsChannel(BmsChannelTypes::kMeasureLength);
   case 3:   // BPM change
+    return MakeBmsChannel(BmsChannelTypes::kTiming, TimingTrackTypes::kBpm, 0, 16);
   case 8:   // BPM (exbpm)
+    return MakeBmsChannel(BmsChannelTypes::kTiming, TimingTrackTypes::kBmsBpm);
   case 9:   // STOP
-    return BmsChannelTypes::kTiming;
+    return MakeBmsChannel(BmsChannelTypes::kTiming, TimingTrackTypes::kBmsStop);
   case 4:   // BGA
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaMain);
   case 6:   // BGA poor
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaMiss);
   case 7:   // BGA layered
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaLayer1);
   case 10:  // BGA layered 2
-    return BmsChannelTypes::kBga;
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaLayer2);
   case 11:  // BGA opacity
   case 12:  // BGA opacity layer
   case 13:  // BGA opacity layer 2
   case 14:  // BGA opacity poor
-    return BmsChannelTypes::kEffect;
-  default:
-    // 1P/2P visible note
-    if (bms_channel >= radix_16_2_36(0x11) && bms_channel <= radix_16_2_36(0x19) ||
-        bms_channel >= radix_16_2_36(0x21) && bms_channel <= radix_16_2_36(0x29))
-      return BmsChannelTypes::kNote;
-    // 1P/2P invisible note
-    else if (bms_channel >= radix_16_2_36(0x31) && bms_channel <= radix_16_2_36(0x39) ||
-             bms_channel >= radix_16_2_36(0x41) && bms_channel <= radix_16_2_36(0x49))
-      return BmsChannelTypes::kNote;
-    // Longnote
-    else if (bms_channel >= radix_16_2_36(0x51) && bms_channel <= radix_16_2_36(0x59) ||
-             bms_channel >= radix_16_2_36(0x61) && bms_channel <= radix_16_2_36(0x69))
-      return BmsChannelTypes::kNote;
-    // Mine
-    else if (bms_channel >= radix_16_2_36(0xD1) && bms_channel <= radix_16_2_36(0xD9) ||
-             bms_channel >= radix_16_2_36(0xE1) && bms_channel <= radix_16_2_36(0xE9))
-      return BmsChannelTypes::kNote;
-  }
-  return BmsChannelTypes::kNone;
+    return MakeBmsChannel(BmsChannelTypes::kEffect, CommandTrackTypes::kBmsARGBLAYER,
+                          static_cast<uint8_t>(bms_channel - 11));
+  }
+
+  // note channels: 1P/2P pair of 0x?1 ~ 0x?9
+  const unsigned hi = bms_channel / 36;
+  const unsigned lo = bms_channel % 36;
+  if (lo < 1 || lo > 9)
+    return MakeBmsChannel(BmsChannelTypes::kNone);
+  const uint8_t lane = GetBmsNoteLane(lo);
+  switch (hi)
+  {
+  case 0x1: case 0x2:   // visible note
+    return MakeBmsNoteChannel(NoteTypes::kNormalNote, lane);
+  case 0x3: case 0x4:   // invisible note
+    return MakeBmsNoteChannel(NoteTypes::kInvisibleNote, lane);
+  case 0x5: case 0x6:   // longnote
+    return MakeBmsNoteChannel(NoteTypes::kNormalNote, lane, true);
+  case 0xD: case 0xE:   // mine
+    return MakeBmsNoteChannel(NoteTypes::kMineNote, lane);
+  }
+  return MakeBmsChannel(BmsChannelTypes::kNone);
 }
 
-#if 0
-/* @depreciated */
-uint8_t GetNotePlayerFromBmsChannel(unsigned int bms_channel)
+constexpr BmsChannelTable MakeBmsChannelTable()
 {
-  if (bms_channel >= radix_16_2_36(0x21) && bms_channel <= radix_16_2_36(0x29) ||
-      bms_channel >= radix_16_2_36(0x41) && bms_channel <= radix_16_2_36(0x49) ||
-      bms_channel >= radix_16_2_36(0x61) && bms_channel <= radix_16_2_36(0x69) ||
-      bms_channel >= radix_16_2_36(0xE1) && bms_channel <= radix_16_2_36(0xE9))
-    return 1;   // 2P
-  return 0;     // 1P
+  BmsChannelTable t{};
+  for (unsigned i = 0; i < kBmsChannelCount; ++i)
+    t.ch[i] = GetBmsChannelInfo(i);
+  return t;
 }
-#endif
 
-/* SC is 8th ch */
-/* in DP: SC is 15, 16th ch */
-/* XXX: pedal is 9th ch, but when it would be in progress? */
-uint8_t GetNoteColFromBmsChannel(unsigned int bms_channel)
+constexpr BmsChannelTable kBmsChannelTable = MakeBmsChannelTable();
+
+ChartLoaderBMS::ChartLoaderBMS(Song *song)
+  : ChartLoader(song), channel_table_(kBmsChannelTable.ch), chart_context_(0),
+    process_conditional_statement_(true),
+    variant_longnote_type_(0), variant_longnote_object_(0)
 {
-  if (bms_channel < radix_16_2_36(0x10)) return 0;  // special channel
-  unsigned int channel_mod_16 = bms_channel % 36;
-  if (channel_mod_16 >= 16) return 0;
-  unsigned int channel_remap[16] = 
-  {0, 1, 2, 3, 4, 5, 8, 9, 6, 7, 0, 0, 0, 0, 0, 0};
-  return static_cast<uint8_t>(channel_remap[channel_mod_16] - 1);
+
 }
 
 bool ChartLoaderBMS::ParseMeasureLength()
@@ -523,7 +948,7 @@ bool ChartLoaderBMS::ParseMeasureLength()
 
 bool ChartLoaderBMS::ParseNote()
 {
-  const unsigned int channel = current_line_->bms_channel;
+  const BmsChannelInfo &desc = channel_table_[current_line_->bms_channel];
   unsigned int len = current_line_->value_len;
 
   // cannot parse between control flow stmt
@@ -531,13 +956,13 @@ bool ChartLoaderBMS::ParseNote()
 
   // check for measure length
   // - if measure changed, 
-  if (channel == 2)
+  if (desc.type == BmsChannelTypes::kMeasureLength)
     return ParseMeasureLength();
 
   // warn for incorrect length
   if (len % 2 == 1)
   {
-    std::cerr << "Warning: incorrect measure length detected. (" << current_line_->command << ")" << std::endl;
+    Report(DiagnosticCodes::kBmsOddObjectLength, current_line_->line);
     len--;
   }
   if (len == 0) return false;
@@ -546,67 +971,74 @@ bool ChartLoaderBMS::ParseNote()
   curr_note_syntax_.measure = current_line_->measure;
   curr_note_syntax_.channel = current_line_->bms_channel;
   curr_note_syntax_.deno = current_line_->value_len;
+  curr_note_syntax_.desc = &desc;
+  curr_note_syntax_.longnote_type = chart_context_->GetMetaData().bms_longnote_type;
+  curr_note_syntax_.longnote_object = (unsigned)chart_context_->GetMetaData().bms_longnote_object;
 
-  for (unsigned int i = 0; i < len; i += 2)
-  {
-    curr_note_syntax_.num = i;
-    curr_note_syntax_.value = current_line_->value + i;
-    curr_note_syntax_.value_u = atoi_bms_channel(curr_note_syntax_.value);
+  const unsigned token_count = len / 2;
+  token_values_.resize(token_count);
+  token_mask_.resize((token_count + 63) / 64);
+  DecodeBase36Tokens(current_line_->value, token_count,
+                     token_values_.data(), token_mask_.data());
 
-    switch (GetNoteTypeFromBmsChannel(current_line_->bms_channel))
+  if (desc.type == BmsChannelTypes::kNote && curr_note_syntax_.longnote_type == 2)
+  {
+    // LNTYPE 2 closes longnote with 00 object, so visit all objects.
+    for (unsigned int i = 0; i < token_count; ++i)
+      ParseNoteToken(i);
+  }
+  else
+  {
+    // most of objects are 00 filler, so visit nonzero objects only.
+    for (unsigned int w = 0; w < token_mask_.size(); ++w)
     {
-    case BmsChannelTypes::kBgm:
-      ParseBgmNote();
-      break;
-    case BmsChannelTypes::kBga:
-      ParseBgaNote();
-      break;
-    case BmsChannelTypes::kNote:
-      ParseSoundNote();
-      break;
-    case BmsChannelTypes::kTiming:
-      ParseTimingNote();
-      break;
-    case BmsChannelTypes::kEffect:
-      ParseEffectNote();
-      break;
+      for (uint64_t m = token_mask_[w]; m; m &= m - 1)
+        ParseNoteToken(w * 64 + CountTrailingZero(m));
     }
   }
 
-  switch (GetNoteTypeFromBmsChannel(current_line_->bms_channel))
-  {
-  case BmsChannelTypes::kBgm:
-    // if bgm channel, then add track idx.
+  // if bgm channel, then add track idx.
+  if (desc.type == BmsChannelTypes::kBgm)
     bgm_column_idx_per_measure_[current_line_->measure]++;
-    break;
-  }
 
   return true;
 }
 
-bool ChartLoaderBMS::ParseBgaNote()
+void ChartLoaderBMS::ParseNoteToken(unsigned token_idx)
 {
-  if (curr_note_syntax_.value_u == 0) return true;
-  unsigned track_idx = 0;
-  NoteElement ne;
-  ne.SetRowPos(curr_note_syntax_.measure, RowPos{ curr_note_syntax_.num, curr_note_syntax_.deno });
-  ne.set_value((int)curr_note_syntax_.value_u);
-  switch (curr_note_syntax_.channel)
+  curr_note_syntax_.num = token_idx * 2;
+  curr_note_syntax_.value = current_line_->value + token_idx * 2;
+  curr_note_syntax_.value_u = token_values_[token_idx];
+
+  switch (curr_note_syntax_.desc->type)
   {
-  default:  // XXX: exception when undefined?
-  case 4:   // BGA
-    track_idx = CommandTrackTypes::kBgaMain;
+  case BmsChannelTypes::kBgm:
+    ParseBgmNote();
     break;
-  case 6:   // BGA poor
-    track_idx = CommandTrackTypes::kBgaMiss;
+  case BmsChannelTypes::kBga:
+    ParseBgaNote();
     break;
-  case 7:   // BGA layered
-    track_idx = CommandTrackTypes::kBgaLayer1;
+  case BmsChannelTypes::kNote:
+    ParseSoundNote();
     break;
-  case 10:  // BGA layered 2
-    track_idx = CommandTrackTypes::kBgaLayer2;
+  case BmsChannelTypes::kTiming:
+    ParseTimingNote();
+    break;
+  case BmsChannelTypes::kEffect:
+    ParseEffectNote();
+    break;
+  default:
     break;
   }
+}
+
+bool ChartLoaderBMS::ParseBgaNote()
+{
+  if (curr_note_syntax_.value_u == 0) return true;
+  const unsigned track_idx = curr_note_syntax_.desc->track;
+  NoteElement ne;
+  ne.SetRowPos(curr_note_syntax_.measure, RowPos{ curr_note_syntax_.num, curr_note_syntax_.deno });
+  ne.set_value((int)curr_note_syntax_.value_u);
 
   chart_context_->GetCommandData()[track_idx].AddNoteElement(ne);
 
@@ -631,33 +1063,17 @@ bool ChartLoaderBMS::ParseEffectNote()
 {
   if (curr_note_syntax_.value_u == 0) return true;
   NoteElement ne;
-  unsigned channel = curr_note_syntax_.channel;
-  unsigned track = 0;
-  const int bmsargb_per_bms_channel[] = { 11, 12, 13, 14 };
+  const BmsChannelInfo &desc = *curr_note_syntax_.desc;
+  const unsigned track = desc.track;
 
   ne.SetRowPos(curr_note_syntax_.measure, RowPos{ curr_note_syntax_.num, curr_note_syntax_.deno });
 
-  switch (channel)
-  {
-  case 11:  // BGA opacity
-  case 12:  // BGA opacity layer
-  case 13:  // BGA opacity layer 2
-  case 14:  // BGA opacity poor
-    track = CommandTrackTypes::kBmsARGBLAYER;
-    break;
-  }
-
   switch (track)
   {
   case CommandTrackTypes::kBmsARGBLAYER:
-    {
-      int bgatypes;
-      for (bgatypes = 0; bgatypes < 4; bgatypes++)
-        if (bmsargb_per_bms_channel[bgatypes] == channel) break;
-      ASSERT(bgatypes < 4);
-      ne.set_point(bgatypes);
-      ne.set_value(curr_note_syntax_.value_u);
-    }
+    // layer index: opacity, opacity layer, opacity layer 2, opacity poor
+    ne.set_point(desc.subtype);
+    ne.set_value(curr_note_syntax_.value_u);
     break;
   default:
     ASSERT(0);
@@ -668,47 +1084,17 @@ bool ChartLoaderBMS::ParseEffectNote()
   return true;
 }
 
-inline int GetNoteSubTypeFromBmsChannel(unsigned int bms_channel, bool &is_longnote)
-{
-  // 1P/2P visible note
-  if (bms_channel >= radix_16_2_36(0x11) && bms_channel <= radix_16_2_36(0x19) ||
-    bms_channel >= radix_16_2_36(0x21) && bms_channel <= radix_16_2_36(0x29))
-    return NoteTypes::kNormalNote;
-  // 1P/2P invisible note
-  else if (bms_channel >= radix_16_2_36(0x31) && bms_channel <= radix_16_2_36(0x39) ||
-    bms_channel >= radix_16_2_36(0x41) && bms_channel <= radix_16_2_36(0x49))
-    return NoteTypes::kInvisibleNote;
-  // Longnote
-  else if (bms_channel >= radix_16_2_36(0x51) && bms_channel <= radix_16_2_36(0x59) ||
-    bms_channel >= radix_16_2_36(0x61) && bms_channel <= radix_16_2_36(0x69))
-  {
-    is_longnote = true;
-    return NoteTypes::kNormalNote;
-  }
-  // Mine
-  else if (bms_channel >= radix_16_2_36(0xD1) && bms_channel <= radix_16_2_36(0xD9) ||
-    bms_channel >= radix_16_2_36(0xE1) && bms_channel <= radix_16_2_36(0xE9))
-    return NoteTypes::kMineNote;
-
-  // Should not reach here. (strictly)
-  //ASSERT(0);
-  // or, regard as general note.
-  return NoteTypes::kNormalNote;
-}
-
 bool ChartLoaderBMS::ParseSoundNote()
 {
-  const unsigned measure = curr_note_syntax_.measure;
-  const unsigned channel = curr_note_syntax_.channel;
-  const char* val = curr_note_syntax_.value;
   const unsigned valu = curr_note_syntax_.value_u;
-  const int longnotetype = chart_context_->GetMetaData().bms_longnote_type;
-  const unsigned lnobj = (unsigned)chart_context_->GetMetaData().bms_longnote_object;
-  bool is_longnote = false;
-  const unsigned subtype = GetNoteSubTypeFromBmsChannel(channel, is_longnote);
-  unsigned curlane = 0;
+  const int longnotetype = curr_note_syntax_.longnote_type;
+  const unsigned lnobj = curr_note_syntax_.longnote_object;
+  const bool is_longnote = curr_note_syntax_.desc->longnote;
+  const unsigned curlane = curr_note_syntax_.desc->lane;
   NoteElement ne;
-  curlane = GetNoteColFromBmsChannel(channel);
+  // ignore lane not available in this chart (e.g. pedal of 7key chart)
+  if (curlane >= chart_context_->GetNoteData().get_track_count())
+    return true;
   auto &track = chart_context_->GetNoteData()[curlane];
 
   if (valu == 0)
@@ -723,8 +1109,22 @@ bool ChartLoaderBMS::ParseSoundNote()
   ne.SetRowPos(curr_note_syntax_.measure, RowPos{ curr_note_syntax_.num, curr_note_syntax_.deno });
   ne.set_value(valu);
 
+  /** LNOBJ check: object ends longnote started by previous note of the lane. */
+  if (!is_longnote && valu == lnobj)
+  {
+    const size_t idx = track.lower_bound_index(ne.measure());
+    NoteElement *prev = idx > 0 ? track.get(idx - 1) : nullptr;
+    if (prev && prev->chain_status() == NoteChainStatus::Tap)
+    {
+      prev->set_chain_status(NoteChainStatus::Start);
+      ne.set_chain_status(NoteChainStatus::End);
+      track.AddNoteElement(ne);
+    }
+    return true;
+  }
+
   /** Longnote check */
-  if (is_longnote || (valu == lnobj) /* LNOBJ check */ )
+  if (is_longnote)
   {
     /** LNTYPE 2 (obsolete) */
     if (longnotetype == 2)
@@ -774,28 +1174,15 @@ bool ChartLoaderBMS::ParseTimingNote()
   if (curr_note_syntax_.value_u == 0) return true;
 
   NoteElement ne;
-  unsigned channel = curr_note_syntax_.channel;
-  unsigned track = 0;
+  const BmsChannelInfo &desc = *curr_note_syntax_.desc;
+  const unsigned track = desc.track;
   ne.SetRowPos(curr_note_syntax_.measure, RowPos{ curr_note_syntax_.num, curr_note_syntax_.deno });
 
-  switch (channel)
-  {
-  case 3:   // BPM change
-    track = TimingTrackTypes::kBpm;
-    /** 16 radix here */
+  /** BPM change channel is in 16 radix */
+  if (desc.radix == 16)
     ne.set_value((float)atoi_16(curr_note_syntax_.value, 2));
-    break;
-  case 8:   // BPM (exbpm)
-    track = TimingTrackTypes::kBmsBpm;
-    ne.set_value(curr_note_syntax_.value_u);
-    break;
-  case 9:   // STOP
-    track = TimingTrackTypes::kBmsStop;
+  else
     ne.set_value(curr_note_syntax_.value_u);
-    break;
-  default:
-    ASSERT(0);
-  }
 
   chart_context_->GetTimingData()[track].AddNoteElement(ne);
   return true;
@@ -804,34 +1191,30 @@ bool ChartLoaderBMS::ParseTimingNote()
 void ChartLoaderBMS::FlushParsingBuffer()
 {
   char terminator_type;
-  for (auto &ii : parsing_buffer_)
+  for (auto *ii : parsing_buffer_)
   {
     current_line_ = ii;
     terminator_type = current_line_->terminator_type;
 
-    if (terminator_type == ':')
+    // object (#mmmcc:) line is only line not targeting metadata.
+    if (current_line_->target != kLineTargetMeta)
     {
-      current_line_->measure = atoi_bms_measure(current_line_->command, 3);
-      current_line_->bms_channel = atoi_bms_channel(current_line_->command + 3, 2);
       if (!ParseNote())
-        std::cerr << "BMSParser: note parsing failed " << std::string(current_line_->stmt, current_line_->stmt_len) << std::endl;
+        Report(DiagnosticCodes::kBmsNoteParseFailed, current_line_->line);
     }
-    else if (terminator_type == ' ')
+    else if (terminator_type == ' ' || terminator_type == ':')
     {
       if (!ParseMetaData())
-        std::cerr << "BMSParser: meta parsing failed " << std::string(current_line_->stmt, current_line_->stmt_len) << std::endl;
+        Report(DiagnosticCodes::kBmsMetaParseFailed, current_line_->line);
     }
     else
     {
-      std::cerr << "BMSParser: unknown terminator " << std::string(current_line_->stmt, current_line_->stmt_len) << std::endl;
+      Report(DiagnosticCodes::kBmsUnknownTerminator, current_line_->line);
     }
   }
 
-  for (auto &ii : parsing_buffer_)
-    delete ii;
   parsing_buffer_.clear();
-
-  cond_.clear();
+  current_line_ = 0;
 }
 
 } /* rparser */
@@ -0,0 +1,854 @@
+/* supports bmson format. */
+
+#include "ChartLoader.h"
+#include "Chart.h"
+#include "rutil.h"
+#include "common.h"
+#include <algorithm>
+
+using namespace rutil;
+
+namespace rparser {
+
+// --------------------------------------------------------------- JsonReader
+
+using Token = ChartLoaderBMSON::JsonReader::Token;
+
+static inline bool is_json_space(char c)
+{
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static inline int hex_value(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static inline void append_utf8(std::string& s, uint32_t cp)
+{
+  if (cp < 0x80)
+    s.push_back(static_cast<char>(cp));
+  else if (cp < 0x800)
+  {
+    s.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    s.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+  else if (cp < 0x10000)
+  {
+    s.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    s.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    s.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+  else
+  {
+    s.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    s.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    s.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    s.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+ChartLoaderBMSON::JsonReader::JsonReader()
+  : p_(nullptr), start_(nullptr), end_(nullptr), str_(nullptr), str_len_(0), number_(0) {}
+
+void ChartLoaderBMSON::JsonReader::SetSource(const char* p, size_t len)
+{
+  p_ = start_ = p;
+  end_ = p + len;
+  str_ = nullptr;
+  str_len_ = 0;
+  number_ = 0;
+  // skip UTF-8 BOM
+  if (len >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+    p_ += 3;
+}
+
+Token ChartLoaderBMSON::JsonReader::Next()
+{
+  // separators are not validated strictly; ',' is treated as whitespace.
+  while (p_ < end_ && (is_json_space(*p_) || *p_ == ','))
+    ++p_;
+  if (p_ >= end_) return Token::kEnd;
+
+  switch (*p_)
+  {
+  case '{':
+    ++p_;
+    return Token::kObjectBegin;
+  case '}':
+    ++p_;
+    return Token::kObjectEnd;
+  case '[':
+    ++p_;
+    return Token::kArrayBegin;
+  case ']':
+    ++p_;
+    return Token::kArrayEnd;
+  case '"':
+    if (!ReadString()) return Token::kError;
+    while (p_ < end_ && is_json_space(*p_))
+      ++p_;
+    if (p_ < end_ && *p_ == ':')
+    {
+      ++p_;
+      return Token::kKey;
+    }
+    return Token::kString;
+  case 't':
+    return ReadLiteral("true", 4) ? Token::kTrue : Token::kError;
+  case 'f':
+    return ReadLiteral("false", 5) ? Token::kFalse : Token::kError;
+  case 'n':
+    return ReadLiteral("null", 4) ? Token::kNull : Token::kError;
+  default:
+    if (*p_ == '-' || (*p_ >= '0' && *p_ <= '9'))
+      return ReadNumber() ? Token::kNumber : Token::kError;
+  }
+  return Token::kError;
+}
+
+bool ChartLoaderBMSON::JsonReader::ReadLiteral(const char* lit, size_t len)
+{
+  if ((size_t)(end_ - p_) < len || memcmp(p_, lit, len) != 0)
+    return false;
+  p_ += len;
+  return true;
+}
+
+bool ChartLoaderBMSON::JsonReader::ReadString()
+{
+  const char *p = ++p_;
+
+  // fast path: string without escape is referred from source directly.
+  while (p < end_ && *p != '"' && *p != '\\')
+    ++p;
+  if (p >= end_) return false;
+  if (*p == '"')
+  {
+    str_ = p_;
+    str_len_ = p - p_;
+    p_ = p + 1;
+    return true;
+  }
+
+  buf_.assign(p_, p);
+  while (p < end_ && *p != '"')
+  {
+    if (*p != '\\')
+    {
+      buf_.push_back(*p++);
+      continue;
+    }
+    if (++p >= end_) return false;
+    switch (*p++)
+    {
+    case '"': buf_.push_back('"'); break;
+    case '\\': buf_.push_back('\\'); break;
+    case '/': buf_.push_back('/'); break;
+    case 'b': buf_.push_back('\b'); break;
+    case 'f': buf_.push_back('\f'); break;
+    case 'n': buf_.push_back('\n'); break;
+    case 'r': buf_.push_back('\r'); break;
+    case 't': buf_.push_back('\t'); break;
+    case 'u':
+    {
+      uint32_t cp = 0;
+      for (int i = 0; i < 4; ++i)
+      {
+        int h = (p < end_) ? hex_value(*p++) : -1;
+        if (h < 0) return false;
+        cp = (cp << 4) | h;
+      }
+      // combine surrogate pair
+      if (cp >= 0xD800 && cp < 0xDC00 && end_ - p >= 6 && p[0] == '\\' && p[1] == 'u')
+      {
+        uint32_t lo = 0;
+        int i;
+        for (i = 0; i < 4; ++i)
+        {
+          int h = hex_value(p[2 + i]);
+          if (h < 0) break;
+          lo = (lo << 4) | h;
+        }
+        if (i == 4 && lo >= 0xDC00 && lo < 0xE000)
+        {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          p += 6;
+        }
+      }
+      append_utf8(buf_, cp);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  if (p >= end_) return false;
+  str_ = buf_.c_str();
+  str_len_ = buf_.size();
+  p_ = p + 1;
+  return true;
+}
+
+bool ChartLoaderBMSON::JsonReader::ReadNumber()
+{
+  // parse manually, as source buffer is not null-terminated.
+  static const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+  };
+  const char *p = p_;
+  bool neg = false;
+  uint64_t ipart = 0;
+  int digits = 0;
+  double v;
+
+  if (*p == '-') { neg = true; ++p; }
+  while (p < end_ && *p >= '0' && *p <= '9')
+  {
+    if (digits < 19) ipart = ipart * 10 + (*p - '0');
+    ++digits;
+    ++p;
+  }
+  if (digits == 0) return false;
+  v = static_cast<double>(ipart);
+  if (digits > 19) v *= pow(10.0, digits - 19);
+
+  if (p < end_ && *p == '.')
+  {
+    uint64_t fpart = 0;
+    int fdigits = 0;
+    ++p;
+    while (p < end_ && *p >= '0' && *p <= '9')
+    {
+      if (fdigits < 18)
+      {
+        fpart = fpart * 10 + (*p - '0');
+        ++fdigits;
+      }
+      ++p;
+    }
+    v += fpart / kPow10[fdigits];
+  }
+
+  if (p < end_ && (*p == 'e' || *p == 'E'))
+  {
+    bool eneg = false;
+    int e = 0;
+    ++p;
+    if (p < end_ && (*p == '+' || *p == '-')) eneg = (*p++ == '-');
+    if (p >= end_ || *p < '0' || *p > '9') return false;
+    while (p < end_ && *p >= '0' && *p <= '9')
+    {
+      if (e < 1000) e = e * 10 + (*p - '0');
+      ++p;
+    }
+    v *= pow(10.0, eneg ? -e : e);
+  }
+
+  number_ = neg ? -v : v;
+  p_ = p;
+  return true;
+}
+
+bool ChartLoaderBMSON::JsonReader::SkipValue(Token t)
+{
+  int depth = 0;
+  do
+  {
+    switch (t)
+    {
+    case Token::kObjectBegin:
+    case Token::kArrayBegin:
+      ++depth;
+      break;
+    case Token::kObjectEnd:
+    case Token::kArrayEnd:
+      --depth;
+      break;
+    case Token::kEnd:
+    case Token::kError:
+      return false;
+    default:
+      break;
+    }
+    if (depth <= 0) break;
+    t = Next();
+  } while (true);
+  return depth == 0;
+}
+
+const char* ChartLoaderBMSON::JsonReader::str() const { return str_; }
+size_t ChartLoaderBMSON::JsonReader::str_len() const { return str_len_; }
+double ChartLoaderBMSON::JsonReader::number() const { return number_; }
+size_t ChartLoaderBMSON::JsonReader::GetOffset() const { return p_ - start_; }
+
+bool ChartLoaderBMSON::JsonReader::IsKey(const char* key) const
+{
+  return strlen(key) == str_len_ && memcmp(key, str_, str_len_) == 0;
+}
+
+
+// --------------------------------------------------------- ChartLoaderBMSON
+
+static bool TestBmsonName(const std::string& fn)
+{
+  return endsWith(lower(fn), ".bmson");
+}
+
+ChartLoaderBMSON::ChartLoaderBMSON(Song *song)
+  : ChartLoader(song), chart_(nullptr), resolution_(240), init_bpm_(120)
+{
+}
+
+bool ChartLoaderBMSON::Test(const void* p, unsigned iLen)
+{
+  JsonReader reader;
+  reader.SetSource(static_cast<const char*>(p), iLen);
+  return reader.Next() == Token::kObjectBegin;
+}
+
+bool ChartLoaderBMSON::LoadFromDirectory()
+{
+  if (!song_->GetDirectory())
+    return false;
+  auto &dir = *song_->GetDirectory();
+
+  if (dir.count() <= 0)
+    return false;
+
+  for (const auto *f : dir)
+  {
+    const std::string filename = f->filename;
+    if (!TestBmsonName(filename)) continue;
+    if (!dir.Read(f->filename)) continue;
+
+    Chart *c = song_->NewChart();
+    if (!c) return false;
+
+    if (diag_) diag_->SetFile(filename);
+    bool r = Load(*c, f->p, f->len);
+    c->SetFilename(filename);
+
+    if (!r)
+    {
+      Report(DiagnosticCodes::kChartLoadFailed);
+      song_->DeleteChart(song_->GetChartCount() - 1);
+    }
+  }
+
+  return true;
+}
+
+bool ChartLoaderBMSON::Load(Chart &c, const void* p, unsigned iLen)
+{
+  Preload(c, p, iLen);
+  chart_ = &c;
+  resolution_ = 240;
+  init_bpm_ = 120;
+  bpm_events_.clear();
+  stop_events_.clear();
+  lines_.clear();
+  reader_.SetSource(static_cast<const char*>(p), iLen);
+
+  if (reader_.Next() != Token::kObjectBegin)
+  {
+    Report(DiagnosticCodes::kBmsonInvalidJson);
+    return false;
+  }
+
+  Token t = Token::kNone;
+  bool r = true;
+  while (r && (t = reader_.Next()) == Token::kKey)
+  {
+    if (reader_.IsKey("info"))
+      r = ParseInfo();
+    else if (reader_.IsKey("lines"))
+      r = ParseLines();
+    else if (reader_.IsKey("bpm_events"))
+      r = ParseEvents(bpm_events_, "bpm");
+    else if (reader_.IsKey("stop_events"))
+      r = ParseEvents(stop_events_, "duration");
+    else if (reader_.IsKey("sound_channels"))
+      r = ParseSoundChannels();
+    else if (reader_.IsKey("bga"))
+      r = ParseBga();
+    else
+      r = reader_.SkipValue(reader_.Next());
+  }
+
+  if (!r || t != Token::kObjectEnd)
+  {
+    Report(DiagnosticCodes::kBmsonInvalidJson);
+    return false;
+  }
+
+  Finalize();
+  return true;
+}
+
+bool ChartLoaderBMSON::ReadNumber(double& out)
+{
+  Token t = reader_.Next();
+  if (t == Token::kNumber)
+  {
+    out = reader_.number();
+    return true;
+  }
+  return reader_.SkipValue(t);
+}
+
+bool ChartLoaderBMSON::ReadString(std::string& out)
+{
+  Token t = reader_.Next();
+  if (t == Token::kString)
+  {
+    out.assign(reader_.str(), reader_.str_len());
+    return true;
+  }
+  return reader_.SkipValue(t);
+}
+
+void ChartLoaderBMSON::SetPulse(NoteElement& ne, uint32_t y) const
+{
+  const uint32_t bar = resolution_ * 4;
+  if (lines_.empty() || y < lines_.front())
+  {
+    ne.SetRowPos(y / bar, RowPos{ y % bar, bar });
+    return;
+  }
+  size_t i = std::upper_bound(lines_.begin(), lines_.end(), y) - lines_.begin() - 1;
+  if (i + 1 < lines_.size())
+  {
+    ne.SetRowPos(static_cast<uint32_t>(i),
+      RowPos{ y - lines_[i], lines_[i + 1] - lines_[i] });
+  }
+  else
+  {
+    // bars after last line have default length.
+    const uint32_t d = y - lines_.back();
+    ne.SetRowPos(static_cast<uint32_t>(i + d / bar), RowPos{ d % bar, bar });
+  }
+}
+
+bool ChartLoaderBMSON::ParseInfo()
+{
+  Token t = reader_.Next();
+  if (t != Token::kObjectBegin)
+    return reader_.SkipValue(t);
+
+  auto &md = chart_->GetMetaData();
+  std::string s;
+  double v;
+  while ((t = reader_.Next()) == Token::kKey)
+  {
+#define INFO_STR(key, attr) \
+    else if (reader_.IsKey(key)) { \
+      if (!ReadString(s)) return false; \
+      md.SetAttribute(attr, s); \
+    }
+#define INFO_NUM(key, attr) \
+    else if (reader_.IsKey(key)) { \
+      if (!ReadNumber(v)) return false; \
+      md.SetAttribute(attr, v); \
+    }
+
+    if (reader_.IsKey("subartists"))
+    {
+      // joined into single string, as metadata has single subartist.
+      std::string subartist;
+      t = reader_.Next();
+      if (t != Token::kArrayBegin)
+      {
+        if (!reader_.SkipValue(t)) return false;
+        continue;
+      }
+      while ((t = reader_.Next()) == Token::kString)
+      {
+        if (!subartist.empty()) subartist += " / ";
+        subartist.append(reader_.str(), reader_.str_len());
+      }
+      if (t != Token::kArrayEnd) return false;
+      md.SetAttribute("SUBARTIST", subartist);
+    }
+    else if (reader_.IsKey("resolution"))
+    {
+      if (!ReadNumber(v)) return false;
+      if (v >= 1) resolution_ = static_cast<unsigned>(v);
+    }
+    else if (reader_.IsKey("init_bpm"))
+    {
+      if (!ReadNumber(v)) return false;
+      if (v > 0) init_bpm_ = v;
+      md.SetAttribute("BPM", v);
+    }
+    INFO_STR("title", "TITLE")
+    INFO_STR("subtitle", "SUBTITLE")
+    INFO_STR("artist", "ARTIST")
+    INFO_STR("genre", "GENRE")
+    INFO_STR("chart_name", "CHARTTYPE")
+    INFO_STR("mode_hint", "MODEHINT")
+    INFO_STR("back_image", "BACKIMAGE")
+    INFO_STR("eyecatch_image", "STAGEIMAGE")
+    INFO_STR("banner_image", "BANNERIMAGE")
+    INFO_STR("preview_music", "PREVIEW")
+    INFO_NUM("level", "PLAYLEVEL")
+    INFO_NUM("judge_rank", "JUDGERANK")
+    INFO_NUM("total", "TOTAL")
+    else if (!reader_.SkipValue(reader_.Next()))
+      return false;
+
+#undef INFO_STR
+#undef INFO_NUM
+  }
+  return t == Token::kObjectEnd;
+}
+
+bool ChartLoaderBMSON::ParseLines()
+{
+  Token t = reader_.Next();
+  if (t != Token::kArrayBegin)
+    return reader_.SkipValue(t);
+
+  if (!lines_.empty())
+  {
+    Report(DiagnosticCodes::kBmsonDuplicatedLines);
+    return reader_.SkipValue(t);
+  }
+
+  double y;
+  while ((t = reader_.Next()) == Token::kObjectBegin)
+  {
+    y = -1;
+    while ((t = reader_.Next()) == Token::kKey)
+    {
+      if (reader_.IsKey("y"))
+      {
+        if (!ReadNumber(y)) return false;
+      }
+      else if (!reader_.SkipValue(reader_.Next()))
+        return false;
+    }
+    if (t != Token::kObjectEnd) return false;
+    if (y >= 0) lines_.push_back(static_cast<uint32_t>(y));
+  }
+  if (t != Token::kArrayEnd) return false;
+
+  std::sort(lines_.begin(), lines_.end());
+  lines_.erase(std::unique(lines_.begin(), lines_.end()), lines_.end());
+  if (!lines_.empty() && lines_.front() != 0)
+    lines_.insert(lines_.begin(), 0);
+  return true;
+}
+
+bool ChartLoaderBMSON::ParseEvents(std::vector<BmsonEvent>& events, const char* value_key)
+{
+  Token t = reader_.Next();
+  if (t != Token::kArrayBegin)
+    return reader_.SkipValue(t);
+
+  BmsonEvent e;
+  double v;
+  while ((t = reader_.Next()) == Token::kObjectBegin)
+  {
+    e.y = 0;
+    e.value = 0;
+    while ((t = reader_.Next()) == Token::kKey)
+    {
+      if (reader_.IsKey("y"))
+      {
+        if (!ReadNumber(v)) return false;
+        e.y = v > 0 ? static_cast<uint32_t>(v) : 0;
+      }
+      else if (reader_.IsKey(value_key))
+      {
+        if (!ReadNumber(e.value)) return false;
+      }
+      else if (!reader_.SkipValue(reader_.Next()))
+        return false;
+    }
+    if (t != Token::kObjectEnd) return false;
+    events.push_back(e);
+  }
+  return t == Token::kArrayEnd;
+}
+
+bool ChartLoaderBMSON::ParseSoundChannels()
+{
+  Token t = reader_.Next();
+  if (t != Token::kArrayBegin)
+    return reader_.SkipValue(t);
+
+  auto *sound_channel = chart_->GetMetaData().GetSoundChannel();
+  unsigned channel = 0;
+  std::string name;
+  while ((t = reader_.Next()) == Token::kObjectBegin)
+  {
+    // channel index starts from 1, as 0 is reserved for empty sound.
+    channel++;
+    while ((t = reader_.Next()) == Token::kKey)
+    {
+      if (reader_.IsKey("name"))
+      {
+        if (!ReadString(name)) return false;
+        sound_channel->Set(channel, name);
+      }
+      else if (reader_.IsKey("notes"))
+      {
+        if (!ParseSoundNotes(channel)) return false;
+      }
+      else if (!reader_.SkipValue(reader_.Next()))
+        return false;
+    }
+    if (t != Token::kObjectEnd) return false;
+  }
+  return t == Token::kArrayEnd;
+}
+
+bool ChartLoaderBMSON::ParseSoundNotes(unsigned channel)
+{
+  Token t = reader_.Next();
+  if (t != Token::kArrayBegin)
+    return reader_.SkipValue(t);
+
+  auto &nd = chart_->GetNoteData();
+  auto &bgm = chart_->GetBgmData();
+  // channels are separated into bgm columns as they may overlap.
+  auto &bgm_track = bgm[(channel - 1) % bgm.get_track_count()];
+  NoteElement ne;
+  double x, y, l;
+  ne.set_value(channel);
+
+  while ((t = reader_.Next()) == Token::kObjectBegin)
+  {
+    x = y = l = 0;
+    while ((t = reader_.Next()) == Token::kKey)
+    {
+      // TODO: 'c' (continue sound) flag is not supported yet.
+      if (reader_.IsKey("x"))
+      {
+        if (!ReadNumber(x)) return false;
+      }
+      else if (reader_.IsKey("y"))
+      {
+        if (!ReadNumber(y)) return false;
+      }
+      else if (reader_.IsKey("l"))
+      {
+        if (!ReadNumber(l)) return false;
+      }
+      else if (!reader_.SkipValue(reader_.Next()))
+        return false;
+    }
+    if (t != Token::kObjectEnd) return false;
+    if (y < 0) continue;
+
+    // raw pulse, converted in Finalize().
+    ne.set_measure(static_cast<uint32_t>(y));
+    if (x < 1)
+    {
+      ne.set_chain_status(NoteChainStatus::Tap);
+      bgm_track.AppendNoteElement(ne);
+      continue;
+    }
+
+    const size_t lane = static_cast<size_t>(x) - 1;
+    if (lane >= kMaxTrackSize)
+    {
+      Report(DiagnosticCodes::kBmsonLaneOutOfRange);
+      continue;
+    }
+    if (lane >= nd.get_track_count())
+      nd.set_track_count(lane + 1);
+
+    auto &track = nd[lane];
+    if (l > 0)
+    {
+      ne.set_chain_status(NoteChainStatus::Start);
+      track.AppendNoteElement(ne);
+      ne.set_measure(static_cast<uint32_t>(y + l));
+      ne.set_chain_status(NoteChainStatus::End);
+      track.AppendNoteElement(ne);
+    }
+    else
+    {
+      ne.set_chain_status(NoteChainStatus::Tap);
+      track.AppendNoteElement(ne);
+    }
+  }
+  return t == Token::kArrayEnd;
+}
+
+bool ChartLoaderBMSON::ParseBga()
+{
+  Token t = reader_.Next();
+  if (t != Token::kObjectBegin)
+    return reader_.SkipValue(t);
+
+  while ((t = reader_.Next()) == Token::kKey)
+  {
+    bool r;
+    if (reader_.IsKey("bga_header"))
+      r = ParseBgaHeader();
+    else if (reader_.IsKey("bga_events"))
+      r = ParseBgaEvents(CommandTrackTypes::kBgaMain);
+    else if (reader_.IsKey("layer_events"))
+      r = ParseBgaEvents(CommandTrackTypes::kBgaLayer1);
+    else if (reader_.IsKey("poor_events"))
+      r = ParseBgaEvents(CommandTrackTypes::kBgaMiss);
+    else
+      r = reader_.SkipValue(reader_.Next());
+    if (!r) return false;
+  }
+  return t == Token::kObjectEnd;
+}
+
+bool ChartLoaderBMSON::ParseBgaHeader()
+{
+  Token t = reader_.Next();
+  if (t != Token::kArrayBegin)
+    return reader_.SkipValue(t);
+
+  auto *bga_channel = chart_->GetMetaData().GetBGAChannel();
+  double id;
+  std::string name;
+  while ((t = reader_.Next()) == Token::kObjectBegin)
+  {
+    id = -1;
+    name.clear();
+    while ((t = reader_.Next()) == Token::kKey)
+    {
+      if (reader_.IsKey("id"))
+      {
+        if (!ReadNumber(id)) return false;
+      }
+      else if (reader_.IsKey("name"))
+      {
+        if (!ReadString(name)) return false;
+      }
+      else if (!reader_.SkipValue(reader_.Next()))
+        return false;
+    }
+    if (t != Token::kObjectEnd) return false;
+    if (id >= 0) bga_channel->Set(static_cast<Channel>(id), name);
+  }
+  return t == Token::kArrayEnd;
+}
+
+bool ChartLoaderBMSON::ParseBgaEvents(size_t track_idx)
+{
+  Token t = reader_.Next();
+  if (t != Token::kArrayBegin)
+    return reader_.SkipValue(t);
+
+  auto &track = chart_->GetCommandData()[track_idx];
+  NoteElement ne;
+  double y, id;
+  while ((t = reader_.Next()) == Token::kObjectBegin)
+  {
+    y = id = 0;
+    while ((t = reader_.Next()) == Token::kKey)
+    {
+      if (reader_.IsKey("y"))
+      {
+        if (!ReadNumber(y)) return false;
+      }
+      else if (reader_.IsKey("id"))
+      {
+        if (!ReadNumber(id)) return false;
+      }
+      else if (!reader_.SkipValue(reader_.Next()))
+        return false;
+    }
+    if (t != Token::kObjectEnd) return false;
+    if (y < 0) continue;
+    ne.set_measure(static_cast<uint32_t>(y));
+    ne.set_value(static_cast<int>(id));
+    track.AppendNoteElement(ne);
+  }
+  return t == Token::kArrayEnd;
+}
+
+void ChartLoaderBMSON::Finalize()
+{
+  auto &md = chart_->GetMetaData();
+  auto &td = chart_->GetTimingData();
+  TrackData* tracks[] = {
+    &chart_->GetNoteData(), &chart_->GetBgmData(), &chart_->GetCommandData()
+  };
+  const uint32_t bar = resolution_ * 4;
+  NoteElement ne;
+
+  md.SetMetaFromAttribute();
+
+  // resolution and lines are known now, so convert pulse into measure.
+  for (auto *trackdata : tracks)
+  {
+    for (size_t i = 0; i < trackdata->get_track_count(); ++i)
+    {
+      auto &track = (*trackdata)[i];
+      if (track.size() == 0) continue;
+      for (auto &n : track) SetPulse(n, static_cast<uint32_t>(n.measure()));
+      track.SortNoteElements();
+    }
+  }
+
+  // measure length
+  if (lines_.size() > 1)
+  {
+    auto &track = td[TimingTrackTypes::kMeasure];
+    double prev_len = 1.0;
+    for (size_t i = 0; i < lines_.size(); ++i)
+    {
+      double len = (i + 1 < lines_.size())
+        ? (double)(lines_[i + 1] - lines_[i]) / bar
+        : 1.0;
+      if (len == prev_len) continue;
+      ne.SetRowPos(static_cast<uint32_t>(i), RowPos{ 0, 1 });
+      ne.set_value(len);
+      track.AppendNoteElement(ne);
+      prev_len = len;
+    }
+  }
+
+  // bpm & stop
+  std::stable_sort(bpm_events_.begin(), bpm_events_.end(),
+    [](const BmsonEvent& a, const BmsonEvent& b) { return a.y < b.y; });
+  std::stable_sort(stop_events_.begin(), stop_events_.end(),
+    [](const BmsonEvent& a, const BmsonEvent& b) { return a.y < b.y; });
+  {
+    auto &track = td[TimingTrackTypes::kBpm];
+    for (auto &e : bpm_events_)
+    {
+      if (e.value <= 0) continue;
+      SetPulse(ne, e.y);
+      ne.set_value(e.value);
+      track.AppendNoteElement(ne);
+    }
+  }
+  {
+    // stop duration is in pulse; converted into msec with bpm at the position.
+    auto &track = td[TimingTrackTypes::kStop];
+    double bpm = init_bpm_;
+    size_t bi = 0;
+    for (auto &e : stop_events_)
+    {
+      while (bi < bpm_events_.size() && bpm_events_[bi].y <= e.y)
+      {
+        if (bpm_events_[bi].value > 0) bpm = bpm_events_[bi].value;
+        ++bi;
+      }
+      if (e.value <= 0) continue;
+      SetPulse(ne, e.y);
+      ne.set_value(e.value / resolution_ * 60000.0 / bpm);
+      track.AppendNoteElement(ne);
+    }
+  }
+  for (size_t i = 0; i < td.get_track_count(); ++i)
+    td[i].SortNoteElements();
+}
+
+}
@@ -0,0 +1,146 @@
+/* supports dtx (DTXMania) format. */
+
+#include "ChartLoader.h"
+#include "Chart.h"
+#include "rutil.h"
+#include "common.h"
+
+using namespace rutil;
+
+namespace rparser {
+
+/**
+ * DTX channel is written in hexadecimal-like form (e.g. 1A),
+ * but it is indexed as base-36 number like BMS channel
+ * as DTX tokenizer is shared with BMS.
+ */
+constexpr unsigned int dtx_channel(unsigned int hi, unsigned int lo)
+{
+  return hi * 36 + lo;
+}
+
+constexpr BmsChannelInfo GetDtxChannelInfo(unsigned int dtx_ch)
+{
+  const unsigned int hi = dtx_ch / 36;
+  const unsigned int lo = dtx_ch % 36;
+
+  switch (dtx_ch)
+  {
+  case dtx_channel(0, 1):   // BGM
+    return MakeBmsChannel(BmsChannelTypes::kBgm);
+  case dtx_channel(0, 2):   // measure length
+    return MakeBmsChannel(BmsChannelTypes::kMeasureLength);
+  case dtx_channel(0, 3):   // BPM change
+    return MakeBmsChannel(BmsChannelTypes::kTiming, TimingTrackTypes::kBpm, 0, 16);
+  case dtx_channel(0, 8):   // BPM (#BPMxx)
+    return MakeBmsChannel(BmsChannelTypes::kTiming, TimingTrackTypes::kBmsBpm);
+  case dtx_channel(0, 4):   // BGA layer 1
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaMain);
+  case dtx_channel(0, 7):   // BGA layer 2
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaLayer1);
+  case dtx_channel(5, 5):   // BGA layer 3
+    return MakeBmsChannel(BmsChannelTypes::kBga, CommandTrackTypes::kBgaLayer2);
+  }
+
+  // drum chips: HH, SD, BD, HT, LT, CY, FT, HHO, RD, LC, LP, LBD
+  // lane is in channel order: 11 -> 0, ..., 1C -> 11
+  if (hi == 1 && lo >= 1 && lo <= 12)
+    return MakeBmsNoteChannel(NoteTypes::kNormalNote, static_cast<uint8_t>(lo - 1));
+  // hidden drum chips (sound only)
+  if (hi == 3 && lo >= 1 && lo <= 12)
+    return MakeBmsNoteChannel(NoteTypes::kInvisibleNote, static_cast<uint8_t>(lo - 1));
+  // auto-play SE channels (61 ~ 92)
+  if ((hi >= 6 && hi <= 8 && lo <= 9 && dtx_ch != dtx_channel(6, 0)) ||
+      (hi == 9 && lo <= 2))
+    return MakeBmsChannel(BmsChannelTypes::kBgm);
+
+  // TODO: guitar (20 ~ 28) / bass (A0 ~ A8) chips
+  return MakeBmsChannel(BmsChannelTypes::kNone);
+}
+
+constexpr BmsChannelTable MakeDtxChannelTable()
+{
+  BmsChannelTable t{};
+  for (unsigned i = 0; i < kBmsChannelCount; ++i)
+    t.ch[i] = GetDtxChannelInfo(i);
+  return t;
+}
+
+constexpr BmsChannelTable kDtxChannelTable = MakeDtxChannelTable();
+
+ChartLoaderDTX::ChartLoaderDTX(Song *song)
+  : ChartLoaderBMS(song)
+{
+  channel_table_ = kDtxChannelTable.ch;
+}
+
+bool ChartLoaderDTX::LoadFromDirectory()
+{
+  if (!song_->GetDirectory())
+    return false;
+  auto &dir = *song_->GetDirectory();
+
+  if (dir.count() <= 0)
+    return false;
+
+  for (const auto *f : dir)
+  {
+    const std::string filename = f->filename;
+    std::string fn_lower = filename; lower(fn_lower);
+    if (!endsWith(fn_lower, ".dtx")) continue;
+    if (!dir.Read(f->filename)) continue;
+
+    Chart *c = song_->NewChart();
+    if (!c) return false;
+
+    if (diag_) diag_->SetFile(filename);
+    bool r = Load(*c, f->p, f->len);
+    c->SetFilename(filename);
+
+    if (!r)
+    {
+      Report(DiagnosticCodes::kChartLoadFailed);
+      song_->DeleteChart(song_->GetChartCount() - 1);
+    }
+  }
+
+  return true;
+}
+
+bool ChartLoaderDTX::Test(const void* p, unsigned iLen)
+{
+  // DTX has no file signature, so search for level header of any part.
+  const char *s = static_cast<const char*>(p);
+  const unsigned len = iLen < 4096 ? iLen : 4096;
+  for (unsigned i = 0; i + 7 < len; i++)
+  {
+    if (s[i] == '#' && (s[i + 1] == 'D' || s[i + 1] == 'G' || s[i + 1] == 'B') &&
+        strncmp(s + i + 2, "LEVEL", 5) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool ChartLoaderDTX::Load(Chart &c, const void* p, unsigned iLen)
+{
+  static const std::pair<const char*, const char*> kDtxMetaKeys[] = {
+    { "DLEVEL", "PLAYLEVEL" },
+    { "PREIMAGE", "STAGEIMAGE" },
+    { "BACKGROUND", "BACKIMAGE" },
+  };
+
+  Preload(c, p, iLen);
+  ProcessCommand(c, static_cast<const char*>(p), iLen);
+
+  MetaData &md = c.GetMetaData();
+  for (const auto &key : kDtxMetaKeys)
+  {
+    if (md.IsAttributeExist(key.first) && !md.IsAttributeExist(key.second))
+      md.SetAttribute(key.second, md.GetAttribute<std::string>(key.first));
+  }
+  md.SetMetaFromAttribute();
+
+  return true;
+}
+
+} /* rparser */
@@ -0,0 +1,264 @@
+/*
+ * O2Jam chart (.ojn) loader.
+ * OJN contains three difficulties with 300 byte header,
+ * and note data is stored in packages of (measure, channel, events).
+ * Samples are stored in separated .ojm container (see DirectoryOJM).
+ */
+
+#include "ChartLoader.h"
+#include "Chart.h"
+#include "common.h"
+
+using namespace rutil;
+
+namespace rparser {
+
+namespace {
+
+constexpr unsigned kOjnHeaderSize = 300;
+constexpr unsigned kOjnDifficultyCount = 3;
+constexpr unsigned kOjnLaneCount = 7;
+
+const char* const kOjnDifficultyNames[kOjnDifficultyCount] = { "EX", "NX", "HX" };
+
+const char* const kOjnGenres[] = {
+  "Ballad", "Rock", "Dance", "Techno", "Hip-hop",
+  "Soul/R&B", "Jazz", "Funk", "Classical", "Traditional", "Etc"
+};
+
+struct OjnHeader
+{
+  float bpm;
+  int32_t genre;
+  int16_t level[kOjnDifficultyCount];
+  uint32_t note_offset[kOjnDifficultyCount + 1];
+  std::string title, artist, noter, ojm_file;
+};
+
+float read_float(const uint8_t* p)
+{
+  uint32_t v = ReadLE32(p);
+  float f;
+  memcpy(&f, &v, sizeof(float));
+  return f;
+}
+
+std::string read_fixed_string(const uint8_t* p, size_t len)
+{
+  size_t l = 0;
+  while (l < len && p[l]) l++;
+  return std::string(reinterpret_cast<const char*>(p), l);
+}
+
+bool ReadOjnHeader(const uint8_t* p, size_t len, OjnHeader& h)
+{
+  if (len < kOjnHeaderSize || memcmp(p + 4, "ojn\0", 4) != 0)
+    return false;
+  h.genre = (int32_t)ReadLE32(p + 12);
+  h.bpm = read_float(p + 16);
+  for (unsigned i = 0; i < kOjnDifficultyCount; ++i)
+  {
+    h.level[i] = (int16_t)ReadLE16(p + 20 + i * 2);
+    h.note_offset[i] = ReadLE32(p + 284 + i * 4);
+  }
+  // note data of last difficulty ends at cover image.
+  h.note_offset[kOjnDifficultyCount] = ReadLE32(p + 296);
+  h.title = read_fixed_string(p + 108, 64);
+  h.artist = read_fixed_string(p + 172, 32);
+  h.noter = read_fixed_string(p + 204, 32);
+  h.ojm_file = read_fixed_string(p + 236, 32);
+  return true;
+}
+
+}
+
+ChartLoaderOJN::ChartLoaderOJN(Song* song) : ChartLoader(song) {}
+
+bool ChartLoaderOJN::Test(const void* p, unsigned iLen)
+{
+  return iLen >= kOjnHeaderSize &&
+         memcmp(static_cast<const uint8_t*>(p) + 4, "ojn\0", 4) == 0;
+}
+
+bool ChartLoaderOJN::LoadFromDirectory()
+{
+  if (!song_->GetDirectory())
+    return false;
+  auto &dir = *song_->GetDirectory();
+  bool r = false;
+
+  for (const auto *f : dir)
+  {
+    const std::string filename = f->filename;
+    std::string fn_lower = filename; lower(fn_lower);
+    if (!endsWith(fn_lower, ".ojn")) continue;
+    if (!dir.Read(f->filename)) continue;
+
+    // Load() appends charts for other difficulties.
+    const size_t chart_idx = song_->GetChartCount();
+    Chart *c = song_->NewChart();
+    if (!c) return false;
+
+    if (diag_) diag_->SetFile(filename);
+    if (!Load(*c, f->p, f->len))
+    {
+      Report(DiagnosticCodes::kChartLoadFailed);
+      song_->DeleteChart(chart_idx);
+      continue;
+    }
+    for (size_t i = chart_idx; i < song_->GetChartCount(); ++i)
+      song_->GetChart(i)->SetFilename(filename);
+    r = true;
+  }
+
+  return r;
+}
+
+bool ChartLoaderOJN::Load(Chart &c, const void* p, unsigned iLen)
+{
+  const uint8_t *data = static_cast<const uint8_t*>(p);
+  OjnHeader header;
+
+  Preload(c, p, iLen);
+  if (!ReadOjnHeader(data, iLen, header))
+  {
+    Report(DiagnosticCodes::kOjnInvalidHeader);
+    return false;
+  }
+
+  // charts of other difficulties are appended to song,
+  // and removed if failed to parse (all of them if EX is failed).
+  std::vector<Chart*> charts;
+  std::vector<bool> loaded;
+  charts.push_back(&c);
+  const size_t extra_idx = song_ ? song_->GetChartCount() : 0;
+  if (song_ && song_->GetSongType() == SONGTYPE::OJM)
+  {
+    for (unsigned i = 1; i < kOjnDifficultyCount; ++i)
+    {
+      Chart *nc = song_->NewChart();
+      Preload(*nc, p, iLen);
+      charts.push_back(nc);
+    }
+  }
+
+  loaded.resize(charts.size(), true);
+  for (unsigned d = 0; d < charts.size() && loaded[0]; ++d)
+  {
+    Chart &chart = *charts[d];
+    MetaData &md = chart.GetMetaData();
+    md.SetAttribute("TITLE", header.title);
+    md.SetAttribute("ARTIST", header.artist);
+    md.SetAttribute("CHARTMAKER", header.noter);
+    md.SetAttribute("BPM", (double)header.bpm);
+    md.SetAttribute("PLAYLEVEL", (int)header.level[d]);
+    md.SetAttribute("DIFFICULTY", (int)d + 1);
+    md.SetAttribute("CHARTTYPE", std::string(kOjnDifficultyNames[d]));
+    if (header.genre >= 0 && header.genre < (int)(sizeof(kOjnGenres) / sizeof(kOjnGenres[0])))
+      md.SetAttribute("GENRE", std::string(kOjnGenres[header.genre]));
+    md.SetMetaFromAttribute();
+
+    // initial BPM is applied from beat 0.
+    NoteElement ne;
+    ne.set_measure(0);
+    ne.set_value((double)header.bpm);
+    chart.GetTimingData()[TimingTrackTypes::kBpm].AddNoteElement(ne);
+
+    uint32_t begin = header.note_offset[d], end = header.note_offset[d + 1];
+    if (end > iLen || end < begin) end = iLen;
+    if (begin < kOjnHeaderSize || begin > end ||
+        !ParsePackages(chart, header.ojm_file, data + begin, end - begin))
+    {
+      Report(DiagnosticCodes::kOjnInvalidNoteData);
+      loaded[d] = false;
+    }
+  }
+
+  for (size_t d = charts.size() - 1; d > 0; --d)
+  {
+    if (!loaded[0] || !loaded[d])
+      song_->DeleteChart(extra_idx + d - 1);
+  }
+  return loaded[0];
+}
+
+bool ChartLoaderOJN::ParsePackages(Chart &c, const std::string& ojm_file,
+                                   const uint8_t* p, size_t len)
+{
+  auto &nd = c.GetNoteData();
+  auto &bgm = c.GetBgmData();
+  auto &td = c.GetTimingData();
+  auto &sound = *c.GetMetaData().GetSoundChannel();
+  NoteElement ne;
+  size_t pos = 0;
+
+  while (pos + 8 <= len)
+  {
+    const int32_t measure = (int32_t)ReadLE32(p + pos);
+    const uint16_t channel = ReadLE16(p + pos + 4);
+    const uint16_t event_count = ReadLE16(p + pos + 6);
+    pos += 8;
+    if (measure < 0 || pos + event_count * 4u > len)
+      return false;
+
+    for (unsigned i = 0; i < event_count; ++i, pos += 4)
+    {
+      const uint8_t *ev = p + pos;
+      ne.SetRowPos(measure, RowPos{ i, event_count });
+
+      // channel 0: measure fraction, 1: BPM (float)
+      if (channel <= 1)
+      {
+        const float v = read_float(ev);
+        if (v <= 0) continue;
+        ne.set_value((double)v);
+        ne.set_chain_status(NoteChainStatus::Tap);
+        td[channel == 0 ? TimingTrackTypes::kMeasure : TimingTrackTypes::kBpm]
+          .AppendNoteElement(ne);
+        continue;
+      }
+
+      // channel 2 ~ 8: note lane, 9 ~ : auto-play sample
+      // (value, volume/pan, note type)
+      unsigned value = ReadLE16(ev);
+      const uint8_t type = ev[3];
+      if (value == 0) continue;
+      value--;
+      if (type % 8 > 3) value += 1000;
+      if (!sound.fn.exist(value))
+        sound.Set(value, ojm_file + "|" + std::to_string(value) + ".ogg");
+      ne.set_value(value);
+
+      if (channel < 2 + kOjnLaneCount)
+      {
+        switch (type % 4)
+        {
+        case 2:
+          ne.set_chain_status(NoteChainStatus::Start);
+          break;
+        case 3:
+          ne.set_chain_status(NoteChainStatus::End);
+          break;
+        default:
+          ne.set_chain_status(NoteChainStatus::Tap);
+        }
+        nd[channel - 2].AppendNoteElement(ne);
+      }
+      else if (channel - 2 - kOjnLaneCount < bgm.get_track_count())
+      {
+        ne.set_chain_status(NoteChainStatus::Tap);
+        bgm[channel - 2 - kOjnLaneCount].AppendNoteElement(ne);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < nd.get_track_count(); ++i)
+    nd[i].SortNoteElements();
+  for (size_t i = 0; i < bgm.get_track_count(); ++i)
+    bgm[i].SortNoteElements();
+  td[TimingTrackTypes::kMeasure].SortNoteElements();
+  td[TimingTrackTypes::kBpm].SortNoteElements();
+  return true;
+}
+
+} /* rparser */
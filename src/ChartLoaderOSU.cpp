@@ -0,0 +1,382 @@
+/* supports osu! beatmap (.osu) format. */
+
+#include "ChartLoader.h"
+#include "Chart.h"
+#include "rutil.h"
+#include "common.h"
+#include <algorithm>
+
+using namespace rutil;
+
+namespace rparser {
+
+namespace {
+
+struct OsuField
+{
+  const char* p;
+  size_t len;
+};
+
+/* @brief get next line without line terminator. returns false at the end. */
+inline bool next_line(const char *&p, const char *end, OsuField &line)
+{
+  if (p >= end) return false;
+  const char *eol = static_cast<const char*>(memchr(p, '\n', end - p));
+  if (!eol) eol = end;
+  line.p = p;
+  line.len = eol - p;
+  if (line.len > 0 && line.p[line.len - 1] == '\r') line.len--;
+  p = (eol < end) ? eol + 1 : end;
+  return true;
+}
+
+inline void trim_field(OsuField &f)
+{
+  while (f.len > 0 && (*f.p == ' ' || *f.p == '\t')) { f.p++; f.len--; }
+  while (f.len > 0 && (f.p[f.len - 1] == ' ' || f.p[f.len - 1] == '\t')) f.len--;
+}
+
+inline size_t split_fields(const OsuField &line, char sep, OsuField *out, size_t max_count)
+{
+  const char *p = line.p, *end = line.p + line.len;
+  size_t cnt = 0;
+  while (cnt < max_count)
+  {
+    const char *q = static_cast<const char*>(memchr(p, sep, end - p));
+    if (!q) q = end;
+    out[cnt].p = p;
+    out[cnt].len = q - p;
+    cnt++;
+    if (q == end) break;
+    p = q + 1;
+  }
+  return cnt;
+}
+
+/* @brief field is not null-terminated, so copied into small buffer. */
+inline double to_double(const OsuField &f, double fallback = 0)
+{
+  char buf[64];
+  if (f.len == 0 || f.len >= sizeof(buf)) return fallback;
+  memcpy(buf, f.p, f.len);
+  buf[f.len] = 0;
+  char *endptr;
+  double r = strtod(buf, &endptr);
+  return (endptr == buf) ? fallback : r;
+}
+
+inline bool is_comment(const OsuField &line)
+{
+  return line.len == 0 || (line.len >= 2 && line.p[0] == '/' && line.p[1] == '/');
+}
+
+}
+
+ChartLoaderOSU::ChartLoaderOSU(Song *song)
+  : ChartLoader(song), chart_(nullptr), header_only_(false)
+{
+  memset(sections_, 0, sizeof(sections_));
+}
+
+void ChartLoaderOSU::SetHeaderOnly(bool header_only)
+{
+  header_only_ = header_only;
+}
+
+bool ChartLoaderOSU::Test(const void* p, unsigned iLen)
+{
+  const char *s = static_cast<const char*>(p);
+  if (iLen >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0)
+  {
+    s += 3;
+    iLen -= 3;
+  }
+  return iLen >= 15 && memcmp(s, "osu file format", 15) == 0;
+}
+
+bool ChartLoaderOSU::LoadFromDirectory()
+{
+  if (!song_->GetDirectory())
+    return false;
+  auto &dir = *song_->GetDirectory();
+
+  if (dir.count() <= 0)
+    return false;
+
+  for (const auto *f : dir)
+  {
+    const std::string filename = f->filename;
+    if (!endsWith(lower(filename), ".osu")) continue;
+    if (!dir.Read(f->filename)) continue;
+
+    Chart *c = song_->NewChart();
+    if (!c) return false;
+
+    if (diag_) diag_->SetFile(filename);
+    bool r = Load(*c, f->p, f->len);
+    c->SetFilename(filename);
+
+    if (!r)
+    {
+      Report(DiagnosticCodes::kChartLoadFailed);
+      song_->DeleteChart(song_->GetChartCount() - 1);
+    }
+  }
+
+  return true;
+}
+
+bool ChartLoaderOSU::Load(Chart &c, const void* p, unsigned iLen)
+{
+  Preload(c, p, iLen);
+  chart_ = &c;
+  timing_points_.clear();
+
+  if (!Test(p, iLen))
+  {
+    Report(DiagnosticCodes::kOsuInvalidSignature);
+    return false;
+  }
+  IndexSections(static_cast<const char*>(p), iLen);
+
+  ParseKeyValues(kOsuGeneral);
+  ParseKeyValues(kOsuMetadata);
+  ParseKeyValues(kOsuDifficulty);
+  ParseEvents();
+
+  auto &md = c.GetMetaData();
+  const int mode = md.GetAttribute("Mode", 0);
+  unsigned key_count = 1;
+  if (mode == 3)  // mania
+  {
+    key_count = static_cast<unsigned>(md.GetAttribute("CircleSize", 4.0));
+    if (key_count == 0 || key_count > kMaxTrackSize) key_count = 4;
+  }
+  c.GetNoteData().set_track_count(key_count);
+
+  if (!header_only_)
+  {
+    ParseTimingPoints();
+    ParseHitObjects();
+  }
+
+  md.SetMetaFromAttribute();
+  return true;
+}
+
+void ChartLoaderOSU::IndexSections(const char* p, size_t len)
+{
+  static const char* kSectionNames[] = {
+    "General", "Metadata", "Difficulty", "Events", "TimingPoints", "HitObjects"
+  };
+  const char *end = p + len;
+  OsuField line;
+  int current = -1;
+
+  memset(sections_, 0, sizeof(sections_));
+  while (next_line(p, end, line))
+  {
+    if (line.len == 0 || line.p[0] != '[') continue;
+
+    // close previous section
+    if (current >= 0)
+      sections_[current].len = line.p - sections_[current].p;
+    current = -1;
+
+    const char *close = static_cast<const char*>(memchr(line.p, ']', line.len));
+    if (!close) continue;
+    const size_t name_len = close - line.p - 1;
+    for (int i = 0; i < kOsuSectionMax; ++i)
+    {
+      if (strlen(kSectionNames[i]) == name_len &&
+          memcmp(kSectionNames[i], line.p + 1, name_len) == 0)
+      {
+        current = i;
+        sections_[i].p = p;
+        break;
+      }
+    }
+    // note sections are placed after header sections; no need to scan more.
+    if (header_only_ && current >= kOsuTimingPoints)
+    {
+      sections_[current].p = nullptr;
+      return;
+    }
+  }
+  if (current >= 0)
+    sections_[current].len = end - sections_[current].p;
+}
+
+void ChartLoaderOSU::ParseKeyValues(OsuSection section)
+{
+  // osu! key is mapped into metadata key if possible,
+  // otherwise stored as attribute with its original name.
+  static const std::map<std::string, std::string> kOsuMetaKeys = {
+    { "Title", "TITLE" },
+    { "TitleUnicode", "TITLE" },
+    { "Artist", "ARTIST" },
+    { "ArtistUnicode", "ARTIST" },
+    { "Creator", "CHARTMAKER" },
+    { "Version", "CHARTTYPE" },
+    { "AudioFilename", "BGM" },
+  };
+  const char *p = sections_[section].p;
+  if (!p) return;
+  const char *end = p + sections_[section].len;
+  auto &md = chart_->GetMetaData();
+  OsuField line, kv[2];
+  std::string key;
+
+  while (next_line(p, end, line))
+  {
+    if (is_comment(line)) continue;
+    if (split_fields(line, ':', kv, 2) < 2) continue;
+    trim_field(kv[0]);
+    trim_field(kv[1]);
+    if (kv[1].len == 0) continue;
+    key.assign(kv[0].p, kv[0].len);
+    auto it = kOsuMetaKeys.find(key);
+    md.SetAttribute(it != kOsuMetaKeys.end() ? it->second : key,
+      std::string(kv[1].p, kv[1].len));
+  }
+}
+
+void ChartLoaderOSU::ParseEvents()
+{
+  const char *p = sections_[kOsuEvents].p;
+  if (!p) return;
+  const char *end = p + sections_[kOsuEvents].len;
+  OsuField line, fields[3];
+
+  while (next_line(p, end, line))
+  {
+    if (is_comment(line)) continue;
+    // background event: 0,0,"filename",xoffset,yoffset
+    if (split_fields(line, ',', fields, 3) < 3) continue;
+    if (fields[0].len != 1 || fields[0].p[0] != '0') continue;
+    OsuField &fn = fields[2];
+    trim_field(fn);
+    if (fn.len >= 2 && fn.p[0] == '"')
+    {
+      fn.p++;
+      fn.len -= 2;
+    }
+    chart_->GetMetaData().SetAttribute("BACKIMAGE", std::string(fn.p, fn.len));
+    break;
+  }
+}
+
+void ChartLoaderOSU::ParseTimingPoints()
+{
+  const char *p = sections_[kOsuTimingPoints].p;
+  const char *end = p ? p + sections_[kOsuTimingPoints].len : nullptr;
+  OsuField line, fields[8];
+  TimingPoint tp;
+
+  while (next_line(p, end, line))
+  {
+    if (is_comment(line)) continue;
+    // time,beatLength,meter,sampleSet,sampleIndex,volume,uninherited,effects
+    const size_t cnt = split_fields(line, ',', fields, 8);
+    if (cnt < 2) continue;
+    tp.time = to_double(fields[0]);
+    tp.beat_length = to_double(fields[1]);
+    // old beatmap has no 'uninherited' field; negative beat length is inherited one.
+    const bool uninherited = (cnt >= 7) ? to_double(fields[6], 1) != 0 : tp.beat_length > 0;
+    if (!uninherited || tp.beat_length <= 0) continue;
+    timing_points_.push_back(tp);
+  }
+
+  std::stable_sort(timing_points_.begin(), timing_points_.end(),
+    [](const TimingPoint& a, const TimingPoint& b) { return a.time < b.time; });
+  if (timing_points_.empty())
+    timing_points_.push_back({ 0, 60000.0 / kDefaultBpm, 0 });
+
+  // first BPM is extended to time 0, so beat 0 is always at time 0.
+  auto &md = chart_->GetMetaData();
+  auto &bpm_track = chart_->GetTimingData()[TimingTrackTypes::kBpm];
+  NoteElement ne;
+  timing_points_[0].beat = timing_points_[0].time / timing_points_[0].beat_length;
+  md.SetAttribute("BPM", 60000.0 / timing_points_[0].beat_length);
+  for (size_t i = 1; i < timing_points_.size(); ++i)
+  {
+    auto &prev = timing_points_[i - 1];
+    auto &curr = timing_points_[i];
+    curr.beat = prev.beat + (curr.time - prev.time) / prev.beat_length;
+    ne.set_measure(curr.beat / kDefaultMeasureLength);
+    ne.set_value(60000.0 / curr.beat_length);
+    bpm_track.AppendNoteElement(ne);
+  }
+}
+
+double ChartLoaderOSU::GetMeasureFromTime(double time_msec, size_t &idx) const
+{
+  // objects are mostly sorted by time, so search from last index.
+  while (idx + 1 < timing_points_.size() && timing_points_[idx + 1].time <= time_msec) ++idx;
+  while (idx > 0 && timing_points_[idx].time > time_msec) --idx;
+  const auto &tp = timing_points_[idx];
+  return (tp.beat + (time_msec - tp.time) / tp.beat_length) / kDefaultMeasureLength;
+}
+
+void ChartLoaderOSU::ParseHitObjects()
+{
+  const char *p = sections_[kOsuHitObjects].p;
+  if (!p) return;
+  const char *end = p + sections_[kOsuHitObjects].len;
+  auto &nd = chart_->GetNoteData();
+  const int key_count = static_cast<int>(nd.get_track_count());
+  const bool is_mania = chart_->GetMetaData().GetAttribute("Mode", 0) == 3;
+  OsuField line, fields[7], endtime;
+  NoteElement ne;
+  size_t tp_idx = 0;
+
+  while (next_line(p, end, line))
+  {
+    if (is_comment(line)) continue;
+    // x,y,time,type,hitSound,objectParams,hitSample
+    const size_t cnt = split_fields(line, ',', fields, 7);
+    if (cnt < 4) continue;
+    const double time = to_double(fields[2], -1);
+    if (time < 0) continue;
+    const int type = static_cast<int>(to_double(fields[3]));
+    int lane = 0;
+    if (is_mania)
+    {
+      lane = static_cast<int>(to_double(fields[0]) * key_count / 512);
+      lane = std::max(0, std::min(key_count - 1, lane));
+    }
+    auto &track = nd[lane];
+
+    // hold (mania) : endTime:hitSample, spinner : endTime
+    // TODO: slider duration requires slider velocity, so it's treated as tap now.
+    double end_time = -1;
+    if ((type & 128) && cnt >= 6)
+    {
+      split_fields(fields[5], ':', &endtime, 1);
+      end_time = to_double(endtime, -1);
+    }
+    else if ((type & 8) && cnt >= 6)
+      end_time = to_double(fields[5], -1);
+
+    ne.set_measure(GetMeasureFromTime(time, tp_idx));
+    if (end_time > time)
+    {
+      ne.set_chain_status(NoteChainStatus::Start);
+      track.AppendNoteElement(ne);
+      ne.set_measure(GetMeasureFromTime(end_time, tp_idx));
+      ne.set_chain_status(NoteChainStatus::End);
+      track.AppendNoteElement(ne);
+    }
+    else
+    {
+      ne.set_chain_status(NoteChainStatus::Tap);
+      track.AppendNoteElement(ne);
+    }
+  }
+
+  for (size_t i = 0; i < nd.get_track_count(); ++i)
+    nd[i].SortNoteElements();
+}
+
+}
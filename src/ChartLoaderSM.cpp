@@ -0,0 +1,407 @@
+/* supports StepMania (.sm) format. */
+
+#include "ChartLoader.h"
+#include "Chart.h"
+#include "rutil.h"
+#include "common.h"
+#include <algorithm>
+#include <thread>
+
+using namespace rutil;
+
+namespace rparser {
+
+namespace {
+
+struct SmTag
+{
+  const char* key;
+  size_t key_len;
+  const char* value;
+  size_t value_len;
+};
+
+inline bool is_sm_space(char c)
+{
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+inline void trim_value(const char *&p, size_t &len)
+{
+  while (len > 0 && is_sm_space(*p)) { p++; len--; }
+  while (len > 0 && is_sm_space(p[len - 1])) len--;
+}
+
+inline const char* skip_comment(const char *p, const char *end)
+{
+  const char *eol = static_cast<const char*>(memchr(p, '\n', end - p));
+  return eol ? eol + 1 : end;
+}
+
+/* @brief read next #KEY:VALUE; tag. */
+bool next_tag(const char *&p, const char *end, SmTag &tag)
+{
+  while (p < end && *p != '#')
+  {
+    if (*p == '/' && p + 1 < end && p[1] == '/')
+      p = skip_comment(p, end);
+    else
+      ++p;
+  }
+  if (p >= end) return false;
+  const char *key = ++p;
+  const char *colon = static_cast<const char*>(memchr(key, ':', end - key));
+  if (!colon)
+  {
+    p = end;
+    return false;
+  }
+  const char *value = colon + 1;
+  const char *semicolon = static_cast<const char*>(memchr(value, ';', end - value));
+  if (!semicolon) semicolon = end;
+  tag.key = key;
+  tag.key_len = colon - key;
+  tag.value = value;
+  tag.value_len = semicolon - value;
+  trim_value(tag.value, tag.value_len);
+  p = (semicolon < end) ? semicolon + 1 : end;
+  return true;
+}
+
+inline bool tag_is(const SmTag &tag, const char *key)
+{
+  return strlen(key) == tag.key_len && memcmp(key, tag.key, tag.key_len) == 0;
+}
+
+/* @brief value is not null-terminated, so copied into small buffer. */
+inline double to_double(const char *p, size_t len, double fallback = 0)
+{
+  char buf[64];
+  trim_value(p, len);
+  if (len == 0 || len >= sizeof(buf)) return fallback;
+  memcpy(buf, p, len);
+  buf[len] = 0;
+  char *endptr;
+  double r = strtod(buf, &endptr);
+  return (endptr == buf) ? fallback : r;
+}
+
+/* @brief iterate "beat=value" pairs separated by ','. */
+template <typename F>
+void for_each_pair(const char *p, size_t len, F func)
+{
+  const char *end = p + len;
+  while (p < end)
+  {
+    const char *comma = static_cast<const char*>(memchr(p, ',', end - p));
+    if (!comma) comma = end;
+    const char *eq = static_cast<const char*>(memchr(p, '=', comma - p));
+    if (eq)
+      func(to_double(p, eq - p, -1), to_double(eq + 1, comma - eq - 1));
+    p = (comma < end) ? comma + 1 : end;
+  }
+}
+
+int GetDifficultyFromName(const std::string& name)
+{
+  static const char* kDifficultyNames[] = {
+    "beginner", "easy", "medium", "hard", "challenge", "edit"
+  };
+  const std::string name_lower = lower(name);
+  for (int i = 0; i < 6; ++i)
+    if (name_lower == kDifficultyNames[i]) return i + 1;
+  return 0;
+}
+
+}
+
+ChartLoaderSM::ChartLoaderSM(Song *song)
+  : ChartLoader(song), thread_count_(std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+void ChartLoaderSM::SetThreadCount(unsigned thread_count)
+{
+  thread_count_ = std::max(1u, thread_count);
+}
+
+bool ChartLoaderSM::Test(const void* p, unsigned iLen)
+{
+  const char *s = static_cast<const char*>(p);
+  SmTag tag;
+  return next_tag(s, s + iLen, tag);
+}
+
+bool ChartLoaderSM::LoadFromDirectory()
+{
+  if (!song_->GetDirectory())
+    return false;
+  auto &dir = *song_->GetDirectory();
+
+  if (dir.count() <= 0)
+    return false;
+
+  // timing is shared by song, so only first simfile is loaded.
+  for (const auto *f : dir)
+  {
+    const std::string filename = f->filename;
+    if (!endsWith(lower(filename), ".sm")) continue;
+    if (!dir.Read(f->filename)) continue;
+
+    const size_t chart_idx = song_->GetChartCount();
+    Chart *c = song_->NewChart();
+    if (!c) return false;
+
+    if (diag_) diag_->SetFile(filename);
+    bool r = Load(*c, f->p, f->len);
+    for (size_t i = chart_idx; i < song_->GetChartCount(); ++i)
+      song_->GetChart(i)->SetFilename(filename);
+
+    if (!r)
+    {
+      Report(DiagnosticCodes::kChartLoadFailed);
+      song_->DeleteChart(chart_idx);
+      continue;
+    }
+    break;
+  }
+
+  return true;
+}
+
+bool ChartLoaderSM::Load(Chart &c, const void* p, unsigned iLen)
+{
+  // song attributes mapped into metadata.
+  static const std::map<std::string, std::string> kSmMetaKeys = {
+    { "TITLE", "TITLE" },
+    { "SUBTITLE", "SUBTITLE" },
+    { "ARTIST", "ARTIST" },
+    { "GENRE", "GENRE" },
+    { "CREDIT", "CHARTMAKER" },
+    { "BANNER", "BANNERIMAGE" },
+    { "BACKGROUND", "BACKIMAGE" },
+    { "MUSIC", "BGM" },
+    { "LYRICSPATH", "LYRICS" },
+  };
+  const char *s = static_cast<const char*>(p);
+  const char *end = s + iLen;
+  const char *bpms = nullptr, *stops = nullptr;
+  size_t bpms_len = 0, stops_len = 0;
+  std::vector<NotesBlock> blocks;
+  MetaData header;
+  SmTag tag;
+
+  // all charts of the file share the hash, so calculate it only once.
+  const std::string hash = rutil::md5_str(p, iLen);
+  Preload(c, hash);
+
+  while (next_tag(s, end, tag))
+  {
+    if (tag_is(tag, "NOTES"))
+      blocks.push_back({ tag.value, tag.value_len });
+    else if (tag_is(tag, "BPMS"))
+      bpms = tag.value, bpms_len = tag.value_len;
+    else if (tag_is(tag, "STOPS"))
+      stops = tag.value, stops_len = tag.value_len;
+    else if (tag_is(tag, "OFFSET"))
+      // offset is time of beat 0 in second (negative)
+      header.SetAttribute("OFFSET", -to_double(tag.value, tag.value_len) * 1000);
+    else if (tag.value_len > 0)
+    {
+      const std::string key(tag.key, tag.key_len);
+      auto it = kSmMetaKeys.find(key);
+      header.SetAttribute(it != kSmMetaKeys.end() ? it->second : key,
+        std::string(tag.value, tag.value_len));
+    }
+  }
+
+  if (blocks.empty())
+  {
+    Report(DiagnosticCodes::kSmNoNotes);
+    return false;
+  }
+
+  ParseTiming(c, bpms, bpms_len, stops, stops_len);
+
+  // prepare charts first, as Song::NewChart() is not thread-safe.
+  std::vector<Chart*> charts;
+  charts.push_back(&c);
+  if (song_ && song_->GetSongType() == SONGTYPE::SM)
+  {
+    for (size_t i = 1; i < blocks.size(); ++i)
+    {
+      Chart *nc = song_->NewChart();
+      Preload(*nc, hash);
+      charts.push_back(nc);
+    }
+  }
+  for (auto *chart : charts)
+    chart->GetMetaData().MergeAttributes(header);
+
+  // diagnostics is not thread-safe, so ignored rows are reported after parsing.
+  std::vector<unsigned> ignored_rows(charts.size(), 0);
+  const size_t worker_count = std::min<size_t>(thread_count_, charts.size());
+  if (worker_count > 1)
+  {
+    std::vector<std::thread> workers;
+    workers.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+      workers.emplace_back([&charts, &blocks, &ignored_rows, i, worker_count]() {
+        for (size_t b = i; b < charts.size(); b += worker_count)
+          ignored_rows[b] = ParseNotes(*charts[b], blocks[b]);
+      });
+    }
+    for (auto &w : workers) w.join();
+  }
+  else
+  {
+    for (size_t b = 0; b < charts.size(); ++b)
+      ignored_rows[b] = ParseNotes(*charts[b], blocks[b]);
+  }
+  for (unsigned count : ignored_rows)
+  {
+    for (unsigned i = 0; i < count; ++i)
+      Report(DiagnosticCodes::kSmInvalidRowLength);
+  }
+
+  if (song_) song_->InvalidateSharedTempoData();
+  return true;
+}
+
+void ChartLoaderSM::ParseTiming(Chart &c, const char* bpms, size_t bpms_len,
+                                const char* stops, size_t stops_len)
+{
+  // shared timing is cleared here, as Preload() only clears chart own data.
+  auto &td = c.GetTimingData();
+  td.clear();
+  c.GetTimingSegmentData().clear();
+
+  NoteElement ne;
+  bool has_initial_bpm = false;
+  double initial_bpm = kDefaultBpm;
+  if (bpms)
+  {
+    auto &track = td[TimingTrackTypes::kBpm];
+    for_each_pair(bpms, bpms_len, [&](double beat, double bpm) {
+      if (beat < 0 || bpm <= 0) return;
+      if (beat == 0) has_initial_bpm = true;
+      ne.set_measure(beat / kDefaultMeasureLength);
+      ne.set_value(bpm);
+      track.AppendNoteElement(ne);
+    });
+    track.SortNoteElements();
+  }
+  if (!has_initial_bpm)
+  {
+    // first BPM is applied from beat 0.
+    const Track &track = td[TimingTrackTypes::kBpm];
+    if (track.size() > 0) initial_bpm = track.get(0)->get_value_f();
+    ne.set_measure(0);
+    ne.set_value(initial_bpm);
+    td[TimingTrackTypes::kBpm].AddNoteElement(ne);
+  }
+  if (stops)
+  {
+    auto &track = td[TimingTrackTypes::kStop];
+    for_each_pair(stops, stops_len, [&](double beat, double sec) {
+      if (beat < 0 || sec <= 0) return;
+      ne.set_measure(beat / kDefaultMeasureLength);
+      ne.set_value(sec * 1000);
+      track.AppendNoteElement(ne);
+    });
+    track.SortNoteElements();
+  }
+}
+
+unsigned ChartLoaderSM::ParseNotes(Chart &c, const NotesBlock &block)
+{
+  // steps type:description:difficulty:meter:radar values:note data
+  const char *p = block.p, *end = block.p + block.len;
+  const char *fields[5];
+  size_t field_len[5];
+  for (int i = 0; i < 5; ++i)
+  {
+    const char *colon = static_cast<const char*>(memchr(p, ':', end - p));
+    if (!colon) return 0;
+    fields[i] = p;
+    field_len[i] = colon - p;
+    trim_value(fields[i], field_len[i]);
+    p = colon + 1;
+  }
+
+  auto &md = c.GetMetaData();
+  md.SetAttribute("CHARTTYPE", std::string(fields[0], field_len[0]));
+  if (field_len[1] > 0)
+    md.SetAttribute("DESCRIPTION", std::string(fields[1], field_len[1]));
+  md.SetAttribute("DIFFICULTY", GetDifficultyFromName(std::string(fields[2], field_len[2])));
+  md.SetAttribute("PLAYLEVEL", static_cast<int>(to_double(fields[3], field_len[3])));
+  md.SetMetaFromAttribute();
+
+  // note data: rows of lane characters, measures separated by ','.
+  auto &nd = c.GetNoteData();
+  std::vector<const char*> rows;
+  size_t lane_count = 0;
+  unsigned ignored_rows = 0;
+  uint32_t measure = 0;
+  NoteElement ne;
+
+  auto flush_measure = [&]() {
+    const uint32_t row_count = static_cast<uint32_t>(rows.size());
+    for (uint32_t r = 0; r < row_count; ++r)
+    {
+      const char *row = rows[r];
+      for (size_t lane = 0; lane < lane_count; ++lane)
+      {
+        switch (row[lane])
+        {
+        case '1':   // tap
+        case 'L':   // lift
+          ne.set_chain_status(NoteChainStatus::Tap);
+          break;
+        case '2':   // hold head
+        case '4':   // roll head
+          ne.set_chain_status(NoteChainStatus::Start);
+          break;
+        case '3':   // hold / roll tail
+          ne.set_chain_status(NoteChainStatus::End);
+          break;
+        default:    // TODO: mine, fake, keysound object is not supported.
+          continue;
+        }
+        ne.SetRowPos(measure, RowPos{ r, row_count });
+        // rows are in order, so no need to sort.
+        nd[lane].AppendNoteElement(ne);
+      }
+    }
+    rows.clear();
+    ++measure;
+  };
+
+  while (p < end)
+  {
+    if (is_sm_space(*p)) { ++p; continue; }
+    if (*p == '/' && p + 1 < end && p[1] == '/') { p = skip_comment(p, end); continue; }
+    if (*p == ',') { flush_measure(); ++p; continue; }
+
+    const char *row = p;
+    while (p < end && !is_sm_space(*p) && *p != ',' && !(*p == '/' && p + 1 < end && p[1] == '/')) ++p;
+    const size_t width = p - row;
+    if (width == 0) { ++p; continue; }
+    if (lane_count == 0)
+    {
+      lane_count = std::min(width, kMaxTrackSize);
+      nd.set_track_count(lane_count);
+    }
+    if (width < lane_count)
+    {
+      ignored_rows++;
+      continue;
+    }
+    rows.push_back(row);
+  }
+  if (!rows.empty()) flush_measure();
+  return ignored_rows;
+}
+
+}
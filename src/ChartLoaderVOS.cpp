@@ -10,6 +10,7 @@
 #include "ChartLoader.h"
 #include "Chart.h"
 #include "ChartUtil.h"
+#include "MidiFile.h"
 #include "common.h"
 
 #define MAX_READ_SIZE 512000
@@ -38,6 +39,9 @@ struct VOSHeader {
   char desc[256];
 };
 
+/* @brief byte size of packed VOSNoteDataV2 record in file. */
+constexpr size_t kVOSNoteDataV2Size = 16;
+
 struct VOSNoteDataV2 {
   uint8_t dummy;        // always zero
   uint32_t time;
@@ -54,6 +58,9 @@ struct VOSNoteDataV2 {
   uint8_t inst;
 };
 
+/* @brief byte size of packed VOSNoteDataV3 record in file. */
+constexpr size_t kVOSNoteDataV3Size = 13;
+
 struct VOSNoteDataV3 {
   uint32_t time;
   uint32_t duration;
@@ -61,37 +68,9 @@ struct VOSNoteDataV3 {
   uint8_t midikey;
   uint8_t vol;
   uint16_t type;      /* (Bit) 8 : tapnote, 9 : longnote, 15 : longnote */
-};
-
-#define MIDISIG_TYPES 8
-#define MIDISIG_LENGTH 2
-#define MIDISIG_NULLCMPR 0xFF /* this byte wont be compared */
-
-// https://www.csie.ntu.edu.tw/~r92092/ref/midi/#sysex_event
-enum class MIDISIG: int {
-  MIDISIG_DUMMY=0, // output port
-  MIDISIG_TRACKNAME,
-  MIDISIG_END,
-  MIDISIG_TEMPO,
-  MIDISIG_MEASURE,
-  MIDISIG_META_OTHERS,
-  MIDISIG_SYSEX,
-  // -- below is for program --
-  MIDISIG_PROGRAM,
-  MIDISIG_PROGRAM_RUNNING,
-  MIDISIG_OTHERS
-};
-
-struct MIDIProgramInfo {
-  uint8_t lastcmd, cmd, a, b;
-  int len;
-  std::string text;
 
-  MIDIProgramInfo()
-  {
-    lastcmd = cmd = a = b = 0;
-    len = 0;
-  }
+  // -- additional information --
+  uint8_t segment;
 };
 
 ChartLoaderVOS::BinaryStream::BinaryStream()
@@ -106,167 +85,85 @@ void ChartLoaderVOS::BinaryStream::SetSource(const void* p, size_t len)
 
 void ChartLoaderVOS::BinaryStream::SeekSet(size_t cnt)
 {
-  offset_ = cnt;
-  ASSERT(offset_ <= len_);
+  ASSERT(cnt <= len_);
+  offset_ = std::min(cnt, (size_t)len_);
 }
 
 void ChartLoaderVOS::BinaryStream::SeekCur(size_t cnt)
 {
-  offset_ += cnt;
-  ASSERT(offset_ <= len_);
+  ASSERT(HasRemain(cnt));
+  offset_ = HasRemain(cnt) ? offset_ + cnt : len_;
 }
 
 int32_t ChartLoaderVOS::BinaryStream::ReadInt32()
 {
-  return *reinterpret_cast<const int32_t*>((uint8_t*)p_ + offset_);
+  if (!HasRemain(sizeof(int32_t))) return 0;
+  return (int32_t)ReadLE32((const uint8_t*)p_ + offset_);
 }
 
 uint8_t ChartLoaderVOS::BinaryStream::ReadUInt8()
 {
-  return *reinterpret_cast<const uint8_t*>((uint8_t*)p_ + offset_);
+  if (!HasRemain(sizeof(uint8_t))) return 0;
+  return *((const uint8_t*)p_ + offset_);
 }
 
 int32_t ChartLoaderVOS::BinaryStream::GetInt32()
 {
-  int32_t r = *reinterpret_cast<const int32_t*>((uint8_t*)p_ + offset_);
-  offset_ += sizeof(int32_t);
-  ASSERT(offset_ <= len_);
-  return r;
+  return (int32_t)GetUInt32();
 }
 
 uint32_t ChartLoaderVOS::BinaryStream::GetUInt32()
 {
-  uint32_t r = *reinterpret_cast<const uint32_t*>((uint8_t*)p_ + offset_);
+  if (!HasRemain(sizeof(uint32_t))) { offset_ = len_; return 0; }
+  uint32_t r = ReadLE32((const uint8_t*)p_ + offset_);
   offset_ += sizeof(uint32_t);
-  ASSERT(offset_ <= len_);
   return r;
 }
 
 uint16_t ChartLoaderVOS::BinaryStream::GetUInt16()
 {
-  uint16_t r = *reinterpret_cast<const uint16_t*>((uint8_t*)p_ + offset_);
+  if (!HasRemain(sizeof(uint16_t))) { offset_ = len_; return 0; }
+  uint16_t r = ReadLE16((const uint8_t*)p_ + offset_);
   offset_ += sizeof(uint16_t);
-  ASSERT(offset_ <= len_);
   return r;
 }
 
 uint8_t ChartLoaderVOS::BinaryStream::GetUInt8()
 {
-  uint8_t r = *reinterpret_cast<const uint8_t*>((uint8_t*)p_ + offset_);
-  offset_ += sizeof(uint8_t);
-  ASSERT(offset_ <= len_);
-  return r;
+  if (!HasRemain(sizeof(uint8_t))) { offset_ = len_; return 0; }
+  return *((const uint8_t*)p_ + offset_++);
 }
 
 void ChartLoaderVOS::BinaryStream::GetChar(char *out, size_t cnt)
 {
-  memcpy(out, (uint8_t*)p_ + offset_, cnt);
+  if (!HasRemain(cnt))
+  {
+    memset(out, 0, cnt);
+    offset_ = len_;
+    return;
+  }
+  memcpy(out, (const uint8_t*)p_ + offset_, cnt);
   offset_ += cnt;
-  ASSERT(offset_ <= len_);
-}
-
-size_t ChartLoaderVOS::BinaryStream::GetOffset()
-{
-  return offset_;
 }
 
-inline int GetMSFixedInt_internal(const uint8_t *p, uint8_t len)
+size_t ChartLoaderVOS::BinaryStream::GetRemain() const
 {
-  int r = 0;
-  for (int i = 0; i < len; i++)
-  {
-    r = (r << 8) + *p;
-    p++;
-  }
-  return r;
+  return offset_ < len_ ? len_ - offset_ : 0;
 }
 
-int ChartLoaderVOS::BinaryStream::GetMSFixedInt(uint8_t bytesize)
+bool ChartLoaderVOS::BinaryStream::HasRemain(size_t cnt) const
 {
-  int r = GetMSFixedInt_internal((uint8_t*)p_ + offset_, bytesize);
-  offset_ += bytesize;
-  return r;
+  return cnt <= GetRemain();
 }
 
-int ChartLoaderVOS::BinaryStream::GetMSInt()
+const uint8_t* ChartLoaderVOS::BinaryStream::GetPtr() const
 {
-  int r = 0;
-  bool cont_flag = false;
-  do
-  {
-    cont_flag = *((uint8_t*)p_ + offset_) & 0x80;
-    r = (r << 7) + (*((uint8_t*)p_ + offset_) & 0x7F);
-    offset_++;
-  } while (cont_flag);
-  return r;
+  return (const uint8_t*)p_ + offset_;
 }
 
-MIDISIG ChartLoaderVOS::BinaryStream::GetMidiSignature(MIDIProgramInfo &mprog)
+size_t ChartLoaderVOS::BinaryStream::GetOffset()
 {
-  MIDISIG r = MIDISIG::MIDISIG_OTHERS;
-  mprog.cmd = GetUInt8();
-  mprog.a = mprog.b = 0;
-  mprog.len = 0;
-  mprog.text.clear();
-  char buf[256];
-
-  // check SYSEX event first
-  if (mprog.cmd == 0xF0 || mprog.cmd == 0xF7)
-  {
-    // XXX: informing necessary?
-    std::cerr << "MIDI Sysex event found, going to be ignored." << std::endl;
-    mprog.len = GetMSInt();
-    GetChar(buf, mprog.len);
-    mprog.text = std::string(buf, mprog.len);
-    return MIDISIG::MIDISIG_SYSEX;
-  }
-
-  if (mprog.cmd < 0x80)
-  {
-    // running status. use previous command
-    ASSERT(mprog.lastcmd > 0);
-    mprog.a = mprog.cmd;
-    mprog.cmd = mprog.lastcmd;
-  }
-  else
-  {
-    mprog.lastcmd = mprog.cmd;
-    mprog.a = GetUInt8();
-  }
-
-  // check for meta event
-  if (mprog.cmd == 0xFF)
-  {
-    // basic form of meta event
-    mprog.len = GetMSInt();
-    GetChar(buf, mprog.len);
-    mprog.text = std::string(buf, mprog.len);
-
-    // check for some special commands (TEMPO, EOT)
-    if (mprog.a == 0x2F) return MIDISIG::MIDISIG_END;
-    else if (mprog.a == 0x51) return MIDISIG::MIDISIG_TEMPO;
-    else if (mprog.a == 0x58) return MIDISIG::MIDISIG_MEASURE;
-    else return MIDISIG::MIDISIG_META_OTHERS;
-  }
-
-  // check voice message: if it is necessary to parse second parameter
-  switch ((mprog.cmd >> 4) & 0x07)
-  {
-  case 0: /* Note off */
-  case 1: /* Note on */
-  case 2: /* Key pressure */
-  case 3: /* Control change */
-  case 6: /* Pitch wheel */
-    mprog.b = GetUInt8();
-    break;
-  }
-
-#if 0
-  if (mprog.cmd < 0xF0)
-    r = MIDISIG::MIDISIG_PROGRAM;
-#endif
-
-  return r;
+  return offset_;
 }
 
 bool ChartLoaderVOS::BinaryStream::IsEnd()
@@ -326,7 +223,7 @@ bool ChartLoaderVOS::ParseMetaDataV2()
 
   // common part: 16 channels for midi
   for (size_t i = 0; i < 16; ++i)
-    md.GetSoundChannel()->fn[i] = "midi";
+    md.GetSoundChannel()->Set(i, "midi");
 
   // 4 byte: filename length
   int fnamelen = stream.GetInt32();
@@ -383,7 +280,7 @@ bool ChartLoaderVOS::ParseMetaDataV3()
 
   // common part: 16 channels for midi
   for (size_t i = 0; i < 16; ++i)
-    md.GetSoundChannel()->fn[i] = "midi";
+    md.GetSoundChannel()->Set(i, "midi");
 
   int headersize = stream.GetInt32();
   stream.SeekCur(4);  // inf; static flag
@@ -443,6 +340,11 @@ bool ChartLoaderVOS::ParseNoteDataV2()
   int playmode = 0;   // SP or DP ...
   int level = 0;
   std::string title;
+  if (cnt_inst < 0 || cnt_inst > 20 || cnt_chart < 0)
+  {
+    Report(DiagnosticCodes::kVosInvalidData);
+    return false;
+  }
   for (int i=0; i<cnt_inst; i++) {
     stream.SeekCur(1);
     midichannel_per_track[i] = stream.GetInt32();
@@ -451,87 +353,105 @@ bool ChartLoaderVOS::ParseNoteDataV2()
     playmode = stream.GetUInt8();  // SP=0, DP=1
     level = stream.GetUInt8(); level++;
     uint16_t len = stream.GetUInt16();
+    if (len >= sizeof(buf)) return false;
     stream.GetChar(buf, len);
-    title = buf;
+    title.assign(buf, len);
     // track index? (int 0)
     stream.SeekCur(4);
   }
 
   // parse note objects per each channels.
   // (includes BGM/autoplay objects)
-  std::vector<VOSNoteDataV2*> vnotes;
-  VOSNoteDataV2* vnote_tappable[65536];
-  VOSNoteDataV2* vnote;
-  size_t _tappable_cnt = 0;
+  // records are packed (no struct padding), so decode them field by field
+  // after validating record count with remaining bytes once.
+  std::vector<VOSNoteDataV2> vnotes;
+  std::vector<size_t> vnote_tappable;
   auto &nd = chart_->GetNoteData();
   auto &bgm = chart_->GetBgmData();
   for (int i=0; i<cnt_inst; i++) {
     int channel = i;
     int notecnt = stream.GetInt32();
-    for (int j=0; j<notecnt; j++) {
-      vnote = new VOSNoteDataV2();
-      /** cannot do memcpy due to struct padding. */
-      vnote->dummy = stream.GetUInt8();       // always zero
-      vnote->time = static_cast<uint32_t>(stream.GetUInt32() * kVOSTimeConstant);
-      vnote->pitch = stream.GetUInt16();
-      vnote->volume = stream.GetUInt8();
-      vnote->istappable = stream.GetUInt8();
-      vnote->issoundable = stream.GetUInt8();
-      vnote->islongnote = stream.GetUInt8();
-      vnote->duration = static_cast<uint32_t>(stream.GetUInt32() * kVOSTimeConstant);
-      vnote->dummy2 = stream.GetUInt8();      // 00 ~ 04? unknown
-      vnote->lane = 0;
-      vnote->inst = channel;
+    if (notecnt < 0 || !stream.HasRemain((size_t)notecnt * kVOSNoteDataV2Size))
+    {
+      Report(DiagnosticCodes::kVosInvalidData);
+      return false;
+    }
+    vnotes.reserve(vnotes.size() + notecnt);
+    const uint8_t *p = stream.GetPtr();
+    for (int j=0; j<notecnt; j++, p += kVOSNoteDataV2Size) {
+      VOSNoteDataV2 vnote;
+      vnote.dummy = p[0];             // always zero
+      vnote.time = static_cast<uint32_t>(ReadLE32(p + 1) * kVOSTimeConstant);
+      vnote.pitch = ReadLE16(p + 5);
+      vnote.volume = p[7];
+      vnote.istappable = p[8];
+      vnote.issoundable = p[9];
+      vnote.islongnote = p[10];
+      vnote.duration = static_cast<uint32_t>(ReadLE32(p + 11) * kVOSTimeConstant);
+      vnote.dummy2 = p[15];           // 00 ~ 04? unknown
+      vnote.lane = 0;
+      vnote.inst = channel;
+      if (vnote.istappable)
+        vnote_tappable.push_back(vnotes.size());
       vnotes.push_back(vnote);
-      if (vnote->istappable)
-        vnote_tappable[_tappable_cnt++] = vnote;
     }
+    stream.SeekCur((size_t)notecnt * kVOSNoteDataV2Size);
   }
 
   /** Actual playable note segment */
   ASSERT(stream.ReadInt32() == 0);
   stream.SeekCur(4);                      // empty int32
   uint32_t seg_cnt = stream.GetUInt32();  // note segment count
-  ASSERT(seg_cnt == _tappable_cnt);
+  ASSERT(seg_cnt == vnote_tappable.size());
+  if (!stream.HasRemain((size_t)seg_cnt * 6))
+  {
+    Report(DiagnosticCodes::kVosInvalidData);
+    return false;
+  }
 
-  for (size_t i = 0; i < seg_cnt; i++)
+  const uint8_t *p_seg = stream.GetPtr();
+  for (size_t i = 0; i < seg_cnt; i++, p_seg += 6)
   {
-    uint8_t inst_idx = stream.GetUInt8();   // seems like instrument channel?
-    uint32_t idx = stream.GetUInt32();      // idx for instrument channel
-    uint8_t lane = stream.GetUInt8();
-    //std::cout << (int)lane << "," << (int)ln_size << ",idx:" << (int)idx << std::endl;
-    vnote_tappable[i]->lane = lane;
+    // 1 byte: seems like instrument channel?
+    // 4 byte: idx for instrument channel
+    uint8_t lane = p_seg[5];
+    if (i < vnote_tappable.size())
+      vnotes[vnote_tappable[i]].lane = lane;
   }
+  stream.SeekCur((size_t)seg_cnt * 6);
   stream.SeekCur(4);                      // some unknown bytes
 
   uint32_t lyrics_cnt = stream.GetUInt32();
-  for (size_t i = 0; i < lyrics_cnt; i++)
+  for (size_t i = 0; i < lyrics_cnt && !stream.IsEnd(); i++)
   {
     uint32_t time = stream.GetUInt32();
     uint8_t lyric_len = stream.GetUInt8();
-    stream.GetChar(buf, lyric_len);
+    stream.SeekCur(lyric_len);
   }
   
-  /** Append data to NoteData and cleanup */
+  /** Append data to NoteData in time order, as out-of-order insertion
+   *  into Track costs O(n) per note. */
+  std::stable_sort(vnotes.begin(), vnotes.end(),
+    [](const VOSNoteDataV2 &a, const VOSNoteDataV2 &b) { return a.time < b.time; });
   NoteElement ne;
-  for (auto *p : vnotes)
+  for (const auto &vnote : vnotes)
   {
-    unsigned track = p->lane;
-    if (p->istappable)
+    unsigned track = vnote.lane;
+    if (vnote.istappable && track < nd.get_track_count())
     {
       // midi time --> beat position
-      ne.set_measure(p->time / (double)timedivision_ / 4.0);
+      ne.set_measure(vnote.time / (double)timedivision_ / 4.0);
       auto &sprop = ne.get_property_sound();
-      sprop.volume = p->volume / 127.0f;
-      sprop.key = p->pitch;
-      sprop.length = p->duration;
-      ne.set_value(p->inst);
-      if (p->islongnote)
+      sprop.volume = vnote.volume / 127.0f;
+      sprop.key = vnote.pitch;
+      sprop.length = vnote.duration;
+      ne.set_value(vnote.inst);
+      if (vnote.islongnote)
       {
         ne.set_chain_status(NoteChainStatus::Start);
         nd[track].AddNoteElement(ne);
         // XXX: length is not correct ...
-        ne.set_measure(ne.measure() + p->duration / (double)timedivision_ / 4.0);
+        ne.set_measure(ne.measure() + vnote.duration / (double)timedivision_ / 4.0);
         ne.set_chain_status(NoteChainStatus::End);
         nd[track].AddNoteElement(ne);
       }
@@ -543,99 +463,111 @@ bool ChartLoaderVOS::ParseNoteDataV2()
     }
     else
     {
-      ne.set_measure(p->time / (double)timedivision_ / 4.0);
+      ne.set_measure(vnote.time / (double)timedivision_ / 4.0);
       auto &sprop = ne.get_property_sound();
-      sprop.volume = p->volume / 127.0f;
-      sprop.key = p->pitch;
-      sprop.length = p->duration;
-      ne.set_value(p->inst);
+      sprop.volume = vnote.volume / 127.0f;
+      sprop.key = vnote.pitch;
+      sprop.length = vnote.duration;
+      ne.set_value(vnote.inst);
+      ne.set_chain_status(NoteChainStatus::Tap);
       bgm[0].AddNoteElement(ne);
     }
   }
-  for (auto* p : vnotes)
-    delete p;
-
   return true;
 }
 
 bool ChartLoaderVOS::ParseNoteDataV3()
 {
   // start to read note data
-  VOSNoteDataV3 note;
+  std::vector<VOSNoteDataV3> vnotes;
   NoteElement ne;
   uint32_t cnt;
   auto &nd = chart_->GetNoteData();
   auto &bgm = chart_->GetBgmData();
   size_t segment_idx = 0;   // maybe midi channel no?
 
-  while (stream.GetOffset() < vos_v3_midi_offset_) {
+  while (stream.GetOffset() < vos_v3_midi_offset_ && !stream.IsEnd()) {
     int midiinstrument = stream.GetInt32();
     cnt = stream.GetUInt32();
     stream.SeekCur(14);
+    if (!stream.HasRemain((size_t)cnt * kVOSNoteDataV3Size))
+    {
+      Report(DiagnosticCodes::kVosInvalidData);
+      return false;
+    }
 
-    for (unsigned i=0; i<cnt; i++) {
-      note.time = static_cast<uint32_t>(stream.GetUInt32() * kVOSTimeConstant);
-      note.duration = static_cast<uint32_t>(stream.GetUInt32() * kVOSTimeConstant);
-      note.midicmd = stream.GetUInt8();
-      note.midikey = stream.GetUInt8();
-      note.vol = stream.GetUInt8();
-      note.type = stream.GetUInt16();
-
-      uint8_t istappable = (note.type & 0b010000000) > 0;
-      uint8_t islongnote = (note.type & 0b01000000000000000) > 0;
-      uint8_t keybits = (note.type >> 4) & 0b0111;
-      bool is_tap = (segment_idx == 16 && istappable);
-      unsigned channel = (note.midicmd & 0x0F);
-
-      ne.set_measure(note.time / (double)timedivision_ / 4.0);
-      auto &sprop = ne.get_property_sound();
-      sprop.volume = note.vol / 127.0f;
-      sprop.key = note.midikey;
-      sprop.length = note.duration;
-      ne.set_value(channel);
-      //sprop.channel = channel;
+    vnotes.reserve(vnotes.size() + cnt);
+    const uint8_t *p = stream.GetPtr();
+    for (unsigned i=0; i<cnt; i++, p += kVOSNoteDataV3Size) {
+      VOSNoteDataV3 note;
+      note.time = static_cast<uint32_t>(ReadLE32(p) * kVOSTimeConstant);
+      note.duration = static_cast<uint32_t>(ReadLE32(p + 4) * kVOSTimeConstant);
+      note.midicmd = p[8];
+      note.midikey = p[9];
+      note.vol = p[10];
+      note.type = ReadLE16(p + 11);
+      note.segment = static_cast<uint8_t>(segment_idx);
+      vnotes.push_back(note);
+    }
+    stream.SeekCur((size_t)cnt * kVOSNoteDataV3Size);
+    segment_idx++;
+  }
+  ASSERT(segment_idx == 17);
 
-      if (is_tap)
+  /** Append data to NoteData in time order (same as V2) */
+  std::stable_sort(vnotes.begin(), vnotes.end(),
+    [](const VOSNoteDataV3 &a, const VOSNoteDataV3 &b) { return a.time < b.time; });
+  for (const auto &note : vnotes) {
+    uint8_t istappable = (note.type & 0b010000000) > 0;
+    uint8_t islongnote = (note.type & 0b01000000000000000) > 0;
+    uint8_t keybits = (note.type >> 4) & 0b0111;
+    bool is_tap = (note.segment == 16 && istappable);
+    unsigned channel = (note.midicmd & 0x0F);
+
+    ne.set_measure(note.time / (double)timedivision_ / 4.0);
+    auto &sprop = ne.get_property_sound();
+    sprop.volume = note.vol / 127.0f;
+    sprop.key = note.midikey;
+    sprop.length = note.duration;
+    ne.set_value(channel);
+    //sprop.channel = channel;
+
+    if (is_tap)
+    {
+      if (islongnote)
       {
-        if (islongnote)
-        {
-          ne.set_chain_status(NoteChainStatus::Start);
-          nd[keybits].AddNoteElement(ne);
-          // XXX: need to be fixed
-          ne.set_chain_status(NoteChainStatus::End);
-          ne.set_measure(ne.measure() + note.duration / (double)timedivision_ / 4.0);
-          nd[keybits].AddNoteElement(ne);
-        }
-        else
-        {
-          ne.set_chain_status(NoteChainStatus::Tap);
-          nd[keybits].AddNoteElement(ne);
-        }
+        ne.set_chain_status(NoteChainStatus::Start);
+        nd[keybits].AddNoteElement(ne);
+        // XXX: need to be fixed
+        ne.set_chain_status(NoteChainStatus::End);
+        ne.set_measure(ne.measure() + note.duration / (double)timedivision_ / 4.0);
+        nd[keybits].AddNoteElement(ne);
       }
       else
       {
-        bgm[0].AddNoteElement(ne);
+        ne.set_chain_status(NoteChainStatus::Tap);
+        nd[keybits].AddNoteElement(ne);
       }
     }
-    segment_idx++;
+    else
+    {
+      ne.set_chain_status(NoteChainStatus::Tap);
+      bgm[0].AddNoteElement(ne);
+    }
   }
-  ASSERT(segment_idx == 17);
 
   return true;
 }
 
 bool ChartLoaderVOS::ParseMIDI()
 {
-  char buf[256];
-  char *buf_midi = (char*)malloc(65536);
-
   switch (vos_version_)
   {
   case 2:
   {
     // in case of version 2, skip file name.
     uint32_t fnamelen = stream.GetUInt32();
-    stream.GetChar(buf, fnamelen);
+    stream.SeekCur(fnamelen);
     stream.GetUInt32(); // filesize
     break;
   }
@@ -646,17 +578,15 @@ bool ChartLoaderVOS::ParseMIDI()
     ASSERT(0);
   }
 
-  // MUST start from MThd signature
-  stream.GetChar(buf, 4);
-  if (memcmp(buf, "MThd", 4) != 0) {
-    std::cerr << "[VOSLoader] Invalid MIDI start signature" << std::endl;
+  MidiFile midi;
+  if (!midi.Parse(stream.GetPtr(), stream.GetRemain()))
+  {
+    Report(DiagnosticCodes::kVosInvalidData);
     return false;
   }
-  stream.SeekCur(5);  // len: 00 00 00 06
-  uint16_t format = stream.GetUInt16();       // always 1
-  ASSERT(format == 1);
-  uint16_t trackcount = stream.GetUInt16();
-  uint32_t timedivision = stream.GetUInt8();  // tick size
+  stream.SeekCur(midi.size());
+
+  uint32_t timedivision = midi.timedivision();  // tick size
   if (timedivision_ != timedivision)
   {
     double ratio = (double)timedivision_ / timedivision;
@@ -669,79 +599,47 @@ bool ChartLoaderVOS::ParseMIDI()
     }
     timedivision_ = timedivision;
   }
-  double cur_measure = 0;
 
-  auto &td = chart_->GetTimingData();
-  auto &nd = chart_->GetNoteData();
-  auto &cd = chart_->GetCommandData();
-  uint32_t val, val2;
-  NoteElement ne;
+  // VOS tempo is based on 120 tick per beat.
+  midi.FillTimingData(chart_->GetTimingData(), 120.0 / timedivision);
 
-  int trackidx = 0;
-  do {  /* loop for each MIDI file */
-    stream.GetChar(buf, 4);
-    if (memcmp(buf, "MTrk", 4) != 0)
-      break;
-
-    uint32_t tracksize = stream.GetMSFixedInt();
-    uint32_t offset_cur = stream.GetOffset();
-
-    MIDISIG midisig = MIDISIG::MIDISIG_DUMMY;
-    MIDIProgramInfo mprog;
-    int delta = 0;  // delta tick(position) from previous event.
-    int ticks = 0;  // current midi event position (tick). 480 tick: 1 measure (4 beat), mostly.
-    bool is_midisegment_end = false;
-
-    do { /* loop for each MIDI command in MIDI file */
-      delta = stream.GetMSInt();
-      midisig = stream.GetMidiSignature(mprog);
-      ticks += delta;
-      cur_measure = (double)ticks / timedivision / 4.0;
-      ne.set_measure(cur_measure);
-#if 0
-      std::cout << (int)ticks << "/" << (int)mprog.cmd << " "
-        << (int)mprog.a << " "
-        << (int)mprog.b << std::endl;
-#endif
-      ASSERT(stream.GetOffset() <= offset_cur + tracksize);
+  // positions so far are linear to beat (4 beat per measure);
+  // convert them into measure position with time signatures.
+  if (!midi.GetTimeSignatures().empty())
+  {
+    TrackData *tracks[] = {
+      &chart_->GetNoteData(), &chart_->GetBgmData(), &chart_->GetTimingData() };
+    for (auto *td : tracks)
+    {
+      for (size_t i = 0; i < td->get_track_count(); ++i)
+        for (auto &n : (*td)[i])
+          n.set_measure(midi.GetMeasure(n.measure()));
+    }
+    midi.FillMeasureLength(chart_->GetTimingData());
+  }
 
-      switch (midisig)
-      {
-      case MIDISIG::MIDISIG_TEMPO:
-        val = GetMSFixedInt_internal((uint8_t*)mprog.text.c_str(), 3);
-        ne.set_value(60'000'000 / timedivision * 120 / (double)val);
-        td[TimingTrackTypes::kBpm].AddNoteElement(ne);
-        break;
-      case MIDISIG::MIDISIG_MEASURE:
-        val = mprog.text.c_str()[0];
-        val2 = mprog.text.c_str()[1];
-        ne.set_value(val / val2);
-        td[TimingTrackTypes::kMeasure].AddNoteElement(ne);
-        break;
-      case MIDISIG::MIDISIG_END:
-        is_midisegment_end = true;
-        break;
-      case MIDISIG::MIDISIG_SYSEX:
-        // ignore
-        break;
-      case MIDISIG::MIDISIG_META_OTHERS:
-        // ignore other metas
-        break;
-      case MIDISIG::MIDISIG_PROGRAM:
-      case MIDISIG::MIDISIG_OTHERS:
-        // all of other metas & program info
-        ne.set_value(trackidx);
-        ne.set_point(mprog.cmd, mprog.a, mprog.b);
-        cd[CommandTrackTypes::kMidi].AddNoteElement(ne);
-        break;
-      default:
-        ASSERT(0);
-      }
-    } while (!is_midisegment_end);
-    trackidx ++;
-  } while (!stream.IsEnd());
+  // all program events to command track, in tick order.
+  std::vector<std::pair<unsigned, const MidiEvent*> > events;
+  for (size_t i = 0; i < midi.get_track_count(); ++i)
+    for (auto &e : midi.get_track(i).events)
+      if (!e.is_meta() && !e.is_sysex())
+        events.emplace_back((unsigned)i, &e);
+  std::stable_sort(events.begin(), events.end(),
+    [](const std::pair<unsigned, const MidiEvent*>& a,
+       const std::pair<unsigned, const MidiEvent*>& b)
+    { return a.second->tick < b.second->tick; });
+
+  auto &cd = chart_->GetCommandData();
+  NoteElement ne;
+  for (auto &p : events)
+  {
+    const MidiEvent &e = *p.second;
+    ne.set_measure(midi.GetMeasure((double)e.tick / timedivision / 4.0));
+    ne.set_value((int)p.first);
+    ne.set_point(e.cmd, e.a, e.b);
+    cd[CommandTrackTypes::kMidi].AddNoteElement(ne);
+  }
 
-  free(buf_midi);
   return true;
 }
 
@@ -8,54 +8,106 @@ namespace rparser
 
 const char *ChartTypeToStringSafe(CHARTTYPE charttype);
 
+/**
+ * @detail Formats HTML text into reusable buffer.
+ * If sink (FILE / ostream) is given, buffer is flushed to sink
+ * when it grows over kFlushSize, so only small part of document is
+ * kept in memory. Otherwise buffer keeps the whole document.
+ */
 class HTMLWriter
 {
 public:
   HTMLWriter();
+  HTMLWriter(FILE *fp);
+  HTMLWriter(std::ostream *os);
   ~HTMLWriter();
   void AddNode(const char *name, const char *id_ = 0, const char *class_ = 0);
   void AddNodeWithNoChildren(const char *name, const char *id_ = 0, const char *class_ = 0, const char *text_ = 0);
   void AddNodeWithNoChildren(const char *name, const char *id_, const char *class_, const std::string &s);
   void AddRawText(const char *text);
   void PopNode();
-  std::stringstream &ss();
-  std::string str() const;
+  HTMLWriter &out();
+  HTMLWriter &operator<<(const char *s);
+  HTMLWriter &operator<<(const std::string &s);
+  HTMLWriter &operator<<(char c);
+  HTMLWriter &operator<<(int v);
+  HTMLWriter &operator<<(unsigned v);
+  HTMLWriter &operator<<(long v);
+  HTMLWriter &operator<<(unsigned long v);
+  HTMLWriter &operator<<(long long v);
+  HTMLWriter &operator<<(unsigned long long v);
+  HTMLWriter &operator<<(double v);
+  void Flush(bool force = false);
+  bool good() const;
+  std::string release();
 private:
-  std::stringstream ss_;
-  std::list<std::string> tag_stack_;
+  void indent();
+  void write_uint(unsigned long long v);
+
+  static constexpr size_t kFlushSize = 64 * 1024;
+  std::string buf_;
+  FILE *fp_;
+  std::ostream *os_;
+  bool good_;
+  // tag names are expected to be string literals.
+  std::vector<const char*> tag_stack_;
 };
 
-HTMLWriter::HTMLWriter() {}
+HTMLWriter::HTMLWriter() : fp_(nullptr), os_(nullptr), good_(true) {}
+
+HTMLWriter::HTMLWriter(FILE *fp) : fp_(fp), os_(nullptr), good_(fp != nullptr)
+{
+  buf_.reserve(kFlushSize * 2);
+}
+
+HTMLWriter::HTMLWriter(std::ostream *os) : fp_(nullptr), os_(os), good_(os != nullptr)
+{
+  buf_.reserve(kFlushSize * 2);
+}
+
+HTMLWriter::~HTMLWriter()
+{
+  Flush(true);
+}
 
-HTMLWriter::~HTMLWriter() {}
+void HTMLWriter::indent()
+{
+  buf_.append(tag_stack_.size(), '\t');
+}
 
 void HTMLWriter::AddNode(const char *name, const char *id_, const char *class_)
 {
-  for (unsigned i = 0; i < tag_stack_.size(); ++i)
-    ss_ << "\t";
-  ss_ << "<" << name;
+  indent();
+  buf_ += '<'; buf_ += name;
   if (id_)
-    ss_ << " id='" << id_ << "'";
+  {
+    buf_ += " id='"; buf_ += id_; buf_ += '\'';
+  }
   if (class_)
-    ss_ << " class='" << class_ << "'";
-  ss_ << ">" << std::endl;
+  {
+    buf_ += " class='"; buf_ += class_; buf_ += '\'';
+  }
+  buf_ += ">\n";
   tag_stack_.push_back(name);
 }
 
 void HTMLWriter::AddNodeWithNoChildren(const char *name, const char *id_, const char *class_, const char *text_)
 {
-  for (unsigned i = 0; i < tag_stack_.size(); ++i)
-    ss_ << "\t";
-  ss_ << "<" << name;
+  indent();
+  buf_ += '<'; buf_ += name;
   if (id_)
-    ss_ << " id='" << id_ << "'";
+  {
+    buf_ += " id='"; buf_ += id_; buf_ += '\'';
+  }
   if (class_)
-    ss_ << " class='" << class_ << "'";
+  {
+    buf_ += " class='"; buf_ += class_; buf_ += '\'';
+  }
   if (text_)
   {
-    ss_ << ">" << text_ << "<" << name;
+    buf_ += '>'; buf_ += text_; buf_ += '<'; buf_ += name;
   }
-  ss_ << "/>" << std::endl;
+  buf_ += "/>\n";
 }
 
 void HTMLWriter::AddNodeWithNoChildren(const char *name, const char *id_, const char *class_, const std::string &s)
@@ -65,34 +117,140 @@ void HTMLWriter::AddNodeWithNoChildren(const char *name, const char *id_, const
 
 void HTMLWriter::AddRawText(const char *text)
 {
-  ss() << text << std::endl;
+  out() << text << '\n';
 }
 
-std::stringstream &HTMLWriter::ss()
+HTMLWriter &HTMLWriter::out()
 {
-  for (unsigned i = 0; i < tag_stack_.size(); ++i)
-    ss_ << "\t";
-  return ss_;
+  indent();
+  return *this;
 }
 
 void HTMLWriter::PopNode()
 {
   ASSERT(!tag_stack_.empty());
-  for (unsigned i = 0; i < tag_stack_.size(); ++i)
-    ss_ << "\t";
-  ss_ << "<" << tag_stack_.back() << "/>" << std::endl;
+  indent();
+  buf_ += '<'; buf_ += tag_stack_.back(); buf_ += "/>\n";
   tag_stack_.pop_back();
 }
 
-std::string HTMLWriter::str() const
+HTMLWriter &HTMLWriter::operator<<(const char *s) { buf_ += s; return *this; }
+HTMLWriter &HTMLWriter::operator<<(const std::string &s) { buf_ += s; return *this; }
+HTMLWriter &HTMLWriter::operator<<(char c) { buf_ += c; return *this; }
+HTMLWriter &HTMLWriter::operator<<(int v) { return *this << (long long)v; }
+HTMLWriter &HTMLWriter::operator<<(unsigned v) { write_uint(v); return *this; }
+HTMLWriter &HTMLWriter::operator<<(long v) { return *this << (long long)v; }
+HTMLWriter &HTMLWriter::operator<<(unsigned long v) { write_uint(v); return *this; }
+HTMLWriter &HTMLWriter::operator<<(unsigned long long v) { write_uint(v); return *this; }
+
+HTMLWriter &HTMLWriter::operator<<(long long v)
+{
+  if (v < 0)
+  {
+    buf_ += '-';
+    write_uint(0ull - (unsigned long long)v);
+  }
+  else write_uint((unsigned long long)v);
+  return *this;
+}
+
+void HTMLWriter::write_uint(unsigned long long v)
+{
+  char s[24];
+  char *p = s + sizeof(s);
+  do {
+    *--p = '0' + (char)(v % 10);
+    v /= 10;
+  } while (v);
+  buf_.append(p, s + sizeof(s) - p);
+}
+
+/* @brief same output as printf("%g") (6 significant digits). */
+HTMLWriter &HTMLWriter::operator<<(double v)
+{
+  static const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  static const unsigned long long kPow10i[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull,
+    1000000ull, 10000000ull, 100000000ull, 1000000000ull };
+  const double a = v < 0 ? -v : v;
+
+  if (a == 0)
+  {
+    buf_ += (std::signbit(v) ? "-0" : "0");
+    return *this;
+  }
+
+  // fast path: fixed notation range of %g.
+  if (a >= 1e-4 && a < 1e6)
+  {
+    int e = 0;
+    if (a >= 1.0)
+      while (e < 5 && a >= kPow10[e + 1]) e++;
+    else
+      while (e > -4 && a < 1.0 / kPow10[-e]) e--;
+    const int decimals = 5 - e;
+    const unsigned long long scaled = (unsigned long long)std::nearbyint(a * kPow10[decimals]);
+    // rounded up to 7 digits (e.g. 999999.5); leave it to printf.
+    if (scaled < 1000000ull)
+    {
+      unsigned long long ipart = scaled / kPow10i[decimals];
+      unsigned long long fpart = scaled % kPow10i[decimals];
+      if (v < 0) buf_ += '-';
+      write_uint(ipart);
+      if (fpart)
+      {
+        char s[12];
+        int len = decimals;
+        while (fpart % 10 == 0) fpart /= 10, len--;
+        for (int i = len - 1; i >= 0; --i, fpart /= 10)
+          s[i] = '0' + (char)(fpart % 10);
+        buf_ += '.';
+        buf_.append(s, len);
+      }
+      return *this;
+    }
+  }
+
+  char s[32];
+  int len = snprintf(s, sizeof(s), "%g", v);
+  buf_.append(s, len);
+  return *this;
+}
+
+void HTMLWriter::Flush(bool force)
+{
+  if (!fp_ && !os_) return;
+  if (buf_.empty() || (!force && buf_.size() < kFlushSize)) return;
+  if (fp_)
+  {
+    if (fwrite(buf_.c_str(), 1, buf_.size(), fp_) != buf_.size())
+      good_ = false;
+  }
+  else
+  {
+    os_->write(buf_.c_str(), buf_.size());
+    if (!os_->good()) good_ = false;
+  }
+  buf_.clear();
+}
+
+bool HTMLWriter::good() const
+{
+  return good_;
+}
+
+std::string HTMLWriter::release()
 {
   // check all tags are finished for safety.
   RPARSER_ASSERT(tag_stack_.empty(), "Tag stack is not emptied.");
 
-  return ss_.str();
+  std::string r;
+  r.swap(buf_);
+  return r;
 }
 
-static inline void DrawLongnote(std::stringstream &ss, size_t &nd_idx, int track,
+static inline void DrawLongnote(HTMLWriter &ss, size_t &nd_idx, int track,
   const std::string &cls, const NoteElement &ne, double start, double end)
 {
   ss << "<div id='nd" << nd_idx << "' class='" << cls << " longnote longnote_begin lane" << track <<
@@ -113,7 +271,7 @@ static inline void DrawLongnote(std::stringstream &ss, size_t &nd_idx, int track
   nd_idx++;
 }
 
-static inline void DrawTapnote(std::stringstream &ss, size_t &nd_idx, int track,
+static inline void DrawTapnote(HTMLWriter &ss, size_t &nd_idx, int track,
   const std::string &cls, const NoteElement &ne, double p)
 {
   ss << "<div id='nd" << nd_idx << "' class='" << cls << " tapnote lane" << track <<
@@ -127,49 +285,39 @@ HTMLExporter::HTMLExporter() {}
 
 HTMLExporter::HTMLExporter(const Chart& c)
 {
-  Analyze(c);
-  GenerateHTML(c);
+  HTMLWriter e;
+  GenerateHTML(c, e);
+  html_ = e.release();
 }
 
-void HTMLExporter::Analyze(const Chart& c)
+bool HTMLExporter::Write(const Chart& c, FILE *fp)
 {
-  auto &nd = c.GetNoteData();
-  auto &tsd = c.GetTimingSegmentData();
-  auto &cd = c.GetCommandData();
-  auto &td = c.GetTimingData();
-  auto &bars = tsd.GetBarObjects();
-  double last_measure = 0;
-
-  // reserve measure size
-  last_measure = std::max(
-    nd.back() ? nd.back()->measure() : 0,
-    td.back() ? td.back()->measure() : 0);
-  measures_.resize((unsigned)last_measure + 1);
-  for (unsigned i = 0; i < measures_.size(); ++i) {
-    measures_[i].length = tsd.GetBarLength(i);
-    measures_[i].nd_.clear();
-    measures_[i].td_.clear();
-  }
-
-  // add note elements by measure
-  for (auto it = nd.begin(); it != nd.end(); ++it) {
-    unsigned umeasure = static_cast<unsigned>(it.get()->measure());
-    unsigned track = it.track();
-    measures_[umeasure].nd_.push_back(std::make_pair(track, it.get()));
-  }
+  HTMLWriter e(fp);
+  if (!e.good()) return false;
+  GenerateHTML(c, e);
+  e.Flush(true);
+  return e.good();
+}
 
-  // add note elements by measure
-  for (auto it = td.begin(); it != td.end(); ++it) {
-    unsigned umeasure = static_cast<unsigned>(it.get()->measure());
-    unsigned track = it.track();
-    measures_[umeasure].td_.push_back(std::make_pair(track, it.get()));
-  }
+bool HTMLExporter::Write(const Chart& c, std::ostream& os)
+{
+  HTMLWriter e(&os);
+  GenerateHTML(c, e);
+  e.Flush(true);
+  return e.good();
 }
 
-void HTMLExporter::GenerateHTML(const Chart& c)
+bool HTMLExporter::Save(const Chart& c, const std::string& path)
 {
-  HTMLWriter e;
+  FILE *fp = rutil::fopen_utf8(path, "wb");
+  if (!fp) return false;
+  bool r = Write(c, fp);
+  fclose(fp);
+  return r;
+}
 
+void HTMLExporter::GenerateHTML(const Chart& c, HTMLWriter& e)
+{
   bool is_longnote[256];
   uint32_t longnote_start_measure[256];
   double longnote_startpos[256];
@@ -189,9 +337,10 @@ void HTMLExporter::GenerateHTML(const Chart& c)
 
   // STEP 0. Container
   {
-    std::stringstream ss;
-    ss << "playtype - " << ChartTypeToStringSafe(c.GetChartType()) << " playlane-" << (int)c.GetPlayLaneCount() << "key";
-    e.AddNode("div", "rhythmus-container", ss.str().c_str());
+    std::string cls = "playtype - ";
+    cls += ChartTypeToStringSafe(c.GetChartType());
+    cls += " playlane-" + std::to_string((int)c.GetPlayLaneCount()) + "key";
+    e.AddNode("div", "rhythmus-container", cls.c_str());
   }
 
   // STEP 1-1. Metadata
@@ -212,35 +361,35 @@ void HTMLExporter::GenerateHTML(const Chart& c)
     e.AddNodeWithNoChildren("span", 0, "text", std::to_string((int)c.GetPlayLaneCount()));
     e.PopNode();
     // meta related with metadata
-    e.ss() << "<span class='desc meta_title'><span class='label'>Title</span><span class='text'>" << md.title <<
+    e.out() << "<span class='desc meta_title'><span class='label'>Title</span><span class='text'>" << md.title <<
       "<span class='meta_subtitle'>" << md.subtitle << "</span>" << "</span></span>";
-    e.ss() << "<span class='desc meta_artist'><span class='label'>Artist</span><span class='text'>" << md.artist <<
+    e.out() << "<span class='desc meta_artist'><span class='label'>Artist</span><span class='text'>" << md.artist <<
       "<span class='meta_subartist'>" << md.subartist << "</span>" << "</span></span>";
-    e.ss() << "<span class='desc meta_level'><span class='label'>Level</span><span class='text'>" << md.level << "</span></span>";
-    e.ss() << "<span class='desc meta_bpm'><span class='label'>BPM</span><span class='text'>" << md.bpm << "</span></span>";
-    e.ss() << "<span class='desc meta_total'><span class='label'>Gauge Total</span><span class='text'>" << md.gauge_total << "</span></span>";
-    e.ss() << "<span class='desc meta_diff'><span class='label'>Difficulty</span><span class='text'>" << md.difficulty << "</span></span>";
+    e.out() << "<span class='desc meta_level'><span class='label'>Level</span><span class='text'>" << md.level << "</span></span>";
+    e.out() << "<span class='desc meta_bpm'><span class='label'>BPM</span><span class='text'>" << md.bpm << "</span></span>";
+    e.out() << "<span class='desc meta_total'><span class='label'>Gauge Total</span><span class='text'>" << md.gauge_total << "</span></span>";
+    e.out() << "<span class='desc meta_diff'><span class='label'>Difficulty</span><span class='text'>" << md.difficulty << "</span></span>";
     // meta related with notedata
-    e.ss() << "<span class='desc meta_notecount'><span class='label'>Note Count</span><span class='text'>" << c.GetScoreableNoteCount() << "</span></span>";
+    e.out() << "<span class='desc meta_notecount'><span class='label'>Note Count</span><span class='text'>" << c.GetScoreableNoteCount() << "</span></span>";
     // meta related with eventdata
-    e.ss() << "<span class='desc meta_eventcount'><span class='label'>Event Count</span><span class='text'>" << cd.size() << "</span></span>";
+    e.out() << "<span class='desc meta_eventcount'><span class='label'>Event Count</span><span class='text'>" << cd.size() << "</span></span>";
     // meta related with tempodata
-    e.ss() << "<span class='desc meta_maxbpm'><span class='label'>Max BPM</span><span class='text'>" << tsd.GetMaxBpm() << "</span></span>";
-    e.ss() << "<span class='desc meta_minbpm'><span class='label'>Min BPM</span><span class='text'>" << tsd.GetMinBpm() << "</span></span>";
-    e.ss() << "<span class='desc meta_isbpmchange'><span class='label'>BPM Change?</span><span class='text'>" << (tsd.HasBpmChange() ? "Yes" : "No") << "</span></span>";
-    e.ss() << "<span class='desc meta_hasstop'><span class='label'>BPM Change?</span><span class='text'>" << (tsd.HasStop() ? "Yes" : "No") << "</span></span>";
-    e.ss() << "<span class='desc meta_haswarp'><span class='label'>STOP?</span><span class='text'>" << (tsd.HasWarp() ? "Yes" : "No") << "</span></span>";
-    e.ss() << "<span class='desc meta_haswarp'><span class='label'>WARP?</span><span class='text'>" << (tsd.HasWarp() ? "Yes" : "No") << "</span></span>";
+    e.out() << "<span class='desc meta_maxbpm'><span class='label'>Max BPM</span><span class='text'>" << tsd.GetMaxBpm() << "</span></span>";
+    e.out() << "<span class='desc meta_minbpm'><span class='label'>Min BPM</span><span class='text'>" << tsd.GetMinBpm() << "</span></span>";
+    e.out() << "<span class='desc meta_isbpmchange'><span class='label'>BPM Change?</span><span class='text'>" << (tsd.HasBpmChange() ? "Yes" : "No") << "</span></span>";
+    e.out() << "<span class='desc meta_hasstop'><span class='label'>BPM Change?</span><span class='text'>" << (tsd.HasStop() ? "Yes" : "No") << "</span></span>";
+    e.out() << "<span class='desc meta_haswarp'><span class='label'>STOP?</span><span class='text'>" << (tsd.HasWarp() ? "Yes" : "No") << "</span></span>";
+    e.out() << "<span class='desc meta_haswarp'><span class='label'>WARP?</span><span class='text'>" << (tsd.HasWarp() ? "Yes" : "No") << "</span></span>";
     uint32_t lasttime = static_cast<uint32_t>(c.GetSongLastObjectTime());
     char lasttime_str[3][3];
     sprintf(lasttime_str[0], "%02d", lasttime / 3600000);
     sprintf(lasttime_str[1], "%02d", lasttime / 60000 % 60);
     sprintf(lasttime_str[2], "%02d", lasttime / 1000 % 60);
-    e.ss() << "<span class='desc meta_songlength'><span class='label'>Song Length</span><span class='text'>" <<
+    e.out() << "<span class='desc meta_songlength'><span class='label'>Song Length</span><span class='text'>" <<
       lasttime_str[0] << ":" << lasttime_str[1] << ":" << lasttime_str[2] << "</span></span>";
     // meta - BMS conditional statements
     if (!md.script.empty()) {
-      e.ss() << "<span class='desc meta_script'><span class='label'>Script</span><span class='text'>...</span><span class='text hide'>" <<
+      e.out() << "<span class='desc meta_script'><span class='label'>Script</span><span class='text'>...</span><span class='text hide'>" <<
         md.script << "</span></span>";
     }
   }
@@ -252,53 +401,66 @@ void HTMLExporter::GenerateHTML(const Chart& c)
     e.AddNodeWithNoChildren("span", 0, "title", "Resource Info");
 
     e.AddNode("ul", "soundresource");
-    for (auto ii : md.GetSoundChannel()->fn) {
-      e.ss() << "<li data-channel='" << ii.first << "' data-value='" << ii.second <<
+    for (const auto &ii : md.GetSoundChannel()->fn) {
+      e.out() << "<li data-channel='" << ii.first << "' data-value='" << ii.second <<
         "' >Channel " << ii.first << ", " << ii.second << "</li>";
     }
     e.PopNode();
 
     e.AddNode("ul", "bgaresource");
-    for (auto ii : md.GetBGAChannel()->bga) {
-      e.ss() << "<li data-channel='" << ii.first << "' data-value='" << ii.second.fn <<
+    for (const auto &ii : md.GetBGAChannel()->bga) {
+      e.out() << "<li data-channel='" << ii.first << "' data-value='" << ii.second.fn <<
         "' >Channel " << ii.first << ", " << ii.second.fn << "</li>";
     }
     e.PopNode();
 
     e.AddNode("ul", "bpmresource");
-    for (auto ii : md.GetBPMChannel()->bpm) {
-      e.ss() << "<li data-channel='" << ii.first << "' data-value='" << ii.second <<
+    for (const auto &ii : md.GetBPMChannel()->bpm) {
+      e.out() << "<li data-channel='" << ii.first << "' data-value='" << ii.second <<
         "' >Channel " << ii.first << ", " << ii.second << "</li>";
     }
     e.PopNode();
 
     e.AddNode("ul", "stopresource");
-    for (auto ii : md.GetSTOPChannel()->stop) {
-      e.ss() << "<li data-channel='" << ii.first << "' data-value='" << ii.second <<
+    for (const auto &ii : md.GetSTOPChannel()->stop) {
+      e.out() << "<li data-channel='" << ii.first << "' data-value='" << ii.second <<
         "' >Channel " << ii.first << ", " << ii.second << "</li>";
     }
     e.PopNode();
   }
   e.PopNode(); /* div.resourcedata */
+  e.Flush();
 
   // STEP 2. Render objects (base object)
-  // each measure has each div box
+  // each measure has each div box, written measure by measure
+  // while iterating notes in order.
   // TODO: Display CommandData object
 
   e.AddNode("div", "content notedata flip", "notedata");
   note_cls = "chartobject noteobject";
 
-  for (unsigned i = 0; i < measures_.size(); ++i) {
+  const unsigned measure_count = (unsigned)std::max(
+    nd.back() ? nd.back()->measure() : 0,
+    td.back() ? td.back()->measure() : 0) + 1;
+  auto nd_it = nd.begin();
+  auto td_it = td.begin();
+  const auto nd_end = nd.end();
+  const auto td_end = td.end();
+
+  for (unsigned i = 0; i < measure_count; ++i) {
+    const double measure_end = (double)(i + 1);
+
     // measure start.
-    e.ss() << "<div id='measure" << i << "' class='measurebox'" <<
-      " data-measure=" << i << " data-length=" << measures_[i].length << " data-beat=" << i << ">";
+    e.out() << "<div id='measure" << i << "' class='measurebox'" <<
+      " data-measure=" << i << " data-length=" << tsd.GetBarLength(i) << " data-beat=" << i << ">";
     e.AddNode("div", 0, "inner");
-    e.ss() << "<div class='measureno'>" << i << "</div>";
+    e.out() << "<div class='measureno'>" << i << "</div>";
 
     // STEP 2-1. NoteData
-    for (auto& p : measures_[i].nd_) {
-      unsigned lane = p.first;
-      const auto &n = *p.second;
+    note_cls = "chartobject noteobject";
+    for (; nd_it != nd_end && nd_it.get()->measure() < measure_end; ++nd_it) {
+      unsigned lane = nd_it.track();
+      const auto &n = *nd_it.get();
       double ypos = n.measure() - (double)i;
       last_note[lane] = &n;
 
@@ -310,44 +472,43 @@ void HTMLExporter::GenerateHTML(const Chart& c)
         continue;
       }
 
-      bool is_longnote_end = is_longnote[i] && n.chain_status() == NoteChainStatus::End;
+      bool is_longnote_end = is_longnote[lane] && n.chain_status() == NoteChainStatus::End;
       if (is_longnote_end) /* check is longnote */ {
-        DrawLongnote(e.ss(), nd_idx, lane, note_cls, n, longnote_startpos[i], ypos);
-        is_longnote[i] = false;
+        DrawLongnote(e.out(), nd_idx, lane, note_cls, n, longnote_startpos[lane], ypos);
+        is_longnote[lane] = false;
       }
       else {
-        DrawTapnote(e.ss(), nd_idx, lane, note_cls, n, ypos);
+        DrawTapnote(e.out(), nd_idx, lane, note_cls, n, ypos);
       }
     }
 
     /* check for continuing longnote */
     for (size_t llane = 0; llane < nd.get_track_count(); ++llane) {
       if (is_longnote[llane])
-        DrawLongnote(e.ss(), nd_idx, llane, "chartobject noteobject", *last_note[llane], longnote_startpos[llane], 1.0);
+        DrawLongnote(e.out(), nd_idx, llane, "chartobject noteobject", *last_note[llane], longnote_startpos[llane], 1.0);
       longnote_startpos[llane] = 0;
     }
 
     // STEP 2-2. TempoData
     note_cls = "chartobject tempoobject tempotype0";
-    for (auto& p : measures_[i].td_) {
-      note_cls.back() = '0' + (char)i;
-      unsigned lane = p.first;
-      const auto &n = *p.second;
+    for (; td_it != td_end && td_it.get()->measure() < measure_end; ++td_it) {
+      unsigned lane = td_it.track();
+      const auto &n = *td_it.get();
       double ypos = n.measure() - (double)i;
-      DrawTapnote(e.ss(), td_idx, i, note_cls, n, ypos);
+      note_cls.back() = '0' + (char)lane;
+      DrawTapnote(e.out(), td_idx, lane, note_cls, n, ypos);
     }
 
     // measure end.
     e.PopNode();
-    e.ss() << "</div>";
+    e.out() << "</div>";
+    e.Flush();
   }
 
   e.PopNode();
 
   // -- end --
   e.PopNode();
-
-  html_ = e.str();
 }
 
 const std::string& HTMLExporter::toHTML()
@@ -525,7 +686,7 @@ void HRandom(Chart &c, const EffectorParam& param)
   TrackData track_new;
 
   track_new.set_track_count(track_count);
-  auto rows = RowCollection(c.GetNoteData());
+  auto rows = ConstRowCollection(c.GetNoteData());
   int measure_idx = -1;
   for (auto &row : rows) {
     // TODO: Longnote processing?
@@ -576,7 +737,7 @@ void RRandom(Chart &c, const EffectorParam& param, bool mapping_by_measure)
 
   constexpr double time_rotation_delta = 0.072;
 
-  auto rows = RowCollection(c.GetNoteData());
+  auto rows = ConstRowCollection(c.GetNoteData());
   const size_t track_count = c.GetNoteData().get_track_count();
   bool change_mapping = true;
   size_t shift_idx = 0;
@@ -651,7 +812,7 @@ void AllSC(Chart &c, const EffectorParam& param)
   if (sc_idx == -1) return;
 
   track_new.set_track_count(c.GetNoteData().get_track_count());
-  auto rows = RowCollection(c.GetNoteData());
+  auto rows = ConstRowCollection(c.GetNoteData());
   for (auto &row : rows) {
     /* scratch column should be empty. */
     if (row.get(sc_idx) != nullptr)
@@ -660,7 +821,7 @@ void AllSC(Chart &c, const EffectorParam& param)
       bool is_sc_filled = false;
       int colidx = (i + scan_col_start) % param.lanesize;
 
-      NoteElement *n = row.get(colidx);
+      const NoteElement *n = row.get(colidx);
       if (!n) continue;
       if (!is_sc_filled && n->chain_status() == NoteChainStatus::Tap) /* if not longnote */ {
         // then copy note to scratch lane.
@@ -697,13 +858,13 @@ void Flip(Chart &c, const EffectorParam& param)
 
 
 
-template <typename T> NoteElement* RowElement<T>::get(size_t column)
+template <typename T> T* RowElement<T>::get(size_t column)
 {
   for (auto &t : notes) if (t.first == column) return t.second;
   return nullptr;
 }
 
-template <typename T> const NoteElement* RowElement<T>::get(size_t column) const
+template <typename T> const T* RowElement<T>::get(size_t column) const
 {
   for (auto &t : notes) if (t.first == column) return t.second;
   return nullptr;
@@ -714,7 +875,8 @@ RowElementCollection<TD, T>::RowElementCollection(TD& td)
 {
   RowElement<T> row;
   row.pos = 0;
-  for (auto &p : td) {
+  for (auto iter = td.begin(); iter != td.end(); ++iter) {
+    auto p = *iter;
     auto &n = *p.second;
     if (row.pos != n.measure()) {
       if (!row.notes.empty()) {
@@ -764,25 +926,137 @@ typename std::vector<RowElement<T> >::const_iterator RowElementCollection<TD, T>
 { return rows_.end(); }
 
 // Explicit instantiation
+template struct RowElement<NoteElement>;
+template struct RowElement<const NoteElement>;
 template class RowElementCollection<TrackData, NoteElement>;
 template class RowElementCollection<const TrackData, const NoteElement>;
 
 
-ChartProfiler::ChartProfiler() : stop_count_(0), bpm_change_(0) { }
+ChartProfiler::ChartProfiler()
+  : stop_count_(0), bpm_change_(0), avg_density_(0), max_density_(0) { }
 
-ChartProfiler::ChartProfiler(const Chart& c) { Profile(c); }
+ChartProfiler::ChartProfiler(const Chart& c) : ChartProfiler() { Profile(c); }
 
 void ChartProfiler::Profile(const Chart& c)
 {
+  // window size for note density (msec).
+  static const double kDensityWindow[2] = { 1000.0, 4000.0 };
+  struct ProfileNote
+  {
+    double pos;
+    unsigned lane;
+    NoteChainStatus chain;
+  };
+
   const auto &nd = c.GetNoteData();
-  RowElementCollection<TrackData, NoteElement> rows(const_cast<TrackData&>(nd));  // TODO: make support for constant TrackData
+  const auto &tsd = c.GetTimingSegmentData();
+  const auto &segments = tsd.GetTimingSegments();
+
+  name_ = c.GetMetaData().title;
   row_segments_.clear();
-  for (const auto& row : rows) {
+  stop_count_ = 0;
+  bpm_change_ = 0;
+  avg_density_ = 0;
+  max_density_ = 0;
+  for (size_t i = 0; i < segments.size(); ++i)
+  {
+    if (segments[i].stoptime_ > 0) stop_count_++;
+    if (i > 0 && segments[i].bpm_ != segments[i - 1].bpm_) bpm_change_++;
+  }
+
+  // gather notes of all lanes in position order; tracks are already sorted,
+  // so they are merged (notes in same row are in lane order) without sorting.
+  std::vector<ProfileNote> notes;
+  notes.reserve(nd.GetNoteElementCount());
+  for (auto it = nd.begin(); !it.is_end(); ++it)
+  {
+    const NoteElement *n = it.get();
+    notes.push_back(ProfileNote{ n->measure(), (unsigned)it.track(), n->chain_status() });
+  }
+
+  const std::string empty_pattern(nd.get_track_count(), '0');
+  std::vector<unsigned> row_hits;
+  size_t window_head[2] = { 0, 0 };
+  unsigned window_count[2] = { 0, 0 };
+  unsigned total_hits = 0;
+  uint32_t prev_mask[2] = { 0, 0 };
+  size_t tidx = 0, bidx = 0;
+  row_segments_.reserve(notes.size());
+  row_hits.reserve(notes.size());
+
+  for (size_t i = 0; i < notes.size(); )
+  {
     ProfileSegment seg;
-    seg.notes = row.notes.size();
-    // TODO: do proper processing
+    unsigned hits = 0;
+    uint32_t mask = 0, flags = 0;
+    seg.pos = notes[i].pos;
+    seg.notes = 0;
+    seg.pattern = empty_pattern;
+    for (; i < notes.size() && notes[i].pos == seg.pos; ++i)
+    {
+      const auto &n = notes[i];
+      char &p = seg.pattern[n.lane];
+      seg.notes++;
+      switch (n.chain)
+      {
+      case NoteChainStatus::Start:
+        flags |= kPatternLongnote;
+        p = '2';
+        break;
+      case NoteChainStatus::Tap:
+        p = '1';
+        break;
+      default:
+        // longnote body / end is not counted as hit.
+        p = '3';
+        continue;
+      }
+      hits++;
+      if (n.lane < 32) mask |= 1u << n.lane;
+    }
+
+    if (hits >= 2) flags |= kPatternChord;
+    if (mask & prev_mask[0]) flags |= kPatternJack;
+    else if (mask && prev_mask[0] && mask == prev_mask[1]) flags |= kPatternTrill;
+    if (hits)
+    {
+      prev_mask[1] = prev_mask[0];
+      prev_mask[0] = mask;
+    }
+    seg.pattern_i[0] = mask;
+    seg.pattern_i[1] = flags;
+
+    seg.time = tsd.GetTimeFromMeasure(seg.pos, tidx, bidx);
+    seg.bpm = (float)segments[tidx].bpm_;
+    if (row_segments_.empty())
+      seg.delta_time = seg.delta_pos = 0;
+    else
+    {
+      seg.delta_time = seg.time - row_segments_.back().time;
+      seg.delta_pos = seg.pos - row_segments_.back().pos;
+    }
+
+    // sliding window: drop rows older than window size.
+    row_hits.push_back(hits);
+    total_hits += hits;
+    for (unsigned w = 0; w < 2; ++w)
+    {
+      window_count[w] += hits;
+      while (row_segments_.size() > window_head[w] &&
+             row_segments_[window_head[w]].time <= seg.time - kDensityWindow[w])
+        window_count[w] -= row_hits[window_head[w]++];
+      seg.density[w] = (float)(window_count[w] * 1000.0 / kDensityWindow[w]);
+    }
+    if (max_density_ < seg.density[0])
+      max_density_ = seg.density[0];
     row_segments_.push_back(seg);
   }
+
+  if (!row_segments_.empty())
+  {
+    const double length = row_segments_.back().time - row_segments_.front().time;
+    avg_density_ = length > 0 ? total_hits * 1000.0 / length : 0;
+  }
 }
 
 std::string ChartProfiler::toString() const
@@ -792,6 +1066,8 @@ std::string ChartProfiler::toString() const
   ss << "name:" << name_ << ",\n";
   ss << "stop_count:" << stop_count_ << ",\n";
   ss << "bpm_change:" << bpm_change_ << ",\n";
+  ss << "avg_density:" << avg_density_ << ",\n";
+  ss << "max_density:" << max_density_ << ",\n";
   ss << "data:[";
   for (const auto& seg : row_segments_) {
     ss << "{time:" << seg.time
@@ -801,7 +1077,8 @@ std::string ChartProfiler::toString() const
       << ", bpm:" << seg.bpm
       << ", notes:" << seg.notes
       << ", pattern:" << seg.pattern
-      << ", pattern_i:" << seg.pattern_i[0]
+      << ", pattern_i:[" << seg.pattern_i[0] << "," << seg.pattern_i[1] << "]"
+      << ", density:[" << seg.density[0] << "," << seg.density[1] << "]"
       << "},\n";
   }
   ss << "]\n};\n";
@@ -826,4 +1103,328 @@ const ProfileSegment* ChartProfiler::GetSegment(unsigned i) const
   return &row_segments_[i];
 }
 
+double ChartProfiler::GetAverageDensity() const { return avg_density_; }
+
+double ChartProfiler::GetMaxDensity() const { return max_density_; }
+
+int ChartProfiler::GetStopCount() const { return stop_count_; }
+
+int ChartProfiler::GetBpmChangeCount() const { return bpm_change_; }
+
+// ------------------------------------------------------------ ChartHasher
+
+ChartHasher::ChartHasher(ChartHashTypes type) : type_(type), len_(0) {}
+
+void ChartHasher::Reset()
+{
+  xxh_.reset();
+  md5_.reset();
+  len_ = 0;
+}
+
+void ChartHasher::Write32(uint32_t v)
+{
+  if (len_ + 4 > sizeof(buf_)) Flush();
+  uint8_t *p = buf_ + len_;
+  p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+  len_ += 4;
+}
+
+void ChartHasher::Write64(uint64_t v)
+{
+  Write32((uint32_t)v);
+  Write32((uint32_t)(v >> 32));
+}
+
+void ChartHasher::Flush()
+{
+  if (type_ == ChartHashTypes::kMD5)
+    md5_.update(buf_, len_);
+  else
+    xxh_.update(buf_, len_);
+  len_ = 0;
+}
+
+void ChartHasher::Update(const TrackData& td, TrackTypes type)
+{
+  const bool is_float_value = (type == TrackTypes::kTrackTiming);
+  for (unsigned i = 0; i < td.get_track_count(); ++i)
+  {
+    const Track &track = td[i];
+    if (track.is_empty()) continue;
+    Write32((uint32_t)type << 16 | i);
+    Write32((uint32_t)track.size());
+    for (const auto &n : track)
+    {
+      const double m = n.measure();
+      const uint32_t measure = m > 0 ? (uint32_t)m : 0;
+      const RowPos &rpos = n.GetRowPos();
+      uint32_t num, deno;
+      if (rpos.deno > 0 && rpos.num < rpos.deno &&
+          measure + (double)rpos.num / rpos.deno == m)
+      {
+        uint32_t a = rpos.num, b = rpos.deno;
+        while (b) { uint32_t t = a % b; a = b; b = t; }
+        num = rpos.num / a;
+        deno = rpos.deno / a;
+      }
+      else
+      {
+        num = (uint32_t)((m - measure) * 4294967296.0);
+        deno = 0;
+      }
+      uint64_t value;
+      if (is_float_value)
+      {
+        const double v = n.get_value_f();
+        memcpy(&value, &v, sizeof(value));
+      }
+      else value = n.get_value_u();
+
+      Write32(measure);
+      Write32(num);
+      Write32(deno);
+      Write32((uint32_t)n.chain_status());
+      Write64(value);
+    }
+  }
+}
+
+void ChartHasher::Update(const Chart& c)
+{
+  Update(c.GetNoteData(), TrackTypes::kTrackTap);
+  Update(c.GetTimingData(), TrackTypes::kTrackTiming);
+}
+
+std::string ChartHasher::GetDigest()
+{
+  Flush();
+  if (type_ == ChartHashTypes::kMD5)
+    return md5_.hexdigest();
+  return rutil::hash64_str(xxh_.digest());
+}
+
+uint64_t ChartHasher::GetDigest64()
+{
+  Flush();
+  if (type_ == ChartHashTypes::kMD5)
+  {
+    unsigned char d[16];
+    md5_.digest(d);
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = v << 8 | d[i];
+    return v;
+  }
+  return xxh_.digest();
+}
+
+// ------------------------------------------------------- ChartFingerprint
+
+namespace
+{
+
+inline uint64_t mix64(uint64_t x)
+{
+  x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+void MinHash(const std::vector<uint64_t>& hashes, uint64_t* sig)
+{
+  for (unsigned k = 0; k < ChartFingerprint::kSignatureSize; ++k)
+  {
+    const uint64_t seed = (k + 1) * 0x9E3779B97F4A7C15ULL;
+    uint64_t m = UINT64_MAX;
+    for (uint64_t h : hashes)
+      m = std::min(m, mix64(h ^ seed));
+    sig[k] = m;
+  }
+}
+
+double SignatureSimilarity(const uint64_t* a, const uint64_t* b)
+{
+  unsigned match = 0;
+  for (unsigned k = 0; k < ChartFingerprint::kSignatureSize; ++k)
+    if (a[k] == b[k]) match++;
+  return (double)match / ChartFingerprint::kSignatureSize;
+}
+
+struct FingerprintNote
+{
+  uint32_t measure;
+  uint32_t pos;       // position in measure, in 1/3840 unit
+  uint32_t lane;
+  uint32_t chain;
+  bool operator<(const FingerprintNote& o) const
+  {
+    if (measure != o.measure) return measure < o.measure;
+    if (pos != o.pos) return pos < o.pos;
+    return lane < o.lane;
+  }
+};
+
+}
+
+ChartFingerprint::ChartFingerprint() : note_count(0)
+{
+  std::fill(signature, signature + kSignatureSize, UINT64_MAX);
+  std::fill(pattern_signature, pattern_signature + kSignatureSize, UINT64_MAX);
+}
+
+ChartFingerprint::ChartFingerprint(const Chart& c) : ChartFingerprint()
+{
+  Generate(c);
+}
+
+void ChartFingerprint::Generate(const Chart& c)
+{
+  const auto &nd = c.GetNoteData();
+  std::vector<FingerprintNote> notes;
+  notes.reserve(nd.size());
+  note_count = 0;
+  for (unsigned lane = 0; lane < nd.get_track_count(); ++lane)
+  {
+    for (const auto &n : nd[lane])
+    {
+      if (n.chain_status() == NoteChainStatus::Body || n.measure() < 0) continue;
+      if (n.chain_status() != NoteChainStatus::End) note_count++;
+      const uint32_t m = (uint32_t)n.measure();
+      notes.push_back({ m, (uint32_t)std::lround((n.measure() - m) * 3840),
+                        lane, (uint32_t)n.chain_status() });
+    }
+  }
+  std::sort(notes.begin(), notes.end());
+
+  measure_hash.clear();
+  measure_pattern.clear();
+  for (size_t i = 0; i < notes.size(); )
+  {
+    const uint32_t measure = notes[i].measure;
+    const uint64_t seed = measure - notes.front().measure;
+    rutil::XXH64Hasher exact(seed), pattern(seed);
+    while (i < notes.size() && notes[i].measure == measure)
+    {
+      const uint32_t pos = notes[i].pos;
+      uint32_t row_count = 0;
+      for (; i < notes.size() && notes[i].measure == measure && notes[i].pos == pos; ++i)
+      {
+        const uint32_t v[3] = { pos, notes[i].lane, notes[i].chain };
+        exact.update(v, sizeof(v));
+        row_count++;
+      }
+      const uint32_t v[2] = { pos, row_count };
+      pattern.update(v, sizeof(v));
+    }
+    measure_hash.push_back(exact.digest());
+    measure_pattern.push_back(pattern.digest());
+  }
+
+  MinHash(measure_hash, signature);
+  MinHash(measure_pattern, pattern_signature);
+}
+
+const uint64_t* ChartFingerprint::GetSignature(bool lane_agnostic) const
+{
+  return lane_agnostic ? pattern_signature : signature;
+}
+
+bool ChartFingerprint::is_empty() const { return measure_hash.empty(); }
+
+double ChartFingerprint::Similarity(const ChartFingerprint& other, bool lane_agnostic) const
+{
+  if (is_empty() || other.is_empty()) return 0;
+  return SignatureSimilarity(GetSignature(lane_agnostic), other.GetSignature(lane_agnostic));
+}
+
+// ---------------------------------------------------- ChartDuplicateIndex
+
+ChartDuplicateIndex::ChartDuplicateIndex(bool lane_agnostic)
+  : lane_agnostic_(lane_agnostic), count_(0) {}
+
+uint64_t ChartDuplicateIndex::GetBandKey(const uint64_t* sig, unsigned band) const
+{
+  return rutil::xxh64(sig + band * kBandRows, kBandRows * sizeof(uint64_t), band);
+}
+
+unsigned ChartDuplicateIndex::Add(const ChartFingerprint& fp)
+{
+  const unsigned id = count_++;
+  if (!fp.is_empty())
+  {
+    const uint64_t *sig = fp.GetSignature(lane_agnostic_);
+    const unsigned entry_idx = (unsigned)entries_.size();
+    entries_.emplace_back();
+    entries_.back().id = id;
+    std::copy(sig, sig + ChartFingerprint::kSignatureSize, entries_.back().signature);
+    for (unsigned b = 0; b < kBandCount; ++b)
+      buckets_[GetBandKey(sig, b)].push_back(entry_idx);
+  }
+  return id;
+}
+
+void ChartDuplicateIndex::Query(const ChartFingerprint& fp, double threshold,
+                                std::vector<std::pair<unsigned, double> >& out) const
+{
+  if (fp.is_empty()) return;
+  Query(fp.GetSignature(lane_agnostic_), threshold, out);
+}
+
+void ChartDuplicateIndex::Query(const uint64_t* sig, double threshold,
+                                std::vector<std::pair<unsigned, double> >& out) const
+{
+  std::vector<unsigned> candidates;
+  for (unsigned b = 0; b < kBandCount; ++b)
+  {
+    auto it = buckets_.find(GetBandKey(sig, b));
+    if (it != buckets_.end())
+      candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+  }
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+  for (unsigned idx : candidates)
+  {
+    const double s = SignatureSimilarity(sig, entries_[idx].signature);
+    if (s >= threshold)
+      out.emplace_back(entries_[idx].id, s);
+  }
+}
+
+void ChartDuplicateIndex::FindDuplicates(double threshold,
+                                         std::vector<std::vector<unsigned> >& groups) const
+{
+  // union-find of similar pairs
+  std::vector<unsigned> parent(count_);
+  for (unsigned i = 0; i < parent.size(); ++i) parent[i] = i;
+  auto find = [&parent](unsigned x) {
+    while (parent[x] != x) x = parent[x] = parent[parent[x]];
+    return x;
+  };
+
+  std::vector<std::pair<unsigned, double> > similar;
+  for (const auto &e : entries_)
+  {
+    similar.clear();
+    Query(e.signature, threshold, similar);
+    for (const auto &s : similar)
+    {
+      const unsigned a = find(e.id), b = find(s.first);
+      if (a != b) parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+
+  std::map<unsigned, std::vector<unsigned> > group_map;
+  for (unsigned i = 0; i < parent.size(); ++i)
+    group_map[find(i)].push_back(i);
+  for (auto &g : group_map)
+  {
+    if (g.second.size() > 1)
+      groups.push_back(std::move(g.second));
+  }
+}
+
+size_t ChartDuplicateIndex::size() const { return count_; }
+
 } /* namespace rparser */
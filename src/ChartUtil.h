@@ -2,15 +2,24 @@
 #define RPARSER_CHARTUTIL_H
 
 #include "Chart.h"
+#include <stdio.h>
+#include <iosfwd>
+#include <unordered_map>
 
 namespace rparser
 {
 
 constexpr int kMaxSizeLane = 20;
 
+class HTMLWriter;
+
 /**
  * Export chart data (metadata, notedata, events etc ...) to HTML format.
  * CSS and other necessary things should be made by oneself ...
+ *
+ * Write() / Save() streams HTML measure by measure into file or stream,
+ * so whole document is not kept in memory for long charts.
+ * toHTML() returns HTML generated by constructor.
  */
 class HTMLExporter
 {
@@ -18,16 +27,11 @@ public:
   HTMLExporter();
   HTMLExporter(const Chart& c);
   const std::string& toHTML();
+  bool Write(const Chart& c, FILE *fp);
+  bool Write(const Chart& c, std::ostream& os);
+  bool Save(const Chart& c, const std::string& path);
 private:
-  void Analyze(const Chart& c);
-  void GenerateHTML(const Chart& c);
-  struct Measure
-  {
-    double length;
-    std::vector<std::pair<unsigned, const NoteElement*> > nd_;
-    std::vector<std::pair<unsigned, const NoteElement*> > td_;
-  };
-  std::vector<Measure> measures_;
+  void GenerateHTML(const Chart& c, HTMLWriter& e);
   std::string html_;
 };
 
@@ -79,8 +83,8 @@ struct RowElement
 public:
   std::vector<std::pair<unsigned, T*> > notes;
   double pos;
-  NoteElement* get(size_t column);
-  const NoteElement* get(size_t column) const;
+  T* get(size_t column);
+  const T* get(size_t column) const;
 };
 
 /* for note iterating by row
@@ -102,6 +106,23 @@ private:
 typedef RowElementCollection<TrackData, NoteElement> RowCollection;
 typedef RowElementCollection<const TrackData, const NoteElement> ConstRowCollection;
 
+/* @brief pattern flags of a row, stored in ProfileSegment::pattern_i[1]. */
+enum ProfilePatternTypes
+{
+  kPatternChord = 1,      // two or more notes in a row
+  kPatternJack = 2,       // note on the same lane as previous row
+  kPatternTrill = 4,      // alternates with previous row (ABAB)
+  kPatternLongnote = 8,   // longnote starts in a row
+};
+
+/**
+ * @detail Profiled data of a note row.
+ * pattern_i[0] is lane bitmask of the row (lane 0 ~ 31),
+ * pattern_i[1] is ProfilePatternTypes flags.
+ * pattern is lane state of the row for each character
+ * (0: none, 1: tap, 2: longnote start, 3: longnote body/end).
+ * density is notes/sec within 1 sec / 4 sec window ending at the row.
+ */
 struct ProfileSegment
 {
   double time;
@@ -112,8 +133,16 @@ struct ProfileSegment
   unsigned notes;
   std::string pattern;
   uint32_t pattern_i[2];
+  float density[2];
 };
 
+/**
+ * @detail Analyzes note density and patterns of chart.
+ * Lanes are merged into time order (O(n) for fixed lane count, as tracks
+ * are already sorted), each rows are scanned once and densities are
+ * calculated with sliding window, so it is O(n) to note count.
+ * Average density is 0 if chart has no length (e.g. single row).
+ */
 class ChartProfiler
 {
 public:
@@ -125,6 +154,10 @@ public:
 
   unsigned GetSegmentCount() const;
   const ProfileSegment* GetSegment(unsigned i) const;
+  double GetAverageDensity() const;
+  double GetMaxDensity() const;
+  int GetStopCount() const;
+  int GetBpmChangeCount() const;
 
 private:
   std::string name_;
@@ -136,6 +169,116 @@ private:
   double max_density_;
 };
 
+/* @brief hash algorithm of ChartHasher. */
+enum class ChartHashTypes
+{
+  kXXH64,   // fast non-cryptographic hash (16 hex characters)
+  kMD5,     // md5, in same key format as file hash (32 hex characters)
+};
+
+/**
+ * @detail Streaming canonical hash of chart objects.
+ * Each object is fed as fixed little-endian record of
+ * (track, exact position, value, chain status) into incremental hash,
+ * so it doesn't depend on file format or text serialization.
+ * Position is reduced row fraction (or 32bit fixed-point fraction
+ * if row position is not set), and empty tracks are skipped.
+ * @warn GetDigest() finalizes hash; call Reset() before reusing hasher.
+ */
+class ChartHasher
+{
+public:
+  ChartHasher(ChartHashTypes type = ChartHashTypes::kXXH64);
+  void Reset();
+  void Update(const TrackData& td, TrackTypes type);
+  /* @brief hashes note data and timing data (playable objects) of the chart. */
+  void Update(const Chart& c);
+  std::string GetDigest();
+  uint64_t GetDigest64();
+
+private:
+  void Write32(uint32_t v);
+  void Write64(uint64_t v);
+  void Flush();
+
+  ChartHashTypes type_;
+  rutil::XXH64Hasher xxh_;
+  rutil::MD5Hasher md5_;
+  uint8_t buf_[4096];
+  size_t len_;
+};
+
+/**
+ * @detail Content fingerprint of chart for finding duplicated charts.
+ * Notes are hashed per measure, so it doesn't depend on file format,
+ * encoding, sound values (WAV names) or metadata.
+ * - lane-exact hash: (row position, lane, chain status) of notes in measure.
+ * - lane-agnostic hash: (row position, note count) of rows in measure,
+ *   which matches lane-shuffled (mirror / random) charts.
+ * Measure index is counted from the first measure with notes.
+ * Signature is MinHash of the measure hashes, so ratio of equal values
+ * between two signatures estimates Jaccard similarity of their measures.
+ */
+struct ChartFingerprint
+{
+  static constexpr unsigned kSignatureSize = 32;
+
+  std::vector<uint64_t> measure_hash;
+  std::vector<uint64_t> measure_pattern;
+  uint64_t signature[kSignatureSize];
+  uint64_t pattern_signature[kSignatureSize];
+  unsigned note_count;
+
+  ChartFingerprint();
+  ChartFingerprint(const Chart& c);
+  void Generate(const Chart& c);
+  const uint64_t* GetSignature(bool lane_agnostic) const;
+  bool is_empty() const;
+  double Similarity(const ChartFingerprint& other, bool lane_agnostic = false) const;
+};
+
+/**
+ * @detail Locality-sensitive index of chart fingerprints.
+ * Signature is split into bands and each band is hashed into bucket,
+ * so charts sharing any band are compared only (sublinear lookup).
+ * With 8 bands of 4 rows, pair with similarity 0.9 is found by 99.98%,
+ * while pair with similarity 0.3 becomes candidate by 6%.
+ * Only signature and id of chart is kept, not whole fingerprint.
+ */
+class ChartDuplicateIndex
+{
+public:
+  ChartDuplicateIndex(bool lane_agnostic = false);
+  /* @brief add fingerprint and return its id. (empty chart is not indexed) */
+  unsigned Add(const ChartFingerprint& fp);
+  /* @brief get id and similarity of indexed charts similar to given fingerprint. */
+  void Query(const ChartFingerprint& fp, double threshold,
+             std::vector<std::pair<unsigned, double> >& out) const;
+  /* @brief get groups of similar charts (each group is sorted ids of 2 or more). */
+  void FindDuplicates(double threshold, std::vector<std::vector<unsigned> >& groups) const;
+  size_t size() const;
+
+  static constexpr unsigned kBandCount = 8;
+  static constexpr unsigned kBandRows = ChartFingerprint::kSignatureSize / kBandCount;
+
+private:
+  struct Entry
+  {
+    unsigned id;
+    uint64_t signature[ChartFingerprint::kSignatureSize];
+  };
+
+  uint64_t GetBandKey(const uint64_t* sig, unsigned band) const;
+  void Query(const uint64_t* sig, double threshold,
+             std::vector<std::pair<unsigned, double> >& out) const;
+
+  bool lane_agnostic_;
+  unsigned count_;
+  // entries of non-empty charts, and entry indices for each band key.
+  std::vector<Entry> entries_;
+  std::unordered_map<uint64_t, std::vector<unsigned> > buckets_;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -4,11 +4,15 @@
 namespace rparser
 {
 
-ChartWriter::ChartWriter()
+ChartWriter::ChartWriter() : song_(nullptr), error(0)
+{}
+
+ChartWriter::~ChartWriter()
 {}
 
 bool ChartWriter::Write(Song* song)
 {
+  song_ = song;
   if (!WriteMeta(song)) return false;
   Chart *c;
   for (unsigned i = 0; i < song->GetChartCount(); ++i)
@@ -41,9 +45,24 @@ void ChartWriter::AddData(rutil::FileData& d)
 
 }
 
+bool ChartWriter::SetFile(const Chart* c, const char* p, size_t len)
+{
+  Song *song = c->GetParent() ? c->GetParent() : song_;
+  if (!song || !song->GetDirectory() || c->GetFilename().empty())
+    return false;
+  song->GetDirectory()->SetFile(c->GetFilename(), p, len);
+  return true;
+}
+
 ChartWriter* CreateChartWriter(SONGTYPE songtype)
 {
-  return new ChartWriter();
+  switch (songtype)
+  {
+  case SONGTYPE::BMS:
+    return new ChartWriterBMS();
+  default:
+    return new ChartWriter();
+  }
 }
 
 
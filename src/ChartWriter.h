@@ -4,16 +4,19 @@
 
 #include "common.h"
 #include "Directory.h"
+#include "MetaData.h"
 
 namespace rparser {
 
 class Song;
 class Chart;
+class Diagnostics;
 enum class SONGTYPE;
 
 class ChartWriter {
 public:
   ChartWriter();
+  virtual ~ChartWriter();
 
   /* @brief Write song data, including charts. (automatical) */
   bool Write(Song* s);
@@ -27,11 +30,64 @@ public:
   std::string GetFilename();
 protected:
   void AddData(rutil::FileData& d);
+
+  /* @brief Store serialized chart file into directory of the song. */
+  bool SetFile(const Chart* c, const char* p, size_t len);
+
+  Song *song_;
 private:
   std::string filename_;
   int error;
 };
 
+/**
+ * @detail Writes chart into BMS format.
+ * Objects of each measure / channel are written in a line
+ * with minimal denominator of their row positions (LCM of reduced RowPos).
+ * Whole file is serialized into single reused buffer.
+ *
+ * @warn
+ * Only BMS-native tracks are written (BMS timing / BGA / ARGB tracks),
+ * and objects out of BMS range (measure >= 1000, value >= ZZ) are dropped.
+ * BPM which cannot be written in channel 03 is registered as #BPMxx.
+ * Objects quantized into the same position of a line (row positions whose
+ * LCM exceeds the line length limit) are spilled to another line of the
+ * same channel and reported as kBmsWriteQuantized.
+ * Note lanes 0 ~ 8 are written in 1P channels, as the loader produces.
+ * Conditional statements (#RANDOM) are not written.
+ */
+class ChartWriterBMS : public ChartWriter {
+public:
+  ChartWriterBMS();
+  virtual bool WriteMeta(const Song*);
+  virtual bool WriteChart(const Chart* c);
+
+  /* @brief Serialize chart into internal buffer and returns it. */
+  const std::string& Serialize(const Chart& c);
+
+  struct BmsObject
+  {
+    uint32_t measure;
+    uint16_t channel;
+    uint16_t line;      // line index of same channel (BGM / duplicated objects)
+    uint32_t num;
+    uint32_t deno;
+    uint32_t value;
+  };
+
+private:
+  void CollectObjects(const Chart& c);
+  void AddObject(const NoteElement& n, unsigned channel, unsigned line, unsigned value,
+                 unsigned line_stride = 1);
+  void WriteHeader(const MetaData& md);
+  void WriteObjects(Diagnostics *diag);
+
+  std::string buffer_;
+  std::vector<BmsObject> objects_;
+  std::vector<double> measure_length_;
+  ChannelTable<float> bpm_table_;
+};
+
 ChartWriter* CreateChartWriter(SONGTYPE songtype);
 
 }
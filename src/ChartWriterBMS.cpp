@@ -0,0 +1,539 @@
+/* writes bms format chart. */
+
+#include "ChartWriter.h"
+#include "Chart.h"
+#include "Song.h"
+#include "Diagnostics.h"
+#include "common.h"
+
+namespace rparser
+{
+
+namespace
+{
+
+constexpr char kBase36Chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+constexpr unsigned kBmsMaxValue = 36 * 36;
+constexpr unsigned kBmsMaxMeasure = 1000;
+
+// approximated row position for note without valid RowPos.
+// (enough for 384th note and triplets)
+constexpr uint32_t kMaxRowDenominator = 1920;
+// line denominator is limited to keep line length reasonable;
+// objects are quantized if LCM of row positions exceeds it.
+constexpr uint32_t kMaxLineDenominator = 1u << 14;
+
+// channel of lane 0 ~ 8 (inverse of GetBmsNoteLane)
+constexpr unsigned kBmsLaneChannel[9] = { 1, 2, 3, 4, 5, 8, 9, 6, 7 };
+constexpr unsigned kBmsLaneCount = 9;
+
+enum BmsWriteChannels
+{
+  kChBgm = 1,
+  kChMeasureLength = 2,
+  kChBpm = 3,
+  kChBgaMain = 4,
+  kChBgaMiss = 6,
+  kChBgaLayer1 = 7,
+  kChExBpm = 8,
+  kChStop = 9,
+  kChBgaLayer2 = 10,
+  kChArgbBase = 11,
+};
+
+inline uint32_t gcd_u32(uint32_t a, uint32_t b)
+{
+  while (b)
+  {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// LCM of reduced row positions of the objects, limited to kMaxLineDenominator.
+inline uint32_t GetLineDenominator(const ChartWriterBMS::BmsObject *begin,
+                                   const ChartWriterBMS::BmsObject *end)
+{
+  uint64_t deno = 1;
+  for (auto *o = begin; o != end && deno <= kMaxLineDenominator; ++o)
+    deno = deno / gcd_u32((uint32_t)deno, o->deno) * o->deno;
+  return (uint32_t)std::min<uint64_t>(deno, kMaxLineDenominator);
+}
+
+inline void EncodeBase36(unsigned v, char *out)
+{
+  out[0] = kBase36Chars[v / 36];
+  out[1] = kBase36Chars[v % 36];
+}
+
+inline void EncodeHex(unsigned v, char *out)
+{
+  out[0] = kBase36Chars[v / 16];
+  out[1] = kBase36Chars[v % 16];
+}
+
+/* @brief approximate 0 <= x < 1 with continued fraction. */
+void ApproximateFraction(double x, uint32_t max_deno, uint32_t &num, uint32_t &deno)
+{
+  uint64_t h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+  double v = x;
+  for (int i = 0; i < 32; ++i)
+  {
+    const uint64_t a = (uint64_t)floor(v);
+    const uint64_t h2 = a * h1 + h0, k2 = a * k1 + k0;
+    if (k2 > max_deno) break;
+    h0 = h1; h1 = h2;
+    k0 = k1; k1 = k2;
+    const double f = v - (double)a;
+    if (f < 1e-9) break;
+    v = 1.0 / f;
+  }
+  num = (uint32_t)h1;
+  deno = (uint32_t)k1;
+}
+
+/* @brief row position of the note in measure as reduced fraction. */
+void GetRowFraction(const NoteElement &n, unsigned measure, uint32_t &num, uint32_t &deno)
+{
+  const RowPos &rpos = n.GetRowPos();
+  const double frac = n.measure() - measure;
+  if (rpos.deno > 0 && rpos.num < rpos.deno &&
+      fabs((double)rpos.num / rpos.deno - frac) < 1e-9)
+  {
+    num = rpos.num;
+    deno = rpos.deno;
+  }
+  else
+  {
+    ApproximateFraction(frac, kMaxRowDenominator, num, deno);
+    if (num >= deno) num = deno - 1;
+  }
+  const uint32_t g = gcd_u32(num, deno);
+  num /= g;
+  deno /= g;
+}
+
+bool IsMetaKey(const std::string &key)
+{
+#define META_INT(x,s) if (key == s) return true
+#define META_DBL(x,s) if (key == s) return true
+#define META_STR(x,s) if (key == s) return true
+  RPARSER_METADATA_LISTS
+#undef META_STR
+#undef META_DBL
+#undef META_INT
+  return false;
+}
+
+// metadata which is derived from other BMS command or written separately.
+bool IsWritableMetaKey(const char *key)
+{
+  static const char *kSkipKeys[] = {
+    "PLAYERCOUNT", "PLAYERSIDE", "JUDGERANK", "LNTYPE", "LNOBJ"
+  };
+  for (const char *k : kSkipKeys)
+    if (strcmp(k, key) == 0) return false;
+  return true;
+}
+
+void AppendUInt(std::string &out, unsigned long long v)
+{
+  char s[24];
+  char *p = s + sizeof(s);
+  do {
+    *--p = '0' + (char)(v % 10);
+    v /= 10;
+  } while (v);
+  out.append(p, s + sizeof(s) - p);
+}
+
+void AppendInt(std::string &out, long long v)
+{
+  if (v < 0)
+  {
+    out += '-';
+    AppendUInt(out, 0ull - (unsigned long long)v);
+  }
+  else AppendUInt(out, (unsigned long long)v);
+}
+
+void AppendDouble(std::string &out, double v)
+{
+  if (v == floor(v) && fabs(v) < 1e15)
+  {
+    AppendInt(out, (long long)v);
+    return;
+  }
+  char s[32];
+  int len = snprintf(s, sizeof(s), "%.15g", v);
+  out.append(s, len);
+}
+
+void AppendHeader(std::string &out, const char *key, const std::string &value)
+{
+  out += '#'; out += key; out += ' '; out += value; out += "\r\n";
+}
+
+void AppendHeader(std::string &out, const char *key, int value)
+{
+  out += '#'; out += key; out += ' '; AppendInt(out, value); out += "\r\n";
+}
+
+void AppendHeader(std::string &out, const char *key, double value)
+{
+  out += '#'; out += key; out += ' '; AppendDouble(out, value); out += "\r\n";
+}
+
+void AppendChannelHeader(std::string &out, const char *key, Channel ch)
+{
+  char s[2];
+  EncodeBase36(ch, s);
+  out += '#'; out += key; out.append(s, 2); out += ' ';
+}
+
+}
+
+ChartWriterBMS::ChartWriterBMS() {}
+
+bool ChartWriterBMS::WriteMeta(const Song*)
+{
+  // BMS has no song metadata file.
+  return true;
+}
+
+bool ChartWriterBMS::WriteChart(const Chart* c)
+{
+  if (!c) return false;
+  const std::string &data = Serialize(*c);
+  return SetFile(c, data.c_str(), data.size());
+}
+
+const std::string& ChartWriterBMS::Serialize(const Chart& c)
+{
+  buffer_.clear();
+  CollectObjects(c);
+  WriteHeader(c.GetMetaData());
+  WriteObjects(c.GetParent() ? c.GetParent()->GetDiagnostics() : nullptr);
+  return buffer_;
+}
+
+void ChartWriterBMS::AddObject(const NoteElement& n, unsigned channel, unsigned line, unsigned value,
+                               unsigned line_stride)
+{
+  if (n.measure() < 0 || n.measure() >= kBmsMaxMeasure) return;
+  if (value == 0 || value >= kBmsMaxValue) return;
+  BmsObject obj;
+  obj.measure = (uint32_t)n.measure();
+  obj.channel = (uint16_t)channel;
+  obj.line = (uint16_t)line;
+  obj.value = value;
+  GetRowFraction(n, obj.measure, obj.num, obj.deno);
+
+  // objects in same position of a track (duplicated lines of the same channel)
+  // are spilled to next line, as track is appended in order of position.
+  if (!objects_.empty())
+  {
+    const BmsObject &prev = objects_.back();
+    if (prev.channel == obj.channel && prev.measure == obj.measure &&
+        prev.line >= obj.line && (prev.line - obj.line) % line_stride == 0 &&
+        (uint64_t)prev.num * obj.deno == (uint64_t)obj.num * prev.deno)
+      obj.line = prev.line + line_stride;
+  }
+  objects_.push_back(obj);
+}
+
+void ChartWriterBMS::CollectObjects(const Chart& c)
+{
+  const MetaData &md = c.GetMetaData();
+  const auto &nd = c.GetNoteData();
+  const auto &bgm = c.GetBgmData();
+  const auto &td = c.GetTimingData();
+  const auto &cd = c.GetCommandData();
+  const unsigned lnobj = md.bms_longnote_object > 0 ? (unsigned)md.bms_longnote_object : 0;
+
+  objects_.clear();
+  measure_length_.clear();
+  bpm_table_ = md.GetBPMChannel()->bpm;
+
+  // note objects
+  for (unsigned lane = 0; lane < nd.get_track_count() && lane < kBmsLaneCount; ++lane)
+  {
+    const unsigned lo = kBmsLaneChannel[lane];
+    const unsigned visible_ch = 1 * 36 + lo;
+    const unsigned longnote_ch = 5 * 36 + lo;
+    const auto &track = nd[lane];
+    unsigned ln_ch = longnote_ch;
+    for (auto it = track.begin(); it != track.end(); ++it)
+    {
+      const NoteElement &n = *it;
+      switch (n.chain_status())
+      {
+      case NoteChainStatus::Tap:
+        AddObject(n, visible_ch, 0, n.get_value_u());
+        break;
+      case NoteChainStatus::Start:
+      {
+        // longnote ending with LNOBJ is written in visible channel.
+        auto end_it = it + 1;
+        while (end_it != track.end() && end_it->chain_status() != NoteChainStatus::End)
+          ++end_it;
+        ln_ch = (lnobj && end_it != track.end() && end_it->get_value_u() == lnobj)
+          ? visible_ch : longnote_ch;
+        AddObject(n, ln_ch, 0, n.get_value_u());
+        break;
+      }
+      case NoteChainStatus::End:
+        AddObject(n, ln_ch, 0, n.get_value_u());
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  // bgm objects: each track is written as separated line.
+  for (unsigned i = 0; i < bgm.get_track_count(); ++i)
+  {
+    for (const auto &n : bgm[i])
+      AddObject(n, kChBgm, i, n.get_value_u(), bgm.get_track_count());
+  }
+
+  // timing objects
+  for (const auto &n : td[TimingTrackTypes::kMeasure])
+  {
+    if (n.measure() < 0 || n.measure() >= kBmsMaxMeasure) continue;
+    measure_length_.push_back(n.get_value_f());
+    BmsObject obj{ (uint32_t)n.measure(), kChMeasureLength, 0, 0, 1,
+                   (uint32_t)measure_length_.size() - 1 };
+    objects_.push_back(obj);
+  }
+  for (const auto &n : td[TimingTrackTypes::kBpm])
+  {
+    const double bpm = n.get_value_f();
+    if (bpm >= 1 && bpm <= 255 && bpm == floor(bpm))
+    {
+      AddObject(n, kChBpm, 0, (unsigned)bpm);
+      continue;
+    }
+    // register bpm which cannot be written in hex channel.
+    Channel key = 0;
+    for (const auto &b : bpm_table_)
+    {
+      if (b.second == (float)bpm) { key = b.first; break; }
+    }
+    if (key == 0)
+    {
+      for (key = 1; key < kBmsMaxValue && bpm_table_.exist(key); ++key);
+      if (key >= kBmsMaxValue) continue;
+      bpm_table_[key] = (float)bpm;
+    }
+    AddObject(n, kChExBpm, 0, key);
+  }
+  for (const auto &n : td[TimingTrackTypes::kBmsBpm])
+    AddObject(n, kChExBpm, 0, n.get_value_u());
+  for (const auto &n : td[TimingTrackTypes::kBmsStop])
+    AddObject(n, kChStop, 0, n.get_value_u());
+
+  // command objects
+  static const std::pair<unsigned, unsigned> kBgaChannels[] = {
+    { CommandTrackTypes::kBgaMain, kChBgaMain },
+    { CommandTrackTypes::kBgaMiss, kChBgaMiss },
+    { CommandTrackTypes::kBgaLayer1, kChBgaLayer1 },
+    { CommandTrackTypes::kBgaLayer2, kChBgaLayer2 },
+  };
+  for (const auto &ch : kBgaChannels)
+  {
+    for (const auto &n : cd[ch.first])
+      AddObject(n, ch.second, 0, n.get_value_u());
+  }
+  for (const auto &n : cd[CommandTrackTypes::kBmsARGBLAYER])
+  {
+    NoteElement ne(n);
+    int layer;
+    ne.get_point(layer);
+    if (layer >= 0 && layer < 4)
+      AddObject(n, kChArgbBase + layer, 0, n.get_value_u());
+  }
+
+  // objects in same line are placed together, keeping track order.
+  std::stable_sort(objects_.begin(), objects_.end(),
+    [](const BmsObject& a, const BmsObject& b) {
+      if (a.measure != b.measure) return a.measure < b.measure;
+      if (a.channel != b.channel) return a.channel < b.channel;
+      return a.line < b.line;
+    });
+}
+
+void ChartWriterBMS::WriteHeader(const MetaData& md)
+{
+  buffer_ += "\r\n*---------------------- HEADER FIELD\r\n\r\n";
+
+  // attribute is used if exists, as metadata field is filled from it
+  // by SetMetaFromAttribute(). Otherwise metadata field is used if set.
+  const auto &attrs = md.GetAttributes();
+  auto write_meta = [&](const char *key, bool is_set, auto value) {
+    if (!IsWritableMetaKey(key)) return;
+    auto it = attrs.find(key);
+    if (it != attrs.end())
+      AppendHeader(buffer_, key, it->second);
+    else if (is_set)
+      AppendHeader(buffer_, key, value);
+  };
+#define META_INT(x,s) write_meta(s, md.x != 0, md.x)
+#define META_DBL(x,s) write_meta(s, md.x != 0, md.x)
+#define META_STR(x,s) write_meta(s, !md.x.empty(), md.x)
+  RPARSER_METADATA_LISTS
+#undef META_STR
+#undef META_DBL
+#undef META_INT
+
+  for (const auto &attr : attrs)
+  {
+    if (attr.first.empty() || IsMetaKey(attr.first)) continue;
+    AppendHeader(buffer_, attr.first.c_str(), attr.second);
+  }
+
+  // LNTYPE 2 is not written as longnotes are written in LNTYPE 1 manner.
+  if (md.bms_longnote_type == 1)
+    AppendHeader(buffer_, "LNTYPE", 1);
+  if (md.bms_longnote_object > 0 && (unsigned)md.bms_longnote_object < kBmsMaxValue)
+  {
+    char s[2];
+    EncodeBase36(md.bms_longnote_object, s);
+    buffer_ += "#LNOBJ "; buffer_.append(s, 2); buffer_ += "\r\n";
+  }
+
+  buffer_ += "\r\n";
+  for (const auto &ii : md.GetSoundChannel()->fn)
+  {
+    if (ii.first >= kBmsMaxValue) continue;
+    AppendChannelHeader(buffer_, "WAV", ii.first);
+    buffer_ += ii.second; buffer_ += "\r\n";
+  }
+  for (const auto &ii : md.GetBGAChannel()->bga)
+  {
+    if (ii.first >= kBmsMaxValue) continue;
+    AppendChannelHeader(buffer_, "BMP", ii.first);
+    buffer_ += ii.second.fn; buffer_ += "\r\n";
+  }
+  for (const auto &ii : bpm_table_)
+  {
+    if (ii.first >= kBmsMaxValue) continue;
+    AppendChannelHeader(buffer_, "BPM", ii.first);
+    AppendDouble(buffer_, ii.second); buffer_ += "\r\n";
+  }
+  for (const auto &ii : md.GetSTOPChannel()->stop)
+  {
+    if (ii.first >= kBmsMaxValue) continue;
+    AppendChannelHeader(buffer_, "STOP", ii.first);
+    AppendDouble(buffer_, ii.second); buffer_ += "\r\n";
+  }
+  for (const auto &ii : md.GetSTOPChannel()->STP)
+  {
+    buffer_ += "#STP ";
+    AppendDouble(buffer_, ii.first); buffer_ += ' ';
+    AppendDouble(buffer_, ii.second); buffer_ += "\r\n";
+  }
+}
+
+void ChartWriterBMS::WriteObjects(Diagnostics *diag)
+{
+  // denominator of each line (LCM of reduced row positions).
+  std::vector<std::pair<size_t, uint32_t> > lines;
+  size_t total_size = 0;
+  for (size_t i = 0; i < objects_.size(); )
+  {
+    const BmsObject &first = objects_[i];
+    size_t j = i;
+    while (j < objects_.size() && objects_[j].measure == first.measure &&
+           objects_[j].channel == first.channel && objects_[j].line == first.line)
+      ++j;
+    lines.emplace_back(j, GetLineDenominator(&objects_[i], objects_.data() + j));
+    total_size += first.channel == kChMeasureLength ? 32 : 9 + lines.back().second * 2;
+    i = j;
+  }
+
+  buffer_ += "\r\n*---------------------- MAIN DATA FIELD\r\n\r\n";
+  buffer_.reserve(buffer_.size() + total_size + lines.size() / 8 * 2);
+
+  // objects quantized into already occupied slot are spilled to
+  // another line of the same channel, as AddObject() does.
+  std::vector<BmsObject> spill, spill_next;
+  auto write_slots = [&](const BmsObject *begin, const BmsObject *end, uint32_t deno) {
+    const size_t pos = buffer_.size();
+    buffer_.append(deno * 2, '0');
+    char *p = &buffer_[pos];
+    for (const BmsObject *obj = begin; obj != end; ++obj)
+    {
+      uint32_t slot;
+      if (deno % obj->deno == 0)
+        slot = obj->num * (deno / obj->deno);
+      else
+        slot = std::min<uint32_t>(deno - 1,
+          (uint32_t)((uint64_t)obj->num * deno / obj->deno));
+      char *s = p + slot * 2;
+      if (s[0] != '0' || s[1] != '0')
+      {
+        spill_next.push_back(*obj);
+        continue;
+      }
+      if (obj->channel == kChBpm)
+        EncodeHex(obj->value, s);
+      else
+        EncodeBase36(obj->value, s);
+    }
+    buffer_ += "\r\n";
+  };
+
+  uint32_t last_measure = 0;
+  size_t i = 0;
+  for (const auto &l : lines)
+  {
+    const BmsObject &first = objects_[i];
+
+    // blank line between measures.
+    if (first.measure != last_measure)
+    {
+      buffer_ += "\r\n";
+      last_measure = first.measure;
+    }
+
+    char head[7] = {
+      '#',
+      (char)('0' + first.measure / 100),
+      (char)('0' + first.measure / 10 % 10),
+      (char)('0' + first.measure % 10),
+      kBase36Chars[first.channel / 36],
+      kBase36Chars[first.channel % 36],
+      ':' };
+    buffer_.append(head, 7);
+
+    if (first.channel == kChMeasureLength)
+    {
+      AppendDouble(buffer_, measure_length_[objects_[l.first - 1].value]);
+      buffer_ += "\r\n";
+    }
+    else
+    {
+      write_slots(&objects_[i], objects_.data() + l.first, l.second);
+      while (!spill_next.empty())
+      {
+        spill.swap(spill_next);
+        spill_next.clear();
+        if (diag)
+        {
+          for (size_t k = 0; k < spill.size(); ++k)
+            diag->Report(DiagnosticCodes::kBmsWriteQuantized);
+        }
+        buffer_.append(head, 7);
+        write_slots(spill.data(), spill.data() + spill.size(),
+                    GetLineDenominator(spill.data(), spill.data() + spill.size()));
+      }
+    }
+    i = l.first;
+  }
+}
+
+}
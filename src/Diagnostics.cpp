@@ -0,0 +1,170 @@
+#include "Diagnostics.h"
+#include "common.h"
+
+namespace rparser {
+
+namespace {
+
+struct DiagnosticInfo
+{
+  const char* name;
+  DiagnosticSeverity severity;
+  const char* msg;
+};
+
+const DiagnosticInfo kDiagnosticInfo[] =
+{
+#define DIAG(name,severity,msg) { #name, DiagnosticSeverity::severity, msg }
+#include "Diagnostics.list"
+#undef DIAG
+};
+
+void WriteJSONString(std::stringstream& ss, const std::string& s)
+{
+  ss << '"';
+  for (char c : s)
+  {
+    switch (c)
+    {
+    case '"': ss << "\\\""; break;
+    case '\\': ss << "\\\\"; break;
+    case '\n': ss << "\\n"; break;
+    case '\r': ss << "\\r"; break;
+    case '\t': ss << "\\t"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+      {
+        char buf[8];
+        sprintf(buf, "\\u%04x", c);
+        ss << buf;
+      }
+      else ss << c;
+    }
+  }
+  ss << '"';
+}
+
+}
+
+Diagnostics::Diagnostics(size_t capacity)
+  : capacity_(capacity > 0 ? capacity : 1)
+{
+  Clear();
+}
+
+void Diagnostics::SetFile(const std::string& filename)
+{
+  if (files_.empty() || files_.back() != filename)
+    files_.push_back(filename);
+}
+
+void Diagnostics::Report(DiagnosticCodes code, unsigned line)
+{
+  const DiagnosticEntry e{ (unsigned)files_.size() - 1, line, code, GetSeverity(code) };
+  if (entries_.size() < capacity_)
+    entries_.push_back(e);
+  else
+    entries_[total_ % capacity_] = e;
+  total_++;
+  counts_[static_cast<size_t>(code)]++;
+  if (callback_)
+    callback_(*this, e);
+}
+
+void Diagnostics::SetCallback(const Callback& callback)
+{
+  callback_ = callback;
+}
+
+void Diagnostics::Clear()
+{
+  entries_.clear();
+  entries_.reserve(capacity_);
+  total_ = 0;
+  memset(counts_, 0, sizeof(counts_));
+  files_.clear();
+  files_.emplace_back();
+}
+
+size_t Diagnostics::size() const
+{
+  return entries_.size();
+}
+
+const DiagnosticEntry& Diagnostics::get(size_t i) const
+{
+  // when ring buffer is full, oldest entry is at (total_ % capacity_).
+  if (total_ <= capacity_)
+    return entries_[i];
+  return entries_[(total_ + i) % capacity_];
+}
+
+const std::string& Diagnostics::GetFilename(const DiagnosticEntry& e) const
+{
+  return files_[e.file];
+}
+
+unsigned Diagnostics::GetCount(DiagnosticCodes code) const
+{
+  return counts_[static_cast<size_t>(code)];
+}
+
+unsigned Diagnostics::GetTotalCount() const
+{
+  return total_;
+}
+
+std::string Diagnostics::toJSON() const
+{
+  std::stringstream ss;
+  ss << "{\"total\":" << total_ << ",\"counts\":{";
+  bool first = true;
+  for (size_t i = 0; i < static_cast<size_t>(DiagnosticCodes::kCount); ++i)
+  {
+    if (counts_[i] == 0) continue;
+    if (!first) ss << ",";
+    ss << "\"" << kDiagnosticInfo[i].name << "\":" << counts_[i];
+    first = false;
+  }
+  ss << "},\"entries\":[";
+  for (size_t i = 0; i < size(); ++i)
+  {
+    const DiagnosticEntry& e = get(i);
+    if (i > 0) ss << ",";
+    ss << "{\"file\":";
+    WriteJSONString(ss, GetFilename(e));
+    ss << ",\"line\":" << e.line
+       << ",\"code\":\"" << GetCodeName(e.code)
+       << "\",\"severity\":\"" << GetSeverityName(e.severity) << "\"}";
+  }
+  ss << "]}";
+  return ss.str();
+}
+
+const char* Diagnostics::GetCodeName(DiagnosticCodes code)
+{
+  return kDiagnosticInfo[static_cast<size_t>(code)].name;
+}
+
+const char* Diagnostics::GetCodeMessage(DiagnosticCodes code)
+{
+  return kDiagnosticInfo[static_cast<size_t>(code)].msg;
+}
+
+DiagnosticSeverity Diagnostics::GetSeverity(DiagnosticCodes code)
+{
+  return kDiagnosticInfo[static_cast<size_t>(code)].severity;
+}
+
+const char* Diagnostics::GetSeverityName(DiagnosticSeverity severity)
+{
+  switch (severity)
+  {
+  case DiagnosticSeverity::kInfo: return "info";
+  case DiagnosticSeverity::kWarning: return "warning";
+  case DiagnosticSeverity::kError: return "error";
+  }
+  return "";
+}
+
+}
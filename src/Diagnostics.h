@@ -0,0 +1,85 @@
+/*
+ * by @lazykuna, MIT License.
+ */
+
+#ifndef RPARSER_DIAGNOSTICS_H
+#define RPARSER_DIAGNOSTICS_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace rparser {
+
+enum class DiagnosticSeverity
+{
+  kInfo,
+  kWarning,
+  kError
+};
+
+enum class DiagnosticCodes
+{
+#define DIAG(name,severity,msg) name
+#include "Diagnostics.list"
+#undef DIAG
+  kCount
+};
+
+struct DiagnosticEntry
+{
+  unsigned file;    // index of filename, use Diagnostics::GetFilename()
+  unsigned line;    // 1-based line number, 0 if unknown
+  DiagnosticCodes code;
+  DiagnosticSeverity severity;
+};
+
+/**
+ * @brief Structured sink of warnings / errors reported by ChartLoader.
+ * @detail
+ * Only the latest entries are kept in a fixed size ring buffer,
+ * while counter of each code counts every report.
+ * ChartLoader reports nothing if no sink is attached,
+ * so disabled diagnostics costs only a null check.
+ * @param
+ * SetFile     set filename of following reports.
+ * Report      add entry, and call callback if exists.
+ * SetCallback called for every report (e.g. print or abort)
+ * get         get i-th kept entry, from the oldest one.
+ * @warn not thread-safe; use a sink per loading thread.
+ */
+class Diagnostics
+{
+public:
+  typedef std::function<void (const Diagnostics&, const DiagnosticEntry&)> Callback;
+
+  Diagnostics(size_t capacity = 1024);
+  void SetFile(const std::string& filename);
+  void Report(DiagnosticCodes code, unsigned line = 0);
+  void SetCallback(const Callback& callback);
+  void Clear();
+
+  size_t size() const;
+  const DiagnosticEntry& get(size_t i) const;
+  const std::string& GetFilename(const DiagnosticEntry& e) const;
+  unsigned GetCount(DiagnosticCodes code) const;
+  unsigned GetTotalCount() const;
+  std::string toJSON() const;
+
+  static const char* GetCodeName(DiagnosticCodes code);
+  static const char* GetCodeMessage(DiagnosticCodes code);
+  static DiagnosticSeverity GetSeverity(DiagnosticCodes code);
+  static const char* GetSeverityName(DiagnosticSeverity severity);
+
+private:
+  std::vector<DiagnosticEntry> entries_;
+  size_t capacity_;
+  unsigned total_;
+  unsigned counts_[static_cast<size_t>(DiagnosticCodes::kCount)];
+  std::vector<std::string> files_;
+  Callback callback_;
+};
+
+}
+
+#endif
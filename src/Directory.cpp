@@ -686,6 +686,245 @@ bool DirectoryArchive::doCreate(const std::string& newpath) { return false; }
 #endif
 
 
+// --------------------- class DirectoryOJM
+
+static void WriteLE32(char* p, uint32_t v)
+{
+  p[0] = (char)(v & 0xFF);
+  p[1] = (char)((v >> 8) & 0xFF);
+  p[2] = (char)((v >> 16) & 0xFF);
+  p[3] = (char)((v >> 24) & 0xFF);
+}
+
+static void WriteLE16(char* p, uint16_t v)
+{
+  p[0] = (char)(v & 0xFF);
+  p[1] = (char)((v >> 8) & 0xFF);
+}
+
+DirectoryOJM::DirectoryOJM() : fp_(0)
+{
+  SetAlternativeSearch(true);
+}
+
+DirectoryOJM::DirectoryOJM(const std::string& path) : Directory(path), fp_(0)
+{
+  // OJN refers sample only by its id, not by its extension.
+  SetAlternativeSearch(true);
+}
+
+DirectoryOJM::~DirectoryOJM()
+{
+  doClose();
+}
+
+bool DirectoryOJM::IsReadOnly()
+{
+  return true;
+}
+
+bool DirectoryOJM::doOpen()
+{
+  fp_ = rutil::fopen_utf8(GetPath(), "rb");
+  if (!fp_)
+  {
+    SetError(ERROR::OPEN_NO_FILE);
+    return false;
+  }
+
+  char sig[4];
+  bool r = false;
+  if (fread(sig, 1, 4, fp_) == 4)
+  {
+    if (memcmp(sig, "M30\0", 4) == 0)
+      r = ParseM30();
+    else if (memcmp(sig, "OMC\0", 4) == 0)
+      r = ParseOMC(true);
+    else if (memcmp(sig, "OJM\0", 4) == 0)
+      r = ParseOMC(false);
+  }
+  if (!r)
+  {
+    SetError(ERROR::OPEN_INVALID_FILE);
+    doClose();
+  }
+  return r;
+}
+
+bool DirectoryOJM::doClose()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fp_) fclose(fp_);
+  fp_ = 0;
+  samples_.clear();
+  return true;
+}
+
+bool DirectoryOJM::ParseM30()
+{
+  uint8_t header[28];
+  if (fseek(fp_, 0, SEEK_END) != 0) return false;
+  const long filesize = ftell(fp_);
+  if (fseek(fp_, 0, SEEK_SET) != 0 || fread(header, 1, 28, fp_) != 28)
+    return false;
+
+  const uint32_t encryption = rutil::ReadLE32(header + 8);
+  const uint32_t sample_count = rutil::ReadLE32(header + 12);
+  long pos = rutil::ReadLE32(header + 16);
+  SampleEncoding encoding = kOjmPlain;
+  if (encryption == 16) encoding = kOjmXorNami;
+  else if (encryption == 32) encoding = kOjmXor0412;
+  else if (encryption != 0)
+    std::cerr << "[DirectoryOJM] Unknown M30 encryption " << encryption << ", read as plain." << std::endl;
+
+  uint8_t sh[52];
+  for (uint32_t i = 0; i < sample_count && pos + 52 <= filesize; ++i)
+  {
+    if (fseek(fp_, pos, SEEK_SET) != 0 || fread(sh, 1, 52, fp_) != 52)
+      break;
+    const uint32_t size = rutil::ReadLE32(sh + 32);
+    const uint16_t codec_code = rutil::ReadLE16(sh + 36);
+    const uint16_t ref = rutil::ReadLE16(sh + 44);
+    pos += 52;
+    if (size > (uint32_t)(filesize - pos))
+      break;
+
+    // codec 0 is background sample, 5 is keysound.
+    const unsigned id = codec_code == 0 ? 1000u + ref : ref;
+    Sample smp = { (uint32_t)pos, size, encoding, 0, 0, 0, 0, 0, 0 };
+    CreateEmptyFile(std::to_string(id) + ".ogg");
+    samples_[files_.back()] = smp;
+    pos += size;
+  }
+  return true;
+}
+
+bool DirectoryOJM::ParseOMC(bool encrypted)
+{
+  uint8_t header[20];
+  if (fseek(fp_, 0, SEEK_SET) != 0 || fread(header, 1, 20, fp_) != 20)
+    return false;
+
+  const long wav_start = rutil::ReadLE32(header + 8);
+  const long ogg_start = rutil::ReadLE32(header + 12);
+  const long filesize = rutil::ReadLE32(header + 16);
+  unsigned id = 0;
+  long pos = wav_start;
+  bool warned = false;
+
+  // WAV samples: numbered from 0, including empty slot.
+  uint8_t wh[56];
+  while (pos + 56 <= ogg_start)
+  {
+    if (fseek(fp_, pos, SEEK_SET) != 0 || fread(wh, 1, 56, fp_) != 56)
+      break;
+    const uint32_t size = rutil::ReadLE32(wh + 52);
+    pos += 56;
+    if (size > 0 && !encrypted)
+    {
+      Sample smp;
+      smp.offset = (uint32_t)pos;
+      smp.size = size;
+      smp.encoding = kOjmWav;
+      smp.audio_format = rutil::ReadLE16(wh + 32);
+      smp.channels = rutil::ReadLE16(wh + 34);
+      smp.sample_rate = rutil::ReadLE32(wh + 36);
+      smp.byte_rate = rutil::ReadLE32(wh + 40);
+      smp.block_align = rutil::ReadLE16(wh + 44);
+      smp.bits_per_sample = rutil::ReadLE16(wh + 46);
+      CreateEmptyFile(std::to_string(id) + ".wav");
+      samples_[files_.back()] = smp;
+    }
+    else if (size > 0 && !warned)
+    {
+      std::cerr << "[DirectoryOJM] Encrypted WAV sample is not supported, skipped." << std::endl;
+      warned = true;
+    }
+    pos += size;
+    id++;
+  }
+
+  // OGG samples: numbered from 1000, not encrypted.
+  uint8_t oh[36];
+  id = 1000;
+  pos = ogg_start;
+  while (pos + 36 <= filesize)
+  {
+    if (fseek(fp_, pos, SEEK_SET) != 0 || fread(oh, 1, 36, fp_) != 36)
+      break;
+    const uint32_t size = rutil::ReadLE32(oh + 32);
+    pos += 36;
+    if (size > 0)
+    {
+      Sample smp = { (uint32_t)pos, size, kOjmPlain, 0, 0, 0, 0, 0, 0 };
+      CreateEmptyFile(std::to_string(id) + ".ogg");
+      samples_[files_.back()] = smp;
+    }
+    pos += size;
+    id++;
+  }
+  return true;
+}
+
+bool DirectoryOJM::doRead(File &f)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!fp_) return false;
+  if (f.p) return true;
+
+  auto it = samples_.find(&f);
+  if (it == samples_.end()) return false;
+  const Sample &smp = it->second;
+
+  const size_t header_size = (smp.encoding == kOjmWav) ? 44 : 0;
+  char *p = (char*)malloc(header_size + smp.size);
+  if (fseek(fp_, smp.offset, SEEK_SET) != 0 ||
+      fread(p + header_size, 1, smp.size, fp_) != smp.size)
+  {
+    free(p);
+    SetError(ERROR::OPEN_INVALID_FILE);
+    return false;
+  }
+
+  switch (smp.encoding)
+  {
+  case kOjmXorNami:
+  case kOjmXor0412:
+  {
+    const char *key = (smp.encoding == kOjmXorNami) ? "nami" : "0412";
+    char *d = p + header_size;
+    for (size_t i = 0; i + 3 < smp.size; i += 4)
+    {
+      d[i] ^= key[0];
+      d[i + 1] ^= key[1];
+      d[i + 2] ^= key[2];
+      d[i + 3] ^= key[3];
+    }
+    break;
+  }
+  case kOjmWav:
+    memcpy(p, "RIFF", 4);
+    WriteLE32(p + 4, (uint32_t)(36 + smp.size));
+    memcpy(p + 8, "WAVEfmt ", 8);
+    WriteLE32(p + 16, 16);
+    WriteLE16(p + 20, smp.audio_format);
+    WriteLE16(p + 22, smp.channels);
+    WriteLE32(p + 24, smp.sample_rate);
+    WriteLE32(p + 28, smp.byte_rate);
+    WriteLE16(p + 32, smp.block_align);
+    WriteLE16(p + 34, smp.bits_per_sample);
+    memcpy(p + 36, "data", 4);
+    WriteLE32(p + 40, smp.size);
+    break;
+  default:
+    break;
+  }
+
+  f.p = p;
+  f.len = header_size + smp.size;
+  return true;
+}
+
 // ----------------- Misc for DirectoryManager
 
 Directory* general_dir_constructor(const char* path)
@@ -700,6 +939,12 @@ Directory* zip_dir_constructor(const char* path)
   return d;
 }
 
+Directory* ojm_dir_constructor(const char* path)
+{
+  Directory *d = new DirectoryOJM(path);
+  return d;
+}
+
 std::mutex dir_mutex;
 
 // --------------------- class DirectoryManager
@@ -885,6 +1130,7 @@ DirectoryManager::DirectoryManager()
 {
   ext_dirconstructor_map_["Directory"] = general_dir_constructor;
   ext_dirconstructor_map_["zip"] = zip_dir_constructor;
+  ext_dirconstructor_map_["ojm"] = ojm_dir_constructor;
 }
 
 DirectoryManager::~DirectoryManager() {}
@@ -10,6 +10,7 @@
 #include "Error.h"
 #include <mutex>
 #include <memory>
+#include <unordered_map>
 
 #ifdef USE_ZLIB
 struct zip;
@@ -187,6 +188,54 @@ private:
 #endif
 };
 
+/**
+ * @brief O2Jam sample container (.ojm) as read-only directory.
+ * @detail
+ * Only sample headers are indexed when opening the container.
+ * Each sample is read, decoded (XOR / WAV header) and cached
+ * when it is accessed first time, so unreferenced samples are
+ * never unpacked.
+ * Samples are named after their sample id referenced by OJN,
+ * e.g. 1001.ogg / 5.wav.
+ * @warn encrypted WAV samples of OMC container are not supported yet.
+ */
+class DirectoryOJM : public Directory
+{
+public:
+  DirectoryOJM();
+  DirectoryOJM(const std::string& path);
+  virtual ~DirectoryOJM();
+  virtual bool IsReadOnly();
+
+private:
+  virtual bool doRead(File &f);
+  virtual bool doOpen();
+  virtual bool doClose();
+
+  bool ParseM30();
+  bool ParseOMC(bool encrypted);
+
+  enum SampleEncoding {
+    kOjmPlain,
+    kOjmXorNami,
+    kOjmXor0412,
+    kOjmWav
+  };
+
+  struct Sample {
+    uint32_t offset;
+    uint32_t size;
+    SampleEncoding encoding;
+    /* WAV format (kOjmWav) */
+    uint16_t audio_format, channels, block_align, bits_per_sample;
+    uint32_t sample_rate, byte_rate;
+  };
+
+  /* sample of each file. */
+  std::unordered_map<const File*, Sample> samples_;
+  FILE *fp_;
+  std::mutex mutex_;
+};
 
 /* @brief A user customizeable directory creator */
 typedef Directory* (*dir_constructor)(const char*);
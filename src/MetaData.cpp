@@ -8,28 +8,76 @@ using namespace rutil;
 
 namespace rparser {
 
+static const std::string kEmptyString;
+
+PooledString::PooledString() : s_(&kEmptyString) {}
+
+PooledString StringPool::Intern(const std::string& s)
+{
+  if (s.empty()) return PooledString();
+  return PooledString(&*strings_.insert(s).first);
+}
+
+size_t StringPool::size() const
+{
+  return strings_.size();
+}
+
+size_t StringPool::GetMemoryUsage() const
+{
+  // node (string + next pointer + hash) and bucket array.
+  size_t r = strings_.bucket_count() * sizeof(void*);
+  for (const auto &s : strings_)
+  {
+    r += sizeof(std::string) + sizeof(void*) + sizeof(size_t);
+    if (s.capacity() >= sizeof(std::string)) r += s.capacity() + 1;
+  }
+  return r;
+}
+
+void SoundMetaData::Set(Channel channel, const std::string& filename)
+{
+  fn[channel] = pool->Intern(filename);
+}
+
+bool BgaMetaData::BgaMetaInfo::operator==(const BgaMetaInfo& b) const
+{
+  return fn == b.fn && sx == b.sx && sy == b.sy && sw == b.sw && sh == b.sh &&
+         dx == b.dx && dy == b.dy && dw == b.dw && dh == b.dh;
+}
+
+void BgaMetaData::Set(Channel channel, const std::string& filename)
+{
+  bga[channel] = { pool->Intern(filename), 0,0,0,0, 0,0,0,0 };
+}
+
 bool BmsBpmMetaData::GetBpm(Channel channel, float &out) const
 {
-  auto it = bpm.find(channel);
-  if (it == bpm.end()) return false;
-  else out = static_cast<float>(it->second); return true;
+  const float *v = bpm.get(channel);
+  if (!v) return false;
+  out = *v;
+  return true;
 }
 
 bool BmsStopMetaData::GetStop(Channel channel, float &out) const
 {
-  auto it = stop.find(channel);
-  if (it == stop.end()) return false;
-  else out = static_cast<float>(it->second); return true;
+  const float *v = stop.get(channel);
+  if (!v) return false;
+  out = *v;
+  return true;
 }
 
 
 MetaData::MetaData()
 {
+  SetStringPool(std::make_shared<StringPool>());
   clear();
 }
 
 MetaData::MetaData(const MetaData& m)
 {
+  SetStringPool(m.sound_channel_.pool);
+
   #define META_INT(x,s) x = m.x;
   #define META_DBL(x,s) x = m.x;
   #define META_STR(x,s) x = m.x;
@@ -75,6 +123,14 @@ double MetaData::GetAttribute(const std::string& key) const
   return GetAttribute(key,.0);
 }
 
+template<>
+std::string MetaData::GetAttribute(const std::string& key) const
+{
+  auto it = attrs_.find(key);
+  if (it == attrs_.end()) return std::string();
+  return it->second;
+}
+
 void MetaData::SetAttribute(const std::string& key, int value)
 {
   char s[100];
@@ -108,62 +164,143 @@ bool MetaData::IsAttributeExist(const std::string& key)
   return attrs_.find(key) != attrs_.end();
 }
 
+const std::map<std::string, std::string>& MetaData::GetAttributes() const
+{
+  return attrs_;
+}
+
+/**
+ * @detail
+ * Keys of SetMetaFromAttribute() and the field to be filled,
+ * dispatched by perfect hash of key.
+ * BMS related attributes (DEFEXRANK, RANK, PLAYER) are converted.
+ */
+enum class MetaKeyTypes { kInt, kDouble, kString, kDefExRank, kRank, kPlayer };
+
+struct MetaKey
+{
+  MetaKeyTypes type;
+  int MetaData::*i;
+  double MetaData::*d;
+  std::string MetaData::*s;
+};
+
+constexpr size_t CountMetaKeys()
+{
+  size_t n = 3;
+  #define META_INT(x,s) n++
+  #define META_DBL(x,s) n++
+  #define META_STR(x,s) n++
+  RPARSER_METADATA_LISTS
+  #undef META_INT
+  #undef META_DBL
+  #undef META_STR
+  return n;
+}
+
+constexpr size_t kMetaKeyCount = CountMetaKeys();
+
+struct MetaKeyTable
+{
+  const char* names[kMetaKeyCount];
+  MetaKey keys[kMetaKeyCount];
+};
+
+constexpr MetaKeyTable MakeMetaKeyTable()
+{
+  MetaKeyTable t{};
+  size_t n = 0;
+  #define META_INT(x,s) t.names[n] = s; t.keys[n++] = { MetaKeyTypes::kInt, &MetaData::x, nullptr, nullptr }
+  #define META_DBL(x,s) t.names[n] = s; t.keys[n++] = { MetaKeyTypes::kDouble, nullptr, &MetaData::x, nullptr }
+  #define META_STR(x,s) t.names[n] = s; t.keys[n++] = { MetaKeyTypes::kString, nullptr, nullptr, &MetaData::x }
+  RPARSER_METADATA_LISTS
+  #undef META_INT
+  #undef META_DBL
+  #undef META_STR
+  t.names[n] = "DEFEXRANK"; t.keys[n++] = { MetaKeyTypes::kDefExRank, nullptr, nullptr, nullptr };
+  t.names[n] = "RANK"; t.keys[n++] = { MetaKeyTypes::kRank, nullptr, nullptr, nullptr };
+  t.names[n] = "PLAYER"; t.keys[n++] = { MetaKeyTypes::kPlayer, nullptr, nullptr, nullptr };
+  return t;
+}
+
+constexpr MetaKeyTable kMetaKeyTable = MakeMetaKeyTable();
+constexpr KeywordHash<kMetaKeyCount> kMetaKeyHash(kMetaKeyTable.names);
+static_assert(kMetaKeyHash.valid(), "Failed to generate perfect hash of metadata keys.");
+
 void MetaData::SetMetaFromAttribute()
 {
   for (const auto &attr : attrs_)
   {
-    if (attr.first.size() == 0) continue;
-#define META_INT(x,s) else if (attr.first == s) x = atoi(attr.second.c_str())
-#define META_DBL(x,s) else if (attr.first == s) x = atof(attr.second.c_str())
-#define META_STR(x,s) else if (attr.first == s) x = attr.second
-    RPARSER_METADATA_LISTS
-#undef META_STR
-#undef META_DBL
-#undef META_INT
-    /** BMS related attributes */
-    if (attr.first == "DEFEXRANK") {
+    const int idx = kMetaKeyHash.Find(attr.first);
+    if (idx < 0) continue;
+    const MetaKey &key = kMetaKeyTable.keys[idx];
+    switch (key.type)
+    {
+    case MetaKeyTypes::kInt:
+      this->*key.i = atoi(attr.second.c_str());
+      break;
+    case MetaKeyTypes::kDouble:
+      this->*key.d = atof(attr.second.c_str());
+      break;
+    case MetaKeyTypes::kString:
+      this->*key.s = attr.second;
+      break;
+    case MetaKeyTypes::kDefExRank:
       // convert from 160 to 100.0
       judgerank = atof(attr.second.c_str()) / 160;
-    }
-    else if (attr.first == "RANK") {
+      break;
+    case MetaKeyTypes::kRank:
       // convert from 4 to 100.0
       judgerank = atof(attr.second.c_str()) / 4.0 * 100;
-    }
-    else if (attr.first == "PLAYER") {
+      break;
+    case MetaKeyTypes::kPlayer:
+    {
       int pl = atoi(attr.second.c_str());
       if (pl == 2 || pl == 4)
         player_count = 2;
       else
         player_count = 1;
       player_side = 1;
+      break;
+    }
     }
   }
 }
 
 bool MetaData::SetEncoding(int from_codepage, int to_codepage)
 {
+  // gather all strings (including Sound/BGA channels)
+  // and convert them with single converter.
+  // pooled strings are converted as copy and interned again.
+  std::vector<std::string> pooled;
+  pooled.reserve(bga_channel_.bga.size() + sound_channel_.fn.size());
+  for (const auto &bga : bga_channel_.bga)
+    pooled.push_back(bga.second.fn);
+  for (const auto &fn : sound_channel_.fn)
+    pooled.push_back(fn.second);
+
+  std::vector<std::string*> strs;
+  strs.reserve(16 + pooled.size() + attrs_.size());
   #define META_INT(x,s)
   #define META_DBL(x,s)
-  #define META_STR(x,s) x = std::move(ConvertEncoding(x, to_codepage, from_codepage))
+  #define META_STR(x,s) strs.push_back(&x);
   RPARSER_METADATA_LISTS
   #undef META_INT
   #undef META_DBL
   #undef META_STR
 
-  // also do encoding process for all Sound/BGA channels
-  for (auto &bga: bga_channel_.bga)
-  {
-    bga.second.fn = std::move(ConvertEncoding(bga.second.fn, to_codepage, from_codepage));
-  }
-  for (auto &fn: sound_channel_.fn)
-  {
-    fn.second = std::move(ConvertEncoding(fn.second, to_codepage, from_codepage));
-  }
+  for (auto &s : pooled)
+    strs.push_back(&s);
   for (auto &pair: attrs_)
-  {
-    pair.second = std::move(ConvertEncoding(pair.second, to_codepage, from_codepage));
-  }
+    strs.push_back(&pair.second);
+
+  ConvertEncoding(strs.data(), strs.size(), to_codepage, from_codepage);
 
+  size_t i = 0;
+  for (const auto &bga : bga_channel_.bga)
+    bga.second.fn = bga_channel_.pool->Intern(pooled[i++]);
+  for (const auto &fn : sound_channel_.fn)
+    fn.second = sound_channel_.pool->Intern(pooled[i++]);
   return true;
 }
 
@@ -177,12 +314,24 @@ bool MetaData::SetUtf8Encoding()
 int MetaData::DetectEncoding()
 {
   // XXX: just try UTF-8, Shift-JIS, EUC-KR (otherwise).
-  std::stringstream encoding_test_ss;
-  encoding_test_ss << title << subtitle << artist << genre;
-  encoding = rutil::DetectEncoding(encoding_test_ss.str());
+  std::string s;
+  s.reserve(title.size() + subtitle.size() + artist.size() + genre.size());
+  s.append(title).append(subtitle).append(artist).append(genre);
+  encoding = rutil::DetectEncoding(s.c_str(), s.size());
   return encoding;
 }
 
+void MetaData::SetStringPool(const std::shared_ptr<StringPool>& pool)
+{
+  sound_channel_.pool = pool;
+  bga_channel_.pool = pool;
+}
+
+StringPool* MetaData::GetStringPool() const
+{
+  return sound_channel_.pool.get();
+}
+
 std::string MetaData::toString() const
 {
     std::stringstream ss;
@@ -10,6 +10,11 @@
 
 #include "Note.h"
 #include <map>
+#include <bitset>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <unordered_set>
 
 namespace rparser {
 
@@ -40,28 +45,215 @@ namespace rparser {
   
 const static int kDefaultBpm = 120;
 
+/*
+ * @detail
+ * Handle of string interned in StringPool.
+ * Same string in a pool shares single storage,
+ * and handle is valid while the pool is alive.
+ */
+class PooledString {
+public:
+  PooledString();
+  const std::string& str() const { return *s_; }
+  operator const std::string&() const { return *s_; }
+  const char* c_str() const { return s_->c_str(); }
+  size_t size() const { return s_->size(); }
+  bool empty() const { return s_->empty(); }
+  bool operator==(const PooledString& s) const { return s_ == s.s_ || *s_ == *s.s_; }
+  bool operator!=(const PooledString& s) const { return !(*this == s); }
+private:
+  friend class StringPool;
+  explicit PooledString(const std::string* s) : s_(s) {}
+  const std::string *s_;
+};
+
+inline bool operator==(const PooledString& a, const std::string& b) { return a.str() == b; }
+inline bool operator==(const std::string& a, const PooledString& b) { return a == b.str(); }
+inline std::ostream& operator<<(std::ostream& os, const PooledString& s) { return os << s.str(); }
+
+/*
+ * @detail
+ * String pool for resource filenames, shared by all charts of a song
+ * (charts of a song mostly have same #WAV / #BMP tables).
+ *
+ * @params
+ * Intern           get handle of the string, stored once in the pool.
+ * GetMemoryUsage   approximate heap usage of the pool in bytes.
+ */
+class StringPool {
+public:
+  PooledString Intern(const std::string& s);
+  size_t size() const;
+  size_t GetMemoryUsage() const;
+private:
+  std::unordered_set<std::string> strings_;
+};
+
+/*
+ * @detail
+ * Resource table indexed by channel.
+ * BMS channels (00 ~ ZZ) are stored in flat array for direct indexing,
+ * and other channels (e.g. bmson, ojn) are stored in overflow map.
+ * Flat array is allocated lazily in blocks of 36 channels
+ * (per first base-36 digit), so sparse table stays small.
+ * Iteration is done in channel order, with (first, second) entry
+ * like std::map.
+ */
+template <typename T>
+class ChannelTable {
+public:
+  static const Channel kFlatSize = 36 * 36;
+  static const Channel kBlockSize = 36;
+
+  template <typename Table, typename V>
+  class Iterator {
+  public:
+    struct Entry { Channel first; V &second; };
+    Iterator(Table *t, Channel ch) : t_(t), ch_(ch) {}
+    Entry operator*() const { return { ch_, *t_->get(ch_) }; }
+    Iterator& operator++() { ch_ = t_->next(ch_ + 1); return *this; }
+    bool operator==(const Iterator& it) const { return ch_ == it.ch_; }
+    bool operator!=(const Iterator& it) const { return ch_ != it.ch_; }
+  private:
+    Table *t_;
+    Channel ch_;
+  };
+  typedef Iterator<ChannelTable, T> iterator;
+  typedef Iterator<const ChannelTable, const T> const_iterator;
+
+  ChannelTable() : count_(0) {}
+
+  T& operator[](Channel ch)
+  {
+    if (ch < kFlatSize)
+    {
+      auto &block = blocks_[ch / kBlockSize];
+      if (block.empty()) block.resize(kBlockSize);
+      if (!used_[ch]) { used_[ch] = true; count_++; }
+      return block[ch % kBlockSize];
+    }
+    auto it = overflow_.find(ch);
+    if (it != overflow_.end()) return it->second;
+    count_++;
+    return overflow_[ch];
+  }
+
+  /* @brief returns nullptr if not exist. */
+  const T* get(Channel ch) const
+  {
+    if (ch < kFlatSize)
+      return used_[ch] ? &blocks_[ch / kBlockSize][ch % kBlockSize] : nullptr;
+    auto it = overflow_.find(ch);
+    return it == overflow_.end() ? nullptr : &it->second;
+  }
+
+  T* get(Channel ch)
+  {
+    return const_cast<T*>(static_cast<const ChannelTable*>(this)->get(ch));
+  }
+
+  bool exist(Channel ch) const { return get(ch) != nullptr; }
+
+  void erase(Channel ch)
+  {
+    if (ch < kFlatSize)
+    {
+      if (!used_[ch]) return;
+      used_[ch] = false;
+      blocks_[ch / kBlockSize][ch % kBlockSize] = T();
+      count_--;
+    }
+    else count_ -= overflow_.erase(ch);
+  }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+
+  /* @brief approximate memory usage in bytes (without heap of T itself). */
+  size_t GetMemoryUsage() const
+  {
+    size_t r = sizeof(*this);
+    for (const auto &block : blocks_)
+      r += block.capacity() * sizeof(T);
+    // map node: 32 byte header + key/value
+    return r + overflow_.size() * (32 + sizeof(std::pair<Channel, T>));
+  }
+
+  void clear()
+  {
+    for (auto &block : blocks_)
+      block.clear();
+    used_.reset();
+    overflow_.clear();
+    count_ = 0;
+  }
+
+  bool operator==(const ChannelTable& t) const
+  {
+    if (count_ != t.count_ || used_ != t.used_ || overflow_ != t.overflow_)
+      return false;
+    for (Channel ch = 0; ch < kFlatSize; ++ch)
+      if (used_[ch] && !(*get(ch) == *t.get(ch))) return false;
+    return true;
+  }
+  bool operator!=(const ChannelTable& t) const { return !(*this == t); }
+
+  iterator begin() { return iterator(this, next(0)); }
+  iterator end() { return iterator(this, kEnd); }
+  const_iterator begin() const { return const_iterator(this, next(0)); }
+  const_iterator end() const { return const_iterator(this, kEnd); }
+
+private:
+  static const Channel kEnd = std::numeric_limits<Channel>::max();
+
+  /* @brief first existing channel from given channel. */
+  Channel next(Channel ch) const
+  {
+    if (count_ == overflow_.size())
+      ch = ch < kFlatSize ? kFlatSize : ch;
+    for (; ch < kFlatSize; ++ch)
+      if (used_[ch]) return ch;
+    auto it = overflow_.lower_bound(ch);
+    return it == overflow_.end() ? kEnd : it->first;
+  }
+
+  std::vector<T> blocks_[kFlatSize / kBlockSize];  // allocated when channel is set
+  std::bitset<kFlatSize> used_;
+  std::map<Channel, T> overflow_;
+  size_t count_;
+};
+
+template <typename T> const Channel ChannelTable<T>::kFlatSize;
+template <typename T> const Channel ChannelTable<T>::kBlockSize;
+template <typename T> const Channel ChannelTable<T>::kEnd;
+
 struct SoundMetaData {
-  // channelno, filename
-  std::map<Channel, std::string> fn;
+  // channelno, filename (interned to pool)
+  ChannelTable<PooledString> fn;
+  std::shared_ptr<StringPool> pool;
+  void Set(Channel channel, const std::string& filename);
 };
 
 struct BgaMetaData {
   struct BgaMetaInfo {
-    std::string fn;
+    PooledString fn;
     int sx,sy,sw,sh;
     int dx,dy,dw,dh;
+    bool operator==(const BgaMetaInfo& b) const;
   };
   // channelno, bgainfo(filename)
-  std::map<Channel, BgaMetaInfo> bga;
+  ChannelTable<BgaMetaInfo> bga;
+  std::shared_ptr<StringPool> pool;
+  void Set(Channel channel, const std::string& filename);
 };
 
 struct BmsBpmMetaData {
-  std::map<Channel, float> bpm;	  // #BPM command (key, value)
+  ChannelTable<float> bpm;        // #BPM command (key, value)
   bool GetBpm(Channel channel, float &out) const;
 };
 
 struct BmsStopMetaData {
-  std::map<Channel, float> stop;  // #STOP command (key, value)
+  ChannelTable<float> stop;       // #STOP command (key, value)
   std::map<float, float> STP;	    // #STP command (time, value)
   bool GetStop(Channel channel, float &out) const;
 };
@@ -76,6 +268,7 @@ struct BmsStopMetaData {
  * SetEncoding        convert encoding of metadata if necessary.
  * SetUtf8Encoding    set metadata into utf8 encoding.
  * DetectEncoding     detect encoding from metadata.
+ * SetStringPool      set pool for Sound / BGA filenames (shared by song).
  * 
  * genre
  * charttype          NORMAL, HYPER, ANOTHER, ONI, ...
@@ -112,11 +305,14 @@ public:
   void SetAttribute(const std::string& key, double value);
   void MergeAttributes(const MetaData& md);
   bool IsAttributeExist(const std::string& key);
+  const std::map<std::string, std::string>& GetAttributes() const;
   void SetMetaFromAttribute();
 
   bool SetEncoding(int from_codepage, int to_codepage);
   bool SetUtf8Encoding();
   int DetectEncoding();
+  void SetStringPool(const std::shared_ptr<StringPool>& pool);
+  StringPool* GetStringPool() const;
 
   // @description
   // It returns valid Channel object pointer always (without exception)
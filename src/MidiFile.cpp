@@ -0,0 +1,294 @@
+#include "MidiFile.h"
+#include "Note.h"
+#include "rutil.h"
+#include "common.h"
+#include <thread>
+#include <cmath>
+
+namespace rparser
+{
+
+bool MidiEvent::is_meta() const { return cmd == 0xFF; }
+bool MidiEvent::is_sysex() const { return cmd == 0xF0 || cmd == 0xF7; }
+bool MidiEvent::is_channel() const { return cmd >= 0x80 && cmd < 0xF0; }
+
+/* @brief read variable length quantity. returns false if out of range. */
+static inline bool read_vlq(const uint8_t *&p, const uint8_t *end, uint32_t &out)
+{
+  out = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    if (p >= end) return false;
+    uint8_t c = *p++;
+    out = (out << 7) | (c & 0x7F);
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+MidiFile::MidiFile()
+  : p_(nullptr), len_(0), end_offset_(0), format_(0), timedivision_(0) {}
+
+bool MidiFile::Parse(const void* p, size_t len, unsigned thread_count)
+{
+  clear();
+  p_ = static_cast<const uint8_t*>(p);
+  len_ = len;
+
+  // MUST start from MThd signature
+  if (len < 14 || memcmp(p_, "MThd", 4) != 0)
+  {
+    std::cerr << "[MidiFile] Invalid MIDI start signature" << std::endl;
+    return false;
+  }
+  uint32_t header_len = rutil::ReadBE32(p_ + 4);
+  if (header_len < 6 || header_len > len - 8)
+  {
+    std::cerr << "[MidiFile] Invalid MIDI header length" << std::endl;
+    return false;
+  }
+  format_ = rutil::ReadBE16(p_ + 8);
+  uint16_t track_count = rutil::ReadBE16(p_ + 10);
+  timedivision_ = rutil::ReadBE16(p_ + 12);
+  if (timedivision_ == 0 || (timedivision_ & 0x8000))
+  {
+    std::cerr << "[MidiFile] SMPTE time division is not supported" << std::endl;
+    return false;
+  }
+
+  // locate MTrk chunks first, so each chunk can be decoded independently.
+  size_t offset = 8 + header_len;
+  tracks_.reserve(track_count);
+  while (tracks_.size() < track_count && len - offset >= 8)
+  {
+    uint32_t chunk_len = rutil::ReadBE32(p_ + offset + 4);
+    if (chunk_len > len - offset - 8)
+    {
+      std::cerr << "[MidiFile] Truncated MIDI chunk" << std::endl;
+      return false;
+    }
+    if (memcmp(p_ + offset, "MTrk", 4) == 0)
+    {
+      MidiTrack track;
+      track.chunk_offset = static_cast<uint32_t>(offset + 8);
+      track.chunk_len = chunk_len;
+      track.is_valid = false;
+      tracks_.push_back(track);
+    }
+    // unknown chunks are skipped.
+    offset += 8 + chunk_len;
+  }
+  end_offset_ = offset;
+
+  if (thread_count > 1 && tracks_.size() > 1)
+  {
+    const size_t worker_count = std::min<size_t>(thread_count, tracks_.size());
+    std::vector<std::thread> workers;
+    workers.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+      workers.emplace_back([this, i, worker_count]() {
+        for (size_t t = i; t < tracks_.size(); t += worker_count)
+          ParseTrack(tracks_[t]);
+      });
+    }
+    for (auto &w : workers) w.join();
+  }
+  else
+  {
+    for (auto &track : tracks_)
+      ParseTrack(track);
+  }
+
+  for (size_t i = 0; i < tracks_.size(); ++i)
+  {
+    if (!tracks_[i].is_valid)
+    {
+      std::cerr << "[MidiFile] Invalid MIDI event in track " << i << std::endl;
+      return false;
+    }
+  }
+
+  BuildTempoMap();
+  return true;
+}
+
+bool MidiFile::ParseTrack(MidiTrack& track) const
+{
+  const uint8_t *p = p_ + track.chunk_offset;
+  const uint8_t *end = p + track.chunk_len;
+  uint32_t tick = 0;
+  uint32_t delta, len;
+  uint8_t running_status = 0;
+  MidiEvent e;
+
+  // smallest event is 3 bytes (delta, running status data 2 byte)
+  track.events.clear();
+  track.events.reserve(track.chunk_len / 3 + 1);
+  track.is_valid = false;
+
+  while (p < end)
+  {
+    if (!read_vlq(p, end, delta) || p >= end) return false;
+    tick += delta;
+    e.tick = tick;
+    e.data_offset = e.data_len = 0;
+    e.a = e.b = 0;
+    e.cmd = *p;
+
+    if (e.is_meta())
+    {
+      if (end - p < 2) return false;
+      e.a = p[1];
+      p += 2;
+      if (!read_vlq(p, end, len) || len > (size_t)(end - p)) return false;
+      e.data_offset = static_cast<uint32_t>(p - p_);
+      e.data_len = len;
+      p += len;
+      running_status = 0;
+      track.events.push_back(e);
+      if (e.a == 0x2F) break;   // end of track
+      continue;
+    }
+
+    if (e.is_sysex())
+    {
+      ++p;
+      if (!read_vlq(p, end, len) || len > (size_t)(end - p)) return false;
+      e.data_offset = static_cast<uint32_t>(p - p_);
+      e.data_len = len;
+      p += len;
+      running_status = 0;
+      track.events.push_back(e);
+      continue;
+    }
+
+    if (e.cmd & 0x80)
+    {
+      running_status = e.cmd;
+      ++p;
+    }
+    else if (running_status == 0)
+      return false;
+    e.cmd = running_status;
+
+    // program change, channel pressure (and system messages) have single data byte.
+    size_t datasize = 2;
+    switch (e.cmd >> 4)
+    {
+    case 0xC:
+    case 0xD:
+    case 0xF:
+      datasize = 1;
+      break;
+    }
+    if ((size_t)(end - p) < datasize) return false;
+    e.a = p[0];
+    if (datasize == 2) e.b = p[1];
+    p += datasize;
+    track.events.push_back(e);
+  }
+
+  track.is_valid = true;
+  return true;
+}
+
+void MidiFile::BuildTempoMap()
+{
+  for (auto &track : tracks_)
+  {
+    for (auto &e : track.events)
+    {
+      if (!e.is_meta()) continue;
+      const uint8_t *data = GetEventData(e);
+      if (e.a == 0x51 && e.data_len >= 3)
+      {
+        uint32_t usec = (data[0] << 16) | (data[1] << 8) | data[2];
+        if (usec > 0) tempos_.push_back({ e.tick, usec });
+      }
+      else if (e.a == 0x58 && e.data_len >= 2 && data[1] < 8)
+      {
+        timesigs_.push_back({ e.tick, data[0], (uint8_t)(1 << data[1]) });
+      }
+    }
+  }
+  // tracks are merged in track order for events in same tick.
+  std::stable_sort(tempos_.begin(), tempos_.end(),
+    [](const MidiTempo& a, const MidiTempo& b) { return a.tick < b.tick; });
+  std::stable_sort(timesigs_.begin(), timesigs_.end(),
+    [](const MidiTimeSignature& a, const MidiTimeSignature& b) { return a.tick < b.tick; });
+
+  bars_.push_back({ 0.0, 0.0, 1.0 });
+  for (auto &ts : timesigs_)
+  {
+    if (ts.numerator == 0 || timedivision_ == 0) continue;
+    const double length = (double)ts.numerator / ts.denominator;
+    const double pos = ts.tick / (double)timedivision_ / 4.0;
+    MidiBar &last = bars_.back();
+    const double measure = std::ceil(last.measure + (pos - last.pos) / last.length - 1e-9);
+    if (measure == last.measure)
+      last.length = length;
+    else if (length != last.length)
+      bars_.push_back({ last.pos + (measure - last.measure) * last.length, measure, length });
+  }
+}
+
+void MidiFile::FillTimingData(TrackData& td, double bpm_ratio) const
+{
+  NoteElement ne;
+  auto &bpm_track = td[TimingTrackTypes::kBpm];
+  for (auto &t : tempos_)
+  {
+    ne.set_measure(t.tick / (double)timedivision_ / 4.0);
+    ne.set_value(60'000'000.0 * bpm_ratio / t.usec_per_quarter);
+    bpm_track.AddNoteElement(ne);
+  }
+}
+
+double MidiFile::GetMeasure(double pos) const
+{
+  if (bars_.empty()) return pos;
+  auto it = std::upper_bound(bars_.begin() + 1, bars_.end(), pos,
+    [](double p, const MidiBar& b) { return p < b.pos; });
+  const MidiBar &b = *(it - 1);
+  return b.measure + (pos - b.pos) / b.length;
+}
+
+void MidiFile::FillMeasureLength(TrackData& td) const
+{
+  NoteElement ne;
+  auto &measure_track = td[TimingTrackTypes::kMeasure];
+  double prev_length = 1.0;
+  for (auto &b : bars_)
+  {
+    if (b.length == prev_length) continue;
+    ne.SetRowPos(static_cast<uint32_t>(b.measure), RowPos{ 0, 1 });
+    ne.set_value(b.length);
+    measure_track.AddNoteElement(ne);
+    prev_length = b.length;
+  }
+}
+
+void MidiFile::clear()
+{
+  p_ = nullptr;
+  len_ = 0;
+  end_offset_ = 0;
+  format_ = 0;
+  timedivision_ = 0;
+  tracks_.clear();
+  tempos_.clear();
+  timesigs_.clear();
+  bars_.clear();
+}
+
+uint16_t MidiFile::format() const { return format_; }
+uint16_t MidiFile::timedivision() const { return timedivision_; }
+size_t MidiFile::get_track_count() const { return tracks_.size(); }
+const MidiTrack& MidiFile::get_track(size_t track) const { return tracks_[track]; }
+const uint8_t* MidiFile::GetEventData(const MidiEvent& e) const { return p_ + e.data_offset; }
+size_t MidiFile::size() const { return end_offset_; }
+const std::vector<MidiTempo>& MidiFile::GetTempoMap() const { return tempos_; }
+const std::vector<MidiTimeSignature>& MidiFile::GetTimeSignatures() const { return timesigs_; }
+
+}
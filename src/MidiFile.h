@@ -0,0 +1,135 @@
+#ifndef RPARSER_MIDIFILE_H
+#define RPARSER_MIDIFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace rparser
+{
+
+class TrackData;
+
+/**
+ * @brief Decoded MIDI event.
+ * Meta / sysex data is not copied; it is referred by offset from
+ * the source buffer. (use MidiFile::GetEventData())
+ */
+struct MidiEvent
+{
+  uint32_t tick;          // absolute tick of the event
+  uint32_t data_offset;   // meta / sysex data offset from source buffer
+  uint32_t data_len;      // meta / sysex data length
+  uint8_t cmd;            // status byte (0xFF: meta, 0xF0/0xF7: sysex)
+  uint8_t a;              // first data byte (meta type in case of meta event)
+  uint8_t b;              // second data byte
+
+  bool is_meta() const;
+  bool is_sysex() const;
+  bool is_channel() const;
+};
+
+/* @brief Decoded events of single MTrk chunk. */
+struct MidiTrack
+{
+  std::vector<MidiEvent> events;
+  uint32_t chunk_offset;  // offset of track data from source buffer
+  uint32_t chunk_len;
+  bool is_valid;
+};
+
+/* @brief Tempo change. bpm = 60'000'000 / usec_per_quarter */
+struct MidiTempo
+{
+  uint32_t tick;
+  uint32_t usec_per_quarter;
+};
+
+/* @brief Time signature change. denominator is actual value (not power of 2). */
+struct MidiTimeSignature
+{
+  uint32_t tick;
+  uint8_t numerator;
+  uint8_t denominator;
+};
+
+/**
+ * @brief Measure segment built from time signatures.
+ * pos is beat position (tick / timedivision / 4) where the measure starts,
+ * and length is measure length ratio to 4/4.
+ */
+struct MidiBar
+{
+  double pos;
+  double measure;
+  double length;
+};
+
+/**
+ * @brief Standard MIDI File (SMF) parser.
+ *
+ * Decodes each MTrk chunk into compact event array without
+ * allocation per event. Tempo / time signature events of all
+ * tracks are merged into tempo map after parsing.
+ *
+ * As MTrk chunks are independent, they can be decoded in parallel
+ * by giving thread count to Parse().
+ *
+ * @warn source buffer should be alive while using event data.
+ */
+class MidiFile
+{
+public:
+  MidiFile();
+
+  /* @brief parse SMF from memory. returns false if invalid. */
+  bool Parse(const void* p, size_t len, unsigned thread_count = 1);
+  void clear();
+
+  uint16_t format() const;
+  uint16_t timedivision() const;
+  size_t get_track_count() const;
+  const MidiTrack& get_track(size_t track) const;
+  const uint8_t* GetEventData(const MidiEvent& e) const;
+  /* @brief bytes consumed by parsing (end of last MTrk chunk). */
+  size_t size() const;
+
+  const std::vector<MidiTempo>& GetTempoMap() const;
+  const std::vector<MidiTimeSignature>& GetTimeSignatures() const;
+
+  /**
+   * @brief fill kBpm timing track for TimingSegmentData.
+   * Position is tick / timedivision / 4 (4 beat per measure),
+   * and BPM is multiplied by bpm_ratio.
+   * Time signatures are not filled as measure length, as position is
+   * linear to beat. Use GetMeasure() and FillMeasureLength() for bar lines.
+   */
+  void FillTimingData(TrackData& td, double bpm_ratio = 1.0) const;
+
+  /**
+   * @brief convert beat position (tick / timedivision / 4) into
+   * measure position, with measure length of time signatures.
+   * Time signature in the middle of a measure takes effect from next measure.
+   */
+  double GetMeasure(double pos) const;
+  /* @brief fill kMeasure timing track with measure length changes. */
+  void FillMeasureLength(TrackData& td) const;
+
+private:
+  bool ParseTrack(MidiTrack& track) const;
+  void BuildTempoMap();
+
+  const uint8_t* p_;
+  size_t len_;
+  size_t end_offset_;
+  uint16_t format_;
+  uint16_t timedivision_;
+  std::vector<MidiTrack> tracks_;
+  std::vector<MidiTempo> tempos_;
+  std::vector<MidiTimeSignature> timesigs_;
+  std::vector<MidiBar> bars_;
+};
+
+}
+
+#endif
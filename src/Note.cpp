@@ -2,6 +2,7 @@
 #include "common.h"
 #include <math.h>
 #include <limits>
+#include <algorithm>
 
 namespace rparser
 {
@@ -244,6 +245,59 @@ NoteSoundProperty& NoteElement::get_property_sound()
   return prop_.sound;
 }
 
+/**
+ * @brief Galloping (exponential) search from hint index.
+ * @param is_before should be true for leading elements and false for others.
+ * @return index of first element which is_before is false.
+ */
+template <typename IT, typename P>
+static size_t gallop_search(IT first, size_t size, size_t hint, P is_before)
+{
+  size_t lo = 0, hi = size, step = 1;
+  if (hint > size) hint = size;
+  if (hint < size && is_before(first[hint]))
+  {
+    // search forward
+    lo = hint + 1;
+    while (hint + step < size && is_before(first[hint + step]))
+    {
+      lo = hint + step + 1;
+      step <<= 1;
+    }
+    hi = std::min(hint + step, size);
+  }
+  else
+  {
+    // search backward
+    hi = hint;
+    while (step <= hint && !is_before(first[hint - step]))
+    {
+      hi = hint - step;
+      step <<= 1;
+    }
+    lo = step <= hint ? hint - step + 1 : 0;
+  }
+  return std::partition_point(first + lo, first + hi, is_before) - first;
+}
+
+/**
+ * @brief Move index to partition point of is_before.
+ *        Small forward motion is done with linear scan,
+ *        which is cheapest for per-frame (or per-input) seeking.
+ */
+template <typename IT, typename P>
+static size_t advance_search(IT first, size_t size, size_t idx, P is_before)
+{
+  constexpr int kLinearScanMax = 8;
+  if (idx > size) idx = size;
+  for (int i = 0; i < kLinearScanMax && idx < size && is_before(first[idx]); ++i)
+    ++idx;
+  if ((idx < size && is_before(first[idx])) ||
+      (idx > 0 && !is_before(first[idx - 1])))
+    return gallop_search(first, size, idx, is_before);
+  return idx;
+}
+
 // --------------------------------------- Note
 
 Note::Note(Track* track) : track_(track), index_(0), size_(track_->size()) {}
@@ -273,21 +327,25 @@ void Note::reset()
   size_ = track_->size();
 }
 
-void Note::SeekByBeat(double beat)
+bool Note::SeekByBeat(double beat)
 {
-  // TODO: fast binary search
-  if (size_ == 0) return;
+  const Track *track = track_;
+  index_ = gallop_search(track->begin(), size_, index_,
+    [beat](const NoteElement& n) { return n.measure() < beat; });
+  return index_ < size_;
 }
 
-void Note::SeekByTime(double time)
+bool Note::SeekByTime(double time)
 {
-  // TODO: fast binary search
-  if (size_ == 0) return;
+  const Track *track = track_;
+  index_ = gallop_search(track->begin(), size_, index_,
+    [time](const NoteElement& n) { return n.time() < time; });
+  return index_ < size_;
 }
 
 bool Note::is_end() const
 {
-  return index_ + 1 == size_;
+  return index_ + 1 >= size_;
 }
 
 NoteElement* Note::get()
@@ -297,7 +355,7 @@ NoteElement* Note::get()
 
 const NoteElement* Note::get() const
 {
-  return const_cast<Note*>(this)->get();
+  return static_cast<const Track*>(track_)->get(index_);
 }
 
 
@@ -307,74 +365,153 @@ Track::Track() : is_object_duplicable_(true) {}
 
 Track::~Track() {}
 
+const std::vector<NoteElement>& Track::notes() const
+{
+  static const std::vector<NoteElement> kEmptyNotes;
+  return notes_ ? *notes_ : kEmptyNotes;
+}
+
+std::vector<NoteElement>& Track::mutable_notes()
+{
+  // detach note buffer on first mutation if shared with other track.
+  if (!notes_)
+    notes_ = std::make_shared<std::vector<NoteElement> >();
+  else if (notes_.use_count() > 1)
+    notes_ = std::make_shared<std::vector<NoteElement> >(*notes_);
+  return *notes_;
+}
+
+std::vector<NoteElement>& Track::detached_notes()
+{
+  // nothing can be written through empty buffer, so it is safe to share.
+  static std::vector<NoteElement> kEmptyNotes;
+  return is_empty() ? kEmptyNotes : mutable_notes();
+}
+
+bool Track::is_shared() const
+{
+  return notes_ && notes_.use_count() > 1;
+}
+
 
 void Track::set_name(const std::string& name) { name_ = name; }
 
 const std::string& Track::name() const { return name_; }
 
-void Track::AddNoteElement(const NoteElement& object)
+static inline bool IsChainOpen(const NoteElement& n)
+{
+  return n.chain_status() == NoteChainStatus::Start ||
+         n.chain_status() == NoteChainStatus::Body;
+}
+
+static inline bool IsChainContinued(const NoteElement& n)
 {
-  // for fast-append logic
-  bool is_last_note_duplicated = !notes_.empty() && notes_.back().measure() == object.measure();
-  if (notes_.empty() || is_last_note_duplicated)
+  return n.chain_status() == NoteChainStatus::Body ||
+         n.chain_status() == NoteChainStatus::End;
+}
+
+/**
+ * @brief Resolve overlap of note at idx with other notes (non-duplicable track).
+ * - end of longnote removes tapnotes inside the longnote.
+ * - tapnote / start of longnote replaces notes in the same position,
+ *   and removes (closed) longnote which it is placed in.
+ * Longnote is removed as a whole if any of its object is removed.
+ * Used by both AddNoteElement() and SortNoteElements(),
+ * so bulk loading gives the same track as adding notes in position order.
+ */
+static void ResolveNoteOverlap(std::vector<NoteElement>& notes, size_t idx)
+{
+  const NoteElement &obj = notes[idx];
+  size_t lo = idx;
+  if (obj.chain_status() == NoteChainStatus::End)
+  {
+    while (lo > 0 && notes[lo - 1].chain_status() == NoteChainStatus::Tap)
+      --lo;
+    notes.erase(notes.begin() + lo, notes.begin() + idx);
+    return;
+  }
+
+  while (lo > 0 && notes[lo - 1].measure() == obj.measure())
+    --lo;
+  // (longnote which end is not added yet is not overlapped,
+  //  as tapnotes inside it are removed when its end is added.)
+  if (lo > 0 && IsChainOpen(notes[lo - 1]) &&
+      idx + 1 < notes.size() && IsChainContinued(notes[idx + 1]))
+    --lo;
+  if (lo == idx) return;
+
+  const bool is_open = IsChainOpen(notes[idx - 1]);
+  while (lo > 0 && IsChainContinued(notes[lo]))
+    --lo;
+  notes.erase(notes.begin() + lo, notes.begin() + idx);
+  idx = lo;
+  if (is_open)
   {
-    // if object is not duplicatable
-    if (!is_object_duplicable_ && is_last_note_duplicated)
+    // rest of the removed longnote after inserted note.
+    size_t hi = idx + 1;
+    while (hi < notes.size() && IsChainContinued(notes[hi]))
     {
-      if (object.chain_status() == NoteChainStatus::End)
-      {
-        // if end of longnote, pop other tapnotes till beginning of the longnote.
-        while (notes_.back().chain_status() == NoteChainStatus::Tap && notes_.size() > 1)
-          notes_.pop_back();
-      }
-      // don't check tapnote in case of fast-append logic,
-      // as there'll be no longnote at last position.
-      notes_.back() = object;
-      return;
+      if (notes[hi++].chain_status() == NoteChainStatus::End) break;
     }
-    notes_.push_back(object);
-    return;
+    notes.erase(notes.begin() + idx + 1, notes.begin() + hi);
+  }
+}
+
+void Track::AddNoteElement(const NoteElement& object)
+{
+  auto &notes = mutable_notes();
+  size_t idx;
+  // fast-append in case of position order
+  if (notes.empty() || !(object < notes.back()))
+  {
+    idx = notes.size();
+    notes.push_back(object);
+  }
+  else
+  {
+    idx = std::upper_bound(notes.begin(), notes.end(), object) - notes.begin();
+    notes.insert(notes.begin() + idx, object);
   }
-  // search position to insert note
-  auto it = std::upper_bound(notes_.begin(), notes_.end(), object);
-  auto end = notes_.insert(it, object);
   if (!is_object_duplicable_)
+    ResolveNoteOverlap(notes, idx);
+}
+
+void Track::AppendNoteElement(const NoteElement& object)
+{
+  auto &notes = mutable_notes();
+  notes.push_back(object);
+}
+
+void Track::SortNoteElements()
+{
+  if (size() < 2) return;
+  auto &notes = mutable_notes();
+  std::stable_sort(notes.begin(), notes.end(),
+    [](const NoteElement& a, const NoteElement& b) { return a.measure() < b.measure(); });
+  if (!is_object_duplicable_ && notes.size() > 1)
   {
-    if (object.chain_status() == NoteChainStatus::End)
+    // same as adding notes in position (and appended) order.
+    std::vector<NoteElement> sorted;
+    sorted.swap(notes);
+    notes.reserve(sorted.size());
+    for (const auto &n : sorted)
     {
-      // if end of longnote, pop all invalid tapnotes
-      int remove_count = 0;
-      while (end - remove_count != notes_.begin()
-        && (end - remove_count - 1)->chain_status() == NoteChainStatus::Tap)
-      {
-        remove_count++;
-      }
-      notes_.erase(end - remove_count, end);
-    }
-    else {
-      // if tapnote / LN start, then check overlapping with other longnotes.
-      unsigned l = 1;
-      while (end + l != notes_.end() && (end + l)->chain_status() != NoteChainStatus::Tap)
-        l++;
-      notes_.erase(end + 1, end + l);
-      l = 0;
-      while (end - l != notes_.begin() && (end - l - 1)->chain_status() != NoteChainStatus::Tap)
-        l++;
-      notes_.erase(end - l, end);
+      notes.push_back(n);
+      ResolveNoteOverlap(notes, notes.size() - 1);
     }
   }
 }
 
 void Track::RemoveNoteElement(const NoteElement& object)
 {
-  if (notes_.empty()) return;
-  NoteElement *nf = &notes_.front();
-  NoteElement *ne = &notes_.back();
+  const auto &cnotes = notes();
+  if (cnotes.empty()) return;
 
   // TODO: throw exception when object is not included in track?
-  if (&object < nf || &object > ne) return;
+  if (&object < &cnotes.front() || &object > &cnotes.back()) return;
 
-  notes_.erase(std::remove(notes_.begin(), notes_.end(), object), notes_.end());
+  auto &notes = mutable_notes();
+  notes.erase(std::remove(notes.begin(), notes.end(), object), notes.end());
 }
 
 NoteElement* Track::GetNoteElementByPos(int measure, int nu, int de)
@@ -385,16 +522,20 @@ NoteElement* Track::GetNoteElementByPos(int measure, int nu, int de)
 NoteElement* Track::GetNoteElementByMeasure(double measure)
 {
   // @brief Find note element that is equal or bigger than given measure.
-  // TODO: use faster binary search without creating NoteElement
-  NoteElement n;
-  n.set_measure(measure);
-  auto it = std::lower_bound(notes_.begin(), notes_.end(), n);
-  if (it == notes_.end())
-    return nullptr;
-  return &*it;
+  return get(lower_bound_index(measure));
 }
 
-NoteElement* Track::get(size_t index) { return index < notes_.size() ? &notes_[index] : nullptr; }
+NoteElement* Track::get(size_t index)
+{
+  if (index >= size()) return nullptr;
+  return &mutable_notes()[index];
+}
+
+const NoteElement* Track::get(size_t index) const
+{
+  if (index >= size()) return nullptr;
+  return &notes()[index];
+}
 
 void Track::RemoveNoteByPos(int measure, int nu, int de)
 {
@@ -404,28 +545,28 @@ void Track::RemoveNoteByPos(int measure, int nu, int de)
 void Track::RemoveNoteByMeasure(double measure)
 {
   // @brief Remove note element that is equal or bigger than given measure.
-  if (notes_.empty()) return;
-  NoteElement n;
-  n.set_measure(measure);
-  auto it = std::lower_bound(notes_.begin(), notes_.end(), n);
-  notes_.erase(it);
+  size_t idx = lower_bound_index(measure);
+  if (idx == size()) return;
+  auto &notes = mutable_notes();
+  notes.erase(notes.begin() + idx);
 }
 
 void Track::SetObjectDupliable(bool duplicable) { is_object_duplicable_ = duplicable; }
 
 bool Track::IsRangeEmpty(double measure) const
 {
+  const auto &notes = this->notes();
   // TODO: use faster binary search
   bool is_ln = false;
-  for (unsigned i = 0; i < notes_.size(); ++i)
+  for (unsigned i = 0; i < notes.size(); ++i)
   {
-    if (notes_[i].chain_status() == NoteChainStatus::Start)
+    if (notes[i].chain_status() == NoteChainStatus::Start)
       is_ln = true;
-    else if (notes_[i].chain_status() == NoteChainStatus::End)
+    else if (notes[i].chain_status() == NoteChainStatus::End)
       is_ln = false;
-    if (notes_[i].measure() == measure)
+    if (notes[i].measure() == measure)
       return false;
-    if (notes_[i].measure() > measure)
+    if (notes[i].measure() > measure)
       break;
   }
   return is_ln;
@@ -433,99 +574,104 @@ bool Track::IsRangeEmpty(double measure) const
 
 bool Track::IsRangeEmpty(double m_start, double m_end) const
 {
-  // XXX: should use temporary NoteElement?
-  NoteElement n;
-  n.set_measure(m_start);
-  auto it = std::lower_bound(notes_.begin(), notes_.end(), n);
-  return (it == notes_.end() || it->measure() > m_end);
+  const auto &notes = this->notes();
+  size_t idx = lower_bound_index(m_start);
+  return (idx == notes.size() || notes[idx].measure() > m_end);
 }
 
 bool Track::IsHoldNoteAt(double measure) const
 {
-  NoteElement n;
-  n.set_measure(measure);
-  auto it = std::lower_bound(notes_.begin(), notes_.end(), n);
-  return (n.chain_status() == NoteChainStatus::Body || n.chain_status() == NoteChainStatus::End);
+  const auto &notes = this->notes();
+  size_t idx = lower_bound_index(measure);
+  if (idx == notes.size()) return false;
+  const NoteChainStatus cstat = notes[idx].chain_status();
+  return (cstat == NoteChainStatus::Body || cstat == NoteChainStatus::End);
 }
 
 bool Track::HasLongnote() const
 {
-  for (auto &n : notes_)
+  const auto &notes = this->notes();
+  for (auto &n : notes)
     if (n.chain_status() == NoteChainStatus::Start) return true;
   return false;
 }
 
 void Track::GetNoteElementsByRange(double m_start, double m_end, std::vector<const NoteElement*> &out) const
 {
-  for (auto iter = begin(m_start); iter != end(m_end); ++iter)
-    out.push_back(&*iter);
+  const auto &notes = this->notes();
+  const size_t idx = lower_bound_index(m_start);
+  const size_t idx_end = upper_bound_index(m_end, idx);
+  for (size_t i = idx; i < idx_end; ++i)
+    out.push_back(&notes[i]);
 }
 
 void Track::GetAllNoteElements(std::vector<const NoteElement*> &out) const
 {
-  for (size_t i = 0; i < notes_.size(); ++i)
-    out.push_back(&notes_[i]);
+  const auto &notes = this->notes();
+  for (size_t i = 0; i < notes.size(); ++i)
+    out.push_back(&notes[i]);
 }
 
 void Track::GetNoteElementsByRange(double m_start, double m_end, std::vector<NoteElement*> &out)
 {
-  for (auto iter = begin(m_start); iter != end(m_end); ++iter)
-    out.push_back(&*iter);
+  const size_t idx = lower_bound_index(m_start);
+  const size_t idx_end = upper_bound_index(m_end, idx);
+  if (idx >= idx_end) return;
+  auto &notes = mutable_notes();
+  for (size_t i = idx; i < idx_end; ++i)
+    out.push_back(&notes[i]);
 }
 
 void Track::GetAllNoteElements(std::vector<NoteElement*> &out)
 {
-  for (size_t i = 0; i < notes_.size(); ++i)
-    out.push_back(&notes_[i]);
+  auto &notes = detached_notes();
+  for (size_t i = 0; i < notes.size(); ++i)
+    out.push_back(&notes[i]);
 }
 
 
 void Track::ClearAll()
 {
-  notes_.clear();
+  // shared buffer is just released, otherwise reuse its capacity.
+  if (is_shared())
+    notes_.reset();
+  else if (notes_)
+    notes_->clear();
 }
 
 void Track::ClearRange(double m_begin, double m_end)
 {
-  for (size_t i = 0; i < notes_.size(); ++i)
-  {
-    if (notes_[i].measure() >= m_begin)
-    {
-      size_t si = i;
-      size_t ei = i+1;
-      while (ei < notes_.size())
-      {
-        if (notes_[ei].measure() > m_end)
-          break;
-        ei++;
-      }
-      notes_.erase(notes_.begin() + si, notes_.begin() + ei);
-      break;
-    }
-  }
+  // search range first, so buffer is detached only if any note is removed.
+  const size_t si = lower_bound_index(m_begin);
+  if (si >= size()) return;
+  const size_t ei = std::max(si + 1, upper_bound_index(m_end, si));
+  auto &notes = mutable_notes();
+  notes.erase(notes.begin() + si, notes.begin() + ei);
 }
 
 void Track::CopyAll(const Track& from)
 {
+  const auto &from_notes = from.notes();
   // TODO: check track type before copy element from other track
-  for (size_t i = 0; i < from.notes_.size(); ++i)
+  for (size_t i = 0; i < from_notes.size(); ++i)
   {
-    AddNoteElement(from.notes_[i]);
+    AddNoteElement(from_notes[i]);
   }
 }
 
 void Track::CopyRange(const Track& from, double m_begin, double m_end)
 {
+  const auto &from_notes = from.notes();
   // TODO: check track type before copy element from other track
-  for (size_t i = 0; i < from.notes_.size(); ++i)
+  for (size_t i = 0; i < from_notes.size(); ++i)
   {
-    if (from.notes_[i].measure() >= m_begin)
+    if (from_notes[i].measure() >= m_begin)
     {
-      while (i < from.notes_.size())
+      while (i < from_notes.size())
       {
-        if (from.notes_[i].measure() > m_end)
+        if (from_notes[i].measure() > m_end)
           break;
-        AddNoteElement(from.notes_[i]);
+        AddNoteElement(from_notes[i]);
         ++i;
       }
       break;
@@ -544,7 +690,8 @@ void Track::MoveRange(double m_delta, double m_begin, double m_end)
 
 void Track::MoveAll(double m_delta)
 {
-  for (auto &obj : notes_)
+  auto &notes = detached_notes();
+  for (auto &obj : notes)
   {
     obj.set_measure(obj.measure() + m_delta);
   }
@@ -555,27 +702,34 @@ void Track::InsertBlank(double m_begin, double m_delta)
   MoveRange(m_delta, m_begin, std::numeric_limits<double>::max());
 }
 
-static bool __comp_note_pos(const NoteElement& a, const NoteElement& b) {
-  return a.measure() < b.measure();
+size_t Track::lower_bound_index(double measure, size_t hint) const
+{
+  const auto &notes = this->notes();
+  return gallop_search(notes.begin(), notes.size(), hint,
+    [measure](const NoteElement& n) { return n.measure() < measure; });
 }
 
-Track::iterator Track::begin() { return notes_.begin(); }
-Track::iterator Track::end() { return notes_.end(); }
-Track::const_iterator Track::begin() const { return notes_.begin(); }
-Track::const_iterator Track::end() const { return notes_.end(); }
+size_t Track::upper_bound_index(double measure, size_t hint) const
+{
+  const auto &notes = this->notes();
+  return gallop_search(notes.begin(), notes.size(), hint,
+    [measure](const NoteElement& n) { return n.measure() <= measure; });
+}
+
+Track::iterator Track::begin() { return detached_notes().begin(); }
+Track::iterator Track::end() { return detached_notes().end(); }
+Track::const_iterator Track::begin() const { return notes().begin(); }
+Track::const_iterator Track::end() const { return notes().end(); }
 
-// TODO: use custom lower/upper bound function to remove unnecessary struct creation
-Track::iterator Track::begin(double mpos)
-{ NoteElement e; e.set_measure(mpos); return std::lower_bound(notes_.begin(), notes_.end(), e, __comp_note_pos); }
-Track::iterator Track::end(double mpos)
-{ NoteElement e; e.set_measure(mpos); return std::upper_bound(notes_.begin(), notes_.end(), e, __comp_note_pos); }
-Track::const_iterator Track::begin(double mpos) const
-{ NoteElement e; e.set_measure(mpos); return std::lower_bound(notes_.begin(), notes_.end(), e, __comp_note_pos); }
-Track::const_iterator Track::end(double mpos) const
-{ NoteElement e; e.set_measure(mpos); return std::upper_bound(notes_.begin(), notes_.end(), e, __comp_note_pos); }
+Track::iterator Track::begin(double mpos) { return detached_notes().begin() + lower_bound_index(mpos); }
+Track::iterator Track::end(double mpos) { return detached_notes().begin() + upper_bound_index(mpos); }
+Track::const_iterator Track::begin(double mpos) const { return notes().begin() + lower_bound_index(mpos); }
+Track::const_iterator Track::end(double mpos) const { return notes().begin() + upper_bound_index(mpos); }
 
-NoteElement& Track::front() { return notes_.front(); };
-NoteElement& Track::back() { return notes_.back(); };
+NoteElement& Track::front() { return mutable_notes().front(); };
+NoteElement& Track::back() { return mutable_notes().back(); };
+const NoteElement& Track::front() const { return notes().front(); };
+const NoteElement& Track::back() const { return notes().back(); };
 
 void Track::swap(Track &track)
 {
@@ -584,12 +738,12 @@ void Track::swap(Track &track)
 
 size_t Track::size() const
 {
-  return notes_.size();
+  return notes().size();
 }
 
 bool Track::is_empty() const
 {
-  return notes_.empty();
+  return notes().empty();
 }
 
 void Track::clear()
@@ -658,7 +812,7 @@ void TrackData::RemoveObjectByMeasure(double measure)
 bool TrackData::IsHoldNoteAt(double measure) const
 {
   for (auto &track : tracks_)
-    if (!track.IsHoldNoteAt(measure)) return false;
+    if (track.IsHoldNoteAt(measure)) return true;
   return false;
 }
 
@@ -767,25 +921,41 @@ unsigned TrackData::GetNoteCount() const
 
 NoteElement* TrackData::front()
 {
-  NoteElement *n = nullptr;
+  // search in const way, so only the track of returned note is detached.
+  const Track *t = nullptr;
+  for (const auto &track : tracks_) if (!track.is_empty())
+    if (!t || t->front().measure() > track.front().measure())
+      t = &track;
+  return t ? &tracks_[t - tracks_.data()].front() : nullptr;
+}
+
+NoteElement* TrackData::back()
+{
+  const Track *t = nullptr;
+  for (const auto &track : tracks_) if (!track.is_empty())
+    if (!t || t->back().measure() < track.back().measure())
+      t = &track;
+  return t ? &tracks_[t - tracks_.data()].back() : nullptr;
+}
+
+const NoteElement* TrackData::front() const
+{
+  const NoteElement *n = nullptr;
   for (auto &track : tracks_) if (!track.is_empty())
     if (!n || n->measure() > track.front().measure())
       n = &track.front();
   return n;
 }
 
-NoteElement* TrackData::back()
+const NoteElement* TrackData::back() const
 {
-  NoteElement *n = nullptr;
+  const NoteElement *n = nullptr;
   for (auto &track : tracks_) if (!track.is_empty())
     if (!n || n->measure() < track.back().measure())
       n = &track.back();
   return n;
 }
 
-const NoteElement* TrackData::front() const { return const_cast<TrackData*>(this)->front(); }
-const NoteElement* TrackData::back() const { return const_cast<TrackData*>(this)->back(); }
-
 
 // @brief temporary struct to store note elements with track number
 struct NoteElementsWithTrackNumber
@@ -810,6 +980,9 @@ template <typename TD, typename T, typename IT>
 TrackData::all_track_iterator<TD, T, IT>::all_track_iterator(TD& td)
   : track_(-1), pos_(.0)
 {
+  begin_iters_.reserve(td.get_track_count());
+  curr_iters_.reserve(td.get_track_count());
+  end_iters_.reserve(td.get_track_count());
   for (size_t i = 0; i < td.get_track_count(); ++i) {
     begin_iters_.push_back(td.get_track(i).begin());
     curr_iters_.push_back(begin_iters_.back());
@@ -822,6 +995,9 @@ template <typename TD, typename T, typename IT>
 TrackData::all_track_iterator<TD, T, IT>::all_track_iterator(TD& td, double m_start, double m_end)
   : track_(-1), pos_(.0)
 {
+  begin_iters_.reserve(td.get_track_count());
+  curr_iters_.reserve(td.get_track_count());
+  end_iters_.reserve(td.get_track_count());
   for (size_t i = 0; i < td.get_track_count(); ++i) {
     begin_iters_.push_back(td.get_track(i).begin(m_start));
     curr_iters_.push_back(begin_iters_.back());
@@ -889,8 +1065,8 @@ void TrackData::all_track_iterator<TD, T, IT>::set_current_track()
 }
 
 // Explicit instantiation
-template class TrackData::iterator;
-template class TrackData::const_iterator;
+template class TrackData::all_track_iterator<TrackData, NoteElement, Track::iterator>;
+template class TrackData::all_track_iterator<const TrackData, const NoteElement, Track::const_iterator>;
 
 TrackData::iterator TrackData::begin()
 {
@@ -922,6 +1098,71 @@ TrackData::const_iterator TrackData::end() const
   return const_iterator();
 }
 
+TrackData::window_cursor::window_cursor(const TrackData& td)
+  : td_(&td), t_start_(0), t_end_(0)
+{
+  reset();
+}
+
+void TrackData::window_cursor::reset()
+{
+  begin_idx_.assign(td_->get_track_count(), 0);
+  end_idx_.assign(td_->get_track_count(), 0);
+  t_start_ = t_end_ = 0;
+}
+
+void TrackData::window_cursor::Seek(double t_start, double t_end)
+{
+  ASSERT(begin_idx_.size() == td_->get_track_count());
+  for (size_t i = 0; i < begin_idx_.size(); ++i)
+  {
+    const Track& track = td_->get_track(i);
+    begin_idx_[i] = advance_search(track.begin(), track.size(), begin_idx_[i],
+      [t_start](const NoteElement& n) { return n.time() < t_start; });
+    end_idx_[i] = advance_search(track.begin(), track.size(), end_idx_[i],
+      [t_end](const NoteElement& n) { return n.time() <= t_end; });
+    if (end_idx_[i] < begin_idx_[i]) end_idx_[i] = begin_idx_[i];
+  }
+  t_start_ = t_start;
+  t_end_ = t_end;
+}
+
+size_t TrackData::window_cursor::get_track_count() const
+{
+  return begin_idx_.size();
+}
+
+Track::const_iterator TrackData::window_cursor::begin(size_t track) const
+{
+  return td_->get_track(track).begin() + begin_idx_[track];
+}
+
+Track::const_iterator TrackData::window_cursor::end(size_t track) const
+{
+  return td_->get_track(track).begin() + end_idx_[track];
+}
+
+size_t TrackData::window_cursor::size(size_t track) const
+{
+  return end_idx_[track] - begin_idx_[track];
+}
+
+size_t TrackData::window_cursor::size() const
+{
+  size_t r = 0;
+  for (size_t i = 0; i < begin_idx_.size(); ++i)
+    r += end_idx_[i] - begin_idx_[i];
+  return r;
+}
+
+double TrackData::window_cursor::time_start() const { return t_start_; }
+double TrackData::window_cursor::time_end() const { return t_end_; }
+
+TrackData::window_cursor TrackData::GetWindowCursor() const
+{
+  return window_cursor(*this);
+}
+
 TrackData::iterator TrackData::GetAllTrackIterator()
 {
   return begin();
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <memory>
 
 namespace rparser
 {
@@ -171,6 +172,12 @@ class Track;
  * @brief An object consisted with NoteElement. Consisted with multiple NoteElements if Longnote object.
  *        Mainly used for note iterating.
  * @warn  May behave wrong if track data is modified during usage of Note object.
+ *
+ * SeekByBeat / SeekByTime moves to the first note at or after given position
+ * using galloping search from current index, so seeking forward per input
+ * (judgement) is O(1) amortized. Returns false if there is no such note,
+ * and get() returns nullptr in that case.
+ * SeekByTime requires note time filled by Chart::UpdateAllNotePos().
  */
 class Note
 {
@@ -180,8 +187,8 @@ public:
   bool next();
   bool prev();
   void reset();
-  void SeekByBeat(double beat);
-  void SeekByTime(double time);
+  bool SeekByBeat(double beat);
+  bool SeekByTime(double time);
   bool is_end() const;
   NoteElement* get();
   const NoteElement* get() const;
@@ -205,9 +212,24 @@ private:
  * If not compatible, then value of the NoteElement will be wipe out,
  * only measure value would be left.
  *
+ * Measure searching takes optional hint index (e.g. result of previous
+ * search) owned by caller, so monotonic seeks (e.g. sliding window
+ * for rendering) take O(log delta) time rather than O(log n).
+ *
  * @warn
  * All object's postype/track should be Beat,
  * and should not modified outside TrackData.
+ * Note buffer is copy-on-write: copied Track shares the same buffer,
+ * and it is detached when it is modified (or accessed in non-const way)
+ * at the first time. So copying chart or swapping tracks (lane mapping)
+ * takes O(tracks), not O(notes). Use const access for reading notes
+ * not to detach buffer, and empty track is not allocated until a note
+ * is inserted.
+ *
+ * @warn
+ * Pointer / iterator taken from non-const method before copying track
+ * should not be used to modify note after copying,
+ * as it points the buffer shared with copied track.
  */
 class Track
 {
@@ -219,9 +241,14 @@ public:
   const std::string& name() const;
   void AddNoteElement(const NoteElement& object);
   void RemoveNoteElement(const NoteElement& object);
+  // For batch building: append notes without sorting,
+  // then call SortNoteElements() once after appending.
+  void AppendNoteElement(const NoteElement& object);
+  void SortNoteElements();
   NoteElement* GetNoteElementByPos(int measure, int nu, int de);
   NoteElement* GetNoteElementByMeasure(double measure);
   NoteElement* get(size_t index);
+  const NoteElement* get(size_t index) const;
   void RemoveNoteByPos(int measure, int nu, int de);
   void RemoveNoteByMeasure(double measure);
   void ClearAll();
@@ -257,14 +284,30 @@ public:
   const_iterator end(double measure) const;
   NoteElement& front();
   NoteElement& back();
+  const NoteElement& front() const;
+  const NoteElement& back() const;
   void swap(Track &track);
   size_t size() const;
   bool is_empty() const;
   void clear();
 
+  // index of first note which measure is equal or bigger than given measure.
+  // search starts from hint index, if given.
+  size_t lower_bound_index(double measure, size_t hint = 0) const;
+  // index of first note which measure is bigger than given measure.
+  size_t upper_bound_index(double measure, size_t hint = 0) const;
+  // whether note buffer is shared with other (copied) track.
+  bool is_shared() const;
+
 protected:
   std::string name_;
-  std::vector<NoteElement> notes_;
+  // shared note buffer; nullptr for empty track.
+  std::shared_ptr<std::vector<NoteElement> > notes_;
+  const std::vector<NoteElement>& notes() const;
+  // detached note buffer, allocated if empty (for inserting notes).
+  std::vector<NoteElement>& mutable_notes();
+  // detached note buffer, without allocating empty track.
+  std::vector<NoteElement>& detached_notes();
   std::string track_datatype_;
   bool is_object_duplicable_;
 };
@@ -356,6 +399,39 @@ public:
   const_iterator begin(double m_start, double m_end) const;
   const_iterator end() const;
 
+  /**
+   * @brief Cursor for notes in time window [t_start, t_end] for each track.
+   *
+   * Keeps index of each track, so seeking in monotonic time
+   * (e.g. rendering visible notes every frame) takes amortized O(delta)
+   * without any allocation. Backward / far seeks use galloping search.
+   *
+   * @warn Note time should be filled (Chart::Update) before seeking.
+   * @warn Cursor is invalidated if track count or notes are modified.
+   *       Call reset() in that case.
+   */
+  class window_cursor
+  {
+  public:
+    window_cursor(const TrackData& td);
+    void Seek(double t_start, double t_end);
+    void reset();
+    size_t get_track_count() const;
+    Track::const_iterator begin(size_t track) const;
+    Track::const_iterator end(size_t track) const;
+    size_t size(size_t track) const;
+    size_t size() const;
+    double time_start() const;
+    double time_end() const;
+  private:
+    const TrackData* td_;
+    std::vector<size_t> begin_idx_;
+    std::vector<size_t> end_idx_;
+    double t_start_, t_end_;
+  };
+
+  window_cursor GetWindowCursor() const;
+
   // XXX: backward compatibility
   iterator GetAllTrackIterator();
   iterator GetAllTrackIterator(double m_start, double m_end);
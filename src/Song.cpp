@@ -14,6 +14,7 @@
   BMS( SONGTYPE::OSU, "osu" ),     \
   BMS( SONGTYPE::SM, "sm" ),       \
   BMS( SONGTYPE::OJM, "ojm" ),     \
+  BMS( SONGTYPE::OJM, "ojn" ),     \
   BMS( SONGTYPE::VOS, "vos" ),     \
   BMS( SONGTYPE::DTX, "dtx" )
 //BMS( SONGTYPE::BMS, "zip" ),     \ -- is directory.
@@ -92,7 +93,9 @@ const char** GetSongExtensions()
 }
 
 Song::Song()
-  : songtype_(SONGTYPE::NONE), error_(ERROR::NONE), directory_(0)
+  : directory_(0), songtype_(SONGTYPE::NONE),
+    string_pool_(std::make_shared<StringPool>()),
+    shared_tempo_updated_(false), error_(ERROR::NONE), diag_(nullptr)
 {
 }
 
@@ -114,9 +117,17 @@ Chart* Song::NewChart()
   switch (songtype_)
   {
   case SONGTYPE::BMS:
+  case SONGTYPE::BMSON:
     c->GetNoteData().set_track_count(8);
     break;
+  case SONGTYPE::DTX:
+    c->GetNoteData().set_track_count(12);
+    break;
+  case SONGTYPE::OSU:
+    c->GetNoteData().set_track_count(4);
+    break;
   case SONGTYPE::VOS:
+  case SONGTYPE::OJM:
     c->GetNoteData().set_track_count(7);
     break;
   case SONGTYPE::SM:
@@ -129,11 +140,25 @@ Chart* Song::NewChart()
     ASSERT(0);
   }
 
+  c->GetMetaData().SetStringPool(string_pool_);
   c->SetParent(this);
   charts_.push_back(c);
   return c;
 }
 
+void Song::UpdateSharedTempoData()
+{
+  if (shared_tempo_updated_) return;
+  // initial BPM should be in timing track, as metadata is not shared.
+  chart_shared_.GetTimingSegmentData().Update(nullptr, chart_shared_.GetTimingData());
+  shared_tempo_updated_ = true;
+}
+
+void Song::InvalidateSharedTempoData()
+{
+  shared_tempo_updated_ = false;
+}
+
 Chart* Song::GetChart(size_t idx)
 {
   if (idx >= charts_.size()) return nullptr;
@@ -224,6 +249,7 @@ bool Song::Open(const std::string &path, SONGTYPE songtype)
     ASSERT(fd.len > 0);
     Chart *c = NewChart();
     c->SetFilename(filepath_);
+    if (diag_) diag_->SetFile(filepath_);
     r = cl->Load(*c, fd.p, fd.len);
     if (!r)
       DeleteChart(0);
@@ -285,6 +311,9 @@ bool Song::Close(bool save)
   for (auto *c : charts_)
     delete c;
   charts_.clear();
+  chart_shared_.Clear();
+  string_pool_ = std::make_shared<StringPool>();
+  shared_tempo_updated_ = false;
   if (directory_)
   {
     directory_.reset();
@@ -335,17 +364,35 @@ Directory * Song::GetDirectory()
 	return directory_.get();
 }
 
+void Song::SetDiagnostics(Diagnostics *diag)
+{
+  diag_ = diag;
+}
+
+Diagnostics* Song::GetDiagnostics()
+{
+  return diag_;
+}
+
 std::string Song::GetHash() const
 {
-  /* use default hash with bit 1
-     to avoid creating same hash with chart. */
-  std::string hash = "11111111"
-    "11111111"
-    "11111111"
-    "11111111";
+  /* md5 of all chart hashes in sorted order
+     (so it won't be same with hash of any chart,
+      and won't depend on order of files in directory). */
+  std::vector<std::string> hashes;
+  hashes.reserve(charts_.size());
   for (auto *c : charts_)
-    hash = md5_sum(hash, c->GetHash());
-  return hash;
+    hashes.push_back(c->GetHash());
+  std::sort(hashes.begin(), hashes.end());
+  rutil::MD5Hasher hasher;
+  for (const auto &h : hashes)
+    hasher.update(h.c_str(), h.size());
+  return hasher.hexdigest();
+}
+
+StringPool* Song::GetStringPool()
+{
+  return string_pool_.get();
 }
 
 std::string Song::toString(bool detailed) const
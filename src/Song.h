@@ -19,6 +19,8 @@
 
 namespace rparser {
 
+class Diagnostics;
+
 enum class SONGTYPE {
   NONE = 0,
   BMS,
@@ -51,6 +53,9 @@ enum class SONGTYPE {
  * Save save all changes.
  *      warning: MUST close chart file before process save.
  * Close close song file and empty handle.
+ * SetDiagnostics set sink for warnings while loading charts.
+ *                (not owned by song, nullptr to disable)
+ * GetStringPool pool of resource filenames shared by charts.
  */
 class Song {
 public:
@@ -75,10 +80,26 @@ public:
   const std::string GetPath() const;
   const char* GetErrorStr() const;
   Directory* GetDirectory();
-
-  /* @brief Create hash value for identity code based on charts. */
+  void SetDiagnostics(Diagnostics *diag);
+  Diagnostics* GetDiagnostics();
+  StringPool* GetStringPool();
+
+  /**
+   * @brief Create hash value for identity code based on charts.
+   * @detail
+   * MD5 of chart hashes in sorted order, so it doesn't depend on
+   * order of charts in song (e.g. order of files in directory).
+   */
   std::string GetHash() const;
 
+  /**
+   * @brief Update timing data shared by charts (e.g. SM).
+   * Shared timing is calculated only once until invalidated,
+   * though Chart::Update() is called for every chart.
+   */
+  void UpdateSharedTempoData();
+  void InvalidateSharedTempoData();
+
   virtual std::string toString(bool detailed=false) const;
 
 private:
@@ -90,11 +111,16 @@ private:
 
   std::vector<Chart*> charts_;
 
+  // interned resource filenames of charts.
+  std::shared_ptr<StringPool> string_pool_;
+
   // used for song sharing bga / bgm / timing as common data.
   Chart chart_shared_;
+  bool shared_tempo_updated_;
 
   ERROR error_;
   std::string errormsg_detailed_;
+  Diagnostics *diag_;
 };
 
 SONGTYPE GetSongTypeByName(const std::string& filename);
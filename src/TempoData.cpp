@@ -648,6 +648,11 @@ const std::vector<BarObject>& TimingSegmentData::GetBarObjects() const
   return barobjs_;
 }
 
+const std::vector<TimingSegment>& TimingSegmentData::GetTimingSegments() const
+{
+  return timingsegments_;
+}
+
 double TimingSegmentData::GetBarLength(uint32_t measure) const
 {
   BarObject b;
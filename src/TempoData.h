@@ -87,6 +87,7 @@ public:
   void clear();
   void swap(TimingSegmentData& timingdata);
   const std::vector<BarObject>& GetBarObjects() const;
+  const std::vector<TimingSegment>& GetTimingSegments() const;
   double GetBarLength(uint32_t measure) const;
 
   static void UseDetailedInfo(bool use_detailed_info);
@@ -40,7 +40,13 @@ namespace rparser
   };
 }
 
-#define RPARSER_LOG(x) std::cerr << x << std::endl;
+// verbose log is only enabled for debugging;
+// warnings of chart loading are reported to rparser::Diagnostics.
+#if defined(_DEBUG) || defined(RPARSER_VERBOSE_LOG)
+# define RPARSER_LOG(x) do { std::cerr << x << std::endl; } while (0)
+#else
+# define RPARSER_LOG(x) do {} while (0)
+#endif
 #define RPARSER_ASSERT(x, m) if (!x) { throw rparser::RparserException(m); }
 
 #endif
@@ -24,10 +24,6 @@
 # include <zip.h>
 #endif
 
-#ifdef USE_OPENSSL
-# include <openssl/md5.h>
-#endif
-
 #ifdef WIN32
 # include <windows.h>
 # include <stdarg.h>
@@ -43,6 +39,18 @@
 # include <iconv.h>
 #endif
 
+#if defined(__AVX2__)
+# define RUTIL_USE_AVX2
+# define RUTIL_USE_SSE2
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define RUTIL_USE_SSE2
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define RUTIL_USE_NEON
+# include <arm_neon.h>
+#endif
+
 #include <assert.h>
 #ifdef DEBUG
 # define ASSERT(x) assert(x)
@@ -50,102 +58,132 @@
 # define ASSERT(x)
 #endif
 
+#include "rutil_codepage.h"
+
 namespace rutil {
 
-bool TestUTF8Encoding(const std::string &s)
+// length of leading ASCII (< 0x80) bytes.
+size_t CountASCII(const char* s, size_t len)
 {
-  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(s.c_str());
-  int num;
-  while (*bytes != 0x00)
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(s);
+  size_t i = 0;
+#if defined(RUTIL_USE_AVX2)
+  for (; i + 32 <= len; i += 32)
   {
-    if ((*bytes & 0x80) == 0x00)
-    {
-      // U+0000 to U+007F 
-      num = 1;
-    }
-    else if ((*bytes & 0xE0) == 0xC0)
-    {
-      // U+0080 to U+07FF 
-      num = 2;
-    }
-    else if ((*bytes & 0xF0) == 0xE0)
-    {
-      // U+0800 to U+FFFF 
-      num = 3;
-    }
-    else if ((*bytes & 0xF8) == 0xF0)
-    {
-      // U+10000 to U+10FFFF 
-      num = 4;
-    }
-    else
-      return false;
-    bytes += 1;
-    for (int i = 1; i < num; ++i)
-    {
-      if ((*bytes & 0xC0) != 0x80)
-        return false;
-      bytes += 1;
-    }
+    const int mask = _mm256_movemask_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+    if (mask) break;
   }
-  return true;
+#endif
+#if defined(RUTIL_USE_SSE2)
+  for (; i + 16 <= len; i += 16)
+  {
+    const int mask = _mm_movemask_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+    if (mask) break;
+  }
+#endif
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t v;
+    memcpy(&v, p + i, 8);
+    if (v & 0x8080808080808080ULL) break;
+  }
+  while (i < len && p[i] < 0x80) ++i;
+  return i;
 }
 
-bool TestJISEncoding(const std::string &s)
+bool IsValidUTF8(const char* s, size_t len)
 {
-  // XXX: not exact method.
-  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(s.c_str());
-  while (*bytes != 0x00)
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(s);
+  size_t i = 0;
+  while (i < len)
   {
-    if ((*bytes & 0x80) == 0x00)
+    // skip ASCII run with SIMD, then validate a multibyte sequence.
+    i += CountASCII(s + i, len - i);
+    if (i >= len) break;
+    const uint8_t c = p[i];
+    unsigned num;
+    uint8_t lo = 0x80, hi = 0xBF;   // valid range of second byte
+    if (c >= 0xC2 && c <= 0xDF) num = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
     {
-      // U+0000 to U+007F: single byte
-      bytes++;
+      num = 3;
+      if (c == 0xE0) lo = 0xA0;         // overlong
+      else if (c == 0xED) hi = 0x9F;    // surrogates
     }
-    else if ( ((0x81 <= (*bytes) && (*bytes) < 0x9f) || (0xe0 <= (*bytes) && (*bytes) < 0xef)) &&
-              ((0x40 <= (*(bytes+1)) && (*(bytes+1)) <= 0x7e) || (0x80 <= (*(bytes+1)) && (*(bytes+1)) <= 0xfc)) )
+    else if (c >= 0xF0 && c <= 0xF4)
     {
-      bytes+=2;
+      num = 4;
+      if (c == 0xF0) lo = 0x90;         // overlong
+      else if (c == 0xF4) hi = 0x8F;    // over U+10FFFF
     }
     else return false;
+    if (i + num > len) return false;
+    if (p[i + 1] < lo || p[i + 1] > hi) return false;
+    for (unsigned k = 2; k < num; ++k)
+      if ((p[i + k] & 0xC0) != 0x80) return false;
+    i += num;
   }
   return true;
 }
 
-bool TestEUCKREncoding(const std::string &s)
+// classifies non-UTF8 string as Shift_JIS or EUC-KR (CP949) in single pass,
+// running byte state machines of both encodings together.
+int ClassifyMultibyte(const char* s, size_t len)
 {
-  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(s.c_str());
-  while (*bytes != 0x00)
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(s);
+  // state: 0 (expecting lead byte), 1 (expecting trail byte), -1 (invalid)
+  int sjis = 0, euckr = 0;
+  uint8_t euckr_lead = 0;
+  for (size_t i = 0; i < len && (sjis >= 0 || euckr >= 0); ++i)
   {
-    if ((*bytes & 0x80) == 0x00)
+    const uint8_t c = p[i];
+    if (sjis == 0)
     {
-      // U+0000 to U+007F: single byte
-      bytes++;
+      if (c >= 0x80)
+      {
+        if ((0x81 <= c && c < 0x9f) || (0xe0 <= c && c < 0xef)) sjis = 1;
+        else sjis = -1;
+      }
     }
-    else if (0xa1 <= (*bytes) && (*bytes) <= 0xfe && 0xa1 <= (*(bytes+1)) && (*(bytes+1)) <= 0xfe)
+    else if (sjis == 1)
     {
-      // KS X 1001
-      bytes+=2;
+      sjis = ((0x40 <= c && c <= 0x7e) || (0x80 <= c && c <= 0xfc)) ? 0 : -1;
     }
-    else if (0x81 <= (*bytes) && (*bytes) <= 0xc5 && (
-             (0x41 <= (*(bytes+1)) && (*(bytes+1)) <= 0x5A) ||
-             (0x61 <= (*(bytes+1)) && (*(bytes+1)) <= 0x7A) ||
-             (0x81 <= (*(bytes+1)) && (*(bytes+1)) <= 0xFE)) )
+
+    if (euckr == 0)
     {
-      // extended CP949
-      bytes+=2;
+      if (c >= 0x80)
+      {
+        if (0x81 <= c && c <= 0xfe) { euckr = 1; euckr_lead = c; }
+        else euckr = -1;
+      }
+    }
+    else if (euckr == 1)
+    {
+      if (0xa1 <= euckr_lead && 0xa1 <= c && c <= 0xfe)
+        euckr = 0;    // KS X 1001
+      else if (euckr_lead <= 0xc5 && (
+               (0x41 <= c && c <= 0x5A) || (0x61 <= c && c <= 0x7A) || (0x81 <= c && c <= 0xFE)))
+        euckr = 0;    // extended CP949
+      else euckr = -1;
     }
-    else return false;
   }
-  return true;
+  if (sjis == 0) return E_SHIFT_JIS;
+  if (euckr == 0) return E_EUC_KR;
+  return 0;
+}
+
+int DetectEncoding(const char* s, size_t len)
+{
+  if (IsValidUTF8(s, len)) return E_UTF8;
+  return ClassifyMultibyte(s, len);
 }
 
 int DetectEncoding(const std::string &str)
 {
-  if (TestUTF8Encoding(str)) return E_UTF8;
-  else if (TestJISEncoding(str)) return E_SHIFT_JIS;
-  else if (TestEUCKREncoding(str)) return E_EUC_KR;
-  return 0;
+  return DetectEncoding(str.c_str(), str.size());
 }
 
 // encoding part
@@ -156,9 +194,9 @@ const char* GetCodepageString(int cp)
   switch (cp)
   {
   case E_EUC_KR:
-    return "euc-kr";
+    return "CP949";
   case E_SHIFT_JIS:
-    return "shift-jis";
+    return "CP932";
   case E_UTF8:  // utf-8
     return "UTF-8";
   case E_UTF32:
@@ -168,61 +206,78 @@ const char* GetCodepageString(int cp)
     return 0;
   }
 }
-std::string ConvertEncoding(const std::string &s, int to_codepage, int from_codepage)
+EncodingConverter::~EncodingConverter()
 {
-  // Check encoding if necessary
-  if (from_codepage == 0)
+  for (auto &c : converters_)
   {
-    from_codepage = DetectEncoding(s);
-    if (!from_codepage) return std::string();
+    if (c.cd != (void*)-1)
+      iconv_close((iconv_t)c.cd);
   }
+}
 
+void* EncodingConverter::GetConverter(int to_codepage, int from_codepage)
+{
+  for (auto &c : converters_)
+  {
+    if (c.to == to_codepage && c.from == from_codepage)
+    {
+      // reset shift state of the converter before reusing it.
+      if (c.cd != (void*)-1)
+        iconv((iconv_t)c.cd, nullptr, nullptr, nullptr, nullptr);
+      return c.cd;
+    }
+  }
   const char* cp_from_str = GetCodepageString(from_codepage);
   const char* cp_to_str = GetCodepageString(to_codepage);
-  if (!cp_from_str || !cp_to_str) return std::string();
+  void *cd = (void*)-1;
+  if (cp_from_str && cp_to_str)
+    cd = (void*)iconv_open(cp_to_str, cp_from_str);
+  // failed converter is also cached not to try opening it again.
+  converters_.push_back({ to_codepage, from_codepage, cd });
+  return cd;
+}
 
-  iconv_t converter = iconv_open( cp_to_str, cp_from_str );
+bool EncodingConverter::ConvertRaw(const std::string &s, std::string &out, int to_codepage, int from_codepage)
+{
+  iconv_t converter = (iconv_t)GetConverter(to_codepage, from_codepage);
   if( converter == (iconv_t) -1 )
-  {
-    return std::string();
-  }
+    return false;
 
   /* Copy the string into a char* for iconv */
   const char *szTextIn = const_cast<const char*>( s.data() );
   size_t iInLeft = s.size();
 
-  /* Create a new string with enough room for the new conversion */
-  std::string sBuf;
-  sBuf.resize( s.size() * 5 );
+  /* Reuse buffer with enough room for the new conversion (UTF-32 with BOM) */
+  if (buf_.size() < s.size() * 4 + 4)
+    buf_.resize( s.size() * 4 + 4 );
 
-  char *sTextOut = const_cast<char*>( sBuf.data() );
-  size_t iOutLeft = sBuf.size();
+  char *sTextOut = const_cast<char*>( buf_.data() );
+  size_t iOutLeft = buf_.size();
   size_t size = iconv( converter, const_cast<char**>(&szTextIn), &iInLeft, &sTextOut, &iOutLeft );
 
-  iconv_close( converter );
-
   if( size == (size_t)(-1) )
-  {
-    return std::string(); /* Returned an error */
-  }
+    return false; /* Returned an error */
 
   if( iInLeft != 0 )
   {
-    printf("iconv(%s to %s) for \"%s\": whole buffer not converted",cp_from_str, cp_to_str, s.c_str());
-    return std::string();
+    printf("iconv(%s to %s) for \"%s\": whole buffer not converted",
+      GetCodepageString(from_codepage), GetCodepageString(to_codepage), s.c_str());
+    return false;
   }
 
-  if( sBuf.size() == iOutLeft )
-    return std::string(); /* Conversion failed */
-
-  sBuf.resize( sBuf.size()-iOutLeft );
+  const size_t len = buf_.size() - iOutLeft;
+  if( len == 0 )
+    return false; /* Conversion failed */
 
   /* Delete 'BOM' character */
-  if (to_codepage == E_UTF32 && *(uint32_t*)(sBuf.c_str()) == 65279)
-    sBuf = sBuf.substr(4);
-
-  return sBuf;
+  const char *p = buf_.data();
+  if (to_codepage == E_UTF32 && len >= 4 && *(const uint32_t*)p == 65279)
+    out.assign(p + 4, len - 4);
+  else
+    out.assign(p, len);
+  return true;
 }
+
 int DecodeTo(std::string &s, int to_codepage)
 {
   s = ConvertEncoding(s, to_codepage, E_UTF8);
@@ -300,49 +355,40 @@ uint32_t UTF16toUTF32(uint16_t codepoint)
 
   return (lead << 10) + trail + SURROGATE_OFFSET;
 }
-std::string ConvertEncoding(const std::string &s, int to_codepage, int from_codepage)
-{
-  // Check encoding if necessary
-  if (from_codepage == 0)
-  {
-    from_codepage = DetectEncoding(s);
-    if (!from_codepage) return std::string();
-  }
+EncodingConverter::~EncodingConverter() {}
 
+bool EncodingConverter::ConvertRaw(const std::string &s, std::string &out, int to_codepage, int from_codepage)
+{
   // to UTF16
   std::wstring sWstr;
   int iSize = 0;
   if (DecodeToWStr(s, sWstr, from_codepage) == 0)
-    return std::string();
+    return false;
 
   // just return result string if UTF16
   if (to_codepage == E_UTF16)
   {
     const char* p_start = reinterpret_cast<const char*>(sWstr.c_str());
     const char* p_end = p_start + sWstr.size() * 2;
-    return std::string(p_start, p_end);
+    out.assign(p_start, p_end);
+    return true;
   }
 
   // little more tricks in case of UTF32
   if (to_codepage == E_UTF32)
   {
-    std::string r;
+    out.clear();
     for (uint16_t t : sWstr)
     {
       uint32_t v = UTF16toUTF32(t);
-      r.push_back(((char*)&v)[0]);
-      r.push_back(((char*)&v)[1]);
-      r.push_back(((char*)&v)[2]);
-      r.push_back(((char*)&v)[3]);
+      out.append((const char*)&v, 4);
     }
-    return r;
+    return true;
   }
 
   // from UTF16
-  std::string r;
-  iSize = EncodeFromWStr(sWstr, r, to_codepage);
-  if (!iSize) return std::string();
-  else return r;
+  iSize = EncodeFromWStr(sWstr, out, to_codepage);
+  return iSize != 0;
 }
 FILE* fopen_utf8(const char* fname, const char* mode)
 {
@@ -368,6 +414,126 @@ int printf_utf8(const char* fmt, ...)
   return vwprintf(sWOut.c_str(), args);
 }
 #endif
+EncodingConverter::EncodingConverter() {}
+
+bool DecodeToUTF8(const char* s, size_t len, std::string &out, int from_codepage)
+{
+  const uint16_t *single;
+  const CodepageLead *lead;
+  const uint16_t *table;
+  switch (from_codepage)
+  {
+  case E_SHIFT_JIS:
+    single = kCp932Single; lead = kCp932Lead; table = kCp932Double;
+    break;
+  case E_EUC_KR:
+    single = kCp949Single; lead = kCp949Lead; table = kCp949Double;
+    break;
+  default:
+    out.clear();
+    return false;
+  }
+
+  // each byte becomes 3 bytes of UTF-8 at most (halfwidth katakana).
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(s);
+  out.resize(len * 3);
+  char *o = &out[0];
+  size_t i = 0;
+  while (i < len)
+  {
+    const uint8_t c = p[i];
+    if (c < 0x80)
+    {
+      // copy ASCII run at once.
+      const size_t ascii_len = len - i >= 16 ? CountASCII(s + i, len - i) : 1;
+      memcpy(o, s + i, ascii_len);
+      o += ascii_len;
+      i += ascii_len;
+      continue;
+    }
+
+    uint16_t u = single[c - 0x80];
+    if (u) i++;
+    else
+    {
+      const CodepageLead &l = lead[c - 0x80];
+      if (i + 1 >= len || p[i + 1] < l.trail_lo || p[i + 1] > l.trail_hi ||
+          (u = table[l.offset + p[i + 1] - l.trail_lo]) == 0)
+      {
+        out.clear();
+        return false;
+      }
+      i += 2;
+    }
+    if (u < 0x800)
+    {
+      *o++ = (char)(0xC0 | (u >> 6));
+      *o++ = (char)(0x80 | (u & 0x3F));
+    }
+    else
+    {
+      *o++ = (char)(0xE0 | (u >> 12));
+      *o++ = (char)(0x80 | ((u >> 6) & 0x3F));
+      *o++ = (char)(0x80 | (u & 0x3F));
+    }
+  }
+  out.resize(o - out.data());
+  return true;
+}
+
+static bool IsASCIICompatible(int codepage)
+{
+  return codepage == E_UTF8 || codepage == E_SHIFT_JIS || codepage == E_EUC_KR;
+}
+
+bool EncodingConverter::Convert(const std::string &s, std::string &out, int to_codepage, int from_codepage)
+{
+  // Check encoding if necessary
+  if (from_codepage == 0)
+  {
+    from_codepage = DetectEncoding(s);
+    if (!from_codepage) { out.clear(); return false; }
+  }
+
+  // ASCII string is same in ASCII-compatible codepages, so copy it directly.
+  if (!s.empty() && IsASCIICompatible(from_codepage) && IsASCIICompatible(to_codepage) &&
+      CountASCII(s.c_str(), s.size()) == s.size())
+  {
+    out = s;
+    return true;
+  }
+
+  // Shift_JIS / EUC-KR is decoded by built-in tables.
+  if (to_codepage == E_UTF8 && (from_codepage == E_SHIFT_JIS || from_codepage == E_EUC_KR))
+    return DecodeToUTF8(s.c_str(), s.size(), out, from_codepage);
+
+  if (!ConvertRaw(s, out, to_codepage, from_codepage))
+  {
+    out.clear();
+    return false;
+  }
+  return true;
+}
+
+std::string ConvertEncoding(const std::string &s, int to_codepage, int from_codepage)
+{
+  static thread_local EncodingConverter converter;
+  std::string r;
+  converter.Convert(s, r, to_codepage, from_codepage);
+  return r;
+}
+
+void ConvertEncoding(std::string* const* strs, size_t count, int to_codepage, int from_codepage)
+{
+  EncodingConverter converter;
+  std::string r;
+  for (size_t i = 0; i < count; ++i)
+  {
+    converter.Convert(*strs[i], r, to_codepage, from_codepage);
+    strs[i]->swap(r);
+  }
+}
+
 std::string ConvertEncodingToUTF8(const std::string &s, int from_codepage)
 {
   return ConvertEncoding(s, E_UTF8, from_codepage);
@@ -620,7 +786,24 @@ std::string ChangeExtension(const std::string& path, const std::string &new_ext)
 
 uint32_t ReadLE32(const unsigned char* p)
 {
-  return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t ReadLE16(const unsigned char* p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t ReadBE32(const unsigned char* p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+    ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+uint16_t ReadBE16(const unsigned char* p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
 }
 
 bool IsDirectory(const std::string& fpath)
@@ -1151,44 +1334,453 @@ bool FileData::IsEOF() { return pos == len; };
 
 bool FileData::IsEmpty() { return p == 0; };
 
-bool md5(const void* p, int iLen, unsigned char* out)
+namespace
 {
-#ifdef USE_OPENSSL
-  MD5((unsigned char*)p, iLen, reinterpret_cast<unsigned char*>(out));
-  return true;
-#else
-  for (size_t i = 0; i < 16; ++i)
-    out[i] = '0';
-  return false;
+
+constexpr uint64_t kXXH64Prime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kXXH64Prime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kXXH64Prime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kXXH64Prime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kXXH64Prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+inline uint32_t rotr32(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+inline uint64_t read64(const uint8_t* p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
 #endif
+  return v;
 }
 
-bool md5_str(const void* p, int iLen, char *out)
+inline uint32_t read32(const uint8_t* p)
 {
-#ifndef USE_OPENSSL
-#define MD5_DIGEST_LENGTH 16
+  uint32_t v;
+  memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
 #endif
-  unsigned char result[MD5_DIGEST_LENGTH];
-  if (md5(p, iLen, result))
+  return v;
+}
+
+inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+  acc += input * kXXH64Prime2;
+  acc = rotl64(acc, 31);
+  return acc * kXXH64Prime1;
+}
+
+inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+  acc ^= xxh64_round(0, val);
+  return acc * kXXH64Prime1 + kXXH64Prime4;
+}
+
+}
+
+static const char kHexChars[] = "0123456789abcdef";
+
+static void hex_str(const unsigned char* p, size_t len, char* out)
+{
+  for (size_t i = 0; i < len; i++)
   {
-    for (int i = 0; i < MD5_DIGEST_LENGTH; i++)
-    {
-      sprintf(out, "%02x", result[i]);
-      out += 2;
-    }
-    return true;
+    out[i * 2] = kHexChars[p[i] >> 4];
+    out[i * 2 + 1] = kHexChars[p[i] & 15];
   }
-  else return false;
+}
+
+bool md5(const void* p, int iLen, unsigned char* out)
+{
+  MD5Hasher h;
+  h.update(p, iLen);
+  return h.digest(out);
+}
+
+bool md5_str(const void* p, int iLen, char *out)
+{
+  unsigned char result[16];
+  md5(p, iLen, result);
+  hex_str(result, 16, out);
+  return true;
 }
 
 std::string md5_str(const void* p, int iLen)
 {
   char s[33];
-  s[0] = s[32] = 0;
+  s[32] = 0;
   md5_str(p, iLen, s);
   return std::string(s);
 }
 
+std::string sha256_str(const void* p, size_t len)
+{
+  SHA256Hasher h;
+  h.update(p, len);
+  return h.hexdigest();
+}
+
+
+// ------------------------------------------------------------ MD5 (RFC 1321)
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MD5_STEP(f, a, b, c, d, x, t, s) \
+  (a) += f((b), (c), (d)) + (x) + (t); \
+  (a) = (((a) << (s)) | ((a) >> (32 - (s)))) + (b);
+
+MD5Hasher::MD5Hasher() { reset(); }
+
+void MD5Hasher::reset()
+{
+  state_[0] = 0x67452301;
+  state_[1] = 0xefcdab89;
+  state_[2] = 0x98badcfe;
+  state_[3] = 0x10325476;
+  total_len_ = 0;
+  buflen_ = 0;
+}
+
+void MD5Hasher::transform(const uint8_t* p, size_t block_count)
+{
+  uint32_t a, b, c, d, x[16];
+  for (; block_count > 0; --block_count, p += 64)
+  {
+    for (int i = 0; i < 16; ++i)
+      x[i] = read32(p + i * 4);
+    a = state_[0]; b = state_[1]; c = state_[2]; d = state_[3];
+
+    MD5_STEP(MD5_F, a, b, c, d, x[0], 0xd76aa478, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[1], 0xe8c7b756, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[2], 0x242070db, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[3], 0xc1bdceee, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[4], 0xf57c0faf, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[5], 0x4787c62a, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[6], 0xa8304613, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[7], 0xfd469501, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[8], 0x698098d8, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[9], 0x8b44f7af, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22)
+
+    MD5_STEP(MD5_G, a, b, c, d, x[1], 0xf61e2562, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[6], 0xc040b340, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[0], 0xe9b6c7aa, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[5], 0xd62f105d, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[4], 0xe7d3fbc8, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[9], 0x21e1cde6, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[3], 0xf4d50d87, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[8], 0x455a14ed, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[2], 0xfcefa3f8, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[7], 0x676f02d9, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20)
+
+    MD5_STEP(MD5_H, a, b, c, d, x[5], 0xfffa3942, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[8], 0x8771f681, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[1], 0xa4beea44, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[4], 0x4bdecfa9, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[7], 0xf6bb4b60, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[0], 0xeaa127fa, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[3], 0xd4ef3085, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[6], 0x04881d05, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[9], 0xd9d4d039, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[2], 0xc4ac5665, 23)
+
+    MD5_STEP(MD5_I, a, b, c, d, x[0], 0xf4292244, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[7], 0x432aff97, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[5], 0xfc93a039, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[3], 0x8f0ccc92, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[1], 0x85845dd1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[8], 0x6fa87e4f, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[6], 0xa3014314, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[4], 0xf7537e82, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[2], 0x2ad7d2bb, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[9], 0xeb86d391, 21)
+
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+  }
+}
+
+#undef MD5_STEP
+#undef MD5_I
+#undef MD5_H
+#undef MD5_G
+#undef MD5_F
+
+void MD5Hasher::update(const void* data, size_t len)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  total_len_ += len;
+  if (buflen_ > 0)
+  {
+    const size_t n = std::min<size_t>(64 - buflen_, len);
+    memcpy(buf_ + buflen_, p, n);
+    buflen_ += (unsigned)n; p += n; len -= n;
+    if (buflen_ < 64) return;
+    transform(buf_, 1);
+    buflen_ = 0;
+  }
+  // full blocks are hashed directly from input.
+  transform(p, len / 64);
+  p += len / 64 * 64;
+  len %= 64;
+  memcpy(buf_, p, len);
+  buflen_ = (unsigned)len;
+}
+
+bool MD5Hasher::digest(unsigned char* out)
+{
+  const uint64_t bits = total_len_ * 8;
+  uint8_t pad[72] = { 0x80 };
+  const size_t padlen = (buflen_ < 56 ? 56 : 120) - buflen_;
+  for (int i = 0; i < 8; ++i)
+    pad[padlen + i] = (uint8_t)(bits >> (i * 8));
+  update(pad, padlen + 8);
+  for (int i = 0; i < 4; ++i)
+  {
+    out[i * 4] = (uint8_t)state_[i];
+    out[i * 4 + 1] = (uint8_t)(state_[i] >> 8);
+    out[i * 4 + 2] = (uint8_t)(state_[i] >> 16);
+    out[i * 4 + 3] = (uint8_t)(state_[i] >> 24);
+  }
+  return true;
+}
+
+std::string MD5Hasher::hexdigest()
+{
+  unsigned char result[16];
+  char s[32];
+  digest(result);
+  hex_str(result, 16, s);
+  return std::string(s, 32);
+}
+
+// ------------------------------------------------------------ SHA-256 (FIPS 180-4)
+
+static const uint32_t kSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+SHA256Hasher::SHA256Hasher() { reset(); }
+
+void SHA256Hasher::reset()
+{
+  static const uint32_t kInit[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(state_, kInit, sizeof(state_));
+  total_len_ = 0;
+  buflen_ = 0;
+}
+
+void SHA256Hasher::transform(const uint8_t* p, size_t block_count)
+{
+  uint32_t w[64];
+  for (; block_count > 0; --block_count, p += 64)
+  {
+    for (int i = 0; i < 16; ++i)
+      w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 |
+             (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    for (int i = 16; i < 64; ++i)
+    {
+      const uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; ++i)
+    {
+      const uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) +
+                          (g ^ (e & (f ^ g))) + kSha256K[i] + w[i];
+      const uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) +
+                          ((a & b) | (c & (a | b)));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+  }
+}
+
+void SHA256Hasher::update(const void* data, size_t len)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  total_len_ += len;
+  if (buflen_ > 0)
+  {
+    const size_t n = std::min<size_t>(64 - buflen_, len);
+    memcpy(buf_ + buflen_, p, n);
+    buflen_ += (unsigned)n; p += n; len -= n;
+    if (buflen_ < 64) return;
+    transform(buf_, 1);
+    buflen_ = 0;
+  }
+  transform(p, len / 64);
+  p += len / 64 * 64;
+  len %= 64;
+  memcpy(buf_, p, len);
+  buflen_ = (unsigned)len;
+}
+
+void SHA256Hasher::digest(unsigned char* out)
+{
+  const uint64_t bits = total_len_ * 8;
+  uint8_t pad[72] = { 0x80 };
+  const size_t padlen = (buflen_ < 56 ? 56 : 120) - buflen_;
+  for (int i = 0; i < 8; ++i)
+    pad[padlen + i] = (uint8_t)(bits >> (56 - i * 8));
+  update(pad, padlen + 8);
+  for (int i = 0; i < 8; ++i)
+  {
+    out[i * 4] = (uint8_t)(state_[i] >> 24);
+    out[i * 4 + 1] = (uint8_t)(state_[i] >> 16);
+    out[i * 4 + 2] = (uint8_t)(state_[i] >> 8);
+    out[i * 4 + 3] = (uint8_t)state_[i];
+  }
+}
+
+std::string SHA256Hasher::hexdigest()
+{
+  unsigned char result[32];
+  char s[64];
+  digest(result);
+  hex_str(result, 32, s);
+  return std::string(s, 64);
+}
+
+// ------------------------------------------------------------ XXH64
+
+XXH64Hasher::XXH64Hasher(uint64_t seed) { reset(seed); }
+
+void XXH64Hasher::reset(uint64_t seed)
+{
+  seed_ = seed;
+  v_[0] = seed + kXXH64Prime1 + kXXH64Prime2;
+  v_[1] = seed + kXXH64Prime2;
+  v_[2] = seed;
+  v_[3] = seed - kXXH64Prime1;
+  total_len_ = 0;
+  memsize_ = 0;
+}
+
+void XXH64Hasher::update(const void* data, size_t len)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const uint8_t *const end = p + len;
+  total_len_ += len;
+
+  if (memsize_ + len < 32)
+  {
+    memcpy(mem_ + memsize_, p, len);
+    memsize_ += (unsigned)len;
+    return;
+  }
+  if (memsize_ > 0)
+  {
+    memcpy(mem_ + memsize_, p, 32 - memsize_);
+    p += 32 - memsize_;
+    for (int i = 0; i < 4; ++i)
+      v_[i] = xxh64_round(v_[i], read64(mem_ + i * 8));
+    memsize_ = 0;
+  }
+  // stripes are processed in local accumulators.
+  uint64_t v1 = v_[0], v2 = v_[1], v3 = v_[2], v4 = v_[3];
+  for (; p + 32 <= end; p += 32)
+  {
+    v1 = xxh64_round(v1, read64(p));
+    v2 = xxh64_round(v2, read64(p + 8));
+    v3 = xxh64_round(v3, read64(p + 16));
+    v4 = xxh64_round(v4, read64(p + 24));
+  }
+  v_[0] = v1; v_[1] = v2; v_[2] = v3; v_[3] = v4;
+  if (p < end)
+  {
+    memcpy(mem_, p, end - p);
+    memsize_ = (unsigned)(end - p);
+  }
+}
+
+uint64_t XXH64Hasher::digest() const
+{
+  uint64_t h;
+  if (total_len_ >= 32)
+  {
+    h = rotl64(v_[0], 1) + rotl64(v_[1], 7) + rotl64(v_[2], 12) + rotl64(v_[3], 18);
+    for (int i = 0; i < 4; ++i)
+      h = xxh64_merge(h, v_[i]);
+  }
+  else h = seed_ + kXXH64Prime5;
+  h += total_len_;
+
+  const uint8_t *p = mem_;
+  const uint8_t *const end = mem_ + memsize_;
+  for (; p + 8 <= end; p += 8)
+    h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * kXXH64Prime1 + kXXH64Prime4;
+  if (p + 4 <= end)
+  {
+    h = rotl64(h ^ (read32(p) * kXXH64Prime1), 23) * kXXH64Prime2 + kXXH64Prime3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+    h = rotl64(h ^ (*p * kXXH64Prime5), 11) * kXXH64Prime1;
+
+  h ^= h >> 33;
+  h *= kXXH64Prime2;
+  h ^= h >> 29;
+  h *= kXXH64Prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t xxh64(const void* p, size_t len, uint64_t seed)
+{
+  XXH64Hasher h(seed);
+  h.update(p, len);
+  return h.digest();
+}
+
+std::string hash64_str(uint64_t h)
+{
+  std::string s(16, '0');
+  for (int i = 15; i >= 0; --i, h >>= 4)
+    s[i] = kHexChars[h & 15];
+  return s;
+}
+
 char h2c(char x)
 {
   if (x >= '0' && x <= '9')
@@ -1253,10 +1845,10 @@ char *itoa(int value, char *str, int base)
   for (i=0; i<ilen/2; i++)
   {
     s = str[i];
-    str[ilen-1-i] = str[i];
+    str[i] = str[ilen-1-i];
     str[ilen-1-i] = s;
   }
-  return 0;
+  return str;
 }
 
 char *gcvt(double value, int ndigits, char *buf)
@@ -1295,6 +1887,168 @@ long atoi_16(const char* str, unsigned int len)
   }
 }
 
+namespace {
+
+uint16_t DecodeBase36Token(const char* p)
+{
+  unsigned r = 0;
+  for (unsigned i = 0; i < 2 && p[i]; ++i)
+  {
+    const char c = p[i];
+    r *= 36;
+    if (c >= '0' && c <= '9') r += c - '0';
+    else if (c >= 'A' && c <= 'Z') r += c - 'A' + 10;
+    else if (c >= 'a' && c <= 'z') r += c - 'a' + 10;
+    else break;
+  }
+  return static_cast<uint16_t>(r);
+}
+
+#ifdef RUTIL_USE_SSE2
+/* @brief decode 8 tokens (16 chars), returns nonzero bits. */
+unsigned DecodeBase36Tokens8(const char* p, uint16_t* out)
+{
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  // (unsigned) x <= n  <=>  min(x, n) == x
+  const __m128i t = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(9)), t);
+  const __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  const __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(25)), l);
+  const __m128i d = _mm_or_si128(_mm_and_si128(t, is_digit),
+    _mm_and_si128(_mm_add_epi8(l, _mm_set1_epi8(10)), is_alpha));
+  const __m128i valid = _mm_or_si128(is_digit, is_alpha);
+  const __m128i is_nul = _mm_cmpeq_epi8(c, _mm_setzero_si128());
+
+  // 16bit lane: low byte is first (upper) digit, high byte is second digit.
+  const __m128i hi = _mm_and_si128(d, _mm_set1_epi16(0x00FF));
+  const __m128i lo = _mm_srli_epi16(d, 8);
+  __m128i v = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_set1_epi16(36)), lo);
+  const __m128i single = _mm_srai_epi16(is_nul, 8);
+  const __m128i first_valid = _mm_srai_epi16(_mm_slli_epi16(valid, 8), 8);
+  v = _mm_or_si128(_mm_and_si128(single, hi), _mm_andnot_si128(single, v));
+  v = _mm_and_si128(v, first_valid);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+
+  const __m128i z = _mm_cmpeq_epi16(v, _mm_setzero_si128());
+  return ~_mm_movemask_epi8(_mm_packs_epi16(z, z)) & 0xFF;
+}
+#endif
+
+#ifdef RUTIL_USE_AVX2
+/* @brief decode 16 tokens (32 chars), returns nonzero bits. */
+unsigned DecodeBase36Tokens16(const char* p, uint16_t* out)
+{
+  const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  const __m256i t = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+  const __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(9)), t);
+  const __m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+  const __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(25)), l);
+  const __m256i d = _mm256_or_si256(_mm256_and_si256(t, is_digit),
+    _mm256_and_si256(_mm256_add_epi8(l, _mm256_set1_epi8(10)), is_alpha));
+  const __m256i valid = _mm256_or_si256(is_digit, is_alpha);
+  const __m256i is_nul = _mm256_cmpeq_epi8(c, _mm256_setzero_si256());
+
+  const __m256i hi = _mm256_and_si256(d, _mm256_set1_epi16(0x00FF));
+  const __m256i lo = _mm256_srli_epi16(d, 8);
+  __m256i v = _mm256_add_epi16(_mm256_mullo_epi16(hi, _mm256_set1_epi16(36)), lo);
+  const __m256i single = _mm256_srai_epi16(is_nul, 8);
+  const __m256i first_valid = _mm256_srai_epi16(_mm256_slli_epi16(valid, 8), 8);
+  v = _mm256_or_si256(_mm256_and_si256(single, hi), _mm256_andnot_si256(single, v));
+  v = _mm256_and_si256(v, first_valid);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), v);
+
+  // packs works per 128bit lane, so gather both lanes into lower 64bit.
+  const __m256i z = _mm256_cmpeq_epi16(v, _mm256_setzero_si256());
+  const __m256i zp = _mm256_permute4x64_epi64(_mm256_packs_epi16(z, z), 0xD8);
+  return ~_mm256_movemask_epi8(zp) & 0xFFFF;
+}
+#endif
+
+#ifdef RUTIL_USE_NEON
+/* @brief decode 8 tokens (16 chars), returns nonzero bits. */
+unsigned DecodeBase36Tokens8(const char* p, uint16_t* out)
+{
+  static const uint8_t kBits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+  const uint8x16_t c = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+  const uint8x16_t t = vsubq_u8(c, vdupq_n_u8('0'));
+  const uint8x16_t is_digit = vcleq_u8(t, vdupq_n_u8(9));
+  const uint8x16_t l = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  const uint8x16_t is_alpha = vcleq_u8(l, vdupq_n_u8(25));
+  const uint8x16_t d = vorrq_u8(vandq_u8(t, is_digit),
+    vandq_u8(vaddq_u8(l, vdupq_n_u8(10)), is_alpha));
+  const uint16x8_t valid = vreinterpretq_u16_u8(vorrq_u8(is_digit, is_alpha));
+  const uint16x8_t is_nul = vreinterpretq_u16_u8(vceqq_u8(c, vdupq_n_u8(0)));
+
+  const uint16x8_t d16 = vreinterpretq_u16_u8(d);
+  const uint16x8_t hi = vandq_u16(d16, vdupq_n_u16(0x00FF));
+  const uint16x8_t lo = vshrq_n_u16(d16, 8);
+  uint16x8_t v = vmlaq_u16(lo, hi, vdupq_n_u16(36));
+  v = vbslq_u16(vtstq_u16(is_nul, vdupq_n_u16(0xFF00)), hi, v);
+  v = vandq_u16(v, vtstq_u16(valid, vdupq_n_u16(0x00FF)));
+  vst1q_u16(out, v);
+
+  uint8x8_t b = vand_u8(vmovn_u16(vtstq_u16(v, v)), vld1_u8(kBits));
+#if defined(__aarch64__)
+  return vaddv_u8(b);
+#else
+  b = vpadd_u8(b, b);
+  b = vpadd_u8(b, b);
+  b = vpadd_u8(b, b);
+  return vget_lane_u8(b, 0);
+#endif
+}
+#endif
+
+}
+
+unsigned DecodeBase36TokensScalar(const char* p, unsigned token_count,
+                                  uint16_t* out, uint64_t* nonzero_mask)
+{
+  unsigned nonzero_count = 0;
+  memset(nonzero_mask, 0, (token_count + 63) / 64 * sizeof(uint64_t));
+  for (unsigned i = 0; i < token_count; ++i)
+  {
+    out[i] = DecodeBase36Token(p + i * 2);
+    if (out[i])
+    {
+      nonzero_mask[i / 64] |= 1ull << (i % 64);
+      nonzero_count++;
+    }
+  }
+  return nonzero_count;
+}
+
+unsigned DecodeBase36Tokens(const char* p, unsigned token_count,
+                            uint16_t* out, uint64_t* nonzero_mask)
+{
+  unsigned i = 0;
+  unsigned nonzero_count = 0;
+  memset(nonzero_mask, 0, (token_count + 63) / 64 * sizeof(uint64_t));
+
+  // block size divides 64, so bits of a block never cross mask word.
+#ifdef RUTIL_USE_AVX2
+  for (; i + 16 <= token_count; i += 16)
+    nonzero_mask[i / 64] |= (uint64_t)DecodeBase36Tokens16(p + i * 2, out + i) << (i % 64);
+#endif
+#if defined(RUTIL_USE_SSE2) || defined(RUTIL_USE_NEON)
+  for (; i + 8 <= token_count; i += 8)
+    nonzero_mask[i / 64] |= (uint64_t)DecodeBase36Tokens8(p + i * 2, out + i) << (i % 64);
+#endif
+  for (; i < token_count; ++i)
+  {
+    out[i] = DecodeBase36Token(p + i * 2);
+    if (out[i])
+      nonzero_mask[i / 64] |= 1ull << (i % 64);
+  }
+
+  for (unsigned w = 0; w < (token_count + 63) / 64; ++w)
+  {
+    uint64_t m = nonzero_mask[w];
+    for (; m; m &= m - 1) nonzero_count++;
+  }
+  return nonzero_count;
+}
+
 
 Random::Random()
 {
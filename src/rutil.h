@@ -25,6 +25,8 @@
 #define DEFAULT_RESOLUTION_SIZE 192
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
 #include <vector>
 #include <map>
@@ -53,8 +55,41 @@ enum EncodingTypes
 // if no encoding found then it returns 0 with no string changed.
 // if from_codepage=0, then attempt encoding Shift_JIS / CP949
 std::string ConvertEncoding(const std::string &s, int to_codepage, int from_codepage = 0);
+// converts all strings in place with single converter.
+void ConvertEncoding(std::string* const* strs, size_t count, int to_codepage, int from_codepage = 0);
 std::string ConvertEncodingToUTF8(const std::string &s, int from_codepage = 0);
+// UTF-8 is tested first, then Shift_JIS / EUC-KR in single pass.
+// returns 0 if no encoding is matched.
 int DetectEncoding(const std::string &s);
+int DetectEncoding(const char* s, size_t len);
+// strict UTF-8 validation (no overlong / surrogate), with SIMD ASCII skipping.
+bool IsValidUTF8(const char* s, size_t len);
+// length of leading ASCII bytes.
+size_t CountASCII(const char* s, size_t len);
+// decodes Shift_JIS (CP932) / EUC-KR (CP949) into UTF-8 with built-in tables.
+// returns false with empty out if invalid character exists.
+bool DecodeToUTF8(const char* s, size_t len, std::string &out, int from_codepage);
+
+// @description
+// converts encoding of strings, keeping opened converter (iconv)
+// of each codepage pair for next conversion.
+// ASCII string is copied without conversion if possible.
+class EncodingConverter
+{
+public:
+  EncodingConverter();
+  ~EncodingConverter();
+  // same to ConvertEncoding; returns false with empty out if failed.
+  bool Convert(const std::string &s, std::string &out, int to_codepage, int from_codepage = 0);
+private:
+  EncodingConverter(const EncodingConverter&) = delete;
+  EncodingConverter& operator=(const EncodingConverter&) = delete;
+  bool ConvertRaw(const std::string &s, std::string &out, int to_codepage, int from_codepage);
+  void* GetConverter(int to_codepage, int from_codepage);
+  struct Converter { int to, from; void* cd; };
+  std::vector<Converter> converters_;
+  std::string buf_;
+};
 #ifdef WIN32
 int DecodeToWStr(const std::string& s, std::wstring& sOut, int from_codepage);
 int EncodeFromWStr(const std::wstring& s, std::string& sOut, int to_codepage);
@@ -99,6 +134,9 @@ std::string GetPathJoin(const std::string& s1, const std::string s2);
 
 // 
 uint32_t ReadLE32(const unsigned char* p);
+uint16_t ReadLE16(const unsigned char* p);
+uint32_t ReadBE32(const unsigned char* p);
+uint16_t ReadBE16(const unsigned char* p);
 
 
 
@@ -192,19 +230,164 @@ void GetFileInfo(const std::vector<std::string> &files, std::vector<FileInfo>& o
 bool wild_match(const std::string& str, const std::string& pat);
 
 
-// if succeed, return true, and write md5 hash to char* out;
-// else, return false.
-// (requires MD5_DIGEST_LENGTH; 16)
-bool md5(const void* p, int iLen, char* out);
-// same to md5; returns 32byte string (%02x formatted)
+// write md5 hash to out (16 bytes) and returns true.
+bool md5(const void* p, int iLen, unsigned char* out);
+// same to md5; writes 32byte string (%02x formatted, not NUL-terminated)
 bool md5_str(const void* p, int iLen, char* out);
 std::string md5_str(const void* p, int iLen);
 std::string md5_sum(const std::string &s1, const std::string &s2);
+// returns 64byte string of sha-256 hash (%02x formatted)
+std::string sha256_str(const void* p, size_t len);
+
+// @description
+// incremental md5 context, for hashing data without concatenating it.
+// (built-in implementation, doesn't require OpenSSL)
+// digest() finalizes the context; call reset() before reusing it.
+class MD5Hasher
+{
+public:
+  MD5Hasher();
+  void reset();
+  void update(const void* p, size_t len);
+  bool digest(unsigned char* out);
+  std::string hexdigest();
+private:
+  void transform(const uint8_t* p, size_t block_count);
+  uint32_t state_[4];
+  uint64_t total_len_;
+  uint8_t buf_[64];
+  unsigned buflen_;
+};
+
+// @description
+// incremental sha-256 context, same usage with MD5Hasher.
+class SHA256Hasher
+{
+public:
+  SHA256Hasher();
+  void reset();
+  void update(const void* p, size_t len);
+  void digest(unsigned char* out);
+  std::string hexdigest();
+private:
+  void transform(const uint8_t* p, size_t block_count);
+  uint32_t state_[8];
+  uint64_t total_len_;
+  uint8_t buf_[64];
+  unsigned buflen_;
+};
+
+// @description
+// incremental 64bit non-cryptographic hash, compatible with XXH64.
+class XXH64Hasher
+{
+public:
+  XXH64Hasher(uint64_t seed = 0);
+  void reset(uint64_t seed = 0);
+  void update(const void* p, size_t len);
+  uint64_t digest() const;
+private:
+  uint64_t v_[4];
+  uint64_t seed_;
+  uint64_t total_len_;
+  uint8_t mem_[32];
+  unsigned memsize_;
+};
+uint64_t xxh64(const void* p, size_t len, uint64_t seed = 0);
+// formats 64bit hash into 16byte string (%016x formatted)
+std::string hash64_str(uint64_t h);
+
+// @description
+// compile-time perfect hash of keyword list (up to 254 keywords).
+// seed is searched while constructing (constexpr), so that each keyword
+// has its own slot; lookup is done with one hash and one compare.
+// Find() returns index of keyword in the list, or -1 if not a keyword.
+// (check valid() with static_assert, as seed may not be found)
+constexpr size_t KeywordHashSize(size_t n)
+{
+  size_t r = 16;
+  while (r < n * 4) r <<= 1;
+  return r;
+}
+
+template <size_t N>
+class KeywordHash
+{
+public:
+  static constexpr size_t kSize = KeywordHashSize(N);
+
+  constexpr KeywordHash(const char* const (&keywords)[N])
+    : keywords_(), lens_(), slots_(), seed_(0)
+  {
+    for (size_t i = 0; i < N; ++i)
+    {
+      keywords_[i] = keywords[i];
+      while (keywords[i][lens_[i]]) lens_[i]++;
+    }
+    for (uint32_t seed = 1; seed < 0x10000; ++seed)
+    {
+      if (TrySeed(seed)) { seed_ = seed; break; }
+    }
+  }
+
+  constexpr bool valid() const { return N < 0xFF && seed_ != 0; }
+
+  int Find(const char* s, size_t len) const
+  {
+    const uint8_t i = slots_[Hash(s, len, seed_) & (kSize - 1)];
+    return (i != 0xFF && lens_[i] == len && memcmp(keywords_[i], s, len) == 0) ? i : -1;
+  }
+
+  int Find(const std::string& s) const { return Find(s.c_str(), s.size()); }
+
+private:
+  // FNV-1a with seed
+  static constexpr uint32_t Hash(const char* s, size_t len, uint32_t seed)
+  {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; ++i)
+      h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h ^ (h >> 15);
+  }
+
+  constexpr bool TrySeed(uint32_t seed)
+  {
+    for (size_t i = 0; i < kSize; ++i)
+      slots_[i] = 0xFF;
+    for (size_t i = 0; i < N; ++i)
+    {
+      uint8_t &slot = slots_[Hash(keywords_[i], lens_[i], seed) & (kSize - 1)];
+      if (slot != 0xFF) return false;
+      slot = static_cast<uint8_t>(i);
+    }
+    return true;
+  }
+
+  const char* keywords_[N];
+  size_t lens_[N];
+  uint8_t slots_[kSize];
+  uint32_t seed_;
+};
 
 char *itoa(int value, char *str, int base);
 char *gcvt(double value, int digits, char *string);
 long atoi_16(const char* str, unsigned int len = 0);
 
+// @description
+// decodes token_count pairs of base-36 characters (e.g. BMS object "0A")
+// into out[], with same rule of decoding BMS channel:
+// invalid character terminates the token, and NUL at second character
+// makes single-digit token.
+// bit (i % 64) of nonzero_mask[i / 64] is set if out[i] != 0,
+// so nonzero_mask requires (token_count + 63) / 64 words.
+// returns count of nonzero tokens.
+// (uses SSE2 / AVX2 / NEON if available)
+unsigned DecodeBase36Tokens(const char* p, unsigned token_count,
+                            uint16_t* out, uint64_t* nonzero_mask);
+// scalar implementation of DecodeBase36Tokens, for reference.
+unsigned DecodeBase36TokensScalar(const char* p, unsigned token_count,
+                                  uint16_t* out, uint64_t* nonzero_mask);
+
 
 class Random
 {
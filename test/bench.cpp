@@ -0,0 +1,1021 @@
+﻿#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <gtest/gtest.h>
+#include "Song.h"
+#include "ChartLoader.h"
+#include "ChartWriter.h"
+#include "ChartUtil.h"
+#include "MidiFile.h"
+#include "test_util.h"
+#ifdef USE_OPENSSL
+# include <openssl/md5.h>
+# include <openssl/sha.h>
+#endif
+using namespace std;
+using namespace rparser;
+
+/*
+ * Benchmarks, separated from unit test (rparser_test)
+ * as they take long time and only report timing.
+ * Filter with --gtest_filter to run some of them.
+ */
+
+static const char *kBase36 = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/* @brief bgm, bpm, 7key (with scratch) channels of synthetic BMS. */
+static const std::vector<const char*> kBmsChannels = {
+  "01", "03", "04", "11", "12", "13", "14", "15", "18", "19", "16" };
+
+/* @brief #WAV / #BMP / #BPM definitions of all channels (01 ~ ZZ). */
+static std::string MakeBmsResourceHeader()
+{
+  std::string s;
+  char buf[64];
+  for (unsigned i = 1; i < 1296; ++i)
+  {
+    sprintf(buf, "#WAV%c%c sound/keysound_%04u.wav\n", kBase36[i / 36], kBase36[i % 36], i);
+    s += buf;
+    sprintf(buf, "#BMP%c%c image/frame_%04u.png\n", kBase36[i / 36], kBase36[i % 36], i);
+    s += buf;
+    sprintf(buf, "#BPM%c%c %u\n", kBase36[i / 36], kBase36[i % 36], 100 + i % 100);
+    s += buf;
+  }
+  return s;
+}
+
+/**
+ * @brief object lines of given channels for each measure.
+ * @detail filled(measure, channel index, position) decides whether
+ * object is placed at the position of the line (otherwise "00").
+ */
+template <typename F>
+static std::string MakeBmsObjectLines(unsigned measure_count,
+  const std::vector<const char*> &channels, unsigned division, F filled,
+  const char *value = "0A")
+{
+  std::string s;
+  char buf[16];
+  for (unsigned m = 0; m < measure_count; ++m)
+  {
+    for (unsigned c = 0; c < channels.size(); ++c)
+    {
+      sprintf(buf, "#%03u%s:", m, channels[c]);
+      s += buf;
+      for (unsigned i = 0; i < division; ++i)
+        s += filled(m, c, i) ? value : "00";
+      s += "\n";
+    }
+  }
+  return s;
+}
+
+TEST(RUTIL, MD5_SHA256_BENCH)
+{
+  using namespace rutil;
+  const size_t size = 64 * 1024 * 1024;
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) data[i] = (char)(i * 2654435761u >> 24);
+
+  auto mbps = [size](std::chrono::steady_clock::duration d) {
+    return size / 1048576.0 / std::chrono::duration<double>(d).count();
+  };
+  auto t0 = std::chrono::steady_clock::now();
+  const std::string h_md5 = md5_str(data.c_str(), (int)size);
+  auto t1 = std::chrono::steady_clock::now();
+  const std::string h_sha = sha256_str(data.c_str(), size);
+  auto t2 = std::chrono::steady_clock::now();
+  std::cout << "Hash throughput: md5 " << mbps(t1 - t0) << " MB/s, sha256 "
+    << mbps(t2 - t1) << " MB/s" << std::endl;
+
+#ifdef USE_OPENSSL
+  unsigned char d[SHA256_DIGEST_LENGTH];
+  char hex[65];
+  t0 = std::chrono::steady_clock::now();
+  MD5((const unsigned char*)data.c_str(), size, d);
+  t1 = std::chrono::steady_clock::now();
+  for (int i = 0; i < 16; ++i) sprintf(hex + i * 2, "%02x", d[i]);
+  EXPECT_EQ(h_md5, std::string(hex, 32));
+  t1 = std::chrono::steady_clock::now();
+  SHA256((const unsigned char*)data.c_str(), size, d);
+  t2 = std::chrono::steady_clock::now();
+  for (int i = 0; i < 32; ++i) sprintf(hex + i * 2, "%02x", d[i]);
+  EXPECT_EQ(h_sha, std::string(hex, 64));
+  std::cout << "OpenSSL throughput: md5 " << mbps(t1 - t0) << " MB/s, sha256 "
+    << mbps(t2 - t1) << " MB/s" << std::endl;
+#endif
+}
+
+TEST(RUTIL, ENCODING_BATCH_BENCH)
+{
+  using namespace rutil;
+  // metadata with 1295 sound channels (half of them are Shift_JIS)
+  const std::string sjis = ReadFileText(BASE_DIR + "rutil/ENCODING_SHIFTJIS.txt");
+  MetaData md;
+  md.title = sjis;
+  md.artist = sjis;
+  for (unsigned i = 1; i < 1296; ++i)
+    md.GetSoundChannel()->Set(i, (i % 2 ? sjis : std::string("kick")) + std::to_string(i) + ".wav");
+
+  // converter opened for each string (as ConvertEncoding without cache)
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::string> uncached;
+  for (const auto &fn : md.GetSoundChannel()->fn)
+  {
+    EncodingConverter converter;
+    uncached.emplace_back();
+    converter.Convert(fn.second, uncached.back(), E_UTF8, E_SHIFT_JIS);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  EXPECT_TRUE(md.SetUtf8Encoding());
+  auto t2 = std::chrono::steady_clock::now();
+  EXPECT_STREQ(u8"七色ゆえんじ", md.title.c_str());
+  unsigned i = 0;
+  for (const auto &fn : md.GetSoundChannel()->fn)
+    EXPECT_EQ(uncached[i++], fn.second);
+
+  std::cout << "Metadata encoding: 1295 sounds, converter per string "
+    << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms, batch "
+    << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms" << std::endl;
+}
+
+TEST(RUTIL, ENCODING_TABLE_BENCH)
+{
+  using namespace rutil;
+  // archive with 5000 Shift_JIS filenames
+  const std::string sjis = ReadFileText(BASE_DIR + "rutil/ENCODING_SHIFTJIS.txt");
+  std::vector<std::string> filenames;
+  for (unsigned i = 0; i < 5000; ++i)
+    filenames.push_back(sjis + "/" + sjis + "_" + std::to_string(i) + ".wav");
+
+  std::vector<std::string> decoded(filenames.size());
+  std::string out;
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < filenames.size(); ++i)
+  {
+    DecodeToUTF8(filenames[i].c_str(), filenames[i].size(), out, E_SHIFT_JIS);
+    decoded[i] = out;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  EXPECT_EQ(std::string(u8"七色ゆえんじ/七色ゆえんじ_4999.wav"), decoded.back());
+
+#ifndef _WIN32
+  iconv_t cd = iconv_open("UTF-8", "CP932");
+  ASSERT_NE((iconv_t)-1, cd);
+  std::vector<std::string> decoded_iconv(filenames.size());
+  auto t2 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < filenames.size(); ++i)
+  {
+    iconv_decode(cd, filenames[i], out);
+    decoded_iconv[i] = out;
+  }
+  auto t3 = std::chrono::steady_clock::now();
+  iconv_close(cd);
+  EXPECT_EQ(decoded, decoded_iconv);
+  std::cout << "Filename decoding: 5000 names, iconv "
+    << std::chrono::duration<double, std::milli>(t3 - t2).count() << " ms, ";
+#endif
+  std::cout << "table "
+    << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms" << std::endl;
+}
+
+TEST(RPARSER, ND_RANGE_SEARCH_BENCH)
+{
+  Track t;
+  const size_t note_count = 100000;
+  {
+    NoteElement n;
+    for (size_t i = 0; i < note_count; ++i)
+    {
+      n.set_measure((i - i / 4) * 0.125);
+      t.AddNoteElement(n);
+    }
+  }
+
+  // sliding window search (like rendering a scrolling chart)
+  const double last = t.back().measure();
+  const size_t frame_count = 1000000;
+  const double step = last / frame_count;
+  size_t total = 0;
+  size_t lower = 0, upper = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frame_count; ++i)
+  {
+    double m = step * i;
+    lower = t.lower_bound_index(m, lower);
+    upper = t.upper_bound_index(m + 4.0, upper);
+    total += upper - lower;
+  }
+  auto t_end = std::chrono::steady_clock::now();
+  std::cout << "Sliding window search (" << frame_count << " frames, "
+    << t.size() << " notes): "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count()
+    << "ms (" << total << ")" << std::endl;
+}
+
+TEST(RPARSER, ND_WINDOW_CURSOR_BENCH)
+{
+  TrackData td;
+  const size_t lane_count = 8;
+  const size_t note_count = 20000;
+  td.set_track_count(lane_count);
+  {
+    NoteElement n;
+    for (size_t i = 0; i < note_count; ++i)
+    {
+      // 120 BPM, 16th notes : 2000ms per measure.
+      double m = i * 0.0625;
+      n.set_measure(m);
+      n.set_time(m * 2000.0);
+      td[(i * 7) % lane_count].AddNoteElement(n);
+    }
+  }
+
+  // per-frame rendering (60fps), compared with ranged iterator.
+  auto cursor = td.GetWindowCursor();
+  const double last = note_count * 0.0625 * 2000.0;
+  const size_t frame_count = (size_t)(last / (1000.0 / 60));
+  size_t total_cursor = 0, total_iter = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frame_count; ++i)
+  {
+    double t = i * (1000.0 / 60);
+    cursor.Seek(t - 100.0, t + 2000.0);
+    for (size_t l = 0; l < cursor.get_track_count(); ++l)
+      for (auto it = cursor.begin(l); it != cursor.end(l); ++it)
+        total_cursor++;
+  }
+  auto t_mid = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frame_count; ++i)
+  {
+    double t = i * (1000.0 / 60);
+    for (auto it = td.begin((t - 100.0) / 2000.0, (t + 2000.0) / 2000.0); it != td.end(); ++it)
+      total_iter++;
+  }
+  auto t_end = std::chrono::steady_clock::now();
+  EXPECT_EQ(total_iter, total_cursor);
+  std::cout << "Window cursor (" << frame_count << " frames): "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(t_mid - t_start).count()
+    << "ms, ranged iterator: "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_mid).count()
+    << "ms" << std::endl;
+}
+
+TEST(RPARSER, TRACK_COW_BENCH)
+{
+  Chart c;
+  auto &nd = c.GetNoteData();
+  nd.set_track_count(7);
+  NoteElement n;
+  for (unsigned i = 0; i < 1000; ++i)
+  {
+    n.set_measure(i * 0.25);
+    nd[i % 7].AppendNoteElement(n);
+  }
+
+  effector::EffectorParam param;
+  effector::SetLanefor7Key(param);
+  const int repeat = 1000;
+  auto t_start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r)
+  {
+    Chart clone(c);
+    effector::Flip(clone, param);
+  }
+  auto t_end = std::chrono::steady_clock::now();
+  std::cout << "Chart clone + flip: "
+    << std::chrono::duration<double, std::micro>(t_end - t_start).count() / repeat
+    << " us/clone" << std::endl;
+}
+
+TEST(RPARSER, METADATA_CHANNEL_BENCH)
+{
+  // 12 charts with full #WAV / #BMP / #BPM tables (same table for all charts)
+  std::string bms = "#TITLE channel bench\n#BPM 150\n" + MakeBmsResourceHeader();
+  char buf[16];
+  // exbpm change for each channel, 16 per measure
+  for (unsigned m = 0; m * 16 + 1 < 1296; ++m)
+  {
+    sprintf(buf, "#%03u08:", m);
+    bms += buf;
+    for (unsigned i = m * 16 + 1; i < m * 16 + 17; ++i)
+    {
+      bms += kBase36[(i % 1296) / 36];
+      bms += kBase36[i % 36];
+    }
+    bms += "\n";
+  }
+
+  const unsigned chart_count = 12;
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  ChartLoaderBMS loader(&song);
+  for (unsigned i = 0; i < chart_count; ++i)
+    ASSERT_TRUE(loader.Load(*song.NewChart(), bms.c_str(), (unsigned)bms.size()));
+  const MetaData &md = song.GetChart(0)->GetMetaData();
+  ASSERT_EQ(1295u, md.GetSoundChannel()->fn.size());
+  EXPECT_EQ(2590u, song.GetStringPool()->size());
+
+  // approximate heap usage, compared with std::map<Channel, std::string> tables
+  // (node: 32 byte header + key/value, with string buffer out of SSO).
+  auto map_bytes = [](const MetaData &m) {
+    size_t r = 0;
+    for (const auto &ii : m.GetSoundChannel()->fn)
+      r += 32 + sizeof(std::pair<Channel, std::string>) + ii.second.size() + 1;
+    for (const auto &ii : m.GetBGAChannel()->bga)
+      r += 32 + sizeof(Channel) + sizeof(std::string) + 8 * sizeof(int) + ii.second.fn.size() + 1;
+    return r;
+  };
+  auto table_bytes = [](const MetaData &m) {
+    return m.GetSoundChannel()->fn.GetMemoryUsage() + m.GetBGAChannel()->bga.GetMemoryUsage();
+  };
+  std::cout << "Resource tables of " << chart_count << " charts: std::map "
+    << chart_count * map_bytes(md) / 1024 << " KiB, flat table "
+    << chart_count * table_bytes(md) / 1024 << " KiB + pool "
+    << song.GetStringPool()->GetMemoryUsage() / 1024 << " KiB" << std::endl;
+
+  // sparse tables (chart with a few resources)
+  const std::string sparse_bms = "#WAV01 kick.wav\n#WAV02 snare.wav\n#BMP01 bg.png\n";
+  Song sparse_song;
+  sparse_song.SetSongType(SONGTYPE::BMS);
+  ChartLoaderBMS sparse_loader(&sparse_song);
+  Chart *sparse = sparse_song.NewChart();
+  ASSERT_TRUE(sparse_loader.Load(*sparse, sparse_bms.c_str(), (unsigned)sparse_bms.size()));
+  EXPECT_EQ(2u, sparse->GetMetaData().GetSoundChannel()->fn.size());
+  std::cout << "Resource tables of sparse chart: std::map "
+    << map_bytes(sparse->GetMetaData()) << " B, flat table "
+    << table_bytes(sparse->GetMetaData()) << " B" << std::endl;
+
+  // BPM lookup (as TimingSegmentData::Update), compared with std::map
+  std::map<Channel, float> bpm_map;
+  for (const auto &ii : md.GetBPMChannel()->bpm)
+    bpm_map[ii.first] = ii.second;
+  const unsigned lookup_count = 1000000;
+  float v, sum_table = 0, sum_map = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < lookup_count; ++i)
+    if (md.GetBPMChannel()->GetBpm(i % 1296, v)) sum_table += v;
+  auto t1 = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < lookup_count; ++i)
+  {
+    auto it = bpm_map.find(i % 1296);
+    if (it != bpm_map.end()) sum_map += it->second;
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  EXPECT_EQ(sum_map, sum_table);
+
+  Chart *c = song.GetChart(0);
+  c->Update();
+  auto t3 = std::chrono::steady_clock::now();
+  c->UpdateTempoData();
+  auto t4 = std::chrono::steady_clock::now();
+  EXPECT_EQ(1295u, c->GetTimingData()[TimingTrackTypes::kBmsBpm].size());
+
+  std::cout << "BPM lookup: table "
+    << std::chrono::duration<double, std::nano>(t1 - t0).count() / lookup_count << " ns, std::map "
+    << std::chrono::duration<double, std::nano>(t2 - t1).count() / lookup_count << " ns, "
+    << "tempo update (1295 exbpm) "
+    << std::chrono::duration<double, std::micro>(t4 - t3).count() << " us" << std::endl;
+}
+
+TEST(RPARSER, VOSFILE_BENCH)
+{
+  Song song;
+  const auto songlist = {
+    "chart_sample/1.vos",
+    "chart_sample/103.vos",
+    "chart_sample/23.vos",
+    "chart_sample/24.vos",
+    "chart_sample/109.vos"
+  };
+  const int repeat = 20;
+  size_t total_bytes = 0;
+  for (auto& songpath : songlist)
+  {
+    rutil::FileData fd;
+    rutil::ReadFileData(BASE_DIR + songpath, fd);
+    total_bytes += fd.GetFileSize() * repeat;
+  }
+  auto t_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; ++i)
+  {
+    for (auto& songpath : songlist)
+    {
+      ASSERT_TRUE(song.Open(BASE_DIR + songpath));
+      Chart *c = song.GetChart(0);
+      ASSERT_TRUE(c);
+      EXPECT_TRUE(c->GetNoteData().GetNoteCount() > 0);
+      song.Close();
+    }
+  }
+  auto t_end = std::chrono::steady_clock::now();
+  double msec = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+  std::cout << "VOS load throughput: " << total_bytes / 1024.0 / 1024.0 / (msec / 1000.0)
+    << "MB/s (" << msec << "ms)" << std::endl;
+}
+
+TEST(RPARSER, MIDIFILE_BENCH)
+{
+  const std::vector<uint8_t> smf = MakeSyntheticMidi(15, 20000);
+  MidiFile midi, midi_mt;
+  const int repeat = 10;
+  auto t_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; ++i) ASSERT_TRUE(midi.Parse(smf.data(), smf.size()));
+  auto t_mid = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; ++i) ASSERT_TRUE(midi_mt.Parse(smf.data(), smf.size(), 4));
+  auto t_end = std::chrono::steady_clock::now();
+  std::cout << "MIDI decode (" << smf.size() << " bytes): "
+    << std::chrono::duration_cast<std::chrono::microseconds>(t_mid - t_start).count() / repeat
+    << "us, 4 threads: "
+    << std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_mid).count() / repeat
+    << "us" << std::endl;
+}
+
+TEST(RPARSER, BMSON_BENCH)
+{
+  // 16 lanes x 20000 notes with long notes
+  std::string bmson;
+  bmson += R"({"version":"1.0.0","info":{"title":"bench","init_bpm":150,"resolution":240},)";
+  bmson += R"("bpm_events":[{"y":96000,"bpm":200}],"sound_channels":[)";
+  const unsigned lane_count = 16, note_per_lane = 20000;
+  char buf[128];
+  for (unsigned i = 0; i < lane_count; ++i)
+  {
+    sprintf(buf, R"(%s{"name":"%02u.wav","notes":[)", i ? "," : "", i);
+    bmson += buf;
+    for (unsigned j = 0; j < note_per_lane; ++j)
+    {
+      sprintf(buf, R"(%s{"x":%u,"y":%u,"l":%u,"c":false})",
+        j ? "," : "", i + 1, j * 60, (j % 10 == 0) ? 30 : 0);
+      bmson += buf;
+    }
+    bmson += "]}";
+  }
+  bmson += "]}";
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMSON);
+  Chart *c = song.NewChart();
+  ChartLoaderBMSON loader(&song);
+  const int repeat = 5;
+  auto t_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; ++i)
+    ASSERT_TRUE(loader.Load(*c, bmson.c_str(), (unsigned)bmson.size()));
+  auto t_end = std::chrono::steady_clock::now();
+  EXPECT_EQ(lane_count * note_per_lane, c->GetNoteData().GetNoteCount());
+  double msec = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+  std::cout << "BMSON load throughput: "
+    << bmson.size() * repeat / 1024.0 / 1024.0 / (msec / 1000.0)
+    << "MB/s (" << bmson.size() << " bytes, " << msec / repeat << "ms)" << std::endl;
+}
+
+static std::string MakeSyntheticOsu(unsigned key_count, unsigned note_count, const std::string& version)
+{
+  std::string s = "osu file format v14\r\n\r\n[General]\r\nAudioFilename: audio.mp3\r\nMode: 3\r\n\r\n"
+    "[Metadata]\r\nTitle:bench\r\nArtist:rparser\r\nVersion:" + version + "\r\n\r\n"
+    "[Difficulty]\r\nCircleSize:" + std::to_string(key_count) + "\r\nOverallDifficulty:8\r\n\r\n"
+    "[TimingPoints]\r\n";
+  char buf[128];
+  for (unsigned i = 0; i < 50; ++i)
+  {
+    sprintf(buf, "%u,%s,4,2,0,100,%d,0\r\n", i * 8000, (i % 2) ? "-80" : (i % 4 ? "400" : "375"), (i % 2) ? 0 : 1);
+    s += buf;
+  }
+  s += "\r\n[HitObjects]\r\n";
+  for (unsigned i = 0; i < note_count; ++i)
+  {
+    const unsigned x = (i % key_count) * 512 / key_count + 10;
+    if (i % 10 == 0)
+      sprintf(buf, "%u,192,%u,128,0,%u:0:0:0:0:\r\n", x, i * 40, i * 40 + 120);
+    else
+      sprintf(buf, "%u,192,%u,1,0,0:0:0:0:\r\n", x, i * 40);
+    s += buf;
+  }
+  return s;
+}
+
+TEST(RPARSER, OSU_BENCH)
+{
+  // synthetic beatmap folder with many difficulties
+  TempDirectory tmpdir("osu_synthetic_");
+  const std::string &dirpath = tmpdir.path();
+  ASSERT_FALSE(dirpath.empty());
+  const unsigned chart_count = 12, note_count = 5000;
+  std::vector<std::string> beatmaps;
+  size_t total_bytes = 0;
+  for (unsigned i = 0; i < chart_count; ++i)
+  {
+    beatmaps.push_back(MakeSyntheticOsu(4 + i % 5, note_count, "diff" + std::to_string(i)));
+    std::ofstream f(dirpath + "/chart" + std::to_string(i) + ".osu", std::ios::binary);
+    f.write(beatmaps.back().c_str(), beatmaps.back().size());
+    total_bytes += beatmaps.back().size();
+  }
+
+  Song song;
+  auto t_start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(song.Open(dirpath));
+  auto t_end = std::chrono::steady_clock::now();
+  ASSERT_EQ(chart_count, song.GetChartCount());
+  EXPECT_EQ(note_count, song.GetChart(0)->GetNoteData().GetNoteCount());
+  song.Close();
+  double msec_folder = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+
+  // full / header-only load from memory
+  Song song_mem;
+  song_mem.SetSongType(SONGTYPE::OSU);
+  Chart *c = song_mem.NewChart();
+  ChartLoaderOSU loader(&song_mem);
+  const int repeat = 5;
+  t_start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r)
+    for (auto &b : beatmaps)
+      loader.Load(*c, b.c_str(), (unsigned)b.size());
+  auto t_mid = std::chrono::steady_clock::now();
+  loader.SetHeaderOnly();
+  for (int r = 0; r < repeat; ++r)
+    for (auto &b : beatmaps)
+      loader.Load(*c, b.c_str(), (unsigned)b.size());
+  t_end = std::chrono::steady_clock::now();
+  EXPECT_EQ(0, c->GetNoteData().GetNoteCount());
+
+  double msec_full = std::chrono::duration<double, std::milli>(t_mid - t_start).count() / repeat;
+  double msec_header = std::chrono::duration<double, std::milli>(t_end - t_mid).count() / repeat;
+  std::cout << "osu! folder (" << chart_count << " charts, " << total_bytes << " bytes): "
+    << msec_folder << "ms, full load: " << msec_full << "ms, header only: "
+    << msec_header << "ms" << std::endl;
+}
+
+TEST(RPARSER, SM_SHARED_TIMING_BENCH)
+{
+  // 6 difficulties with heavy BPM / STOP changes
+  const unsigned chart_count = 6, measure_count = 400, bpm_count = 1000, stop_count = 300;
+  std::string sm = "#TITLE:bench;\n#BPMS:";
+  char buf[64];
+  for (unsigned i = 0; i < bpm_count; ++i)
+  {
+    sprintf(buf, "%s%.3f=%.3f", i ? "," : "", i * 1.6, 120.0 + (i % 7) * 10);
+    sm += buf;
+  }
+  sm += ";\n#STOPS:";
+  for (unsigned i = 0; i < stop_count; ++i)
+  {
+    sprintf(buf, "%s%.3f=0.100", i ? "," : "", i * 5.0 + 0.5);
+    sm += buf;
+  }
+  sm += ";\n";
+  for (unsigned c = 0; c < chart_count; ++c)
+  {
+    sm += "#NOTES:\n dance-single:\n :\n Hard:\n " + std::to_string(c + 1) + ":\n 0,0,0,0,0:\n";
+    for (unsigned m = 0; m < measure_count; ++m)
+    {
+      for (unsigned r = 0; r < 16; ++r)
+      {
+        char row[] = "0000\n";
+        if ((r + m + c) % 2 == 0) row[(r + c) % 4] = '1';
+        sm += row;
+      }
+      sm += (m + 1 < measure_count) ? ",\n" : ";\n";
+    }
+  }
+
+  Song song;
+  song.SetSongType(SONGTYPE::SM);
+  Chart *c = song.NewChart();
+  ChartLoaderSM loader(&song);
+  auto t_start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(loader.Load(*c, sm.c_str(), (unsigned)sm.size()));
+  auto t_load = std::chrono::steady_clock::now();
+  ASSERT_EQ(chart_count, song.GetChartCount());
+  for (size_t i = 0; i < song.GetChartCount(); ++i)
+    song.GetChart(i)->Update();
+  auto t_shared = std::chrono::steady_clock::now();
+
+  // same charts with their own timing data
+  std::vector<Chart> charts(chart_count);
+  for (size_t i = 0; i < chart_count; ++i)
+  {
+    charts[i].GetNoteData() = song.GetChart(i)->GetNoteData();
+    charts[i].GetTimingData() = song.GetChart(i)->GetTimingData();
+    charts[i].GetMetaData().bpm = 120;
+  }
+  auto t_percopy = std::chrono::steady_clock::now();
+  for (auto &pc : charts)
+    pc.Update();
+  auto t_perchart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < chart_count; ++i)
+  {
+    auto &n1 = song.GetChart(i)->GetNoteData();
+    auto &n2 = charts[i].GetNoteData();
+    ASSERT_EQ(n1.GetNoteCount(), n2.GetNoteCount());
+    ASSERT_NEAR(n1.back()->time(), n2.back()->time(), 0.01);
+  }
+
+  auto timing_bytes = [](const Chart &chart) {
+    auto &tsd = chart.GetTimingSegmentData();
+    return chart.GetTimingData().GetNoteCount() * sizeof(NoteElement)
+      + tsd.GetTimingSegments().size() * sizeof(TimingSegment)
+      + tsd.GetBarObjects().size() * sizeof(BarObject);
+  };
+  auto msec = [](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+    return std::chrono::duration<double, std::milli>(b - a).count();
+  };
+  std::cout << "SM load (" << chart_count << " charts): " << msec(t_start, t_load) << "ms" << std::endl
+    << "  shared timing update: " << msec(t_load, t_shared) << "ms, "
+    << timing_bytes(*song.GetChart(0)) << " bytes" << std::endl
+    << "  per-chart timing update: " << msec(t_percopy, t_perchart) << "ms, "
+    << timing_bytes(charts[0]) * chart_count << " bytes" << std::endl;
+}
+
+TEST(RPARSER, BMS_DTX_BENCH)
+{
+  // same amount of objects in both formats
+  const unsigned measure_count = 999, object_per_line = 64;
+  const std::vector<const char*> bms_lanes = { "01", "11", "12", "13", "14", "15", "18", "19" };
+  const std::vector<const char*> dtx_lanes = { "01", "11", "12", "13", "14", "15", "16", "17" };
+  auto make_chart = [&](const char* header, const std::vector<const char*> &lanes) {
+    return header + MakeBmsObjectLines(measure_count, lanes, object_per_line,
+      [](unsigned m, unsigned l, unsigned i) { return (i + l + m) % 4 == 0; });
+  };
+  const std::string bms = make_chart("#TITLE bench\n#BPM 150\n", bms_lanes);
+  const std::string dtx = make_chart("#TITLE: bench\n#BPM: 150\n#DLEVEL: 50\n", dtx_lanes);
+
+  auto bench = [](SONGTYPE type, const std::string &data) {
+    Song song;
+    song.SetSongType(type);
+    Chart *c = song.NewChart();
+    ChartLoader *loader = ChartLoader::Create(&song);
+    auto t_start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(loader->Load(*c, data.c_str(), (unsigned)data.size()));
+    auto t_end = std::chrono::steady_clock::now();
+    delete loader;
+    const double msec = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+    std::cout << (type == SONGTYPE::BMS ? "BMS" : "DTX") << " load: " << msec << "ms, "
+      << data.size() / 1024.0 / 1024.0 / (msec / 1000.0) << " MB/s" << std::endl;
+    return c->GetNoteData().GetNoteCount();
+  };
+  const size_t bms_count = bench(SONGTYPE::BMS, bms);
+  const size_t dtx_count = bench(SONGTYPE::DTX, dtx);
+  EXPECT_EQ(bms_count, dtx_count);
+  EXPECT_LT(0u, bms_count);
+}
+
+TEST(RPARSER, BMS_TOKEN_BENCH)
+{
+  // 192-division lines, mostly filled with "00" tokens
+  const unsigned measure_count = 999, division = 192;
+  const std::string bms = "#TITLE token bench\n#BPM 150\n" +
+    MakeBmsObjectLines(measure_count, kBmsChannels, division,
+      [](unsigned, unsigned, unsigned i) { return i % 24 == 0; });
+  const size_t token_count = measure_count * kBmsChannels.size() * division;
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  const int repeat = 3;
+  auto t_start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r)
+    loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+  auto t_end = std::chrono::steady_clock::now();
+  EXPECT_EQ(measure_count * 8 * (division / 24), c->GetNoteData().GetNoteCount());
+
+  const double nsec = std::chrono::duration<double, std::nano>(t_end - t_start).count() / repeat;
+  std::cout << "BMS token parse: " << token_count << " tokens, "
+    << nsec / token_count << " ns/token" << std::endl;
+}
+
+TEST(RPARSER, BMS_HEADER_BENCH)
+{
+  // header-heavy chart: resource tables, attributes and #RANDOM blocks
+  std::string bms = "#PLAYER 1\n#GENRE bench\n#TITLE header bench\n#ARTIST rparser\n"
+    "#BPM 150\n#PLAYLEVEL 12\n#RANK 3\n#TOTAL 300\n#LNTYPE 1\n#STAGEFILE stage.png\n";
+  bms += MakeBmsResourceHeader();
+  char buf[128];
+  for (unsigned m = 0; m < 200; ++m)
+  {
+    sprintf(buf, "#RANDOM 2\n#IF 1\n#%03u11:0101\n#ELSE\n#%03u12:0101\n#ENDIF\n#ENDRANDOM\n", m, m);
+    bms += buf;
+  }
+  const size_t line_count = 10 + 1295 * 3 + 200 * 7;
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  const int repeat = 10;
+  auto t_start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r)
+    loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+  auto t_end = std::chrono::steady_clock::now();
+  auto &md = c->GetMetaData();
+  md.SetMetaFromAttribute();
+  EXPECT_EQ(1295u, md.GetSoundChannel()->fn.size());
+  EXPECT_EQ(1295u, md.GetBGAChannel()->bga.size());
+  EXPECT_EQ(1295u, md.GetBPMChannel()->bpm.size());
+  EXPECT_EQ(12, md.level);
+  EXPECT_EQ(75.0, md.judgerank);
+  EXPECT_EQ(1, md.bms_longnote_type);
+  EXPECT_EQ(400u, c->GetNoteData().GetNoteCount());
+
+  // attribute dispatch
+  const int attr_repeat = 100000;
+  auto t_attr = std::chrono::steady_clock::now();
+  for (int r = 0; r < attr_repeat; ++r)
+    md.SetMetaFromAttribute();
+  auto t_attr_end = std::chrono::steady_clock::now();
+
+  const double sec = std::chrono::duration<double>(t_end - t_start).count() / repeat;
+  std::cout << "BMS header parse: " << line_count << " lines, "
+    << line_count / sec / 1e6 << " M lines/s, " << bms.size() / sec / 1e6 << " MB/s, "
+    << "SetMetaFromAttribute " << md.GetAttributes().size() << " attrs "
+    << std::chrono::duration<double, std::nano>(t_attr_end - t_attr).count() / attr_repeat
+    << " ns" << std::endl;
+}
+
+TEST(RPARSER, BMS_RANDOM_VARIANT_BENCH)
+{
+  // 8 #RANDOM 2 blocks over dense chart: 256 variants
+  const unsigned measure_count = 100, block_count = 8;
+  std::string bms = "#TITLE random bench\n#BPM 150\n" +
+    MakeBmsObjectLines(measure_count, { "11", "12", "13", "14", "15", "18", "19" }, 16,
+      [](unsigned, unsigned, unsigned i) { return i % 2 == 0; }, "01");
+  char buf[32];
+  for (unsigned b = 0; b < block_count; ++b)
+  {
+    bms += "#RANDOM 2\n";
+    for (unsigned v = 1; v <= 2; ++v)
+    {
+      sprintf(buf, "#IF %u\n#%03u16:", v, measure_count + b);
+      bms += buf;
+      bms += (v == 1) ? "01\n" : "0101\n";
+      bms += "#ENDIF\n";
+    }
+    bms += "#ENDRANDOM\n";
+  }
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+
+  // reopen chart for each variant (variant is decided by seed)
+  auto t_start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < (1u << block_count); ++i)
+  {
+    loader.SetSeed(i);
+    loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+  }
+  auto t_reload = std::chrono::steady_clock::now();
+
+  // tokenize once and replay all variants
+  size_t min_notes = SIZE_MAX, max_notes = 0;
+  std::vector<int> values(block_count, 1);
+  loader.PrepareVariants(bms.c_str(), (unsigned)bms.size());
+  ASSERT_EQ(1u << block_count, loader.GetVariantCount());
+  do {
+    loader.LoadVariant(*c, values);
+    const size_t note_count = c->GetNoteData().GetNoteCount();
+    min_notes = std::min(min_notes, note_count);
+    max_notes = std::max(max_notes, note_count);
+  } while (loader.NextVariant(values));
+  auto t_replay = std::chrono::steady_clock::now();
+
+  EXPECT_EQ(measure_count * 7 * 8 + block_count, min_notes);
+  EXPECT_EQ(measure_count * 7 * 8 + block_count * 2, max_notes);
+  std::cout << "BMS random variants: " << (1u << block_count) << " variants, reload "
+    << std::chrono::duration<double, std::milli>(t_reload - t_start).count() << " ms, replay "
+    << std::chrono::duration<double, std::milli>(t_replay - t_reload).count() << " ms" << std::endl;
+}
+
+TEST(RPARSER, BMS_WRITER_BENCH)
+{
+  const unsigned measure_count = 999, division = 192;
+  const std::string bms = "#TITLE writer bench\n#BPM 150\n" +
+    MakeBmsObjectLines(measure_count, kBmsChannels, division,
+      [](unsigned m, unsigned, unsigned i) { return i % 12 == m % 12; });
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+
+  ChartWriterBMS writer;
+  const int repeat = 10;
+  size_t bytes = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r)
+    bytes += writer.Serialize(*c).size();
+  auto t_end = std::chrono::steady_clock::now();
+  const double msec = std::chrono::duration<double, std::milli>(t_end - t_start).count() / repeat;
+
+  t_start = std::chrono::steady_clock::now();
+  std::string s = c->GetNoteData().Serialize();
+  t_end = std::chrono::steady_clock::now();
+  const double msec_old = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+
+  std::cout << "BMS write: " << bytes / repeat / 1024 << " KB, " << msec << " ms ("
+    << bytes / repeat / 1024.0 / 1024.0 / (msec / 1000.0) << " MB/s), "
+    << "TrackData::Serialize (notes only): " << msec_old << " ms" << std::endl;
+}
+
+TEST(RPARSER, NOTE_SEEK_BENCH)
+{
+  Song song;
+  ASSERT_TRUE(song.Open(BASE_DIR + "chart_sample_bms/L9^.bme"));
+  Chart *c = song.GetChart();
+  ASSERT_TRUE(c);
+  c->Update();
+  auto &nd = c->GetNoteData();
+
+  std::vector<Note> lanes;
+  for (size_t i = 0; i < nd.get_track_count(); ++i)
+    lanes.emplace_back(&nd[i]);
+  auto first_note_after = [](const Track& t, double time) {
+    return (size_t)(std::partition_point(t.begin(), t.end(),
+      [time](const NoteElement& n) { return n.time() < time; }) - t.begin());
+  };
+
+  // simulate judgement with 1kHz input polling.
+  const double song_length = c->GetSongLastObjectTime() + 1000;
+  const double judge_window = 200.0;
+  size_t hit_cursor = 0, hit_bsearch = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  for (double t = 0; t < song_length; t += 1.0)
+  {
+    for (auto &n : lanes)
+      if (n.SeekByTime(t - judge_window) && n.get()->time() <= t + judge_window)
+        hit_cursor++;
+  }
+  auto t_mid = std::chrono::steady_clock::now();
+  for (double t = 0; t < song_length; t += 1.0)
+  {
+    for (size_t i = 0; i < nd.get_track_count(); ++i)
+    {
+      size_t idx = first_note_after(nd[i], t - judge_window);
+      if (idx < nd[i].size() && nd[i].get(idx)->time() <= t + judge_window)
+        hit_bsearch++;
+    }
+  }
+  auto t_end = std::chrono::steady_clock::now();
+  EXPECT_EQ(hit_bsearch, hit_cursor);
+  std::cout << "1kHz judge seek (" << (int)song_length << " polls, "
+    << lanes.size() << " lanes): "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(t_mid - t_start).count()
+    << "ms, binary search: "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_mid).count()
+    << "ms" << std::endl;
+
+  song.Close();
+}
+
+TEST(CHARTUTIL, HTML_EXPORT_BENCH)
+{
+  Chart c;
+  auto &nd = c.GetNoteData();
+  nd.set_track_count(7);
+  NoteElement n;
+  for (unsigned i = 0; i < 20000; ++i)
+  {
+    n.set_measure(i / 24.0);
+    n.set_value(i % 100);
+    nd[i % 7].AppendNoteElement(n);
+  }
+  c.GetMetaData().bpm = 180;
+  c.Update();
+
+  HTMLExporter exporter;
+  FILE *fp = tmpfile();
+  ASSERT_TRUE(fp);
+  auto t_start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(exporter.Write(c, fp));
+  auto t_end = std::chrono::steady_clock::now();
+  const long size = ftell(fp);
+  fclose(fp);
+
+  std::cout << "HTML export: " << size / 1024 << " KB, "
+    << std::chrono::duration<double, std::milli>(t_end - t_start).count() << " ms" << std::endl;
+}
+
+TEST(CHARTUTIL, PROFILER_BENCH)
+{
+  // trill / jack pattern with random chord
+  const unsigned row_count = 100000;
+  Chart c;
+  auto &nd = c.GetNoteData();
+  nd.set_track_count(8);
+  NoteElement n;
+  for (unsigned i = 0; i < row_count; ++i)
+  {
+    n.set_measure(i / 16.0);
+    nd[i % 2].AppendNoteElement(n);
+    if (i % 5 == 0) nd[2 + i % 6].AppendNoteElement(n);
+  }
+  c.GetMetaData().bpm = 150;
+  c.Update();
+
+  ChartProfiler prof;
+  auto t_start = std::chrono::steady_clock::now();
+  prof.Profile(c);
+  auto t_end = std::chrono::steady_clock::now();
+  ASSERT_EQ(row_count, prof.GetSegmentCount());
+  EXPECT_EQ(150.0f, prof.GetSegment(row_count - 1)->bpm);
+  EXPECT_TRUE(prof.GetSegment(3)->pattern_i[1] & kPatternTrill);
+  // 16 rows per 1.6 sec (+ chord every 5 rows)
+  EXPECT_NEAR(12.0, prof.GetMaxDensity(), 1.0);
+
+  std::cout << "Chart profile: " << row_count << " rows, "
+    << std::chrono::duration<double, std::micro>(t_end - t_start).count() / 1000.0
+    << " ms" << std::endl;
+}
+
+TEST(CHARTUTIL, CHART_HASH_BENCH)
+{
+  const unsigned row_count = 200000;
+  Chart c;
+  auto &nd = c.GetNoteData();
+  nd.set_track_count(8);
+  NoteElement n;
+  for (unsigned i = 0; i < row_count; ++i)
+  {
+    n.SetRowPos(i / 16, RowPos{ i % 16, 16 });
+    n.set_value(i % 1295 + 1);
+    nd[i % 8].AppendNoteElement(n);
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  const std::string s = nd.Serialize();
+  const std::string h_text = rutil::md5_str(s.c_str(), (int)s.size());
+  auto t1 = std::chrono::steady_clock::now();
+  ChartHasher xxh;
+  xxh.Update(c);
+  const std::string h_xxh = xxh.GetDigest();
+  auto t2 = std::chrono::steady_clock::now();
+  ChartHasher md5(ChartHashTypes::kMD5);
+  md5.Update(c);
+  const std::string h_md5 = md5.GetDigest();
+  auto t3 = std::chrono::steady_clock::now();
+  EXPECT_EQ(16u, h_xxh.size());
+
+  auto ms = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  std::cout << "Chart hash: " << row_count << " notes, Serialize+md5 " << ms(t1 - t0)
+    << " ms, canonical xxh64 " << ms(t2 - t1)
+    << " ms, canonical md5 " << ms(t3 - t2) << " ms" << std::endl;
+}
+
+TEST(CHARTUTIL, CHART_FINGERPRINT_BENCH)
+{
+  // library of random charts, with a re-upload for every 10 charts.
+  const unsigned chart_count = 5000, measure_count = 48;
+  rutil::Random rnd;
+  rnd.SetSeed(1);
+  std::vector<ChartFingerprint> fps(chart_count);
+  double t_generate = 0;
+  for (unsigned i = 0; i < chart_count; ++i)
+  {
+    if (i % 10 == 9) { fps[i] = fps[i - 1]; continue; }
+    Chart c;
+    auto &nd = c.GetNoteData();
+    NoteElement n;
+    for (unsigned m = 0; m < measure_count; ++m)
+    {
+      for (unsigned r = 0; r < 16; ++r)
+      {
+        if (rnd.Next(0, 2) == 0) continue;
+        n.SetRowPos(m, RowPos{ r, 16 });
+        nd[rnd.Next(1, 7)].AppendNoteElement(n);
+      }
+    }
+    for (unsigned l = 0; l < 8; ++l) nd[l].SortNoteElements();
+    auto t0 = std::chrono::steady_clock::now();
+    fps[i].Generate(c);
+    t_generate += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  }
+
+  auto t0 = std::chrono::steady_clock::now();
+  ChartDuplicateIndex index;
+  for (const auto &fp : fps) index.Add(fp);
+  std::vector<std::vector<unsigned> > groups;
+  index.FindDuplicates(0.9, groups);
+  auto t1 = std::chrono::steady_clock::now();
+  EXPECT_EQ(chart_count / 10, groups.size());
+
+  // brute-force pairwise comparison for reference
+  unsigned pair_count = 0;
+  for (unsigned i = 0; i < chart_count; ++i)
+    for (unsigned j = i + 1; j < chart_count; ++j)
+      if (fps[i].Similarity(fps[j]) >= 0.9) pair_count++;
+  auto t2 = std::chrono::steady_clock::now();
+  EXPECT_EQ(chart_count / 10, pair_count);
+
+  auto ms = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  std::cout << "Chart fingerprint: " << chart_count << " charts, generate " << t_generate
+    << " ms, index + find duplicates " << ms(t1 - t0)
+    << " ms, pairwise " << ms(t2 - t1) << " ms" << std::endl;
+}
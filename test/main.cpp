@@ -1,12 +1,16 @@
 ﻿#include <iostream>
+#include <algorithm>
+#include <fstream>
 #include <gtest/gtest.h>
 #include "Song.h"
+#include "ChartLoader.h"
+#include "ChartWriter.h"
 #include "ChartUtil.h"
+#include "MidiFile.h"
+#include "test_util.h"
 using namespace std;
 using namespace rparser;
 
-#define BASE_DIR std::string("../test/")
-
 TEST(RUTIL, BASIC)
 {
   using namespace rutil;
@@ -15,6 +19,101 @@ TEST(RUTIL, BASIC)
   EXPECT_STREQ(trim("\tABCD  \n").c_str(), "ABCD");
 }
 
+TEST(RUTIL, HASH)
+{
+  using namespace rutil;
+  EXPECT_EQ(0xEF46DB3751D8E999ULL, xxh64("", 0));
+  EXPECT_EQ(0xD24EC4F1A98C6E5BULL, xxh64("a", 1));
+  EXPECT_EQ(0x44BC2CF5AD770999ULL, xxh64("abc", 3));
+  EXPECT_EQ("ef46db3751d8e999", hash64_str(xxh64("", 0)));
+
+  // streaming in any chunk size gives same hash.
+  std::string data;
+  for (int i = 0; i < 1000; ++i) data.push_back((char)(i * 31 + 7));
+  const uint64_t h = xxh64(data.c_str(), data.size(), 3);
+  for (size_t chunk : { 1, 5, 31, 32, 33, 100 })
+  {
+    XXH64Hasher hasher(3);
+    for (size_t i = 0; i < data.size(); i += chunk)
+      hasher.update(data.c_str() + i, std::min(chunk, data.size() - i));
+    EXPECT_EQ(h, hasher.digest()) << chunk;
+  }
+
+  MD5Hasher md5;
+  md5.update("ab", 2);
+  md5.update("c", 1);
+  EXPECT_EQ(md5_str("abc", 3), md5.hexdigest());
+}
+
+TEST(RUTIL, MD5_SHA256)
+{
+  using namespace rutil;
+  EXPECT_EQ("d41d8cd98f00b204e9800998ecf8427e", md5_str("", 0));
+  EXPECT_EQ("900150983cd24fb0d6963f7d28e17f72", md5_str("abc", 3));
+  const std::string alnum =
+    "12345678901234567890123456789012345678901234567890123456789012345678901234567890";
+  EXPECT_EQ("57edf4a22be3c955ac49da2e2107b67a", md5_str(alnum.c_str(), (int)alnum.size()));
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", sha256_str("", 0));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", sha256_str("abc", 3));
+  const std::string s448 = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            sha256_str(s448.c_str(), s448.size()));
+
+  // streaming across block boundary gives same hash.
+  std::string data;
+  for (int i = 0; i < 1000; ++i) data.push_back((char)(i * 13 + 1));
+  for (size_t chunk : { 1, 55, 63, 64, 65, 200 })
+  {
+    MD5Hasher md5;
+    SHA256Hasher sha;
+    for (size_t i = 0; i < data.size(); i += chunk)
+    {
+      md5.update(data.c_str() + i, std::min(chunk, data.size() - i));
+      sha.update(data.c_str() + i, std::min(chunk, data.size() - i));
+    }
+    EXPECT_EQ(md5_str(data.c_str(), (int)data.size()), md5.hexdigest()) << chunk;
+    EXPECT_EQ(sha256_str(data.c_str(), data.size()), sha.hexdigest()) << chunk;
+  }
+}
+
+TEST(RUTIL, BASE36_DECODE)
+{
+  using namespace rutil;
+  const char* tokens = "000A0zZZ1 ? 5";
+  uint16_t v[7];
+  uint64_t mask;
+  EXPECT_EQ(4u, DecodeBase36Tokens(tokens, 6, v, &mask));
+  EXPECT_EQ(0, v[0]);
+  EXPECT_EQ(10, v[1]);
+  EXPECT_EQ(35, v[2]);
+  EXPECT_EQ(36 * 35 + 35, v[3]);
+  EXPECT_EQ(36, v[4]);   // invalid character terminates token
+  EXPECT_EQ(0, v[5]);
+  EXPECT_EQ(0x1Eull, mask);
+
+  // fuzz SIMD decoder against scalar one.
+  const char kChars[] = "0000000000123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcxyz :@[`{\x80\xff";
+  std::mt19937 rng(36);
+  std::vector<char> buf;
+  std::vector<uint16_t> v1, v2;
+  std::vector<uint64_t> m1, m2;
+  for (unsigned iter = 0; iter < 2000; ++iter)
+  {
+    const unsigned count = rng() % 400;
+    const unsigned offset = rng() % 16;
+    buf.assign(offset + count * 2 + 1, 0);
+    for (unsigned i = 0; i < count * 2; ++i)
+      buf[offset + i] = (rng() % 64 == 0) ? 0 : kChars[rng() % (sizeof(kChars) - 1)];
+    v1.assign(count + 1, 0xFFFF); v2.assign(count + 1, 0xFFFF);
+    m1.assign((count + 63) / 64 + 1, ~0ull); m2.assign((count + 63) / 64 + 1, ~0ull);
+    const unsigned c1 = DecodeBase36Tokens(buf.data() + offset, count, v1.data(), m1.data());
+    const unsigned c2 = DecodeBase36TokensScalar(buf.data() + offset, count, v2.data(), m2.data());
+    ASSERT_EQ(c2, c1);
+    ASSERT_TRUE(v1 == v2) << "iteration " << iter;
+    ASSERT_TRUE(m1 == m2) << "iteration " << iter;
+  }
+}
+
 TEST(RUTIL, ENCODING)
 {
   using namespace rutil;
@@ -31,6 +130,98 @@ TEST(RUTIL, ENCODING)
   EXPECT_STREQ(u8"가나다라마바사12345", ConvertEncoding(text_euckr, E_UTF8, E_EUC_KR).c_str());
 }
 
+TEST(RUTIL, ENCODING_BATCH)
+{
+  using namespace rutil;
+  // strict utf-8 validation
+  EXPECT_TRUE(IsValidUTF8("", 0));
+  const std::string long_utf8 = std::string(40, 'a') + u8"가나다" + std::string(40, 'b');
+  EXPECT_TRUE(IsValidUTF8(long_utf8.c_str(), long_utf8.size()));
+  EXPECT_FALSE(IsValidUTF8("\xc0\xaf", 2));            // overlong
+  EXPECT_FALSE(IsValidUTF8("\xed\xa0\x80", 3));        // surrogate
+  EXPECT_FALSE(IsValidUTF8("\xe3\x81", 2));            // truncated
+  EXPECT_EQ(40u, CountASCII(long_utf8.c_str(), long_utf8.size()));
+
+  std::string text_euckr = ReadFileText(BASE_DIR + "rutil/ENCODING_EUCKR.txt");
+  std::string text_shiftjis = ReadFileText(BASE_DIR + "rutil/ENCODING_SHIFTJIS.txt");
+  std::string text_utf8 = ReadFileText(BASE_DIR + "rutil/ENCODING_UTF8.txt");
+
+  std::string a = text_shiftjis, b = "sound\\a.wav", c = "plain.wav", d;
+  std::string *strs[] = { &a, &b, &c, &d };
+  ConvertEncoding(strs, 4, E_UTF8, E_SHIFT_JIS);
+  EXPECT_STREQ(u8"七色ゆえんじ", a.c_str());
+  EXPECT_EQ(ConvertEncoding("sound\\a.wav", E_UTF8, E_SHIFT_JIS), b);
+  EXPECT_EQ("plain.wav", c);
+  EXPECT_EQ("", d);
+
+  // converter is reused for other codepage pair, and detects encoding.
+  EncodingConverter converter;
+  std::string out;
+  EXPECT_TRUE(converter.Convert(text_euckr, out, E_UTF8));
+  EXPECT_STREQ(u8"가나다라마바사12345", out.c_str());
+  EXPECT_TRUE(converter.Convert(text_shiftjis, out, E_UTF8));
+  EXPECT_STREQ(u8"七色ゆえんじ", out.c_str());
+  EXPECT_TRUE(converter.Convert(out, out, E_SHIFT_JIS, E_UTF8));
+  EXPECT_EQ(text_shiftjis, out);
+  EXPECT_FALSE(converter.Convert("\xff\xff", out, E_UTF8, E_UTF8));
+  EXPECT_EQ("", out);
+}
+
+TEST(RUTIL, ENCODING_TABLE)
+{
+  using namespace rutil;
+  std::string text_euckr = ReadFileText(BASE_DIR + "rutil/ENCODING_EUCKR.txt");
+  std::string text_shiftjis = ReadFileText(BASE_DIR + "rutil/ENCODING_SHIFTJIS.txt");
+  std::string out;
+  EXPECT_TRUE(DecodeToUTF8(text_shiftjis.c_str(), text_shiftjis.size(), out, E_SHIFT_JIS));
+  EXPECT_STREQ(u8"七色ゆえんじ", out.c_str());
+  EXPECT_TRUE(DecodeToUTF8(text_euckr.c_str(), text_euckr.size(), out, E_EUC_KR));
+  EXPECT_STREQ(u8"가나다라마바사12345", out.c_str());
+  // CP949 extended hangul, halfwidth katakana, path separator
+  EXPECT_EQ(u8"똠", ConvertEncoding("\x8c\x63", E_UTF8, E_EUC_KR));
+  EXPECT_EQ(u8"ｱ\\~", ConvertEncoding("\xb1\\~", E_UTF8, E_SHIFT_JIS));
+  // invalid / truncated sequence
+  EXPECT_FALSE(DecodeToUTF8("\x82", 1, out, E_SHIFT_JIS));
+  EXPECT_EQ("", out);
+  EXPECT_FALSE(DecodeToUTF8("\xff\xff", 2, out, E_EUC_KR));
+
+#ifndef _WIN32
+  // every 1 / 2 byte sequence gives same result with iconv.
+  for (int cp : { E_SHIFT_JIS, E_EUC_KR })
+  {
+    iconv_t cd = iconv_open("UTF-8", cp == E_SHIFT_JIS ? "CP932" : "CP949");
+    ASSERT_NE((iconv_t)-1, cd);
+    std::string s, expected;
+    for (unsigned c = 0; c < 0x10000; ++c)
+    {
+      if (c < 0x100) s.assign(1, (char)c);
+      else if (c < 0x8000) continue;
+      else { s.assign(1, (char)(c >> 8)); s.push_back((char)(c & 0xFF)); }
+      const bool r = iconv_decode(cd, s, expected);
+      ASSERT_EQ(r, DecodeToUTF8(s.c_str(), s.size(), out, cp)) << cp << " " << std::hex << c;
+      if (r) { ASSERT_EQ(expected, out) << cp << " " << std::hex << c; }
+    }
+    iconv_close(cd);
+  }
+#endif
+}
+
+TEST(RUTIL, KEYWORD_HASH)
+{
+  using namespace rutil;
+  static constexpr const char* keywords[] = { "IF", "ELSE", "ELSEIF", "END", "ENDIF", "WAV" };
+  static constexpr KeywordHash<6> hash(keywords);
+  static_assert(hash.valid(), "Keyword hash not generated");
+  for (int i = 0; i < 6; ++i)
+    EXPECT_EQ(i, hash.Find(keywords[i], strlen(keywords[i])));
+  EXPECT_EQ(-1, hash.Find("", 0));
+  EXPECT_EQ(-1, hash.Find("EN", 2));
+  EXPECT_EQ(-1, hash.Find("ENDIFF", 6));
+  EXPECT_EQ(-1, hash.Find("if", 2));
+  EXPECT_EQ(1, hash.Find("ELSEIF", 4));
+  EXPECT_EQ(5, hash.Find(std::string("WAV")));
+}
+
 TEST(RUTIL, IO)
 {
   using namespace rutil;
@@ -246,6 +437,85 @@ TEST(RPARSER, ND_ROW_ITERATOR)
   EXPECT_EQ(iter, rows.end());
 }
 
+TEST(RPARSER, ND_RANGE_SEARCH)
+{
+  Track t;
+  const size_t note_count = 100000;
+  {
+    NoteElement n;
+    for (size_t i = 0; i < note_count; ++i)
+    {
+      // two notes per quarter, with duplicated measure in every 4th note.
+      n.set_measure((i - i / 4) * 0.125);
+      t.AddNoteElement(n);
+    }
+  }
+  ASSERT_TRUE(t.size() > 0);
+
+  auto brute_count = [&t](double a, double b) {
+    size_t cnt = 0;
+    for (auto &n : t) if (n.measure() >= a && n.measure() <= b) cnt++;
+    return cnt;
+  };
+
+  // forward / backward / random seek should return same result as brute-force.
+  const double last = t.back().measure();
+  for (double m = -1.0; m < last + 2.0; m += 37.3)
+    EXPECT_EQ(brute_count(m, m + 2.0), (size_t)(t.end(m + 2.0) - t.begin(m)));
+  for (double m = last + 2.0; m > -1.0; m -= 41.7)
+    EXPECT_EQ(brute_count(m, m + 2.0), (size_t)(t.end(m + 2.0) - t.begin(m)));
+  EXPECT_EQ(0, t.lower_bound_index(-1.0));
+  EXPECT_EQ(t.size(), t.lower_bound_index(last + 1.0));
+  EXPECT_EQ(t.size(), t.upper_bound_index(last));
+  EXPECT_EQ(1, t.upper_bound_index(0.0));
+  // search result doesn't depend on hint.
+  EXPECT_EQ(t.lower_bound_index(100.0), t.lower_bound_index(100.0, t.size()));
+  EXPECT_EQ(t.upper_bound_index(100.0), t.upper_bound_index(100.0, 3));
+}
+
+TEST(RPARSER, ND_WINDOW_CURSOR)
+{
+  TrackData td;
+  const size_t lane_count = 8;
+  const size_t note_count = 20000;
+  td.set_track_count(lane_count);
+  {
+    NoteElement n;
+    for (size_t i = 0; i < note_count; ++i)
+    {
+      // 120 BPM, 16th notes : 2000ms per measure.
+      double m = i * 0.0625;
+      n.set_measure(m);
+      n.set_time(m * 2000.0);
+      td[(i * 7) % lane_count].AddNoteElement(n);
+    }
+  }
+
+  auto brute_count = [&td](double a, double b) {
+    size_t cnt = 0;
+    for (auto it = td.begin(); it != td.end(); ++it)
+      if ((*it).second->time() >= a && (*it).second->time() <= b) cnt++;
+    return cnt;
+  };
+
+  auto cursor = td.GetWindowCursor();
+  const double last = note_count * 0.0625 * 2000.0;
+  for (double t = -3000.0; t < last + 3000.0; t += 39171.0)
+  {
+    cursor.Seek(t - 100.0, t + 2000.0);
+    EXPECT_EQ(brute_count(t - 100.0, t + 2000.0), cursor.size());
+  }
+  for (double t = last + 3000.0; t > -3000.0; t -= 55313.0)
+  {
+    cursor.Seek(t - 100.0, t + 2000.0);
+    EXPECT_EQ(brute_count(t - 100.0, t + 2000.0), cursor.size());
+  }
+  cursor.Seek(1000.0, 1000.0);
+  ASSERT_EQ(1, cursor.size());
+  ASSERT_EQ(1, cursor.size(0));
+  EXPECT_EQ(1000.0, cursor.begin(0)->time());
+}
+
 TEST(RPARSER, TIMINGDATA)
 {
   Chart c;
@@ -479,6 +749,126 @@ TEST(RPARSER, LONGNOTE)
   EXPECT_FALSE(c.HasLongnote());
 }
 
+TEST(RPARSER, TRACK_OVERLAP)
+{
+  // (measure, chain status, value) in position order
+  const struct { double m; NoteChainStatus cs; int v; } objs[] = {
+    { 0.0, NoteChainStatus::Tap, 1 },
+    { 0.0, NoteChainStatus::Tap, 2 },     // replaces previous one
+    { 1.0, NoteChainStatus::Start, 3 },
+    { 1.5, NoteChainStatus::Tap, 4 },     // removed by end of longnote
+    { 2.0, NoteChainStatus::End, 3 },
+    { 3.0, NoteChainStatus::Tap, 5 },
+    { 4.0, NoteChainStatus::Start, 6 },
+    { 5.0, NoteChainStatus::End, 6 },
+    { 6.0, NoteChainStatus::Tap, 7 },
+  };
+  Track added, sorted;
+  added.SetObjectDupliable(false);
+  sorted.SetObjectDupliable(false);
+  NoteElement n;
+  for (auto &o : objs)
+  {
+    n.set_measure(o.m);
+    n.set_chain_status(o.cs);
+    n.set_value(o.v);
+    added.AddNoteElement(n);
+  }
+  // bulk loading out of position order gives the same track.
+  // (objects in the same position are kept in appended order)
+  const size_t count = sizeof(objs) / sizeof(objs[0]);
+  for (size_t i = 0; i < count; ++i)
+  {
+    auto &o = objs[(i + 5) % count];
+    n.set_measure(o.m);
+    n.set_chain_status(o.cs);
+    n.set_value(o.v);
+    sorted.AppendNoteElement(n);
+  }
+  sorted.SortNoteElements();
+
+  const int expected[] = { 2, 3, 3, 5, 6, 6, 7 };
+  ASSERT_EQ(7u, added.size());
+  ASSERT_EQ(7u, sorted.size());
+  for (size_t i = 0; i < 7; ++i)
+  {
+    EXPECT_EQ(expected[i], added.get(i)->get_value_i());
+    EXPECT_EQ(added.get(i)->measure(), sorted.get(i)->measure());
+    EXPECT_EQ(added.get(i)->chain_status(), sorted.get(i)->chain_status());
+  }
+
+  // tapnote inside longnote removes the whole longnote.
+  n.set_measure(4.5);
+  n.set_chain_status(NoteChainStatus::Tap);
+  n.set_value(8);
+  added.AddNoteElement(n);
+  ASSERT_EQ(6u, added.size());
+  EXPECT_EQ(8, added.get(4)->get_value_i());
+  EXPECT_EQ(7, added.get(5)->get_value_i());
+  EXPECT_TRUE(added.HasLongnote());
+}
+
+TEST(RPARSER, TRACK_COW)
+{
+  Chart c;
+  auto &nd = c.GetNoteData();
+  nd.set_track_count(7);
+  NoteElement n;
+  for (unsigned i = 0; i < 1000; ++i)
+  {
+    n.set_measure(i * 0.25);
+    nd[i % 7].AppendNoteElement(n);
+  }
+
+  // copied chart shares note buffer until it is modified.
+  Chart c2(c);
+  auto &nd2 = c2.GetNoteData();
+  const auto &cnd2 = nd2;
+  EXPECT_TRUE(cnd2[0].is_shared());
+  EXPECT_EQ(1000, nd2.GetNoteElementCount());
+  n.set_measure(1000.0);
+  nd2[0].AddNoteElement(n);
+  EXPECT_FALSE(cnd2[0].is_shared());
+  EXPECT_TRUE(cnd2[1].is_shared());
+  EXPECT_EQ(1001, nd2.GetNoteElementCount());
+  EXPECT_EQ(1000, nd.GetNoteElementCount());
+
+  // lane mapping only swaps buffers.
+  effector::EffectorParam param;
+  effector::SetLanefor7Key(param);
+  const size_t track0_size = nd2[0].size();
+  effector::Mirror(c2, param);
+  EXPECT_EQ(track0_size, nd2[6].size());
+  EXPECT_EQ(1000.0, nd2[6].back().measure());
+  EXPECT_EQ(1000, nd.GetNoteElementCount());
+  nd2[6].ClearAll();
+  EXPECT_EQ(143, nd[0].size());
+
+  // reading or modifying nothing keeps buffer shared.
+  Chart c3(c);
+  auto &nd3 = c3.GetNoteData();
+  const auto &cnd3 = nd3;
+  EXPECT_EQ(249.75, cnd3.back()->measure());
+  Note note(&nd3[1]);
+  EXPECT_TRUE(note.SeekByBeat(100.0));
+  EXPECT_EQ(100.0, static_cast<const Note&>(note).get()->measure());
+  nd3[1].ClearRange(500.0, 600.0);
+  nd3[1].RemoveNoteByMeasure(500.0);
+  for (unsigned i = 0; i < 7; ++i)
+    EXPECT_TRUE(cnd3[i].is_shared()) << i;
+  // only the track of returned note is detached.
+  nd3.back()->set_value(1);
+  EXPECT_FALSE(cnd3[5].is_shared());
+  EXPECT_TRUE(cnd3[4].is_shared());
+  EXPECT_TRUE(cnd3[6].is_shared());
+
+  // non-const iteration of empty track doesn't allocate buffer.
+  Track empty;
+  EXPECT_TRUE(empty.begin() == empty.end());
+  Track empty_copy(empty);
+  EXPECT_FALSE(empty_copy.is_shared());
+}
+
 TEST(RPARSER, CHARTLIST)
 {
   Song s;
@@ -506,6 +896,53 @@ TEST(RPARSER, CHARTLIST)
   EXPECT_EQ(c->GetTimingSegmentData().GetMinBpm(), 121);
 }
 
+TEST(RPARSER, METADATA_CHANNEL)
+{
+  // flat channels and overflow channels are iterated in order.
+  ChannelTable<float> t;
+  t[1295] = 3; t[5000] = 4; t[1] = 1; t[36] = 2;
+  EXPECT_EQ(4u, t.size());
+  std::vector<Channel> keys;
+  for (const auto &ii : t) keys.push_back(ii.first);
+  EXPECT_EQ(std::vector<Channel>({ 1, 36, 1295, 5000 }), keys);
+  EXPECT_TRUE(t.exist(5000));
+  EXPECT_FALSE(t.exist(2));
+  EXPECT_EQ(nullptr, t.get(1296));
+  EXPECT_EQ(2.0f, *t.get(36));
+  ChannelTable<float> t2 = t;
+  EXPECT_TRUE(t == t2);
+  t2.erase(36);
+  t2.erase(5000);
+  EXPECT_FALSE(t == t2);
+  EXPECT_EQ(2u, t2.size());
+
+  // filenames of sibling charts are interned in song's pool.
+  const std::string sjis = rutil::ReadFileText(BASE_DIR + "rutil/ENCODING_SHIFTJIS.txt");
+  const std::string bms = "#TITLE " + sjis + "\n#WAV01 kick.wav\n#WAV02 " + sjis +
+    ".wav\n#BMP01 bg.png\n#BPM01 180\n#00111:01\n";
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  ChartLoaderBMS loader(&song);
+  Chart *c1 = song.NewChart();
+  Chart *c2 = song.NewChart();
+  ASSERT_TRUE(loader.Load(*c1, bms.c_str(), (unsigned)bms.size()));
+  ASSERT_TRUE(loader.Load(*c2, bms.c_str(), (unsigned)bms.size()));
+  const auto &fn1 = c1->GetMetaData().GetSoundChannel()->fn;
+  const auto &fn2 = c2->GetMetaData().GetSoundChannel()->fn;
+  EXPECT_EQ(song.GetStringPool(), c1->GetMetaData().GetStringPool());
+  EXPECT_EQ(&fn1.get(1)->str(), &fn2.get(1)->str());
+  EXPECT_EQ(3u, song.GetStringPool()->size());
+  EXPECT_TRUE(fn1 == fn2);
+
+  // encoding conversion interns converted filenames.
+  c1->Update();
+  EXPECT_EQ(std::string(u8"七色ゆえんじ.wav"), *fn1.get(2));
+  EXPECT_EQ(sjis + ".wav", *fn2.get(2));
+  EXPECT_EQ("kick.wav", *fn1.get(1));
+  EXPECT_EQ("bg.png", c1->GetMetaData().GetBGAChannel()->bga.get(1)->fn.str());
+  EXPECT_EQ(4u, song.GetStringPool()->size());
+}
+
 TEST(RPARSER, VOSFILE_V2)
 {
   Song song;
@@ -543,6 +980,928 @@ TEST(RPARSER, VOSFILE_V3)
   }
 }
 
+TEST(RPARSER, MIDIFILE)
+{
+  const uint16_t note_track_count = 15;
+  const unsigned note_per_track = 20000;
+  const std::vector<uint8_t> smf = MakeSyntheticMidi(note_track_count, note_per_track);
+
+  MidiFile midi;
+  ASSERT_TRUE(midi.Parse(smf.data(), smf.size()));
+  EXPECT_EQ(1, midi.format());
+  EXPECT_EQ(480, midi.timedivision());
+  EXPECT_EQ(smf.size(), midi.size());
+  ASSERT_EQ(note_track_count + 1, midi.get_track_count());
+  ASSERT_EQ(2, midi.GetTempoMap().size());
+  EXPECT_EQ(500000, midi.GetTempoMap()[0].usec_per_quarter);
+  EXPECT_EQ(480, midi.GetTempoMap()[1].tick);
+  ASSERT_EQ(1, midi.GetTimeSignatures().size());
+  EXPECT_EQ(3, midi.GetTimeSignatures()[0].numerator);
+  EXPECT_EQ(4, midi.GetTimeSignatures()[0].denominator);
+  {
+    auto &events = midi.get_track(1).events;
+    ASSERT_EQ(note_per_track + 2, events.size());
+    EXPECT_EQ(0xC0, events[0].cmd);
+    EXPECT_EQ(0x05, events[0].a);
+    EXPECT_EQ(0x90, events[2].cmd);
+    EXPECT_EQ(120, events[2].tick);
+    EXPECT_EQ(61, events[2].a);
+    EXPECT_TRUE(events.back().is_meta());
+  }
+
+  TrackData td;
+  td.set_track_count(kTimingTrackMax);
+  midi.FillTimingData(td);
+  ASSERT_EQ(2, td[kBpm].size());
+  EXPECT_DOUBLE_EQ(240.0, td[kBpm].get(1)->get_value_f());
+  EXPECT_DOUBLE_EQ(0.25, td[kBpm].get(1)->measure());
+
+  // 3/4 time signature: 3 beat per measure.
+  EXPECT_DOUBLE_EQ(1.0 / 3, midi.GetMeasure(0.25));
+  EXPECT_DOUBLE_EQ(2.0, midi.GetMeasure(1.5));
+  midi.FillMeasureLength(td);
+  ASSERT_EQ(1, td[kMeasure].size());
+  EXPECT_DOUBLE_EQ(0.0, td[kMeasure].get(0)->measure());
+  EXPECT_DOUBLE_EQ(0.75, td[kMeasure].get(0)->get_value_f());
+
+  // truncated data should fail
+  MidiFile midi_invalid;
+  EXPECT_FALSE(midi_invalid.Parse(smf.data(), smf.size() - 10));
+
+  // parallel decoding should be same with sequential one
+  ASSERT_TRUE(midi.Parse(smf.data(), smf.size()));
+  MidiFile midi_mt;
+  ASSERT_TRUE(midi_mt.Parse(smf.data(), smf.size(), 4));
+  ASSERT_EQ(midi.get_track_count(), midi_mt.get_track_count());
+  for (size_t i = 0; i < midi.get_track_count(); ++i)
+  {
+    auto &e1 = midi.get_track(i).events;
+    auto &e2 = midi_mt.get_track(i).events;
+    ASSERT_EQ(e1.size(), e2.size());
+    for (size_t j = 0; j < e1.size(); ++j)
+    {
+      ASSERT_EQ(e1[j].tick, e2[j].tick);
+      ASSERT_EQ(e1[j].cmd, e2[j].cmd);
+      ASSERT_EQ(e1[j].a, e2[j].a);
+      ASSERT_EQ(e1[j].b, e2[j].b);
+    }
+  }
+}
+
+TEST(RPARSER, BMSON)
+{
+  // lines are placed after notes to check relocation of notes.
+  const std::string bmson = R"({
+  "version": "1.0.0",
+  "info": {
+    "title": "Caf\u00e9 \"\ud83c\udfb5\"", "subartists": ["music:a", "chart:b"],
+    "init_bpm": 120, "resolution": 240, "level": 7, "total": 3.5e2,
+    "unknown": { "x": [1, 2, { "y": null }], "z": true }
+  },
+  "sound_channels": [
+    { "name": "a.wav", "notes": [
+      { "x": 1, "y": 0, "l": 0, "c": false },
+      { "x": 2, "y": 960, "l": 480, "c": false },
+      { "x": 0, "y": 1200, "l": 0, "c": true } ] },
+    { "name": "b.wav", "notes": [ { "x": 10, "y": 2880, "l": 0, "c": false } ] }
+  ],
+  "lines": [ { "y": 0 }, { "y": 720 }, { "y": 1680 } ],
+  "bpm_events": [ { "y": 1680, "bpm": 240.0 } ],
+  "stop_events": [ { "y": 960, "duration": 240 } ],
+  "bga": {
+    "bga_header": [ { "id": 1, "name": "bg.png" } ],
+    "bga_events": [ { "y": 0, "id": 1 } ]
+  }
+})";
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMSON);
+  Chart *c = song.NewChart();
+  ChartLoaderBMSON loader(&song);
+  EXPECT_TRUE(loader.Test(bmson.c_str(), (unsigned)bmson.size()));
+  ASSERT_TRUE(loader.Load(*c, bmson.c_str(), (unsigned)bmson.size()));
+  c->Update();
+
+  auto &md = c->GetMetaData();
+  EXPECT_STREQ(u8"Café \"\U0001F3B5\"", md.title.c_str());
+  EXPECT_STREQ("music:a / chart:b", md.subartist.c_str());
+  EXPECT_EQ(7, md.level);
+  EXPECT_EQ(350, md.gauge_total);
+  EXPECT_STREQ("b.wav", md.GetSoundChannel()->fn[2].c_str());
+  EXPECT_STREQ("bg.png", md.GetBGAChannel()->bga[1].fn.c_str());
+
+  auto &nd = c->GetNoteData();
+  ASSERT_EQ(10, nd.get_track_count());
+  ASSERT_EQ(1, nd[0].size());
+  ASSERT_EQ(2, nd[1].size());
+  ASSERT_EQ(1, nd[9].size());
+  EXPECT_EQ(NoteChainStatus::Start, nd[1].get(0)->chain_status());
+  EXPECT_EQ(NoteChainStatus::End, nd[1].get(1)->chain_status());
+  EXPECT_EQ(2u, nd[9].get(0)->get_value_u());
+
+  // bar lengths from lines: 0.75, 1.0, then default
+  EXPECT_DOUBLE_EQ(1.25, nd[1].get(0)->measure());
+  EXPECT_DOUBLE_EQ(1.75, nd[1].get(1)->measure());
+  EXPECT_DOUBLE_EQ(3.25, nd[9].get(0)->measure());
+
+  // 120 BPM (500ms per 240 pulse), 500ms stop at y=960, 240 BPM from y=1680
+  EXPECT_NEAR(0, nd[0].get(0)->time(), 0.01);
+  EXPECT_NEAR(2500, nd[1].get(0)->time(), 0.01);
+  EXPECT_NEAR(3500, nd[1].get(1)->time(), 0.01);
+  EXPECT_NEAR(3000, c->GetBgmData()[0].get(0)->time(), 0.01);
+  EXPECT_NEAR(5250, nd[9].get(0)->time(), 0.01);
+  EXPECT_EQ(1, c->GetCommandData()[kBgaMain].size());
+
+  // broken JSON should fail
+  EXPECT_FALSE(loader.Load(*c, bmson.c_str(), (unsigned)bmson.size() / 2));
+
+  // timing does not depend on key order, even if "info" is placed last.
+  const std::string bmson_info_first = R"({
+  "info": { "init_bpm": 120, "resolution": 480 },
+  "lines": [ { "y": 0 }, { "y": 1440 } ],
+  "bpm_events": [ { "y": 960, "bpm": 240.0 } ],
+  "sound_channels": [ { "name": "a.wav", "notes": [ { "x": 1, "y": 1920, "l": 960 } ] } ]
+})";
+  const std::string bmson_info_last = R"({
+  "sound_channels": [ { "name": "a.wav", "notes": [ { "x": 1, "y": 1920, "l": 960 } ] } ],
+  "bpm_events": [ { "y": 960, "bpm": 240.0 } ],
+  "lines": [ { "y": 0 }, { "y": 1440 } ],
+  "info": { "init_bpm": 120, "resolution": 480 }
+})";
+  for (const std::string *s : { &bmson_info_first, &bmson_info_last })
+  {
+    ASSERT_TRUE(loader.Load(*c, s->c_str(), (unsigned)s->size()));
+    c->Update();
+    auto &track = c->GetNoteData()[0];
+    ASSERT_EQ(2, track.size());
+    EXPECT_DOUBLE_EQ(1.25, track.get(0)->measure());
+    EXPECT_DOUBLE_EQ(1.75, track.get(1)->measure());
+    EXPECT_NEAR(1500, track.get(0)->time(), 0.01);
+    EXPECT_NEAR(2000, track.get(1)->time(), 0.01);
+    ASSERT_EQ(1, c->GetTimingData()[TimingTrackTypes::kBpm].size());
+    EXPECT_DOUBLE_EQ(2.0 / 3, c->GetTimingData()[TimingTrackTypes::kBpm].get(0)->measure());
+  }
+}
+
+TEST(RPARSER, OSU)
+{
+  const std::string osu =
+    "\xEF\xBB\xBFosu file format v14\r\n"
+    "\r\n"
+    "[General]\r\n"
+    "AudioFilename: audio.mp3\r\n"
+    "Mode: 3\r\n"
+    "\r\n"
+    "[Metadata]\r\n"
+    "Title:Romanized\r\n"
+    "TitleUnicode:Unicode Title\r\n"
+    "Artist:artist\r\n"
+    "Creator:mapper\r\n"
+    "Version:Hard\r\n"
+    "\r\n"
+    "[Difficulty]\r\n"
+    "CircleSize:4\r\n"
+    "\r\n"
+    "[Events]\r\n"
+    "//Background and Video events\r\n"
+    "0,0,\"bg.jpg\",0,0\r\n"
+    "\r\n"
+    "[TimingPoints]\r\n"
+    "1000,500,4,2,0,100,1,0\r\n"
+    "3000,-50,4,2,0,100,0,0\r\n"
+    "5000,250,4,2,0,100,1,0\r\n"
+    "\r\n"
+    "[HitObjects]\r\n"
+    "64,192,1000,1,0,0:0:0:0:\r\n"
+    "448,192,2000,128,0,3000:0:0:0:0:\r\n"
+    "192,192,6000,1,0,0:0:0:0:\r\n";
+
+  Song song;
+  song.SetSongType(SONGTYPE::OSU);
+  Chart *c = song.NewChart();
+  ChartLoaderOSU loader(&song);
+  EXPECT_TRUE(loader.Test(osu.c_str(), (unsigned)osu.size()));
+  ASSERT_TRUE(loader.Load(*c, osu.c_str(), (unsigned)osu.size()));
+  c->Update();
+
+  auto &md = c->GetMetaData();
+  EXPECT_STREQ("Unicode Title", md.title.c_str());
+  EXPECT_STREQ("Hard", md.charttype.c_str());
+  EXPECT_STREQ("mapper", md.chartmaker.c_str());
+  EXPECT_STREQ("audio.mp3", md.background_music.c_str());
+  EXPECT_STREQ("bg.jpg", md.back_image.c_str());
+  EXPECT_DOUBLE_EQ(120, md.bpm);
+
+  // inherited timing point is ignored; 240 BPM from 5000ms (beat 10)
+  auto &nd = c->GetNoteData();
+  ASSERT_EQ(4, nd.get_track_count());
+  ASSERT_EQ(1, nd[0].size());
+  ASSERT_EQ(1, nd[1].size());
+  ASSERT_EQ(2, nd[3].size());
+  EXPECT_EQ(1, c->GetTimingData()[kBpm].size());
+  EXPECT_DOUBLE_EQ(3.5, nd[1].get(0)->measure());
+  EXPECT_NEAR(1000, nd[0].get(0)->time(), 0.01);
+  EXPECT_NEAR(2000, nd[3].get(0)->time(), 0.01);
+  EXPECT_NEAR(3000, nd[3].get(1)->time(), 0.01);
+  EXPECT_NEAR(6000, nd[1].get(0)->time(), 0.01);
+  EXPECT_EQ(NoteChainStatus::End, nd[3].get(1)->chain_status());
+
+  // header only
+  loader.SetHeaderOnly();
+  ASSERT_TRUE(loader.Load(*c, osu.c_str(), (unsigned)osu.size()));
+  c->GetMetaData().SetMetaFromAttribute();
+  EXPECT_STREQ("Unicode Title", c->GetMetaData().title.c_str());
+  EXPECT_EQ(0, c->GetNoteData().GetNoteCount());
+
+  EXPECT_FALSE(loader.Test("[General]", 9));
+}
+
+TEST(RPARSER, SM)
+{
+  const std::string sm =
+    "#TITLE:Test Song;\n"
+    "#ARTIST:rparser;\n"
+    "#MUSIC:song.ogg;\n"
+    "#OFFSET:-0.100;\n"
+    "#BPMS:0.000=120.000,8.000=240.000;\n"
+    "#STOPS:4.000=0.500;\n"
+    "//--------------- dance-single - Hard ----------------\n"
+    "#NOTES:\n"
+    "     dance-single:\n"
+    "     mapper:\n"
+    "     Hard:\n"
+    "     9:\n"
+    "     0.1,0.2,0.3,0.4,0.5:\n"
+    "1000\n0000\n0200\n0000\n"
+    ",  // measure 1\n"
+    "0000\n0300\n0000\n0001\n"
+    ";\n"
+    "#NOTES:\n"
+    "     dance-double:\n"
+    "     :\n"
+    "     Easy:\n"
+    "     3:\n"
+    "     0,0,0,0,0:\n"
+    "10000000\n00000001\n"
+    ";\n";
+
+  Song song;
+  song.SetSongType(SONGTYPE::SM);
+  Chart *c = song.NewChart();
+  ChartLoaderSM loader(&song);
+  EXPECT_TRUE(loader.Test(sm.c_str(), (unsigned)sm.size()));
+  ASSERT_TRUE(loader.Load(*c, sm.c_str(), (unsigned)sm.size()));
+  ASSERT_EQ(2, song.GetChartCount());
+  Chart *c2 = song.GetChart(1);
+
+  // timing is shared and updated only once.
+  EXPECT_EQ(&c->GetTimingData(), &c2->GetTimingData());
+  EXPECT_EQ(&c->GetTimingSegmentData(), &c2->GetTimingSegmentData());
+  c->Update();
+  const size_t segment_count = c->GetTimingSegmentData().GetTimingSegments().size();
+  c2->Update();
+  EXPECT_EQ(segment_count, c2->GetTimingSegmentData().GetTimingSegments().size());
+  EXPECT_EQ(240, c->GetTimingSegmentData().GetMaxBpm());
+
+  auto &md = c->GetMetaData();
+  EXPECT_STREQ("Test Song", md.title.c_str());
+  EXPECT_STREQ("song.ogg", md.background_music.c_str());
+  EXPECT_STREQ("dance-single", md.charttype.c_str());
+  EXPECT_EQ(4, md.difficulty);
+  EXPECT_EQ(9, md.level);
+  EXPECT_STREQ("Test Song", c2->GetMetaData().title.c_str());
+  EXPECT_EQ(3, c2->GetMetaData().level);
+
+  // 500ms per beat, 500ms stop at beat 4
+  auto &nd = c->GetNoteData();
+  ASSERT_EQ(4, nd.get_track_count());
+  ASSERT_EQ(2, nd[1].size());
+  EXPECT_NEAR(0, nd[0].get(0)->time(), 0.01);
+  EXPECT_NEAR(1000, nd[1].get(0)->time(), 0.01);
+  EXPECT_NEAR(3000, nd[1].get(1)->time(), 0.01);
+  EXPECT_NEAR(4000, nd[3].get(0)->time(), 0.01);
+  EXPECT_EQ(NoteChainStatus::End, nd[1].get(1)->chain_status());
+
+  auto &nd2 = c2->GetNoteData();
+  ASSERT_EQ(8, nd2.get_track_count());
+  ASSERT_EQ(1, nd2[7].size());
+  EXPECT_NEAR(1000, nd2[7].get(0)->time(), 0.01);
+
+  // reloading should not accumulate shared timing.
+  song.Close();
+  song.SetSongType(SONGTYPE::SM);
+  c = song.NewChart();
+  ASSERT_TRUE(loader.Load(*c, sm.c_str(), (unsigned)sm.size()));
+  c->Update();
+  EXPECT_EQ(segment_count, c->GetTimingSegmentData().GetTimingSegments().size());
+}
+
+TEST(RPARSER, DTX)
+{
+  const std::string dtx =
+    "; Created by DTXCreator\n"
+    "#TITLE: Test DTX\n"
+    "#ARTIST: rparser\n"
+    "#DLEVEL: 55\n"
+    "#BPM: 120\n"
+    "#WAV01: hh.wav\n"
+    "#WAV02: sd.wav\n"
+    "#BMP01: bg.png\n"
+    "#00001: 01\n"
+    "#00104: 01\n"
+    "#00111: 01000100\n"
+    "#00112: 0002\n"
+    "#0011A: 02\n"
+    "#00133: 0001\n"
+    "#00161: 01\n"
+    "#00203: F0\n"
+    "#00211: 0001\n"
+    "#00220: 01\n";
+
+  Song song;
+  song.SetSongType(SONGTYPE::DTX);
+  Chart *c = song.NewChart();
+  ChartLoaderDTX loader(&song);
+  EXPECT_TRUE(loader.Test(dtx.c_str(), (unsigned)dtx.size()));
+  ASSERT_TRUE(loader.Load(*c, dtx.c_str(), (unsigned)dtx.size()));
+  c->Update();
+
+  auto &md = c->GetMetaData();
+  EXPECT_STREQ("Test DTX", md.title.c_str());
+  EXPECT_EQ(55, md.level);
+  EXPECT_STREQ("sd.wav", md.GetSoundChannel()->fn[2].c_str());
+
+  auto &nd = c->GetNoteData();
+  ASSERT_EQ(12, nd.get_track_count());
+  ASSERT_EQ(3, nd[0].size());
+  EXPECT_NEAR(2000, nd[0].get(0)->time(), 0.01);
+  EXPECT_NEAR(3000, nd[0].get(1)->time(), 0.01);
+  // BPM 240 (hex F0) from measure 2
+  EXPECT_NEAR(4500, nd[0].get(2)->time(), 0.01);
+  ASSERT_EQ(1, nd[1].size());
+  EXPECT_NEAR(3000, nd[1].get(0)->time(), 0.01);
+  ASSERT_EQ(1, nd[9].size());
+  EXPECT_EQ(2, nd[9].get(0)->get_value_u());
+  ASSERT_EQ(1, nd[2].size());
+  // guitar chips are not loaded.
+  EXPECT_EQ(6, nd.GetNoteCount());
+  EXPECT_EQ(2, c->GetBgmData().GetNoteCount());
+  EXPECT_EQ(1, c->GetCommandData()[CommandTrackTypes::kBgaMain].size());
+}
+
+TEST(RPARSER, BMS_DIAGNOSTICS)
+{
+  const std::string bms =
+    "#TITLE diagnostics\n"
+    "% comment\n"
+    "\n"
+    "#ARTIST\n"
+    "#00111:0A0\n"
+    "#RANDOM 2\n"
+    "#IF 1\n"
+    "#ELSE\n"
+    "#IF 2\n"
+    "#ENDIF\n"
+    "#ENDIF\n"
+    "#ENDRANDOM\n";
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+
+  // no sink attached: nothing reported.
+  {
+    ChartLoaderBMS loader(&song);
+    loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+  }
+
+  Diagnostics diag(4);
+  unsigned callback_count = 0;
+  diag.SetCallback([&](const Diagnostics&, const DiagnosticEntry&) { callback_count++; });
+  diag.SetFile("diagnostics.bms");
+  song.SetDiagnostics(&diag);
+  ChartLoaderBMS loader(&song);
+  loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+
+  EXPECT_EQ(5u, diag.GetTotalCount());
+  EXPECT_EQ(5u, callback_count);
+  EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kBmsPercentLine));
+  EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kBmsNoValue));
+  EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kBmsOddObjectLength));
+  EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kBmsIfAfterElse));
+  EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kBmsEndIfWithoutIf));
+
+  // ring buffer keeps latest 4 entries, from the oldest one.
+  // (object / meta lines are reported when parsing buffer is flushed)
+  ASSERT_EQ(4u, diag.size());
+  EXPECT_EQ(DiagnosticCodes::kBmsIfAfterElse, diag.get(0).code);
+  EXPECT_EQ(9u, diag.get(0).line);
+  EXPECT_EQ(DiagnosticCodes::kBmsEndIfWithoutIf, diag.get(1).code);
+  EXPECT_EQ(11u, diag.get(1).line);
+  EXPECT_EQ(DiagnosticCodes::kBmsNoValue, diag.get(2).code);
+  EXPECT_EQ(4u, diag.get(2).line);
+  EXPECT_EQ(DiagnosticCodes::kBmsOddObjectLength, diag.get(3).code);
+  EXPECT_EQ(5u, diag.get(3).line);
+  EXPECT_EQ(DiagnosticSeverity::kWarning, diag.get(3).severity);
+  EXPECT_STREQ("diagnostics.bms", diag.GetFilename(diag.get(3)).c_str());
+
+  const std::string json = diag.toJSON();
+  EXPECT_NE(std::string::npos, json.find("\"total\":5"));
+  EXPECT_NE(std::string::npos, json.find("\"kBmsPercentLine\":1"));
+  EXPECT_NE(std::string::npos, json.find(
+    "{\"file\":\"diagnostics.bms\",\"line\":5,\"code\":\"kBmsOddObjectLength\",\"severity\":\"warning\"}"));
+
+  // invalid #STP and invalid chart of other loaders are also reported.
+  Diagnostics diag2;
+  song.SetDiagnostics(&diag2);
+  const std::string bms_stp = "#STP 001.500\n#STP 002.000 100\n";
+  ChartLoaderBMS loader_stp(&song);
+  loader_stp.Load(*c, bms_stp.c_str(), (unsigned)bms_stp.size());
+  EXPECT_EQ(1u, diag2.GetCount(DiagnosticCodes::kBmsInvalidStp));
+  EXPECT_EQ(1u, diag2.get(0).line);
+  EXPECT_EQ(1u, c->GetMetaData().GetSTOPChannel()->STP.size());
+  const std::string bmson = "[1, 2]";
+  ChartLoaderBMSON loader_bmson(&song);
+  EXPECT_FALSE(loader_bmson.Load(*c, bmson.c_str(), (unsigned)bmson.size()));
+  EXPECT_EQ(1u, diag2.GetCount(DiagnosticCodes::kBmsonInvalidJson));
+  EXPECT_EQ(2u, diag2.GetTotalCount());
+}
+
+TEST(RPARSER, BMS_COLON_HEADER)
+{
+  // header with colon separator (DTX style) is metadata,
+  // only #mmmcc form is object line.
+  const std::string bms =
+    "#TITLE: colon title\n"
+    "#WAV01:  a.wav\n"
+    "#BPM01: 150\n"
+    "#00111:01\n"
+    "#00103:00\n"
+    "#00108:01\n";
+
+  Diagnostics diag;
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  song.SetDiagnostics(&diag);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+
+  const auto &md = c->GetMetaData();
+  EXPECT_EQ("colon title", md.GetAttribute<std::string>("TITLE"));
+  ASSERT_TRUE(md.GetSoundChannel()->fn.exist(1));
+  EXPECT_EQ("a.wav", md.GetSoundChannel()->fn.get(1)->str());
+  float bpm = 0;
+  EXPECT_TRUE(md.GetBPMChannel()->GetBpm(1, bpm));
+  EXPECT_EQ(150.0f, bpm);
+  EXPECT_EQ(1u, c->GetNoteData()[0].size());
+  EXPECT_EQ(1u, c->GetTimingData()[TimingTrackTypes::kBmsBpm].size());
+  EXPECT_EQ(0u, diag.GetTotalCount());
+}
+
+TEST(RPARSER, BMS_RANDOM_VARIANTS)
+{
+  // common part: 4 notes, 1st block: 1 ~ 2 notes, 2nd block: 1 ~ 3 notes.
+  const std::string bms =
+    "#TITLE random\n#BPM 120\n"
+    "#00111:01010101\n"
+    "#RANDOM 2\n"
+    "#IF 1\n#00112:01\n#ENDIF\n"
+    "#IF 2\n#00112:0101\n#ENDIF\n"
+    "#ENDRANDOM\n"
+    "#RANDOM 3\n"
+    "#IF 1\n#00213:01\n"
+    "#ELSEIF 2\n#00213:0101\n"
+    "#ELSE\n#00213:010101\n#ENDIF\n"
+    "#ENDRANDOM\n";
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  ASSERT_TRUE(loader.PrepareVariants(bms.c_str(), (unsigned)bms.size()));
+  ASSERT_EQ(2u, loader.GetRandomRanges().size());
+  EXPECT_EQ(6u, loader.GetVariantCount());
+
+  std::vector<int> values(loader.GetRandomRanges().size(), 1);
+  unsigned variant_count = 0;
+  do {
+    loader.LoadVariant(*c, values);
+    EXPECT_EQ(4 + values[0] + values[1], (int)c->GetNoteData().GetNoteCount());
+    variant_count++;
+  } while (loader.NextVariant(values));
+  EXPECT_EQ(6u, variant_count);
+
+  // sampled variant is same to the chart loaded by seed.
+  loader.SetSeed(10);
+  loader.PrepareVariants(bms.c_str(), (unsigned)bms.size());
+  for (unsigned i = 0; i < 8; ++i)
+  {
+    loader.SampleVariant(values);
+    ASSERT_EQ(2u, values.size());
+    EXPECT_TRUE(values[0] >= 1 && values[0] <= 2);
+    EXPECT_TRUE(values[1] >= 1 && values[1] <= 3);
+  }
+  Chart c_seed;
+  loader.Load(c_seed, bms.c_str(), (unsigned)bms.size());
+  rutil::Random r;
+  r.SetSeed(10);
+  values[0] = r.Next(1, 2);
+  values[1] = r.Next(1, 3);
+  loader.LoadVariant(*c, values);
+  EXPECT_EQ(c_seed.GetNoteData().GetNoteCount(), c->GetNoteData().GetNoteCount());
+  EXPECT_EQ(c_seed.GetHash(), c->GetHash());
+
+  // #SETRANDOM is constant, and nested #RANDOM is counted only if reachable.
+  // 1st block: (1, nested 1 ~ 3) or 2, 2nd block: 1 ~ 2 -> 8 variants
+  const std::string bms_nested =
+    "#TITLE nested\n#BPM 120\n#LNTYPE 1\n"
+    "#00151:0100\n#00101:01\n"
+    "#SETRANDOM 2\n#IF 2\n#00112:01\n#ENDIF\n#IF 1\n#00112:0101\n#ENDIF\n#ENDRANDOM\n"
+    "#RANDOM 2\n"
+    "#IF 1\n#00101:0202\n#RANDOM 3\n#IF 2\n#00113:01\n#ENDIF\n#ENDRANDOM\n"
+    "#ELSE\n#00151:0001\n#ENDIF\n"
+    "#ENDRANDOM\n"
+    "#RANDOM 2\n#IF 2\n#00201:03\n#ENDIF\n#ENDRANDOM\n"
+    "#00251:01\n#00114:01\n";
+  auto is_same_track = [](const TrackData &a, const TrackData &b) {
+    if (a.get_track_count() != b.get_track_count()) return false;
+    for (size_t i = 0; i < a.get_track_count(); ++i)
+    {
+      if (a[i].size() != b[i].size()) return false;
+      for (size_t j = 0; j < a[i].size(); ++j)
+      {
+        const NoteElement &n1 = *a[i].get(j), &n2 = *b[i].get(j);
+        if (!(n1 == n2) || n1.get_value_i() != n2.get_value_i() ||
+            n1.chain_status() != n2.chain_status())
+          return false;
+      }
+    }
+    return true;
+  };
+  loader.SetSeed(0);
+  ASSERT_TRUE(loader.PrepareVariants(bms_nested.c_str(), (unsigned)bms_nested.size()));
+  ASSERT_EQ(3u, loader.GetRandomRanges().size());
+  EXPECT_EQ(8u, loader.GetVariantCount());
+  values.assign(3, 1);
+  variant_count = 0;
+  do {
+    loader.LoadVariant(*c, values);
+    // value of nested #RANDOM is kept to 1 when it's not reachable.
+    if (values[0] == 2) { EXPECT_EQ(1, values[1]); }
+    variant_count++;
+  } while (loader.NextVariant(values));
+  EXPECT_EQ(8u, variant_count);
+
+  // variant only shares tracks not written by #IF clauses,
+  // and is the same as chart loaded by seed.
+  for (int seed = 0; seed < 16; ++seed)
+  {
+    loader.SetSeed(seed);
+    loader.Load(c_seed, bms_nested.c_str(), (unsigned)bms_nested.size());
+    loader.PrepareVariants(bms_nested.c_str(), (unsigned)bms_nested.size());
+    loader.SampleVariant(values);
+    loader.LoadVariant(*c, values);
+    EXPECT_EQ(values[0] == 1 ? 2u : 3u, c->GetNoteData()[0].size());
+    EXPECT_TRUE(is_same_track(c_seed.GetNoteData(), c->GetNoteData()));
+    EXPECT_TRUE(is_same_track(c_seed.GetBgmData(), c->GetBgmData()));
+    EXPECT_TRUE(is_same_track(c_seed.GetTimingData(), c->GetTimingData()));
+    const TrackData &nd = c->GetNoteData();
+    EXPECT_TRUE(nd[3].is_shared());
+    EXPECT_EQ(values[0] == 1, nd[0].is_shared());
+  }
+}
+
+static void PutLE(std::string &s, uint32_t v, unsigned bytes)
+{
+  for (unsigned i = 0; i < bytes; ++i)
+    s.push_back((char)((v >> (i * 8)) & 0xFF));
+}
+
+static void PutFloat(std::string &s, float f)
+{
+  uint32_t v;
+  memcpy(&v, &f, 4);
+  PutLE(s, v, 4);
+}
+
+static void PutFixedString(std::string &s, const char* str, size_t len)
+{
+  std::string v(str);
+  v.resize(len, '\0');
+  s += v;
+}
+
+static void ExpectSameTrackData(const TrackData &a, const TrackData &b)
+{
+  ASSERT_EQ(a.get_track_count(), b.get_track_count());
+  for (unsigned i = 0; i < a.get_track_count(); ++i)
+  {
+    ASSERT_EQ(a[i].size(), b[i].size()) << "track " << i;
+    auto it_b = b[i].begin();
+    for (auto it_a = a[i].begin(); it_a != a[i].end(); ++it_a, ++it_b)
+    {
+      EXPECT_NEAR(it_a->measure(), it_b->measure(), 1e-9);
+      EXPECT_EQ(it_a->get_value_u(), it_b->get_value_u());
+      EXPECT_EQ(it_a->chain_status(), it_b->chain_status());
+    }
+  }
+}
+
+static void ExpectBmsRoundTrip(Chart &c)
+{
+  ChartWriterBMS writer;
+  const std::string bms = writer.Serialize(c);
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c2 = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  loader.Load(*c2, bms.c_str(), (unsigned)bms.size());
+
+  const auto &md = c.GetMetaData(), &md2 = c2->GetMetaData();
+  EXPECT_EQ(md.title, md2.title);
+  EXPECT_EQ(md.artist, md2.artist);
+  EXPECT_EQ(md.bpm, md2.bpm);
+  EXPECT_EQ(md.bms_longnote_object, md2.bms_longnote_object);
+  EXPECT_TRUE(md.GetSoundChannel()->fn == md2.GetSoundChannel()->fn);
+  EXPECT_EQ(md.GetBPMChannel()->bpm.size(), md2.GetBPMChannel()->bpm.size());
+  ExpectSameTrackData(c.GetNoteData(), c2->GetNoteData());
+  ExpectSameTrackData(c.GetTimingData(), c2->GetTimingData());
+  ExpectSameTrackData(c.GetCommandData(), c2->GetCommandData());
+
+  // bgm lanes are compacted per measure, so compare objects only.
+  std::vector<std::pair<double, unsigned> > bgm, bgm2;
+  for (auto it = c.GetBgmData().begin(); it != c.GetBgmData().end(); ++it)
+    bgm.emplace_back(it.get()->measure(), it.get()->get_value_u());
+  for (auto it = c2->GetBgmData().begin(); it != c2->GetBgmData().end(); ++it)
+    bgm2.emplace_back(it.get()->measure(), it.get()->get_value_u());
+  std::sort(bgm.begin(), bgm.end());
+  std::sort(bgm2.begin(), bgm2.end());
+  EXPECT_TRUE(bgm == bgm2);
+
+  // written again without any change.
+  EXPECT_TRUE(bms == writer.Serialize(*c2));
+}
+
+TEST(RPARSER, BMS_WRITER)
+{
+  // synthetic chart: triplets, longnote (LNOBJ / LN channel),
+  // measure length, bpm not representable in hex channel.
+  const std::string bms =
+    "#TITLE writer\n"
+    "#ARTIST test\n"
+    "#BPM 130\n"
+    "#RANK 2\n"
+    "#LNOBJ ZZ\n"
+    "#WAV01 a.wav\n#WAV0Z b.wav\nwav_not_header\n"
+    "#BPM01 300.5\n"
+    "#00102:0.75\n"
+    "#00111:01000000000000000Z000000\n"
+    "#00112:0001\n"
+    "#00113:01ZZ\n"
+    "#00151:0000010000000100\n"
+    "#00101:0101\n"
+    "#00101:00000001\n"
+    "#00108:0001\n"
+    "#00203:00FF\n"
+    "#00204:01\n";
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  Chart *c = song.NewChart();
+  ChartLoaderBMS loader(&song);
+  loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+
+  ChartWriterBMS writer;
+  const std::string &out = writer.Serialize(*c);
+  // minimal denominator per line
+  EXPECT_NE(std::string::npos, out.find("#00111:01000Z\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#00112:0001\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#00151:00010001\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#00113:01ZZ\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#00102:0.75\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#00203:00FF\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#LNOBJ ZZ\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#BPM01 300.5\r\n"));
+  EXPECT_NE(std::string::npos, out.find("#RANK 2\r\n"));
+  ExpectBmsRoundTrip(*c);
+
+  // notes without row position / bpm out of hex range
+  Chart c2;
+  c2.GetNoteData().set_track_count(8);
+  NoteElement n;
+  n.set_measure(2.0 + 1.0 / 3);
+  n.set_value(5);
+  c2.GetNoteData()[7].AddNoteElement(n);
+  n.set_measure(0.5);
+  n.set_value(155.5);
+  c2.GetTimingData()[TimingTrackTypes::kBpm].AddNoteElement(n);
+  const std::string &out2 = writer.Serialize(c2);
+  EXPECT_NE(std::string::npos, out2.find("#00216:000500\r\n"));
+  EXPECT_NE(std::string::npos, out2.find("#BPM01 155.5\r\n"));
+  EXPECT_NE(std::string::npos, out2.find("#00008:0001\r\n"));
+
+  // row positions exceeding line length limit are quantized,
+  // and object quantized into occupied slot is spilled to another line.
+  Diagnostics diag;
+  Song song3;
+  song3.SetSongType(SONGTYPE::BMS);
+  song3.SetDiagnostics(&diag);
+  Chart *c3 = song3.NewChart();
+  c3->GetNoteData().set_track_count(8);
+  n.SetRowPos(0, RowPos{ 1, 16381 });
+  n.set_value(1);
+  c3->GetNoteData()[0].AddNoteElement(n);
+  n.SetRowPos(0, RowPos{ 1, 16383 });
+  n.set_value(2);
+  c3->GetNoteData()[0].AddNoteElement(n);
+  const std::string out3 = writer.Serialize(*c3);
+  EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kBmsWriteQuantized));
+  const size_t line1 = out3.find("#00011:");
+  ASSERT_NE(std::string::npos, line1);
+  EXPECT_NE(std::string::npos, out3.find("#00011:", line1 + 1));
+
+  Song song4;
+  song4.SetSongType(SONGTYPE::BMS);
+  Chart *c4 = song4.NewChart();
+  ChartLoaderBMS loader4(&song4);
+  loader4.Load(*c4, out3.c_str(), (unsigned)out3.size());
+  EXPECT_EQ(2u, c4->GetNoteData()[0].size());
+}
+
+TEST(RPARSER, BMS_WRITER_ROUNDTRIP)
+{
+  const char *files[] = {
+    "chart_sample_bms/l-for-nanasi.bms",
+    "chart_sample_bms/L9^.bme",
+    "chart_sample_bms/allnightmokugyo.bms",
+  };
+  for (const char *f : files)
+  {
+    SCOPED_TRACE(f);
+    Song song;
+    ASSERT_TRUE(song.Open(BASE_DIR + f));
+    Chart *c = song.GetChart(0);
+    ASSERT_TRUE(c);
+    ExpectBmsRoundTrip(*c);
+    song.Close();
+  }
+
+  // chart is written into directory of the song.
+  Song song;
+  ASSERT_TRUE(song.Open(BASE_DIR + "chart_sample_bms/"));
+  ASSERT_LT(0u, song.GetChartCount());
+  Chart *c = song.GetChart(0);
+  std::unique_ptr<ChartWriter> writer(CreateChartWriter(SONGTYPE::BMS));
+  ASSERT_TRUE(writer->WriteChart(c));
+  const char *p;
+  size_t len;
+  ASSERT_TRUE(song.GetDirectory()->GetFile(c->GetFilename(), &p, len));
+  ChartWriterBMS bms_writer;
+  EXPECT_TRUE(bms_writer.Serialize(*c) == std::string(p, len));
+  song.Close();
+}
+
+TEST(RPARSER, OJN)
+{
+  // note packages: (measure, channel, events[value, vol/pan, type])
+  std::string ex, nx;
+  PutLE(ex, 0, 4); PutLE(ex, 2, 2); PutLE(ex, 4, 2);
+  PutLE(ex, 1, 2); PutLE(ex, 0, 1); PutLE(ex, 0, 1);
+  PutLE(ex, 0, 4);
+  PutLE(ex, 2, 2); PutLE(ex, 0, 1); PutLE(ex, 4, 1);   // sample 1001
+  PutLE(ex, 0, 4);
+  PutLE(ex, 1, 4); PutLE(ex, 1, 2); PutLE(ex, 1, 2);   // BPM 240
+  PutFloat(ex, 240.0f);
+  PutLE(ex, 1, 4); PutLE(ex, 3, 2); PutLE(ex, 2, 2);   // longnote
+  PutLE(ex, 1, 2); PutLE(ex, 0, 1); PutLE(ex, 2, 1);
+  PutLE(ex, 1, 2); PutLE(ex, 0, 1); PutLE(ex, 3, 1);
+  PutLE(ex, 0, 4); PutLE(ex, 11, 2); PutLE(ex, 1, 2);  // auto-play
+  PutLE(ex, 3, 2); PutLE(ex, 0, 1); PutLE(ex, 0, 1);
+  PutLE(nx, 0, 4); PutLE(nx, 8, 2); PutLE(nx, 1, 2);
+  PutLE(nx, 1, 2); PutLE(nx, 0, 1); PutLE(nx, 0, 1);
+
+  auto make_ojn = [](const std::string &ex, const std::string &nx) {
+    std::string ojn;
+    PutLE(ojn, 100, 4);
+    ojn.append("ojn\0", 4);
+    PutFloat(ojn, 2.9f);
+    PutLE(ojn, 3, 4);                                     // genre
+    PutFloat(ojn, 120.0f);
+    PutLE(ojn, 10, 2); PutLE(ojn, 20, 2); PutLE(ojn, 30, 2); PutLE(ojn, 0, 2);
+    ojn.resize(108, '\0');
+    PutFixedString(ojn, "Test OJN", 64);
+    PutFixedString(ojn, "rparser", 32);
+    PutFixedString(ojn, "noter", 32);
+    PutFixedString(ojn, "o2ma100.ojm", 32);
+    PutLE(ojn, 0, 4);                                     // cover size
+    ojn.resize(284, '\0');
+    PutLE(ojn, 300, 4);
+    PutLE(ojn, 300 + (uint32_t)ex.size(), 4);
+    PutLE(ojn, 300 + (uint32_t)(ex.size() + nx.size()), 4);
+    PutLE(ojn, 300 + (uint32_t)(ex.size() + nx.size()), 4);
+    return ojn + ex + nx;
+  };
+  const std::string ojn = make_ojn(ex, nx);
+
+  // invalid note data: chart of the difficulty is not added,
+  // and no chart is left if EX is invalid.
+  {
+    std::string bad;
+    PutLE(bad, 0, 4); PutLE(bad, 2, 2); PutLE(bad, 100, 2);
+    Diagnostics diag;
+    Song song;
+    song.SetSongType(SONGTYPE::OJM);
+    song.SetDiagnostics(&diag);
+    ChartLoaderOJN loader(&song);
+    const std::string ojn_bad_nx = make_ojn(ex, bad);
+    EXPECT_TRUE(loader.Load(*song.NewChart(), ojn_bad_nx.c_str(), (unsigned)ojn_bad_nx.size()));
+    EXPECT_EQ(2, song.GetChartCount());
+    EXPECT_EQ(30, song.GetChart(1)->GetMetaData().level);
+    EXPECT_EQ(1u, diag.GetCount(DiagnosticCodes::kOjnInvalidNoteData));
+    song.Close();
+    const std::string ojn_bad_ex = make_ojn(bad, nx);
+    EXPECT_FALSE(loader.Load(*song.NewChart(), ojn_bad_ex.c_str(), (unsigned)ojn_bad_ex.size()));
+    EXPECT_EQ(1, song.GetChartCount());
+    EXPECT_EQ(2u, diag.GetCount(DiagnosticCodes::kOjnInvalidNoteData));
+  }
+
+  // M30 sample container with "nami" XOR encryption
+  const std::string sample_key("OggS-keysound"), sample_bgm("OggS-bgm");
+  std::string ojm;
+  ojm.append("M30\0", 4);
+  PutLE(ojm, 0, 4); PutLE(ojm, 16, 4); PutLE(ojm, 2, 4);
+  PutLE(ojm, 28, 4); PutLE(ojm, 0, 4); PutLE(ojm, 0, 4);
+  auto put_sample = [&](const std::string &data, uint16_t codec, uint16_t ref) {
+    PutFixedString(ojm, "sample", 32);
+    PutLE(ojm, (uint32_t)data.size(), 4);
+    PutLE(ojm, codec, 2); PutLE(ojm, 0, 2); PutLE(ojm, 0, 4);
+    PutLE(ojm, ref, 2); PutLE(ojm, 0, 2); PutLE(ojm, 0, 4);
+    std::string enc = data;
+    for (size_t i = 0; i + 3 < enc.size(); i += 4)
+      for (size_t j = 0; j < 4; ++j) enc[i + j] ^= "nami"[j];
+    ojm += enc;
+  };
+  put_sample(sample_key, 5, 0);
+  put_sample(sample_bgm, 0, 1);
+
+  TempDirectory tmpdir("ojn_synthetic_");
+  const std::string &dirpath = tmpdir.path();
+  ASSERT_FALSE(dirpath.empty());
+  {
+    std::ofstream f(dirpath + "/o2ma100.ojn", std::ios::binary);
+    f.write(ojn.c_str(), ojn.size());
+    std::ofstream f2(dirpath + "/o2ma100.ojm", std::ios::binary);
+    f2.write(ojm.c_str(), ojm.size());
+  }
+
+  Song song;
+  ASSERT_TRUE(song.Open(dirpath));
+  ASSERT_EQ(SONGTYPE::OJM, song.GetSongType());
+  ASSERT_EQ(3, song.GetChartCount());
+  Chart *c = song.GetChart(0);
+  c->Update();
+  auto &md = c->GetMetaData();
+  EXPECT_STREQ("Test OJN", md.title.c_str());
+  EXPECT_STREQ("Techno", md.genre.c_str());
+  EXPECT_EQ(10, md.level);
+  EXPECT_EQ(30, song.GetChart(2)->GetMetaData().level);
+  EXPECT_STREQ("o2ma100.ojm|1001.ogg", md.GetSoundChannel()->fn[1001].c_str());
+
+  auto &nd = c->GetNoteData();
+  ASSERT_EQ(2, nd[0].size());
+  EXPECT_NEAR(0, nd[0].get(0)->time(), 0.01);
+  EXPECT_NEAR(1000, nd[0].get(1)->time(), 0.01);
+  EXPECT_EQ(1001, nd[0].get(1)->get_value_u());
+  ASSERT_EQ(2, nd[1].size());
+  EXPECT_EQ(NoteChainStatus::Start, nd[1].get(0)->chain_status());
+  EXPECT_NEAR(2000, nd[1].get(0)->time(), 0.01);
+  EXPECT_NEAR(2500, nd[1].get(1)->time(), 0.01);
+  EXPECT_EQ(1, c->GetBgmData()[2].size());
+  EXPECT_EQ(1, song.GetChart(1)->GetNoteData()[6].size());
+  EXPECT_EQ(0, song.GetChart(2)->GetNoteData().GetNoteCount());
+  song.Close();
+
+  // samples are decoded only when accessed.
+  const std::string ojmpath = dirpath + "/o2ma100.ojm";
+  ASSERT_TRUE(DirectoryManager::OpenDirectory(ojmpath));
+  auto dir = DirectoryManager::GetDirectory(ojmpath);
+  ASSERT_TRUE(dir);
+  ASSERT_EQ(2, dir->count());
+  for (auto *f : *dir)
+    EXPECT_EQ(nullptr, f->p);
+  const char *p;
+  size_t len;
+  ASSERT_TRUE(dir->GetFile("1001.wav", &p, len));  // found by sample id
+  EXPECT_EQ(sample_bgm, std::string(p, len));
+  EXPECT_EQ(nullptr, (*dir->begin())->p);
+  ASSERT_TRUE(dir->GetFile("0.ogg", &p, len));
+  EXPECT_EQ(sample_key, std::string(p, len));
+  dir.reset();
+  DirectoryManager::CloseDirectory(ojmpath);
+}
+
 TEST(RPARSER, BMSARCHIVE)
 {
   Song song;
@@ -596,6 +1955,66 @@ TEST(RPARSER, BMS_SINGLE)
   song.Close();
 }
 
+TEST(RPARSER, NOTE_SEEK)
+{
+  using namespace rparser;
+  const std::string fpath(BASE_DIR + "chart_sample_bms/L9^.bme");
+  Song song;
+  ASSERT_TRUE(song.Open(fpath));
+  Chart *c = song.GetChart();
+  ASSERT_TRUE(c);
+  c->Update();
+  auto &nd = c->GetNoteData();
+
+  std::vector<Note> lanes;
+  for (size_t i = 0; i < nd.get_track_count(); ++i)
+    lanes.emplace_back(&nd[i]);
+
+  // seek result should be equal to binary search from beginning.
+  auto first_note_after = [](Track& t, double time) {
+    return (size_t)(std::partition_point(t.begin(), t.end(),
+      [time](const NoteElement& n) { return n.time() < time; }) - t.begin());
+  };
+  for (size_t i = 0; i < lanes.size(); ++i)
+  {
+    Note &n = lanes[i];
+    for (double t = 0; t < 90'000; t += 777)
+    {
+      bool found = n.SeekByTime(t);
+      size_t idx = first_note_after(nd[i], t);
+      EXPECT_EQ(idx < nd[i].size(), found);
+      if (found) { EXPECT_EQ(nd[i].get(idx), n.get()); }
+    }
+    EXPECT_FALSE(n.SeekByTime(1e10));
+    EXPECT_EQ(nullptr, n.get());
+    EXPECT_EQ(nd[i].size() > 0, n.SeekByBeat(0));
+  }
+
+  // simulate judgement with 1kHz input polling.
+  const double song_length = c->GetSongLastObjectTime() + 1000;
+  const double judge_window = 200.0;
+  size_t hit_cursor = 0, hit_bsearch = 0;
+  for (auto &n : lanes) n.reset();
+  for (double t = 0; t < song_length; t += 1.0)
+  {
+    for (auto &n : lanes)
+      if (n.SeekByTime(t - judge_window) && n.get()->time() <= t + judge_window)
+        hit_cursor++;
+  }
+  for (double t = 0; t < song_length; t += 1.0)
+  {
+    for (size_t i = 0; i < nd.get_track_count(); ++i)
+    {
+      size_t idx = first_note_after(nd[i], t - judge_window);
+      if (idx < nd[i].size() && nd[i].get(idx)->time() <= t + judge_window)
+        hit_bsearch++;
+    }
+  }
+  EXPECT_EQ(hit_bsearch, hit_cursor);
+
+  song.Close();
+}
+
 TEST(RPARSER, BMS_STRESS)
 {
   EXPECT_EQ(255, rutil::atoi_16("FF"));
@@ -626,7 +2045,6 @@ TEST(RPARSER, BMS_STRESS)
   ASSERT_TRUE(c);
   {
     auto &md = c->GetMetaData();
-    auto &nd = c->GetNoteData();
     c->Update();
     std::cout << "Total time of song " << md.title.c_str() << " is: " << c->GetSongLastObjectTime() << std::endl;
     EXPECT_STREQ("Mokugyo AllnightMIX", md.title.c_str());
@@ -639,8 +2057,6 @@ TEST(RPARSER, BMS_STRESS)
   c = c_test_l_nanasi;
   ASSERT_TRUE(c);
   {
-    auto &md = c->GetMetaData();
-    auto &nd = c->GetNoteData();
     c->Update();
   }
 
@@ -650,7 +2066,6 @@ TEST(RPARSER, BMS_STRESS)
   ASSERT_TRUE(c);
   {
     auto &md = c->GetMetaData();
-    auto &nd = c->GetNoteData();
     c->Update();
 
     // is timingobj is in order
@@ -683,7 +2098,6 @@ TEST(RPARSER, SERIALIZER)
 {
   Chart c;
   auto &nd = c.GetNoteData();
-  auto &md = c.GetMetaData();
   nd.set_track_count(7);
 
   {
@@ -779,11 +2193,47 @@ TEST(CHARTUTIL, BMS_HTML_EXPORT)
   song.Close();
 }
 
+TEST(CHARTUTIL, HTML_EXPORT_STREAM)
+{
+  Chart c;
+  auto &nd = c.GetNoteData();
+  nd.set_track_count(7);
+  NoteElement n;
+  for (unsigned i = 0; i < 20000; ++i)
+  {
+    n.set_measure(i / 24.0);
+    n.set_value(i % 100);
+    n.set_chain_status(i % 70 == 3 ? NoteChainStatus::Start :
+      (i % 70 == 10 ? NoteChainStatus::End : NoteChainStatus::Tap));
+    nd[i % 7].AppendNoteElement(n);
+  }
+  c.GetMetaData().bpm = 180;
+  c.Update();
+
+  // streamed output is same as in-memory one.
+  HTMLExporter mem_exporter(c);
+  const std::string &html = mem_exporter.toHTML();
+  ASSERT_LT(64u * 1024, html.size());
+
+  HTMLExporter exporter;
+  std::ostringstream os;
+  EXPECT_TRUE(exporter.Write(c, os));
+  EXPECT_TRUE(os.str() == html);
+
+  FILE *fp = tmpfile();
+  ASSERT_TRUE(fp);
+  EXPECT_TRUE(exporter.Write(c, fp));
+  std::string s(html.size() + 1, '\0');
+  rewind(fp);
+  s.resize(fread(&s[0], 1, s.size(), fp));
+  fclose(fp);
+  EXPECT_TRUE(s == html);
+}
+
 TEST(CHARTUTIL, PROFILER)
 {
   Chart c;
   auto &nd = c.GetNoteData();
-  auto &md = c.GetMetaData();
   nd.set_track_count(7);
 
   {
@@ -820,6 +2270,168 @@ TEST(CHARTUTIL, PROFILER)
   EXPECT_EQ(prof.GetSegment(2)->pos, 0.25);
   EXPECT_EQ(prof.GetSegment(3)->pos, 0.375);
   EXPECT_EQ(prof.GetSegment(4)->pos, 0.5);
+
+  // default bpm 120: 1 measure = 2000 msec
+  EXPECT_EQ(120.0f, prof.GetSegment(4)->bpm);
+  EXPECT_NEAR(1000.0, prof.GetSegment(4)->time, 0.01);
+  EXPECT_NEAR(250.0, prof.GetSegment(2)->delta_time, 0.01);
+  EXPECT_EQ(2, prof.GetSegment(2)->notes);
+  EXPECT_EQ("0110000", prof.GetSegment(2)->pattern);
+  EXPECT_EQ(6, prof.GetSegment(2)->pattern_i[0]);
+  EXPECT_EQ(kPatternChord | kPatternJack, prof.GetSegment(2)->pattern_i[1]);
+  EXPECT_EQ(0, prof.GetSegment(3)->pattern_i[1]);
+  // first row is out of 1 sec window at the last row.
+  EXPECT_NEAR(5.0, prof.GetSegment(4)->density[0], 0.01);
+  EXPECT_NEAR(1.5, prof.GetSegment(4)->density[1], 0.01);
+  EXPECT_NEAR(5.0, prof.GetMaxDensity(), 0.01);
+  EXPECT_NEAR(6.0, prof.GetAverageDensity(), 0.01);
+
+  // chord in single row has no length, so no average density.
+  Chart c2;
+  c2.GetNoteData().set_track_count(7);
+  NoteElement n;
+  n.set_measure(1.0);
+  c2.GetNoteData()[0].AddNoteElement(n);
+  c2.GetNoteData()[1].AddNoteElement(n);
+  c2.Update();
+  prof.Profile(c2);
+  ASSERT_EQ(1u, prof.GetSegmentCount());
+  EXPECT_EQ("1100000", prof.GetSegment(0)->pattern);
+  EXPECT_EQ(0.0, prof.GetAverageDensity());
+}
+
+TEST(CHARTUTIL, CHART_HASH)
+{
+  Song song;
+  ASSERT_TRUE(song.Open(BASE_DIR + "chart_sample_bms/l-for-nanasi.bms"));
+  Chart *c = song.GetChart(0);
+  ASSERT_TRUE(c);
+
+  ChartHasher hasher;
+  hasher.Update(*c);
+  const std::string h = hasher.GetDigest();
+  EXPECT_EQ(16u, h.size());
+
+  // same objects written in another form give same hash.
+  ChartWriterBMS writer;
+  const std::string bms = writer.Serialize(*c);
+  Song song2;
+  song2.SetSongType(SONGTYPE::BMS);
+  Chart *c2 = song2.NewChart();
+  ChartLoaderBMS loader(&song2);
+  loader.Load(*c2, bms.c_str(), (unsigned)bms.size());
+  hasher.Reset();
+  hasher.Update(*c2);
+  EXPECT_EQ(h, hasher.GetDigest());
+
+  // any change of object changes hash.
+  c2->GetNoteData()[1].front().set_value(c2->GetNoteData()[1].front().get_value_u() + 1);
+  hasher.Reset();
+  hasher.Update(*c2);
+  EXPECT_NE(h, hasher.GetDigest());
+
+  ChartHasher md5_hasher(ChartHashTypes::kMD5);
+  md5_hasher.Update(*c);
+  EXPECT_EQ(32u, md5_hasher.GetDigest().size());
+
+  // chart without file hash gets canonical hash.
+  Chart c3;
+  NoteElement n;
+  n.set_measure(1.0);
+  n.set_value(1);
+  c3.GetNoteData()[0].AddNoteElement(n);
+  EXPECT_EQ(32u, c3.GetHash().size());
+
+  // song hash doesn't depend on order of charts.
+  const std::string bms_a = "#TITLE a\n#00111:01\n", bms_b = "#TITLE b\n#00112:01\n";
+  Song song_ab, song_ba;
+  song_ab.SetSongType(SONGTYPE::BMS);
+  song_ba.SetSongType(SONGTYPE::BMS);
+  ChartLoaderBMS loader_ab(&song_ab), loader_ba(&song_ba);
+  loader_ab.Load(*song_ab.NewChart(), bms_a.c_str(), (unsigned)bms_a.size());
+  loader_ab.Load(*song_ab.NewChart(), bms_b.c_str(), (unsigned)bms_b.size());
+  loader_ba.Load(*song_ba.NewChart(), bms_b.c_str(), (unsigned)bms_b.size());
+  loader_ba.Load(*song_ba.NewChart(), bms_a.c_str(), (unsigned)bms_a.size());
+  EXPECT_NE(song_ab.GetChart(0)->GetHash(), song_ba.GetChart(0)->GetHash());
+  EXPECT_EQ(song_ab.GetHash(), song_ba.GetHash());
+}
+
+TEST(CHARTUTIL, CHART_FINGERPRINT)
+{
+  rutil::FileData fd;
+  rutil::ReadFileData(BASE_DIR + "chart_sample_bms/l-for-nanasi.bms", fd);
+  ASSERT_LT(0u, fd.len);
+  const std::string bms((const char*)fd.p, fd.len);
+
+  // re-upload: renamed sounds, CRLF and trailing whitespaces.
+  std::string reupload;
+  for (size_t i = 0; i < bms.size(); ++i)
+  {
+    if (bms[i] == '\n') reupload += "  \r\n";
+    else if (bms.compare(i, 4, ".wav") == 0) { reupload += ".ogg"; i += 3; }
+    else reupload += bms[i];
+  }
+
+  Song song;
+  song.SetSongType(SONGTYPE::BMS);
+  ChartLoaderBMS loader(&song);
+  Chart *c = song.NewChart();
+  loader.Load(*c, bms.c_str(), (unsigned)bms.size());
+  Chart *c2 = song.NewChart();
+  loader.Load(*c2, reupload.c_str(), (unsigned)reupload.size());
+  EXPECT_NE(c->GetHash(), c2->GetHash());
+
+  ChartFingerprint fp(*c), fp2(*c2);
+  EXPECT_FALSE(fp.is_empty());
+  EXPECT_EQ(1.0, fp.Similarity(fp2));
+
+  // mirrored chart only matches lane-agnostic fingerprint.
+  Chart mirror(*c);
+  for (unsigned i = 0; i < 3; ++i)
+    mirror.GetNoteData()[1 + i].swap(mirror.GetNoteData()[7 - i]);
+  ChartFingerprint fp_mirror(mirror);
+  EXPECT_GT(0.5, fp.Similarity(fp_mirror));
+  EXPECT_EQ(1.0, fp.Similarity(fp_mirror, true));
+
+  // partially edited chart is still similar.
+  Chart edited(*c);
+  for (auto &n : edited.GetNoteData()[1])
+    if (n.measure() < 8) n.set_chain_status(NoteChainStatus::Start);
+  ChartFingerprint fp_edited(edited);
+  EXPECT_LT(0.7, fp.Similarity(fp_edited));
+  EXPECT_GT(1.0, fp.Similarity(fp_edited));
+
+  Song other;
+  ASSERT_TRUE(other.Open(BASE_DIR + "chart_sample_bms/L9^.bme"));
+  ChartFingerprint fp_other(*other.GetChart(0));
+  EXPECT_GT(0.1, fp.Similarity(fp_other));
+
+  ChartFingerprint fp_empty;
+  ChartDuplicateIndex index, index_pattern(true);
+  for (const auto *f : { &fp, &fp_other, &fp2, &fp_mirror, &fp_empty })
+  {
+    index.Add(*f);
+    index_pattern.Add(*f);
+  }
+  std::vector<std::vector<unsigned> > groups;
+  index.FindDuplicates(0.9, groups);
+  ASSERT_EQ(1u, groups.size());
+  EXPECT_EQ(std::vector<unsigned>({ 0, 2 }), groups[0]);
+  groups.clear();
+  index_pattern.FindDuplicates(0.9, groups);
+  ASSERT_EQ(1u, groups.size());
+  EXPECT_EQ(std::vector<unsigned>({ 0, 2, 3 }), groups[0]);
+  std::vector<std::pair<unsigned, double> > similar;
+  index.Query(fp_edited, 0.7, similar);
+  EXPECT_EQ(2u, similar.size());
+
+  // empty chart is not indexed but takes its id.
+  EXPECT_EQ(5u, index.size());
+  EXPECT_EQ(5u, index.Add(fp));
+  groups.clear();
+  index.FindDuplicates(0.9, groups);
+  ASSERT_EQ(1u, groups.size());
+  EXPECT_EQ(std::vector<unsigned>({ 0, 2, 5 }), groups[0]);
 }
 
 int main(int argc, char **argv)
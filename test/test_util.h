@@ -0,0 +1,97 @@
+#ifndef RPARSER_TEST_UTIL_H
+#define RPARSER_TEST_UTIL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "rutil.h"
+#ifdef _WIN32
+# include <process.h>
+#else
+# include <iconv.h>
+# include <stdlib.h>
+#endif
+
+#define BASE_DIR std::string("../test/")
+
+/**
+ * @brief unique directory under system temp directory,
+ * removed when it goes out of scope (even if test is failed).
+ */
+class TempDirectory
+{
+public:
+  TempDirectory(const char* prefix)
+  {
+#ifdef _WIN32
+    const char *tmp = getenv("TEMP");
+    static int counter = 0;
+    path_ = std::string(tmp ? tmp : ".") + "\\" + prefix +
+      std::to_string(_getpid()) + "_" + std::to_string(counter++);
+    if (!rutil::CreateDirectory(path_)) path_.clear();
+#else
+    const char *tmp = getenv("TMPDIR");
+    std::string tmpl = std::string(tmp && *tmp ? tmp : "/tmp") + "/" + prefix + "XXXXXX";
+    if (mkdtemp(&tmpl[0])) path_ = tmpl;
+#endif
+  }
+  ~TempDirectory() { if (!path_.empty()) rutil::DeleteDirectory(path_); }
+  const std::string& path() const { return path_; }
+private:
+  std::string path_;
+};
+
+#ifndef _WIN32
+// decodes with iconv, for comparing with built-in tables.
+inline bool iconv_decode(iconv_t cd, const std::string &s, std::string &out)
+{
+  out.resize(s.size() * 4 + 4);
+  char *in_p = const_cast<char*>(s.c_str()), *out_p = &out[0];
+  size_t in_left = s.size(), out_left = out.size();
+  iconv(cd, 0, 0, 0, 0);
+  if (iconv(cd, &in_p, &in_left, &out_p, &out_left) == (size_t)-1)
+    return false;
+  out.resize(out.size() - out_left);
+  return true;
+}
+#endif
+
+/**
+ * @brief SMF (format 1, 480 tick per quarter) with tempo track and note tracks.
+ * @detail tempo track : 120 BPM, 3/4 time signature, 240 BPM at tick 480.
+ * note track : program change and note on/off in every 120 tick,
+ * using running status.
+ */
+inline std::vector<uint8_t> MakeSyntheticMidi(uint16_t note_track_count, unsigned note_per_track)
+{
+  std::vector<uint8_t> smf;
+  auto write_be = [&smf](uint32_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) smf.push_back((v >> (i * 8)) & 0xFF);
+  };
+  auto write_chunk = [&smf, &write_be](const std::vector<uint8_t>& data) {
+    smf.insert(smf.end(), { 'M', 'T', 'r', 'k' });
+    write_be((uint32_t)data.size(), 4);
+    smf.insert(smf.end(), data.begin(), data.end());
+  };
+  smf.insert(smf.end(), { 'M', 'T', 'h', 'd' });
+  write_be(6, 4);
+  write_be(1, 2);
+  write_be(note_track_count + 1, 2);
+  write_be(480, 2);
+  write_chunk({
+    0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,   // 120 BPM
+    0x00, 0xFF, 0x58, 0x04, 0x03, 0x02, 0x18, 0x08,   // 3/4
+    0x83, 0x60, 0xFF, 0x51, 0x03, 0x03, 0xD0, 0x90,   // 240 BPM at tick 480
+    0x00, 0xFF, 0x2F, 0x00 });
+  for (uint16_t t = 0; t < note_track_count; ++t)
+  {
+    std::vector<uint8_t> data = { 0x00, (uint8_t)(0xC0 | t), 0x05, 0x00, (uint8_t)(0x90 | t), 60, 100 };
+    for (unsigned i = 1; i < note_per_track; ++i)
+      data.insert(data.end(), { 0x78, (uint8_t)(60 + i % 12), (uint8_t)(i % 2 ? 0 : 100) });
+    data.insert(data.end(), { 0x00, 0xFF, 0x2F, 0x00 });
+    write_chunk(data);
+  }
+  return smf;
+}
+
+#endif
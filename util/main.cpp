@@ -6,6 +6,7 @@
 #include <sstream>
 #include "Song.h"
 #include "ChartUtil.h"
+#include "Diagnostics.h"
 
 #ifdef _WIN32
 # define DIR_SEP '\\'
@@ -179,14 +180,24 @@ int main(int argc, char **argv)
   unsigned process_songs = 0;
   bool export_html = false;
   bool export_profile = false;
+  bool find_duplicates = false;
+  bool lane_agnostic = false;
+  int similarity = 90;
   bool is_folder = false;
   bool verbose = false;
+  std::string diagnostics_format;
+  rparser::Diagnostics diagnostics;
+  std::vector<std::string> chart_names;
 
   args.RegisterCommandBoolean("--html", "Export chart to HTML file.");
   args.RegisterCommandBoolean("--profile", "Export chart profile data.");
+  args.RegisterCommandBoolean("--find-duplicates", "Find duplicated charts by note content.");
+  args.RegisterCommandBoolean("--lane-agnostic", "Match duplicated charts regardless of lanes (mirror / random).");
+  args.RegisterCommandWithArg("--similarity", "percent", "Minimum similarity of duplicated charts.", "90");
   args.RegisterCommandBoolean("--folder", "Consider data from folder.");
   args.RegisterCommandBoolean("--verbose", "Display detailed message.");
   args.RegisterCommandWithArg("--output", "folder", "Set folder for output.");
+  args.RegisterCommandWithArg("--diagnostics", "format", "Report warnings while loading charts. (json)");
   args.RegisterCommandBoolean("--help", "Display this message.");
 
   if (argc == 1 || !args.Parse(argc, argv) || args.Get<bool>("--help")) {
@@ -196,11 +207,21 @@ int main(int argc, char **argv)
 
   export_html = args.Get<bool>("--html");
   export_profile = args.Get<bool>("--profile");
+  find_duplicates = args.Get<bool>("--find-duplicates");
+  lane_agnostic = args.Get<bool>("--lane-agnostic");
+  similarity = args.Get<int>("--similarity");
   is_folder = args.Get<bool>("--folder");
   verbose = args.Get<bool>("--verbose");
   
   if (args.Get<const char*>("--output"))
     output_folder = args.Get<const char*>("--output");
+  if (args.Get<const char*>("--diagnostics"))
+    diagnostics_format = args.Get<const char*>("--diagnostics");
+  if (!diagnostics_format.empty() && diagnostics_format != "json") {
+    std::cerr << "Unsupported diagnostics format: " << diagnostics_format << std::endl;
+    return 1;
+  }
+  rparser::ChartDuplicateIndex duplicate_index(lane_agnostic);
 
   if (is_folder) {
     for (unsigned i = 0; i < args.GetParamCount(); ++i) {
@@ -212,6 +233,7 @@ int main(int argc, char **argv)
         continue;
       }
       for (auto &f : filelist) {
+        if (f.first == "." || f.first == "..") continue;
         songfiles.push_back(folder + DIR_SEP + f.first);
       }
     }
@@ -224,6 +246,8 @@ int main(int argc, char **argv)
   for (const auto& songfile : songfiles) {
     rparser::Song song;
     unsigned chart_count = 0;
+    if (!diagnostics_format.empty())
+      song.SetDiagnostics(&diagnostics);
     if (!song.Open(songfile)) {
       if (verbose)
         std::cerr << "Failed to open song file: " << songfile << std::endl;
@@ -238,16 +262,18 @@ int main(int argc, char **argv)
           << cfilename.c_str() << std::endl;
       }
       if (export_html) {
-        rparser::HTMLExporter htmlexporter(*chart);
-        std::string html = htmlexporter.toHTML();
-        std::ofstream ofs(GetNewFilename(cfilename, output_folder, ".html"));
-        ofs << html;
-        ofs.close();
+        rparser::HTMLExporter htmlexporter;
+        if (!htmlexporter.Save(*chart, GetNewFilename(cfilename, output_folder, ".html")))
+          std::cerr << "Failed to export HTML: " << cfilename << std::endl;
       }
       if (export_profile) {
         rparser::ChartProfiler cprof(*chart);
         cprof.Save(GetNewFilename(cfilename, output_folder, "_profile.json"));
       }
+      if (find_duplicates) {
+        duplicate_index.Add(rparser::ChartFingerprint(*chart));
+        chart_names.push_back(songfile == cfilename ? songfile : songfile + DIR_SEP + cfilename);
+      }
       ++process_count;
     }
     ++process_songs;
@@ -255,5 +281,18 @@ int main(int argc, char **argv)
 
   if (verbose)
     std::cout << "Processed " << process_count << " Charts." << std::endl;
+  if (find_duplicates) {
+    std::vector<std::vector<unsigned> > groups;
+    duplicate_index.FindDuplicates(similarity / 100.0, groups);
+    for (unsigned i = 0; i < groups.size(); ++i) {
+      std::cout << "Duplicate group " << i + 1 << " (" << groups[i].size() << " charts):" << std::endl;
+      for (unsigned id : groups[i])
+        std::cout << "  " << chart_names[id] << std::endl;
+    }
+    if (verbose)
+      std::cout << "Found " << groups.size() << " duplicate groups." << std::endl;
+  }
+  if (diagnostics_format == "json")
+    std::cout << diagnostics.toJSON() << std::endl;
   return 0;
 }
\ No newline at end of file